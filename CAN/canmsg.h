@@ -0,0 +1,552 @@
+#ifndef __CANMSG__H__
+#define __CANMSG__H__
+// Generated by canmsg_gen.py from hopper.canmsg: do not edit, edit hopper.canmsg instead.
+//
+// For each layout <l>: struct canmsg_<l> holds the raw field values,
+// canmsg_<l>_pack()/_unpack() copy it to/from frame data, and
+// canmsg_<l>_get_<f>()/_set_<f>() read/write one field in place. Data is
+// little-endian, whatever the host.
+//
+// For each message <M>: CANMSG_<M>_ID, _EXT (1: extended ID), _CANFD (1: a
+// CAN FD frame), _DLC (its length in bytes), _HZ, and CANMSG_<M>, its index in
+// canmsg_table[]. The table is sorted by key,
+// the ID plus CANMSG_EXT_FLAG for extended IDs (as SocketCAN's can_id), for
+// canmsg_find().
+
+#include <stdint.h>
+
+#define CANMSG_EXT_FLAG 0x80000000u // CAN_EFF_FLAG in linux/can.h
+
+/******************************************************************************
+* layout motor_cmd (8 bytes)
+******************************************************************************/
+typedef struct {
+  uint8_t mode;
+  uint8_t enable[3];
+  int16_t ref[3];
+  uint8_t seq;
+} canmsg_motor_cmd;
+
+// mode: 0: current control, 1: position control
+static inline uint8_t canmsg_motor_cmd_get_mode(const uint8_t *d) {
+  return (d[0] >> 0) & 1;
+}
+static inline void canmsg_motor_cmd_set_mode(uint8_t *d, uint8_t v) {
+  d[0] = (d[0] & ~(1u << 0)) | ((v & 1u) << 0);
+}
+
+// enable: per motor; a disabled motor idles
+static inline uint8_t canmsg_motor_cmd_get_enable(const uint8_t *d, int i) {
+  return (d[(1 + 2*i) >> 3] >> ((1 + 2*i) & 7)) & 1;
+}
+static inline void canmsg_motor_cmd_set_enable(uint8_t *d, int i, uint8_t v) {
+  d[(1 + 2*i) >> 3] = (d[(1 + 2*i) >> 3] & ~(1u << ((1 + 2*i) & 7))) | ((v & 1u) << ((1 + 2*i) & 7));
+}
+
+// ref: per motor; position: 0.1 deg + 270 deg (2700 = 0 deg), current: mA
+static inline int16_t canmsg_motor_cmd_get_ref(const uint8_t *d, int i) {
+  return (int16_t)((uint16_t)d[(8 + 16*i)/8] | (uint16_t)d[(8 + 16*i)/8 + 1] << 8);
+}
+static inline void canmsg_motor_cmd_set_ref(uint8_t *d, int i, int16_t v) {
+  d[(8 + 16*i)/8] = (uint8_t)v; d[(8 + 16*i)/8 + 1] = (uint8_t)((uint16_t)v >> 8);
+}
+
+// seq: cycle number: each motor node samples at once and echoes it
+static inline uint8_t canmsg_motor_cmd_get_seq(const uint8_t *d) {
+  return (uint8_t)((uint8_t)d[7]);
+}
+static inline void canmsg_motor_cmd_set_seq(uint8_t *d, uint8_t v) {
+  d[7] = (uint8_t)v;
+}
+
+static inline void canmsg_motor_cmd_pack(uint8_t *d, const canmsg_motor_cmd *m) {
+  int i;
+
+  canmsg_motor_cmd_set_mode(d, m->mode);
+  for (i = 0; i < 3; ++i) {
+    canmsg_motor_cmd_set_enable(d, i, m->enable[i]);
+  }
+  for (i = 0; i < 3; ++i) {
+    canmsg_motor_cmd_set_ref(d, i, m->ref[i]);
+  }
+  canmsg_motor_cmd_set_seq(d, m->seq);
+}
+
+static inline void canmsg_motor_cmd_unpack(const uint8_t *d, canmsg_motor_cmd *m) {
+  int i;
+
+  m->mode = canmsg_motor_cmd_get_mode(d);
+  for (i = 0; i < 3; ++i) {
+    m->enable[i] = canmsg_motor_cmd_get_enable(d, i);
+  }
+  for (i = 0; i < 3; ++i) {
+    m->ref[i] = canmsg_motor_cmd_get_ref(d, i);
+  }
+  m->seq = canmsg_motor_cmd_get_seq(d);
+}
+
+/******************************************************************************
+* layout motor_pos (5 bytes)
+******************************************************************************/
+typedef struct {
+  uint32_t pos;
+  uint8_t seq;
+} canmsg_motor_pos;
+
+// pos: RLS Orbis encoder angle (deg)
+#define CANMSG_MOTOR_POS_POS_SCALE 0.1 // deg per count
+#define CANMSG_MOTOR_POS_POS_OFFSET (-270.0)
+static inline uint32_t canmsg_motor_pos_get_pos(const uint8_t *d) {
+  return (uint32_t)((uint32_t)d[0] | (uint32_t)d[1] << 8 | (uint32_t)d[2] << 16 | (uint32_t)d[3] << 24);
+}
+static inline void canmsg_motor_pos_set_pos(uint8_t *d, uint32_t v) {
+  d[0] = (uint8_t)v; d[1] = (uint8_t)((uint32_t)v >> 8); d[2] = (uint8_t)((uint32_t)v >> 16); d[3] = (uint8_t)((uint32_t)v >> 24);
+}
+
+// seq: seq of the MOTOR_CMD this sample answers
+static inline uint8_t canmsg_motor_pos_get_seq(const uint8_t *d) {
+  return (uint8_t)((uint8_t)d[4]);
+}
+static inline void canmsg_motor_pos_set_seq(uint8_t *d, uint8_t v) {
+  d[4] = (uint8_t)v;
+}
+
+static inline void canmsg_motor_pos_pack(uint8_t *d, const canmsg_motor_pos *m) {
+  canmsg_motor_pos_set_pos(d, m->pos);
+  canmsg_motor_pos_set_seq(d, m->seq);
+}
+
+static inline void canmsg_motor_pos_unpack(const uint8_t *d, canmsg_motor_pos *m) {
+  m->pos = canmsg_motor_pos_get_pos(d);
+  m->seq = canmsg_motor_pos_get_seq(d);
+}
+
+/******************************************************************************
+* layout motor_cur (2 bytes)
+******************************************************************************/
+typedef struct {
+  int16_t cur;
+} canmsg_motor_cur;
+
+// cur: motor current (mA)
+static inline int16_t canmsg_motor_cur_get_cur(const uint8_t *d) {
+  return (int16_t)((uint16_t)d[0] | (uint16_t)d[1] << 8);
+}
+static inline void canmsg_motor_cur_set_cur(uint8_t *d, int16_t v) {
+  d[0] = (uint8_t)v; d[1] = (uint8_t)((uint16_t)v >> 8);
+}
+
+static inline void canmsg_motor_cur_pack(uint8_t *d, const canmsg_motor_cur *m) {
+  canmsg_motor_cur_set_cur(d, m->cur);
+}
+
+static inline void canmsg_motor_cur_unpack(const uint8_t *d, canmsg_motor_cur *m) {
+  m->cur = canmsg_motor_cur_get_cur(d);
+}
+
+/******************************************************************************
+* layout motor_cmd_fd (28 bytes)
+******************************************************************************/
+typedef struct {
+  uint8_t mode;
+  uint8_t enable[3];
+  uint8_t seq;
+  int16_t ref[3];
+  int16_t ff[3];
+  uint16_t kp[3];
+  uint16_t kd[3];
+} canmsg_motor_cmd_fd;
+
+// mode: as motor_cmd
+static inline uint8_t canmsg_motor_cmd_fd_get_mode(const uint8_t *d) {
+  return (d[0] >> 0) & 1;
+}
+static inline void canmsg_motor_cmd_fd_set_mode(uint8_t *d, uint8_t v) {
+  d[0] = (d[0] & ~(1u << 0)) | ((v & 1u) << 0);
+}
+
+// enable: as motor_cmd
+static inline uint8_t canmsg_motor_cmd_fd_get_enable(const uint8_t *d, int i) {
+  return (d[(1 + 2*i) >> 3] >> ((1 + 2*i) & 7)) & 1;
+}
+static inline void canmsg_motor_cmd_fd_set_enable(uint8_t *d, int i, uint8_t v) {
+  d[(1 + 2*i) >> 3] = (d[(1 + 2*i) >> 3] & ~(1u << ((1 + 2*i) & 7))) | ((v & 1u) << ((1 + 2*i) & 7));
+}
+
+// seq: as motor_cmd
+static inline uint8_t canmsg_motor_cmd_fd_get_seq(const uint8_t *d) {
+  return (uint8_t)((uint8_t)d[1]);
+}
+static inline void canmsg_motor_cmd_fd_set_seq(uint8_t *d, uint8_t v) {
+  d[1] = (uint8_t)v;
+}
+
+// ref: as motor_cmd
+static inline int16_t canmsg_motor_cmd_fd_get_ref(const uint8_t *d, int i) {
+  return (int16_t)((uint16_t)d[(32 + 64*i)/8] | (uint16_t)d[(32 + 64*i)/8 + 1] << 8);
+}
+static inline void canmsg_motor_cmd_fd_set_ref(uint8_t *d, int i, int16_t v) {
+  d[(32 + 64*i)/8] = (uint8_t)v; d[(32 + 64*i)/8 + 1] = (uint8_t)((uint16_t)v >> 8);
+}
+
+// ff: feedforward torque, added to the controller's output (Nm)
+#define CANMSG_MOTOR_CMD_FD_FF_SCALE 0.001 // Nm per count
+#define CANMSG_MOTOR_CMD_FD_FF_OFFSET 0.0
+static inline int16_t canmsg_motor_cmd_fd_get_ff(const uint8_t *d, int i) {
+  return (int16_t)((uint16_t)d[(48 + 64*i)/8] | (uint16_t)d[(48 + 64*i)/8 + 1] << 8);
+}
+static inline void canmsg_motor_cmd_fd_set_ff(uint8_t *d, int i, int16_t v) {
+  d[(48 + 64*i)/8] = (uint8_t)v; d[(48 + 64*i)/8 + 1] = (uint8_t)((uint16_t)v >> 8);
+}
+
+// kp: position gain; kp and kd 0: the node's own gains (Nm/rad)
+#define CANMSG_MOTOR_CMD_FD_KP_SCALE 0.01 // Nm/rad per count
+#define CANMSG_MOTOR_CMD_FD_KP_OFFSET 0.0
+static inline uint16_t canmsg_motor_cmd_fd_get_kp(const uint8_t *d, int i) {
+  return (uint16_t)((uint16_t)d[(64 + 64*i)/8] | (uint16_t)d[(64 + 64*i)/8 + 1] << 8);
+}
+static inline void canmsg_motor_cmd_fd_set_kp(uint8_t *d, int i, uint16_t v) {
+  d[(64 + 64*i)/8] = (uint8_t)v; d[(64 + 64*i)/8 + 1] = (uint8_t)((uint16_t)v >> 8);
+}
+
+// kd: velocity gain (Nm*s/rad)
+#define CANMSG_MOTOR_CMD_FD_KD_SCALE 0.0001 // Nm*s/rad per count
+#define CANMSG_MOTOR_CMD_FD_KD_OFFSET 0.0
+static inline uint16_t canmsg_motor_cmd_fd_get_kd(const uint8_t *d, int i) {
+  return (uint16_t)((uint16_t)d[(80 + 64*i)/8] | (uint16_t)d[(80 + 64*i)/8 + 1] << 8);
+}
+static inline void canmsg_motor_cmd_fd_set_kd(uint8_t *d, int i, uint16_t v) {
+  d[(80 + 64*i)/8] = (uint8_t)v; d[(80 + 64*i)/8 + 1] = (uint8_t)((uint16_t)v >> 8);
+}
+
+static inline void canmsg_motor_cmd_fd_pack(uint8_t *d, const canmsg_motor_cmd_fd *m) {
+  int i;
+
+  canmsg_motor_cmd_fd_set_mode(d, m->mode);
+  for (i = 0; i < 3; ++i) {
+    canmsg_motor_cmd_fd_set_enable(d, i, m->enable[i]);
+  }
+  canmsg_motor_cmd_fd_set_seq(d, m->seq);
+  for (i = 0; i < 3; ++i) {
+    canmsg_motor_cmd_fd_set_ref(d, i, m->ref[i]);
+  }
+  for (i = 0; i < 3; ++i) {
+    canmsg_motor_cmd_fd_set_ff(d, i, m->ff[i]);
+  }
+  for (i = 0; i < 3; ++i) {
+    canmsg_motor_cmd_fd_set_kp(d, i, m->kp[i]);
+  }
+  for (i = 0; i < 3; ++i) {
+    canmsg_motor_cmd_fd_set_kd(d, i, m->kd[i]);
+  }
+}
+
+static inline void canmsg_motor_cmd_fd_unpack(const uint8_t *d, canmsg_motor_cmd_fd *m) {
+  int i;
+
+  m->mode = canmsg_motor_cmd_fd_get_mode(d);
+  for (i = 0; i < 3; ++i) {
+    m->enable[i] = canmsg_motor_cmd_fd_get_enable(d, i);
+  }
+  m->seq = canmsg_motor_cmd_fd_get_seq(d);
+  for (i = 0; i < 3; ++i) {
+    m->ref[i] = canmsg_motor_cmd_fd_get_ref(d, i);
+  }
+  for (i = 0; i < 3; ++i) {
+    m->ff[i] = canmsg_motor_cmd_fd_get_ff(d, i);
+  }
+  for (i = 0; i < 3; ++i) {
+    m->kp[i] = canmsg_motor_cmd_fd_get_kp(d, i);
+  }
+  for (i = 0; i < 3; ++i) {
+    m->kd[i] = canmsg_motor_cmd_fd_get_kd(d, i);
+  }
+}
+
+/******************************************************************************
+* layout motor_state (16 bytes)
+******************************************************************************/
+typedef struct {
+  uint32_t pos;
+  int32_t vel;
+  int16_t cur;
+  uint8_t seq;
+  uint32_t time;
+} canmsg_motor_state;
+
+// pos: as motor_pos (deg)
+#define CANMSG_MOTOR_STATE_POS_SCALE 0.1 // deg per count
+#define CANMSG_MOTOR_STATE_POS_OFFSET (-270.0)
+static inline uint32_t canmsg_motor_state_get_pos(const uint8_t *d) {
+  return (uint32_t)((uint32_t)d[0] | (uint32_t)d[1] << 8 | (uint32_t)d[2] << 16 | (uint32_t)d[3] << 24);
+}
+static inline void canmsg_motor_state_set_pos(uint8_t *d, uint32_t v) {
+  d[0] = (uint8_t)v; d[1] = (uint8_t)((uint32_t)v >> 8); d[2] = (uint8_t)((uint32_t)v >> 16); d[3] = (uint8_t)((uint32_t)v >> 24);
+}
+
+// vel: encoder speed (deg/s)
+#define CANMSG_MOTOR_STATE_VEL_SCALE 0.1 // deg/s per count
+#define CANMSG_MOTOR_STATE_VEL_OFFSET 0.0
+static inline int32_t canmsg_motor_state_get_vel(const uint8_t *d) {
+  return (int32_t)((uint32_t)d[4] | (uint32_t)d[5] << 8 | (uint32_t)d[6] << 16 | (uint32_t)d[7] << 24);
+}
+static inline void canmsg_motor_state_set_vel(uint8_t *d, int32_t v) {
+  d[4] = (uint8_t)v; d[5] = (uint8_t)((uint32_t)v >> 8); d[6] = (uint8_t)((uint32_t)v >> 16); d[7] = (uint8_t)((uint32_t)v >> 24);
+}
+
+// cur: motor current (mA)
+static inline int16_t canmsg_motor_state_get_cur(const uint8_t *d) {
+  return (int16_t)((uint16_t)d[8] | (uint16_t)d[9] << 8);
+}
+static inline void canmsg_motor_state_set_cur(uint8_t *d, int16_t v) {
+  d[8] = (uint8_t)v; d[9] = (uint8_t)((uint16_t)v >> 8);
+}
+
+// seq: as motor_pos
+static inline uint8_t canmsg_motor_state_get_seq(const uint8_t *d) {
+  return (uint8_t)((uint8_t)d[10]);
+}
+static inline void canmsg_motor_state_set_seq(uint8_t *d, uint8_t v) {
+  d[10] = (uint8_t)v;
+}
+
+// time: the node's clock when sampled (wraps after 71 min) (us)
+static inline uint32_t canmsg_motor_state_get_time(const uint8_t *d) {
+  return (uint32_t)((uint32_t)d[12] | (uint32_t)d[13] << 8 | (uint32_t)d[14] << 16 | (uint32_t)d[15] << 24);
+}
+static inline void canmsg_motor_state_set_time(uint8_t *d, uint32_t v) {
+  d[12] = (uint8_t)v; d[13] = (uint8_t)((uint32_t)v >> 8); d[14] = (uint8_t)((uint32_t)v >> 16); d[15] = (uint8_t)((uint32_t)v >> 24);
+}
+
+static inline void canmsg_motor_state_pack(uint8_t *d, const canmsg_motor_state *m) {
+  canmsg_motor_state_set_pos(d, m->pos);
+  canmsg_motor_state_set_vel(d, m->vel);
+  canmsg_motor_state_set_cur(d, m->cur);
+  canmsg_motor_state_set_seq(d, m->seq);
+  canmsg_motor_state_set_time(d, m->time);
+}
+
+static inline void canmsg_motor_state_unpack(const uint8_t *d, canmsg_motor_state *m) {
+  m->pos = canmsg_motor_state_get_pos(d);
+  m->vel = canmsg_motor_state_get_vel(d);
+  m->cur = canmsg_motor_state_get_cur(d);
+  m->seq = canmsg_motor_state_get_seq(d);
+  m->time = canmsg_motor_state_get_time(d);
+}
+
+/******************************************************************************
+* layout imu_fz (4 bytes)
+******************************************************************************/
+typedef struct {
+  int16_t az;
+  uint16_t fz;
+} canmsg_imu_fz;
+
+// az: LSM6DS33 z acceleration, raw
+static inline int16_t canmsg_imu_fz_get_az(const uint8_t *d) {
+  return (int16_t)((uint16_t)d[0] | (uint16_t)d[1] << 8);
+}
+static inline void canmsg_imu_fz_set_az(uint8_t *d, int16_t v) {
+  d[0] = (uint8_t)v; d[1] = (uint8_t)((uint16_t)v >> 8);
+}
+
+// fz: force sensor, ADC counts
+static inline uint16_t canmsg_imu_fz_get_fz(const uint8_t *d) {
+  return (uint16_t)((uint16_t)d[2] | (uint16_t)d[3] << 8);
+}
+static inline void canmsg_imu_fz_set_fz(uint8_t *d, uint16_t v) {
+  d[2] = (uint8_t)v; d[3] = (uint8_t)((uint16_t)v >> 8);
+}
+
+static inline void canmsg_imu_fz_pack(uint8_t *d, const canmsg_imu_fz *m) {
+  canmsg_imu_fz_set_az(d, m->az);
+  canmsg_imu_fz_set_fz(d, m->fz);
+}
+
+static inline void canmsg_imu_fz_unpack(const uint8_t *d, canmsg_imu_fz *m) {
+  m->az = canmsg_imu_fz_get_az(d);
+  m->fz = canmsg_imu_fz_get_fz(d);
+}
+
+/******************************************************************************
+* layout boom_angle (4 bytes)
+******************************************************************************/
+typedef struct {
+  int32_t angle;
+} canmsg_boom_angle;
+
+// angle: boom encoder angle (deg)
+#define CANMSG_BOOM_ANGLE_ANGLE_SCALE 0.1 // deg per count
+#define CANMSG_BOOM_ANGLE_ANGLE_OFFSET 0.0
+static inline int32_t canmsg_boom_angle_get_angle(const uint8_t *d) {
+  return (int32_t)((uint32_t)d[0] | (uint32_t)d[1] << 8 | (uint32_t)d[2] << 16 | (uint32_t)d[3] << 24);
+}
+static inline void canmsg_boom_angle_set_angle(uint8_t *d, int32_t v) {
+  d[0] = (uint8_t)v; d[1] = (uint8_t)((uint32_t)v >> 8); d[2] = (uint8_t)((uint32_t)v >> 16); d[3] = (uint8_t)((uint32_t)v >> 24);
+}
+
+static inline void canmsg_boom_angle_pack(uint8_t *d, const canmsg_boom_angle *m) {
+  canmsg_boom_angle_set_angle(d, m->angle);
+}
+
+static inline void canmsg_boom_angle_unpack(const uint8_t *d, canmsg_boom_angle *m) {
+  m->angle = canmsg_boom_angle_get_angle(d);
+}
+
+/******************************************************************************
+* messages
+******************************************************************************/
+// MOTOR_CMD: every 2 ms, pi -> canmsg_motor_cmd; sent by writePosToCAN()/writeTrqToCAN(); also the cycle's SYNC
+#define CANMSG_MOTOR_CMD_ID 0x001
+#define CANMSG_MOTOR_CMD_EXT 0
+#define CANMSG_MOTOR_CMD_CANFD 0
+#define CANMSG_MOTOR_CMD_DLC 8
+#define CANMSG_MOTOR_CMD_HZ 500
+// IMU_FZ: every 1 ms, imu_fz -> canmsg_imu_fz
+#define CANMSG_IMU_FZ_ID 0x010
+#define CANMSG_IMU_FZ_EXT 0
+#define CANMSG_IMU_FZ_CANFD 0
+#define CANMSG_IMU_FZ_DLC 8
+#define CANMSG_IMU_FZ_HZ 1000
+// MOTOR_1_POS: every 2 ms, motor1 -> canmsg_motor_pos; one per MOTOR_CMD; 1000 Hz free-running without them
+#define CANMSG_MOTOR_1_POS_ID 0x2001
+#define CANMSG_MOTOR_1_POS_EXT 1
+#define CANMSG_MOTOR_1_POS_CANFD 0
+#define CANMSG_MOTOR_1_POS_DLC 8
+#define CANMSG_MOTOR_1_POS_HZ 500
+// MOTOR_2_POS: every 2 ms, motor2 -> canmsg_motor_pos; one per MOTOR_CMD; 1000 Hz free-running without them
+#define CANMSG_MOTOR_2_POS_ID 0x3001
+#define CANMSG_MOTOR_2_POS_EXT 1
+#define CANMSG_MOTOR_2_POS_CANFD 0
+#define CANMSG_MOTOR_2_POS_DLC 8
+#define CANMSG_MOTOR_2_POS_HZ 500
+// MOTOR_3_POS: every 2 ms, motor3 -> canmsg_motor_pos; one per MOTOR_CMD; 1000 Hz free-running without them
+#define CANMSG_MOTOR_3_POS_ID 0x4001
+#define CANMSG_MOTOR_3_POS_EXT 1
+#define CANMSG_MOTOR_3_POS_CANFD 0
+#define CANMSG_MOTOR_3_POS_DLC 8
+#define CANMSG_MOTOR_3_POS_HZ 500
+// MOTOR_1_CUR: on event, motor1 -> canmsg_motor_cur; not sent yet
+#define CANMSG_MOTOR_1_CUR_ID 0x005
+#define CANMSG_MOTOR_1_CUR_EXT 0
+#define CANMSG_MOTOR_1_CUR_CANFD 0
+#define CANMSG_MOTOR_1_CUR_DLC 2
+#define CANMSG_MOTOR_1_CUR_HZ 0
+// MOTOR_2_CUR: on event, motor2 -> canmsg_motor_cur; not sent yet
+#define CANMSG_MOTOR_2_CUR_ID 0x006
+#define CANMSG_MOTOR_2_CUR_EXT 0
+#define CANMSG_MOTOR_2_CUR_CANFD 0
+#define CANMSG_MOTOR_2_CUR_DLC 2
+#define CANMSG_MOTOR_2_CUR_HZ 0
+// MOTOR_3_CUR: on event, motor3 -> canmsg_motor_cur; not sent yet
+#define CANMSG_MOTOR_3_CUR_ID 0x007
+#define CANMSG_MOTOR_3_CUR_EXT 0
+#define CANMSG_MOTOR_3_CUR_CANFD 0
+#define CANMSG_MOTOR_3_CUR_DLC 2
+#define CANMSG_MOTOR_3_CUR_HZ 0
+// BOOM_ROLL: every 100 ms, boom_roll -> canmsg_boom_angle
+#define CANMSG_BOOM_ROLL_ID 0x5001
+#define CANMSG_BOOM_ROLL_EXT 1
+#define CANMSG_BOOM_ROLL_CANFD 0
+#define CANMSG_BOOM_ROLL_DLC 4
+#define CANMSG_BOOM_ROLL_HZ 10
+// BOOM_PITCH: every 100 ms, boom_pitch -> canmsg_boom_angle
+#define CANMSG_BOOM_PITCH_ID 0x6001
+#define CANMSG_BOOM_PITCH_EXT 1
+#define CANMSG_BOOM_PITCH_CANFD 0
+#define CANMSG_BOOM_PITCH_DLC 4
+#define CANMSG_BOOM_PITCH_HZ 10
+// BOOM_YAW: every 100 ms, boom_yaw -> canmsg_boom_angle
+#define CANMSG_BOOM_YAW_ID 0x7001
+#define CANMSG_BOOM_YAW_EXT 1
+#define CANMSG_BOOM_YAW_CANFD 0
+#define CANMSG_BOOM_YAW_DLC 4
+#define CANMSG_BOOM_YAW_HZ 10
+// MOTOR_CMD_FD: every 2 ms, pi -> canmsg_motor_cmd_fd; replaces MOTOR_CMD; also the cycle's SYNC
+#define CANMSG_MOTOR_CMD_FD_ID 0x002
+#define CANMSG_MOTOR_CMD_FD_EXT 0
+#define CANMSG_MOTOR_CMD_FD_CANFD 1
+#define CANMSG_MOTOR_CMD_FD_DLC 32
+#define CANMSG_MOTOR_CMD_FD_HZ 500
+// MOTOR_1_STATE: every 2 ms, motor1 -> canmsg_motor_state; replaces MOTOR_1_POS, one per MOTOR_CMD_FD
+#define CANMSG_MOTOR_1_STATE_ID 0x2002
+#define CANMSG_MOTOR_1_STATE_EXT 1
+#define CANMSG_MOTOR_1_STATE_CANFD 1
+#define CANMSG_MOTOR_1_STATE_DLC 16
+#define CANMSG_MOTOR_1_STATE_HZ 500
+// MOTOR_2_STATE: every 2 ms, motor2 -> canmsg_motor_state; replaces MOTOR_2_POS, one per MOTOR_CMD_FD
+#define CANMSG_MOTOR_2_STATE_ID 0x3002
+#define CANMSG_MOTOR_2_STATE_EXT 1
+#define CANMSG_MOTOR_2_STATE_CANFD 1
+#define CANMSG_MOTOR_2_STATE_DLC 16
+#define CANMSG_MOTOR_2_STATE_HZ 500
+// MOTOR_3_STATE: every 2 ms, motor3 -> canmsg_motor_state; replaces MOTOR_3_POS, one per MOTOR_CMD_FD
+#define CANMSG_MOTOR_3_STATE_ID 0x4002
+#define CANMSG_MOTOR_3_STATE_EXT 1
+#define CANMSG_MOTOR_3_STATE_CANFD 1
+#define CANMSG_MOTOR_3_STATE_DLC 16
+#define CANMSG_MOTOR_3_STATE_HZ 500
+
+enum {
+  CANMSG_MOTOR_CMD,
+  CANMSG_MOTOR_CMD_FD,
+  CANMSG_MOTOR_1_CUR,
+  CANMSG_MOTOR_2_CUR,
+  CANMSG_MOTOR_3_CUR,
+  CANMSG_IMU_FZ,
+  CANMSG_MOTOR_1_POS,
+  CANMSG_MOTOR_1_STATE,
+  CANMSG_MOTOR_2_POS,
+  CANMSG_MOTOR_2_STATE,
+  CANMSG_MOTOR_3_POS,
+  CANMSG_MOTOR_3_STATE,
+  CANMSG_BOOM_ROLL,
+  CANMSG_BOOM_PITCH,
+  CANMSG_BOOM_YAW,
+  CANMSG_COUNT
+};
+
+typedef struct {
+  uint32_t key;      // ID, plus CANMSG_EXT_FLAG if extended
+  uint8_t dlc;       // length in bytes
+  uint8_t fd;        // 1: a CAN FD frame
+  uint16_t hz;       // 0: on event
+  const char *name;
+} canmsg_info;
+
+static const canmsg_info canmsg_table[CANMSG_COUNT] = {
+  {0x00000001u, 8, 0, 500, "MOTOR_CMD"},
+  {0x00000002u, 32, 1, 500, "MOTOR_CMD_FD"},
+  {0x00000005u, 2, 0, 0, "MOTOR_1_CUR"},
+  {0x00000006u, 2, 0, 0, "MOTOR_2_CUR"},
+  {0x00000007u, 2, 0, 0, "MOTOR_3_CUR"},
+  {0x00000010u, 8, 0, 1000, "IMU_FZ"},
+  {0x80002001u, 8, 0, 500, "MOTOR_1_POS"},
+  {0x80002002u, 16, 1, 500, "MOTOR_1_STATE"},
+  {0x80003001u, 8, 0, 500, "MOTOR_2_POS"},
+  {0x80003002u, 16, 1, 500, "MOTOR_2_STATE"},
+  {0x80004001u, 8, 0, 500, "MOTOR_3_POS"},
+  {0x80004002u, 16, 1, 500, "MOTOR_3_STATE"},
+  {0x80005001u, 4, 0, 10, "BOOM_ROLL"},
+  {0x80006001u, 4, 0, 10, "BOOM_PITCH"},
+  {0x80007001u, 4, 0, 10, "BOOM_YAW"},
+};
+
+// index in canmsg_table of the message with this key, -1 if none:
+static inline int canmsg_find(uint32_t key) {
+  int lo = 0, hi = CANMSG_COUNT - 1, mid;
+
+  while (lo <= hi) {
+    mid = (lo + hi)/2;
+    if (canmsg_table[mid].key == key) {
+      return mid;
+    } else if (canmsg_table[mid].key < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return -1;
+}
+
+#endif
@@ -0,0 +1,317 @@
+#!/usr/bin/env python3
+# canmsg_gen.py: generates canmsg.h from a CAN message definition file.
+#
+# usage: python3 canmsg_gen.py hopper.canmsg canmsg.h
+#
+# See hopper.canmsg for the definition format. The definitions are checked
+# before anything is written (unique names and IDs, IDs that fit their
+# frame format, fields inside the DLC and not overlapping), so a bad edit
+# fails the build instead of reaching the bus.
+
+import os
+import re
+import sys
+
+TYPES = {  # name: (bits, C type, signed)
+    'bit': (1, 'uint8_t', False),
+    'u8': (8, 'uint8_t', False),
+    'i8': (8, 'int8_t', True),
+    'u16': (16, 'uint16_t', False),
+    'i16': (16, 'int16_t', True),
+    'u32': (32, 'uint32_t', False),
+    'i32': (32, 'int32_t', True),
+}
+
+NAME = re.compile(r'^[A-Za-z_][A-Za-z0-9_]*$')
+
+MESSAGE_MACROS = ('_ID', '_EXT', '_CANFD', '_DLC', '_HZ')  # CANMSG_<M>..., for each message
+FORMATS = ('std', 'ext', 'std-fd', 'ext-fd')
+FD_LENGTHS = (0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64)  # the lengths a CAN FD DLC codes
+
+
+class DefError(Exception):
+    pass
+
+
+def parse(path):
+    layouts, messages = {}, []
+    layout = None
+
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            text, _, comment = line.partition('#')
+            words = text.split()
+            comment = comment.strip()
+            if not words:
+                continue
+            where = '%s:%d: ' % (path, lineno)
+            try:
+                if words[0] == 'layout' and len(words) == 2:
+                    layout = words[1]
+                    if not NAME.match(layout) or layout in layouts:
+                        raise DefError('bad or duplicate layout name %s' % layout)
+                    layouts[layout] = []
+                elif words[0] == 'field' and len(words) >= 4:
+                    if layout is None:
+                        raise DefError('field outside a layout')
+                    layouts[layout].append(parse_field(words[1:], comment))
+                elif words[0] == 'message' and len(words) == 8:
+                    layout = None
+                    messages.append(parse_message(words[1:], comment))
+                else:
+                    raise DefError('cannot parse "%s"' % text.strip())
+            except (DefError, ValueError) as e:
+                raise DefError(where + str(e))
+
+    check(layouts, messages, path)
+    return layouts, messages
+
+
+def parse_field(words, comment):
+    m = re.match(r'^(\w+)(?:\[(\d+)\])?$', words[1])
+    if not NAME.match(words[0]) or not m or m.group(1) not in TYPES:
+        raise DefError('bad field %s %s' % (words[0], words[1]))
+    bits = TYPES[m.group(1)][0]
+    byte, _, bit = words[2].partition('.')
+    field = {
+        'name': words[0], 'type': m.group(1), 'count': int(m.group(2) or 1),
+        'pos': 8*int(byte) + int(bit or 0), 'comment': comment,
+        'scale': None, 'offset': None, 'unit': None,
+    }
+    if bit and bits != 1:
+        raise DefError('%s: only bit fields take a bit position' % field['name'])
+    stride = bits if bits == 1 else bits//8
+    for opt in words[3:]:
+        key, _, value = opt.partition('=')
+        if key == 'stride':
+            stride = int(value)
+        elif key in ('scale', 'offset'):
+            field[key] = float(value)
+        elif key == 'unit':
+            field[key] = value
+        else:
+            raise DefError('unknown option %s' % opt)
+    field['stride'] = stride if bits == 1 else 8*stride  # in bits
+    if field['stride'] < bits:
+        raise DefError('%s: array elements overlap' % field['name'])
+    return field
+
+
+def parse_message(words, comment):
+    name, ident, fmt, dlc, hz, sender, layout = words
+    if not NAME.match(name) or fmt not in FORMATS:
+        raise DefError('bad message %s %s' % (name, fmt))
+    return {
+        'name': name, 'id': int(ident, 0), 'ext': fmt.startswith('ext'),
+        'fd': fmt.endswith('-fd'), 'dlc': int(dlc),
+        'hz': int(hz), 'sender': sender, 'layout': layout, 'comment': comment,
+    }
+
+
+def check(layouts, messages, path):
+    for name, fields in layouts.items():
+        used = {}
+        for f in fields:
+            bits = TYPES[f['type']][0]
+            for i in range(f['count']):
+                for b in range(f['pos'] + i*f['stride'], f['pos'] + i*f['stride'] + bits):
+                    if b in used:
+                        raise DefError('%s: layout %s: %s overlaps %s' % (path, name, f['name'], used[b]))
+                    used[b] = f['name']
+        layouts[name] = (fields, (max(used) + 8)//8 if used else 0)
+
+    names, keys = {}, {}
+    for m in messages:
+        where = '%s: message %s: ' % (path, m['name'])
+        # the message's own name and the names of its macros:
+        for name in [m['name']] + [m['name'] + s for s in MESSAGE_MACROS]:
+            if name in names:
+                raise DefError(where + 'name clashes with %s' % names[name])
+            names[name] = m['name']
+        if m['layout'] not in layouts:
+            raise DefError(where + 'unknown layout %s' % m['layout'])
+        if m['id'] > (0x1FFFFFFF if m['ext'] else 0x7FF):
+            raise DefError(where + 'ID 0x%X does not fit a %s frame' % (m['id'], 'ext' if m['ext'] else 'std'))
+        if m['fd'] and m['dlc'] not in FD_LENGTHS:
+            raise DefError(where + 'a CAN FD frame cannot be %d bytes long' % m['dlc'])
+        if not 0 <= m['dlc'] <= (64 if m['fd'] else 8) or layouts[m['layout']][1] > m['dlc']:
+            raise DefError(where + 'layout %s needs %d bytes, DLC is %d' % (m['layout'], layouts[m['layout']][1], m['dlc']))
+        key = key_of(m)
+        if key in keys:
+            raise DefError(where + 'same ID as %s' % keys[key])
+        keys[key] = m['name']
+
+
+def key_of(m):
+    return m['id'] | (0x80000000 if m['ext'] else 0)
+
+
+def num(x):
+    return '(%r)' % x if x < 0 else repr(x)
+
+
+def emit_field(out, layout, f):
+    bits, ctype, _ = TYPES[f['type']]
+    fn = 'canmsg_%s_%%s_%s' % (layout, f['name'])
+    arr = f['count'] > 1
+    idxArg = ', int i' if arr else ''
+    pos = '%d + %d*i' % (f['pos'], f['stride']) if arr else str(f['pos'])
+    utype = 'uint%d_t' % max(bits, 8)
+
+    if bits == 1:
+        if arr:
+            byte, shift = '(%s) >> 3' % pos, '((%s) & 7)' % pos
+        else:
+            byte, shift = str(f['pos'] >> 3), str(f['pos'] & 7)
+        get = 'return (d[%s] >> %s) & 1;' % (byte, shift)
+        put = 'd[%s] = (d[%s] & ~(1u << %s)) | ((v & 1u) << %s);' % (byte, byte, shift, shift)
+    else:
+        def at(k):
+            if arr:
+                return '(%s)/8 + %d' % (pos, k) if k else '(%s)/8' % pos
+            return str(f['pos']//8 + k)
+        terms = ['(%s)d[%s] << %d' % (utype, at(k), 8*k) if k else '(%s)d[%s]' % (utype, at(k))
+                 for k in range(bits//8)]
+        get = 'return (%s)(%s);' % (ctype, ' | '.join(terms))
+        put = ' '.join('d[%s] = (uint8_t)((%s)v >> %d);' % (at(k), utype, 8*k) if k
+                       else 'd[%s] = (uint8_t)v;' % at(k) for k in range(bits//8))
+
+    if f['comment'] or f['unit']:
+        out.append('// %s:%s%s' % (f['name'], ' ' + f['comment'] if f['comment'] else '',
+                                   ' (%s)' % f['unit'] if f['unit'] else ''))
+    if f['scale'] is not None or f['offset'] is not None:
+        M = ('CANMSG_%s_%s' % (layout, f['name'])).upper()
+        out.append('#define %s_SCALE %s // %s per count' % (M, num(f['scale'] or 1.0), f['unit'] or 'units'))
+        out.append('#define %s_OFFSET %s' % (M, num(f['offset'] or 0.0)))
+    out.append('static inline %s %s(const uint8_t *d%s) {' % (ctype, fn % 'get', idxArg))
+    out.append('  %s' % get)
+    out.append('}')
+    out.append('static inline void %s(uint8_t *d%s, %s v) {' % (fn % 'set', idxArg, ctype))
+    out.append('  %s' % put)
+    out.append('}')
+
+
+def emit(layouts, messages, src):
+    out = []
+    out.append('#ifndef __CANMSG__H__')
+    out.append('#define __CANMSG__H__')
+    out.append('// Generated by canmsg_gen.py from %s: do not edit, edit %s instead.' % (src, src))
+    out.append('//')
+    out.append('// For each layout <l>: struct canmsg_<l> holds the raw field values,')
+    out.append('// canmsg_<l>_pack()/_unpack() copy it to/from frame data, and')
+    out.append('// canmsg_<l>_get_<f>()/_set_<f>() read/write one field in place. Data is')
+    out.append('// little-endian, whatever the host.')
+    out.append('//')
+    out.append('// For each message <M>: CANMSG_<M>_ID, _EXT (1: extended ID), _CANFD (1: a')
+    out.append('// CAN FD frame), _DLC (its length in bytes), _HZ, and CANMSG_<M>, its index in')
+    out.append('// canmsg_table[]. The table is sorted by key,')
+    out.append('// the ID plus CANMSG_EXT_FLAG for extended IDs (as SocketCAN\'s can_id), for')
+    out.append('// canmsg_find().')
+    out.append('')
+    out.append('#include <stdint.h>')
+    out.append('')
+    out.append('#define CANMSG_EXT_FLAG 0x80000000u // CAN_EFF_FLAG in linux/can.h')
+    out.append('')
+
+    for name, (fields, size) in layouts.items():
+        out.append('/' + '*'*78)
+        out.append('* layout %s (%d bytes)' % (name, size))
+        out.append('*'*78 + '/')
+        out.append('typedef struct {')
+        for f in fields:
+            out.append('  %s %s%s;' % (TYPES[f['type']][1], f['name'],
+                                       '[%d]' % f['count'] if f['count'] > 1 else ''))
+        out.append('} canmsg_%s;' % name)
+        out.append('')
+        for f in fields:
+            emit_field(out, name, f)
+            out.append('')
+        for what, const, dconst in (('pack', 'const ', ''), ('unpack', '', 'const ')):
+            out.append('static inline void canmsg_%s_%s(%suint8_t *d, %scanmsg_%s *m) {'
+                       % (name, what, dconst, const, name))
+            if any(f['count'] > 1 for f in fields):
+                out.append('  int i;')
+                out.append('')
+            for f in fields:
+                loop = f['count'] > 1
+                i, idx = (', i', '[i]') if loop else ('', '')
+                line = ('canmsg_%s_set_%s(d%s, m->%s%s);' % (name, f['name'], i, f['name'], idx)
+                        if what == 'pack' else
+                        'm->%s%s = canmsg_%s_get_%s(d%s);' % (f['name'], idx, name, f['name'], i))
+                if loop:
+                    out.append('  for (i = 0; i < %d; ++i) {' % f['count'])
+                    out.append('    ' + line)
+                    out.append('  }')
+                else:
+                    out.append('  ' + line)
+            out.append('}')
+            out.append('')
+
+    out.append('/' + '*'*78)
+    out.append('* messages')
+    out.append('*'*78 + '/')
+    ordered = sorted(messages, key=key_of)
+    for m in messages:
+        M = 'CANMSG_' + m['name']
+        out.append('// %s: %s, %s -> canmsg_%s%s' % (m['name'], 'every %g ms' % (1000.0/m['hz']) if m['hz'] else 'on event',
+                                               m['sender'], m['layout'], '; ' + m['comment'] if m['comment'] else ''))
+        out.append('#define %s_ID 0x%03X' % (M, m['id']))
+        out.append('#define %s_EXT %d' % (M, m['ext']))
+        out.append('#define %s_CANFD %d' % (M, m['fd']))
+        out.append('#define %s_DLC %d' % (M, m['dlc']))
+        out.append('#define %s_HZ %d' % (M, m['hz']))
+    out.append('')
+    out.append('enum {')
+    for m in ordered:
+        out.append('  CANMSG_%s,' % m['name'])
+    out.append('  CANMSG_COUNT')
+    out.append('};')
+    out.append('')
+    out.append('typedef struct {')
+    out.append('  uint32_t key;      // ID, plus CANMSG_EXT_FLAG if extended')
+    out.append('  uint8_t dlc;       // length in bytes')
+    out.append('  uint8_t fd;        // 1: a CAN FD frame')
+    out.append('  uint16_t hz;       // 0: on event')
+    out.append('  const char *name;')
+    out.append('} canmsg_info;')
+    out.append('')
+    out.append('static const canmsg_info canmsg_table[CANMSG_COUNT] = {')
+    for m in ordered:
+        out.append('  {0x%08Xu, %d, %d, %d, "%s"},' % (key_of(m), m['dlc'], m['fd'], m['hz'], m['name']))
+    out.append('};')
+    out.append('')
+    out.append('// index in canmsg_table of the message with this key, -1 if none:')
+    out.append('static inline int canmsg_find(uint32_t key) {')
+    out.append('  int lo = 0, hi = CANMSG_COUNT - 1, mid;')
+    out.append('')
+    out.append('  while (lo <= hi) {')
+    out.append('    mid = (lo + hi)/2;')
+    out.append('    if (canmsg_table[mid].key == key) {')
+    out.append('      return mid;')
+    out.append('    } else if (canmsg_table[mid].key < key) {')
+    out.append('      lo = mid + 1;')
+    out.append('    } else {')
+    out.append('      hi = mid - 1;')
+    out.append('    }')
+    out.append('  }')
+    out.append('  return -1;')
+    out.append('}')
+    out.append('')
+    out.append('#endif')
+    return '\n'.join(out) + '\n'
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('usage: %s <definitions> <header>' % sys.argv[0])
+    try:
+        layouts, messages = parse(sys.argv[1])
+    except (DefError, OSError) as e:
+        sys.exit('canmsg_gen: %s' % e)
+    text = emit(layouts, messages, os.path.basename(sys.argv[1]))
+    with open(sys.argv[2], 'w') as f:
+        f.write(text)
+
+
+if __name__ == '__main__':
+    main()
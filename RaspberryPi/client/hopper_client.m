@@ -43,61 +43,52 @@ function hopper_client
     qa2_fullcmp = -2.9706;
     qa3_fullcmp = -0.4835;
 
-    qa(:,1:3) = [linspace(qa1_fullext,qa1_fullcmp,nsamples)', ...
-        linspace(qa2_fullext,qa2_fullcmp,nsamples)', ...
-        linspace(qa3_fullext,qa3_fullcmp,nsamples)'];
-    
-
-%      for i=1:length(y_mA)-1
-%         str = sprintf('%d',y_mA(i));
-%         fprintf('sending  y(%d) = %d\n',i,y_mA(i))
-%         fprintf(mySerial,'%s\n',str);
-%      end
+    % from full extension to full compression in nsamples control ticks
+    % (500 Hz), a minimum-jerk move the Pi generates (see traj_upload.m);
+    % the run lasts nsamples ticks, or longer while it has not finished:
+    move.profile = 'quintic';
+    move.space = 'joint';
+    move.t = [0; (nsamples-1)/500];
+    move.points = [qa1_fullext qa2_fullext qa3_fullext; qa1_fullcmp qa2_fullcmp qa3_fullcmp];
+    [samples, texts, st, ok] = traj_upload(mySerial, move, 1, []);
+    fprintf("done sending\n");
+    finished = ~ok;
 
-     for i=1:nsamples
-        str = sprintf('%5.3f %5.3f %5.3f',qa(i,1),qa(i,2),qa(i,3));
-        fprintf('sending  qa(%d) = %5.3f %5.3f %5.3f\n',i,qa(i,1),qa(i,2),qa(i,3))
-        fprintf(mySerial,'%s\n',str);
-     end
-     
-     fprintf("done sending\n");
-     flushinput(mySerial);
-%      fscanf(mySerial); % flush the serial buffer
-     
-     
-%      ser_check = fscanf(mySerial,'%d');
-%      fprintf("ser_check = %d\n",ser_check);
-%      
-%      if (fscanf(mySerial,'%d') ~= nsamples)
-%         writePermission = 0;
-%         fprintf(mySerial,'%d\n',writePermission);
-%         fprintf("Serial comm experienced an error. Program ending.\n"); 
-%         return;
-%      end
-     
-     fscanf(mySerial);
-     
-%      flushoutput(mySerial);
-     flushinput(mySerial); % flush the serial buffer
-   
-%     
-%         
-    writePermission = 1;
-     fprintf(mySerial,'%d\n',writePermission);
-%     
-%     fprintf(mySerial,'1\n');
-%     data = zeros(nsamples); 
-%     
-% 
-      fscanf(mySerial);
-        for i=1:nsamples
-%           str = fscanf(mySerial,'%s');
-%           fprintf('%s\n',str);
-        data(i,1:3) = fscanf(mySerial,'%f %f %f');
-        fprintf('%d: %f %f %f\n',[i-1,data(i,1:3)]);
+      % binary frames (see tlm_decode.m):
+      data = zeros(0,3);
+      t_us = zeros(0,1);
+      i = 0;
+      while true
+        for k=1:length(texts)
+          fprintf('%s\n',texts{k}); % "# can ...", "# hist ..."
+        end
+        for k=1:length(samples)
+          i = i + 1;
+          data(i,1:3) = samples(k).qa;
+          t_us(i) = samples(k).time_us;
+          fprintf('%d: %f %f %f\n',[i-1,data(i,1:3)]);
+        end
+        if i >= nsamples && finished
+          break;
+        end
+        bytes = fread(mySerial, max(mySerial.BytesAvailable,1), 'uint8');
+        if isempty(bytes)
+          fprintf('Serial read timeout, %d of %d samples\n',i,nsamples);
+          break;
+        end
+        [samples, texts, st, acks] = tlm_decode(bytes, st);
+        for a = acks
+          if a.id == 1 && a.status == 3 % finished
+            fprintf('trajectory played, %d points\n',a.points);
+            finished = true;
+          end
+        end
       end
       
       fprintf("done reading\n");
+      if ~isempty(st)
+        fprintf('%d frames, %d lost, %d corrupt\n',st.frames,st.lost,st.corrupt);
+      end
       
       figure;
       plot(data(:,1:3));
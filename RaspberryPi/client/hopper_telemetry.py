@@ -0,0 +1,201 @@
+# Decoder for the Pi's binary telemetry (see RaspberryPi/master/telemetry.h)
+#
+# Feed it the bytes read from the serial port, in pieces of any size:
+#
+#   dec = TelemetryDecoder()
+#   for frame in dec.feed(ser.read(ser.in_waiting or 1)):
+#       if frame.type == TLM_DATA:
+#           print frame.time_us, frame.values['qa']
+#       elif frame.type == TLM_TEXT:
+#           print frame.text
+#
+# A sample holds only the channels subscribed to and due on its tick; the
+# Pi starts with qa alone. Ask for more with subscribe(ser, 'ia', 1) (every
+# tick) or subscribe(ser, 'boom', 50) (every 50th); the Pi answers with a
+# "# tlm ..." text frame, refusing subscriptions the link cannot carry.
+# dec.channels holds the channel table, each with its name, unit and
+# current decimation.
+#
+# TLM_TRAJ frames answer trajectory uploads (see hopper_traj.py); their
+# frame.traj is (id, status, slot, points).
+#
+# dec.lost counts the frames lost (gaps in seq, so the corrupt ones too),
+# dec.corrupt the frames dropped for a bad CRC or framing. Samples can only be decoded once the
+# channel table (TLM_DESC) has come, which the Pi sends every second;
+# dec.undecoded counts the samples before it.
+#
+# Works with Python 2 and 3.
+
+import struct
+
+TLM_DESC, TLM_DATA, TLM_TEXT, TLM_TRAJ = 0, 1, 2, 3
+TLM_I16, TLM_F32 = 0, 1
+
+
+def crc16(data):
+    """CRC-16/CCITT-FALSE, as tlm_crc16(): 0x29B1 for b'123456789'."""
+    crc = 0xFFFF
+    for b in bytearray(data):
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def cobs_decode(data):
+    """Decodes one COBS block (without its zero byte); None if malformed."""
+    data = bytearray(data)
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return out
+
+
+def cobs_encode(data):
+    """COBS encodes data (without the trailing zero byte)."""
+    out = bytearray([0])
+    code = 0
+    for b in bytearray(data):
+        if b:
+            out.append(b)
+        if not b or len(out) - code == 0xFF:
+            out[code] = len(out) - code
+            code = len(out)
+            out.append(0)
+    out[code] = len(out) - code
+    return out
+
+
+def encode_frame(ftype, seq, body):
+    """A frame to the Pi: type, seq, body and CRC, COBS encoded between two zero bytes."""
+    data = bytearray(struct.pack('<BH', ftype, seq & 0xFFFF)) + bytearray(body)
+    data += struct.pack('<H', crc16(data))
+    return b'\x00' + bytes(cobs_encode(data)) + b'\x00'
+
+
+def subscribe(ser, name, decim):
+    """Asks the Pi to send channel name every decim control ticks (0: off)."""
+    ser.write(('s%s %d\n' % (name, decim)).encode('ascii'))
+
+
+class Channel(object):
+    def __init__(self, cid, count, fmt, decim, scale, offset, name, unit):
+        self.id = cid
+        self.count = count
+        self.format = fmt
+        self.decim = decim    # 0: not subscribed
+        self.scale = scale
+        self.offset = offset
+        self.name = name
+        self.unit = unit
+
+    def size(self):
+        return self.count * (4 if self.format == TLM_F32 else 2)
+
+    def decode(self, data):
+        if self.format == TLM_F32:
+            return list(struct.unpack('<%df' % self.count, bytes(data)))
+        raw = struct.unpack('<%dh' % self.count, bytes(data))
+        return [self.offset + self.scale * r for r in raw]
+
+
+class Frame(object):
+    def __init__(self, ftype, seq):
+        self.type = ftype
+        self.seq = seq
+        self.time_us = None
+        self.values = {}   # DATA: channel name -> list of values
+        self.text = None   # TEXT: the line
+        self.traj = None   # TRAJ: (id, status, slot, points)
+
+
+class TelemetryDecoder(object):
+    def __init__(self):
+        self.buf = bytearray()
+        self.channels = {}  # by id, from the last TLM_DESC
+        self.seq = None     # of the last good frame
+        self.frames = 0
+        self.lost = 0
+        self.corrupt = 0
+        self.undecoded = 0
+
+    def feed(self, data):
+        """Returns the frames completed by data."""
+        self.buf += bytearray(data)
+        frames = []
+        while True:
+            end = self.buf.find(b'\x00')
+            if end < 0:
+                break
+            block = self.buf[:end]
+            del self.buf[:end + 1]
+            if block:
+                frame = self._frame(block)
+                if frame is not None:
+                    frames.append(frame)
+        return frames
+
+    def _frame(self, block):
+        data = cobs_decode(block)
+        if data is None or len(data) < 5 or \
+                crc16(data[:-2]) != struct.unpack('<H', bytes(data[-2:]))[0]:
+            self.corrupt += 1
+            return None
+        ftype, seq = struct.unpack('<BH', bytes(data[:3]))
+        body = data[3:-2]
+        if self.seq is not None:
+            self.lost += (seq - self.seq - 1) & 0xFFFF
+        self.seq = seq
+        self.frames += 1
+
+        frame = Frame(ftype, seq)
+        if ftype == TLM_DESC:
+            self._desc(body)
+        elif ftype == TLM_DATA:
+            if not self._data(body, frame):
+                return None
+        elif ftype == TLM_TEXT:
+            frame.text = bytes(body).decode('ascii', 'replace')
+        elif ftype == TLM_TRAJ:
+            if len(body) != 8:
+                self.corrupt += 1
+                return None
+            frame.traj = struct.unpack('<HBBI', bytes(body))
+        return frame
+
+    def _desc(self, body):
+        channels = {}
+        i = 0
+        while i + 14 <= len(body):
+            cid, count, fmt, decim, scale, offset, n = \
+                struct.unpack('<BBBHffB', bytes(body[i:i + 14]))
+            name = bytes(body[i + 14:i + 14 + n]).decode('ascii')
+            i += 14 + n
+            n = body[i] if i < len(body) else 0
+            unit = bytes(body[i + 1:i + 1 + n]).decode('ascii')
+            i += 1 + n
+            channels[cid] = Channel(cid, count, fmt, decim, scale, offset, name, unit)
+        self.channels = channels
+
+    def _data(self, body, frame):
+        if len(body) < 4:
+            self.corrupt += 1
+            return False
+        frame.time_us = struct.unpack('<I', bytes(body[:4]))[0]
+        i = 4
+        while i < len(body):
+            ch = self.channels.get(body[i])
+            if ch is None or i + 1 + ch.size() > len(body):
+                self.undecoded += 1  # no channel table yet (or a stale one)
+                return False
+            frame.values[ch.name] = ch.decode(body[i + 1:i + 1 + ch.size()])
+            i += 1 + ch.size()
+        return True
@@ -0,0 +1,179 @@
+# Trajectory upload to the Pi (see RaspberryPi/master/traj.h)
+#
+# A trajectory is a list of qa points (3 joint angles, rad), one per control
+# tick. Queue any number; they go up one after the other, each while the
+# one before it runs, and the Pi plays them back-to-back:
+#
+#   up = TrajectoryUploader(ser)
+#   up.add(hop1)
+#   up.add(hop2)
+#   while up.busy():
+#       for frame in dec.feed(ser.read(ser.in_waiting or 1)):
+#           up.handle(frame)    # the TLM_TRAJ answers; other frames as usual
+#       up.pump()               # sends what is due
+#
+# Or have the Pi generate it from a few via points (see trajgen.h), e.g. a
+# minimum-jerk move of 2 s from qa0 to qa1:
+#   up.add_move([0, 2.0], [qa0, qa1], 'quintic')
+# profiles: 'linear', 'cubic', 'trapezoid', 'quintic'; space 'joint' (qa,
+# rad) or 'foot' (foot pose: x, y in m, angle in rad).
+#
+# Chunks go out CHUNK points at a time, up to WINDOW chunks ahead of the
+# Pi's answers; a chunk the Pi did not get (bad CRC) is sent again, with
+# the ones after it, on the Pi's next answer or after TIMEOUT seconds.
+# Each upload's state is in its .state; its .played is set when it has run.
+#
+# Works with Python 2 and 3.
+
+import struct
+import time
+
+from hopper_telemetry import TLM_TRAJ, encode_frame
+
+TRAJ_BEGIN, TRAJ_DATA, TRAJ_ABORT, TRAJ_MOVE = 1, 2, 3, 4
+(ACK_OK, ACK_READY, ACK_STARTED, ACK_FINISHED, ACK_BUSY, ACK_REJECTED,
+ ACK_ABORTED) = range(7)
+
+CHUNK = 64      # points per frame (TRAJ_CHUNK_MAX at most)
+WINDOW = 4      # chunks sent ahead of the answers
+TIMEOUT = 0.5   # s without an answer before sending again
+MAX_POINTS = 1 << 18 # TRAJ_MAX_POINTS
+MAX_VIA = 16    # TG_MAX_POINTS
+
+PROFILES = {'linear': 0, 'cubic': 1, 'trapezoid': 2, 'quintic': 3}
+SPACES = {'joint': 0, 'foot': 1}
+
+
+class Upload(object):
+    def __init__(self, tid, points, move=None):
+        self.id = tid
+        self.points = [tuple(float(v) for v in p) for p in points]
+        self.move = move    # the TRAJ_MOVE body after the id, for a generated one
+        # queued, begun, loading, ready, running, finished, rejected, aborted:
+        self.state = 'queued'
+        self.acked = 0      # points the Pi has
+        self.sent = 0       # points sent
+        self.rewound = None # acked when last sent again
+        self.last = 0       # time of the last send or answer
+        self.played = None
+
+
+class TrajectoryUploader(object):
+    def __init__(self, ser):
+        self.ser = ser
+        self.uploads = []
+        self.next_id = 1
+        self.seq = 0
+
+    def add(self, points):
+        """Queues a trajectory (a list of (qa1, qa2, qa3)); returns its Upload."""
+        if not 0 < len(points) <= MAX_POINTS:
+            raise ValueError('a trajectory has 1 to %d points' % MAX_POINTS)
+        return self._add(Upload(self.next_id, points))
+
+    def add_move(self, times, points, profile='quintic', space='joint'):
+        """Queues a trajectory the Pi generates through the via points (a list
+        of 3-tuples) at times (s, the first 0); returns its Upload."""
+        if len(times) != len(points) or not 2 <= len(points) <= MAX_VIA or times[0] != 0:
+            raise ValueError('a move has 2 to %d via points, the first at time 0' % MAX_VIA)
+        body = struct.pack('<BB', PROFILES[profile], SPACES[space]) + \
+            b''.join(struct.pack('<4f', t, *p) for t, p in zip(times, points))
+        return self._add(Upload(self.next_id, points, body))
+
+    def _add(self, up):
+        self.next_id = (self.next_id + 1) & 0xFFFF
+        self.uploads.append(up)
+        return up
+
+    def abort(self, up):
+        self._send(TRAJ_ABORT, struct.pack('<H', up.id))
+
+    def busy(self):
+        """Some upload has not finished (or failed)."""
+        return any(u.state not in ('finished', 'rejected', 'aborted') for u in self.uploads)
+
+    def _send(self, ftype, body):
+        self.ser.write(encode_frame(ftype, self.seq, body))
+        self.seq += 1
+
+    def _begin(self, up):
+        if up.move is not None:
+            self._send(TRAJ_MOVE, struct.pack('<H', up.id) + up.move)
+        else:
+            self._send(TRAJ_BEGIN, struct.pack('<HI', up.id, len(up.points)))
+
+    def _find(self, tid):
+        for u in self.uploads:
+            if u.id == tid and u.state not in ('finished', 'rejected', 'aborted'):
+                return u
+        return None
+
+    def handle(self, frame):
+        """Takes the Pi's answers from the decoded frames (others are ignored)."""
+        if frame.type != TLM_TRAJ:
+            return
+        tid, status, slot, points = frame.traj
+        up = self._find(tid)
+        if up is None:
+            return
+        if status == ACK_OK and up.state in ('begun', 'loading'):
+            up.state = 'loading'
+            up.last = time.time()
+            if points > up.acked:
+                up.acked = points
+                up.rewound = None
+            elif up.sent > points and up.rewound != points:
+                up.sent = points  # a chunk was lost: again from there
+                up.rewound = points
+        elif status == ACK_READY and up.state in ('begun', 'loading'):
+            up.state = 'ready'
+            up.acked = up.sent = len(up.points)
+        elif status == ACK_STARTED:
+            up.state = 'running'
+        elif status == ACK_FINISHED:
+            up.state = 'finished'
+            up.played = points
+            for u in self.uploads:  # a slot is free now
+                if u.state == 'busy':
+                    u.state = 'queued'
+        elif status == ACK_BUSY:
+            up.state = 'busy'
+        elif status == ACK_REJECTED:
+            up.state = 'rejected'
+        elif status == ACK_ABORTED:
+            up.state = 'aborted'
+
+    def pump(self):
+        """Sends what is due: the next BEGIN, chunks, and whatever timed out."""
+        now = time.time()
+        for up in self.uploads:
+            if up.state in ('begun', 'loading'):
+                break
+        else:
+            up = None
+            for u in self.uploads:
+                if u.state == 'queued':
+                    up = u
+                    break
+            if up is not None:
+                up.state = 'begun'
+                up.last = now
+                self._begin(up)
+            return
+
+        if now - up.last > TIMEOUT:
+            if up.state == 'begun':
+                self._begin(up)
+                up.last = now
+                return
+            up.sent = up.acked
+            up.rewound = None
+        if up.state != 'loading':
+            return
+        while up.sent < len(up.points) and up.sent - up.acked < WINDOW * CHUNK:
+            chunk = up.points[up.sent:up.sent + CHUNK]
+            body = struct.pack('<HI', up.id, up.sent) + \
+                b''.join(struct.pack('<3f', *p) for p in chunk)
+            self._send(TRAJ_DATA, body)
+            up.sent += len(chunk)
+            up.last = now
@@ -1,6 +1,9 @@
 import serial
 import time
 
+from hopper_telemetry import TelemetryDecoder, TLM_DATA, TLM_TEXT
+from hopper_traj import TrajectoryUploader
+
 timeout = 10
 timeoutOccurred = 0
 
@@ -14,27 +17,46 @@ deltat = time.time() - now;
 if deltat < timeout:
     NSAMPLES = int(NSAMPLES);
     print "Expecting %d samples." % NSAMPLES
-    get = [0]*NSAMPLES # create array to store received data
+    get = [] # received data
     received = 0;
 
     ser.write('1'); # '1' gives the other device permission to write
 
-    for i in range(NSAMPLES):
-        now = time.time()
-
-        line = ser.readline()
-        get[i] = line
-        print get[i]
-
-        deltat = time.time() - now;
+    # from full extension to full compression in NSAMPLES control ticks
+    # (500 Hz), a minimum-jerk move the Pi generates (see hopper_traj.py):
+    qa_fullext = (-1.6845, -2.6214, -1.4571)
+    qa_fullcmp = (-2.6564, -2.9706, -0.4835)
+    up = TrajectoryUploader(ser)
+    traj = up.add_move([0, (NSAMPLES - 1)/500.0], [qa_fullext, qa_fullcmp], 'quintic')
 
-        if deltat < timeout:
-            received += 1
-        else:
+    # binary frames from here on (see hopper_telemetry.py); the run lasts
+    # NSAMPLES ticks, or longer while the trajectory has not finished:
+    dec = TelemetryDecoder()
+    ser.timeout = 0.1
+    last = time.time()
+    while received < NSAMPLES or up.busy():
+        data = ser.read(ser.in_waiting or 1)
+        if data:
+            last = time.time()
+        elif time.time() - last > timeout:
             timeoutOccurred = 1
             print "Breaking out of read loop..."
             break
 
+        for frame in dec.feed(data):
+            up.handle(frame)
+            if frame.type == TLM_TEXT: # status lines ("# can ...", "# hist ..."), not samples
+                print frame.text
+            elif frame.type == TLM_DATA:
+                get.append(frame.values)
+                print frame.time_us, ' '.join('%.4f' % v for v in frame.values.get('qa', []))
+                received += 1
+        up.pump()
+
+    print "Frames: %d received, %d lost, %d corrupt, %d samples before the channel table." % \
+        (dec.frames, dec.lost, dec.corrupt, dec.undecoded)
+    print "Trajectory: %s, %s points played." % (traj.state, traj.played)
+
     if timeoutOccurred:
         print "Serial read timeout occurred. Expected %d samples, received %d samples." % (NSAMPLES, received)
     else:
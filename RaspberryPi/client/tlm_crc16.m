@@ -0,0 +1,16 @@
+function crc = tlm_crc16(data)
+% TLM_CRC16 CRC-16/CCITT-FALSE of the uint8 column data, as tlm_crc16() on
+% the Pi (RaspberryPi/master/telemetry.h): 0x29B1 for '123456789'
+    crc = uint16(65535);
+    for b = data'
+        crc = bitxor(crc, bitshift(uint16(b), 8));
+        for k = 1:8
+            if bitand(crc, 32768)
+                crc = bitxor(bitshift(crc, 1), uint16(4129));
+            else
+                crc = bitshift(crc, 1);
+            end
+        end
+    end
+    crc = double(crc);
+end
@@ -0,0 +1,192 @@
+function [samples, texts, st, acks] = tlm_decode(bytes, st)
+% TLM_DECODE decodes the Pi's binary telemetry (see RaspberryPi/master/telemetry.h)
+%
+%   [samples, texts, st, acks] = tlm_decode(bytes, st)
+%
+% bytes are read from the serial port, in pieces of any size (e.g.
+% fread(mySerial, n, 'uint8')); st carries the decoder's state from one
+% call to the next: pass [] the first time.
+%
+% samples is a struct array, one element per TLM_DATA frame completed by
+% bytes, with fields seq, time_us and one per channel (e.g. qa, 1x3, rad);
+% a channel not in a sample (not subscribed, or not due on its tick) is [].
+% texts is a cell array of the TLM_TEXT lines ('# can ...', '# hist ...').
+% acks is a struct array of the TLM_TRAJ answers to trajectory uploads
+% (fields id, status, slot, points; see traj_upload.m).
+% st.channels is the channel table, with each channel's name, unit and
+% decimation.
+%
+% The Pi starts with qa alone; ask for another channel with e.g.
+%   fprintf(mySerial, 's ia 1\n');   % every control tick
+%   fprintf(mySerial, 's boom 50\n'); % every 50th; 0 stops it
+% It answers with a '# tlm ...' text line, and refuses subscriptions the
+% serial link cannot carry.
+%
+% st.lost counts the frames lost (gaps in seq, so the corrupt ones too),
+% st.corrupt the frames dropped for a bad CRC or framing. Samples can only
+% be decoded once the channel table has come, which the Pi sends every
+% second; st.undecoded counts the samples before it.
+
+    TLM_DESC = 0; TLM_DATA = 1; TLM_TEXT = 2; TLM_TRAJ = 3;
+
+    if isempty(st)
+        st.buf = uint8([]);
+        st.channels = struct('id', {}, 'count', {}, 'format', {}, 'decim', {}, ...
+            'scale', {}, 'offset', {}, 'name', {}, 'unit', {});
+        st.seq = -1;
+        st.frames = 0;
+        st.lost = 0;
+        st.corrupt = 0;
+        st.undecoded = 0;
+    end
+
+    samples = [];
+    texts = {};
+    acks = struct('id', {}, 'status', {}, 'slot', {}, 'points', {});
+    st.buf = [st.buf; uint8(bytes(:))];
+
+    zeros_at = find(st.buf == 0);
+    start = 1;
+    for z = zeros_at'
+        block = st.buf(start:z-1);
+        start = z + 1;
+        if isempty(block)
+            continue;
+        end
+
+        data = cobs_decode(block);
+        if isempty(data) || length(data) < 5 || ...
+                tlm_crc16(data(1:end-2)) ~= double(typecast(data(end-1:end), 'uint16'))
+            st.corrupt = st.corrupt + 1;
+            continue;
+        end
+        ftype = data(1);
+        seq = double(typecast(data(2:3), 'uint16'));
+        body = data(4:end-2);
+        if st.seq >= 0
+            st.lost = st.lost + mod(seq - st.seq - 1, 65536);
+        end
+        st.seq = seq;
+        st.frames = st.frames + 1;
+
+        switch ftype
+            case TLM_DESC
+                st.channels = parse_desc(body);
+            case TLM_DATA
+                [s, ok] = parse_data(body, st.channels);
+                if ok
+                    s.seq = seq;
+                    samples = append_sample(samples, s);
+                elseif length(body) < 4
+                    st.corrupt = st.corrupt + 1;
+                else
+                    st.undecoded = st.undecoded + 1;
+                end
+            case TLM_TEXT
+                texts{end+1} = char(body'); %#ok<AGROW>
+            case TLM_TRAJ
+                if length(body) == 8
+                    a.id = double(typecast(body(1:2), 'uint16'));
+                    a.status = double(body(3));
+                    a.slot = double(body(4));
+                    a.points = double(typecast(body(5:8), 'uint32'));
+                    acks(end+1) = a; %#ok<AGROW>
+                else
+                    st.corrupt = st.corrupt + 1;
+                end
+        end
+    end
+    st.buf = st.buf(start:end);
+end
+
+function out = cobs_decode(data)
+% one COBS block, without its zero byte; [] if malformed
+    out = uint8([]);
+    i = 1;
+    n = length(data);
+    while i <= n
+        code = double(data(i));
+        if code == 0 || i + code - 1 > n
+            out = uint8([]);
+            return;
+        end
+        out = [out; data(i+1:i+code-1)]; %#ok<AGROW>
+        i = i + code;
+        if code < 255 && i <= n
+            out(end+1, 1) = 0; %#ok<AGROW>
+        end
+    end
+end
+
+function channels = parse_desc(body)
+    channels = struct('id', {}, 'count', {}, 'format', {}, 'decim', {}, ...
+        'scale', {}, 'offset', {}, 'name', {}, 'unit', {});
+    i = 1;
+    while i + 13 <= length(body)
+        c.id = double(body(i));
+        c.count = double(body(i+1));
+        c.format = double(body(i+2));
+        c.decim = double(typecast(body(i+3:i+4), 'uint16'));
+        c.scale = double(typecast(body(i+5:i+8), 'single'));
+        c.offset = double(typecast(body(i+9:i+12), 'single'));
+        n = double(body(i+13));
+        c.name = char(body(i+14:i+13+n)');
+        i = i + 14 + n;
+        n = double(body(i));
+        c.unit = char(body(i+1:i+n)');
+        i = i + 1 + n;
+        channels(end+1) = c; %#ok<AGROW>
+    end
+end
+
+function [s, ok] = parse_data(body, channels)
+    s = struct();
+    ok = false;
+    if length(body) < 4
+        return;
+    end
+    s.time_us = double(typecast(body(1:4), 'uint32'));
+    i = 5;
+    while i <= length(body)
+        c = channels([channels.id] == body(i));
+        if isempty(c)
+            return; % no channel table yet (or a stale one)
+        end
+        if c.format == 1 % TLM_F32
+            n = 4*c.count;
+        else
+            n = 2*c.count;
+        end
+        if i + n > length(body)
+            return;
+        end
+        raw = body(i+1:i+n);
+        if c.format == 1
+            v = double(typecast(raw, 'single'));
+        else
+            v = c.offset + c.scale*double(typecast(raw, 'int16'));
+        end
+        s.(c.name) = v';
+        i = i + 1 + n;
+    end
+    ok = true;
+end
+
+function samples = append_sample(samples, s)
+% a sample may hold channels the others do not: those fields are [] where missing
+    if isempty(samples)
+        samples = s;
+        return;
+    end
+    for f = fieldnames(s)'
+        if ~isfield(samples, f{1})
+            [samples.(f{1})] = deal([]);
+        end
+    end
+    for f = fieldnames(samples)'
+        if ~isfield(s, f{1})
+            s.(f{1}) = [];
+        end
+    end
+    samples(end+1) = orderfields(s, samples(1));
+end
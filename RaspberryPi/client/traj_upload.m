@@ -0,0 +1,159 @@
+function [samples, texts, st, ok] = traj_upload(mySerial, qa, id, st)
+% TRAJ_UPLOAD uploads a trajectory to the Pi (see RaspberryPi/master/traj.h)
+%
+%   [samples, texts, st, ok] = traj_upload(mySerial, qa, id, st)
+%
+% qa is the trajectory, nx3 joint angles (rad), one row per control tick,
+% or a struct for a trajectory the Pi generates from a few via points
+% (see RaspberryPi/master/trajgen.h):
+%   qa.profile  'linear', 'cubic', 'trapezoid' or 'quintic' (minimum jerk)
+%   qa.space    'joint' (qa, rad) or 'foot' (foot pose: x, y in m, angle in rad)
+%   qa.t        times of the via points (s), 2 to 16, the first 0
+%   qa.points   the via points, one row each
+% id (1 to 65535) names it in the Pi's answers. The robot is running while
+% it goes up, so traj_upload keeps decoding the telemetry: samples, texts
+% and st are as from tlm_decode, which takes over again afterwards.
+%
+% Returns once the Pi has all the points and has queued the trajectory
+% (ok true): it starts when the one running, if any, ends, and tlm_decode's
+% acks then tell when it started (status 2) and finished (3, points:
+% how many played), e.g.
+%   [samples, texts, st] = traj_upload(mySerial, hop1, 1, st);
+%   [samples, texts, st] = traj_upload(mySerial, hop2, 2, st); % while hop1 runs
+% ok is false if the Pi refused it (too long: 2^18 points at most).
+%
+% Chunks of CHUNK points go out up to WINDOW chunks ahead of the Pi's
+% answers; a chunk the Pi did not get (bad CRC) is sent again, with the
+% ones after it, on the Pi's next answer or after TIMEOUT seconds. When
+% both of the Pi's slots are taken, the upload waits for one to finish.
+
+    TRAJ_BEGIN = 1; TRAJ_DATA = 2; TRAJ_MOVE = 4;
+    ACK_OK = 0; ACK_READY = 1; ACK_FINISHED = 3; ACK_BUSY = 4; ACK_REJECTED = 5;
+    CHUNK = 64; WINDOW = 4; TIMEOUT = 0.5;
+
+    if isstruct(qa)
+        move = [u16(id); uint8(find(strcmp(qa.profile, {'linear', 'cubic', 'trapezoid', 'quintic'})) - 1); ...
+            uint8(find(strcmp(qa.space, {'joint', 'foot'})) - 1); ...
+            typecast(single(reshape([qa.t(:) qa.points]', [], 1)), 'uint8')];
+        n = size(qa.points, 1);
+    else
+        move = [];
+        n = size(qa, 1);
+    end
+    samples = [];
+    texts = {};
+    ok = false;
+    seq = 0;
+    state = 'begun';    % begun, loading or busy
+    acked = 0;          % points the Pi has
+    sent = 0;           % points sent
+    rewound = -1;       % acked when last sent again
+    send_begin();
+    last = tic;         % since the last send or answer
+
+    while true
+        if strcmp(state, 'loading')
+            while sent < n && sent - acked < WINDOW*CHUNK
+                rows = sent+1:min(sent+CHUNK, n);
+                send_frame(TRAJ_DATA, [u16(id); u32(sent); ...
+                    typecast(single(reshape(qa(rows,:)', [], 1)), 'uint8')]);
+                sent = rows(end);
+                last = tic;
+            end
+        end
+
+        bytes = fread(mySerial, max(mySerial.BytesAvailable,1), 'uint8');
+        if isempty(bytes)
+            fprintf('traj_upload: no answer from the Pi\n');
+            return;
+        end
+        [s, t, st, acks] = tlm_decode(bytes, st);
+        if isempty(samples)
+            samples = s;
+        elseif ~isempty(s)
+            samples = [samples, s]; %#ok<AGROW>
+        end
+        texts = [texts, t]; %#ok<AGROW>
+
+        for a = acks
+            if a.status == ACK_FINISHED && strcmp(state, 'busy')
+                state = 'begun'; % a slot is free now
+                send_begin();
+                last = tic;
+            end
+            if a.id ~= id
+                continue;
+            end
+            switch a.status
+                case ACK_OK
+                    state = 'loading';
+                    last = tic;
+                    if a.points > acked
+                        acked = a.points;
+                        rewound = -1;
+                    elseif sent > a.points && rewound ~= a.points
+                        sent = a.points; % a chunk was lost: again from there
+                        rewound = a.points;
+                    end
+                case ACK_READY
+                    ok = true;
+                    return;
+                case ACK_BUSY
+                    state = 'busy';
+                case ACK_REJECTED
+                    fprintf('traj_upload: the Pi refused trajectory %d (%d points)\n', id, n);
+                    return;
+            end
+        end
+
+        if ~strcmp(state, 'busy') && toc(last) > TIMEOUT
+            if strcmp(state, 'begun')
+                send_begin();
+            else
+                sent = acked;
+                rewound = -1;
+            end
+            last = tic;
+        end
+    end
+
+    function send_begin()
+        if isempty(move)
+            send_frame(TRAJ_BEGIN, [u16(id); u32(n)]);
+        else
+            send_frame(TRAJ_MOVE, move);
+        end
+    end
+
+    function send_frame(ftype, body)
+    % type, seq, body and CRC, COBS encoded between two zero bytes
+        data = [uint8(ftype); u16(seq); body];
+        data = [data; u16(tlm_crc16(data))];
+        fwrite(mySerial, [0; cobs_encode(data); 0], 'uint8');
+        seq = mod(seq + 1, 65536);
+    end
+end
+
+function b = u16(v)
+    b = typecast(uint16(v), 'uint8')';
+end
+
+function b = u32(v)
+    b = typecast(uint32(v), 'uint8')';
+end
+
+function out = cobs_encode(data)
+% COBS encodes data, without the trailing zero byte
+    out = zeros(0, 1, 'uint8');
+    block = zeros(0, 1, 'uint8');
+    for b = data'
+        if b
+            block(end+1, 1) = b; %#ok<AGROW>
+        end
+        if ~b || length(block) == 254
+            out = [out; uint8(length(block) + 1); block]; %#ok<AGROW>
+            block = zeros(0, 1, 'uint8');
+        end
+    end
+    out = [out; uint8(length(block) + 1); block];
+end
@@ -1,6 +1,133 @@
+#define _GNU_SOURCE // recvmmsg
 #include "can_io.h"
 
-int initSocketCAN(void) { // set up CAN raw socket
+#include <limits.h>
+#include <math.h>
+#include <linux/futex.h>
+#include <poll.h>
+#include <sys/syscall.h>
+
+#ifndef IFF_ECHO
+#define IFF_ECHO (1<<18) // linux/if.h, which clashes with net/if.h
+#endif
+
+_Static_assert(CANMSG_EXT_FLAG == CAN_EFF_FLAG, "canmsg.h keys must be SocketCAN IDs");
+
+// What readCAN() does with each message, by its index in canmsg_table.
+// Only messages with a handler, and the echoes of our own commands, get
+// through the kernel's filters; the others never wake us up.
+typedef void (*can_rx_handler)(const uint8_t *data, can_input_struct *ptr);
+
+#define CAN_RX(msg, layout, field, dest) \
+  static void rx_##msg(const uint8_t *data, can_input_struct *ptr) { \
+    ptr->dest = canmsg_##layout##_get_##field(data); \
+  }
+
+// a motor's position, and the cycle it was sampled in:
+#define CAN_RX_POS(msg, i) \
+  static void rx_##msg(const uint8_t *data, can_input_struct *ptr) { \
+    ptr->qa_act[i] = canmsg_motor_pos_get_pos(data); \
+    ptr->cmdSeq[i] = canmsg_motor_pos_get_seq(data); \
+  }
+
+// a motor's whole state, over CAN FD:
+#define CAN_RX_STATE(msg, i) \
+  static void rx_##msg(const uint8_t *data, can_input_struct *ptr) { \
+    ptr->qa_act[i] = canmsg_motor_state_get_pos(data); \
+    ptr->qd_act[i] = canmsg_motor_state_get_vel(data); \
+    ptr->ia[i] = canmsg_motor_state_get_cur(data); \
+    ptr->cmdSeq[i] = canmsg_motor_state_get_seq(data); \
+    ptr->nodeTime[i] = canmsg_motor_state_get_time(data); \
+  }
+
+CAN_RX_POS(MOTOR_1_POS, 0)
+CAN_RX_POS(MOTOR_2_POS, 1)
+CAN_RX_POS(MOTOR_3_POS, 2)
+CAN_RX_STATE(MOTOR_1_STATE, 0)
+CAN_RX_STATE(MOTOR_2_STATE, 1)
+CAN_RX_STATE(MOTOR_3_STATE, 2)
+CAN_RX(MOTOR_1_CUR, motor_cur, cur, ia[0])
+CAN_RX(MOTOR_2_CUR, motor_cur, cur, ia[1])
+CAN_RX(MOTOR_3_CUR, motor_cur, cur, ia[2])
+CAN_RX(BOOM_ROLL, boom_angle, angle, boom[0])
+CAN_RX(BOOM_PITCH, boom_angle, angle, boom[1])
+CAN_RX(BOOM_YAW, boom_angle, angle, boom[2])
+
+static void rx_IMU_FZ(const uint8_t *data, can_input_struct *ptr) {
+  ptr->accel = canmsg_imu_fz_get_az(data); // optionally expand for accelerations in 3 axes
+  ptr->fz = canmsg_imu_fz_get_fz(data);
+}
+
+static const can_rx_handler canRxHandlers[CANMSG_COUNT] = {
+  [CANMSG_MOTOR_1_POS] = rx_MOTOR_1_POS,
+  [CANMSG_MOTOR_2_POS] = rx_MOTOR_2_POS,
+  [CANMSG_MOTOR_3_POS] = rx_MOTOR_3_POS,
+  [CANMSG_MOTOR_1_STATE] = rx_MOTOR_1_STATE,
+  [CANMSG_MOTOR_2_STATE] = rx_MOTOR_2_STATE,
+  [CANMSG_MOTOR_3_STATE] = rx_MOTOR_3_STATE,
+  [CANMSG_MOTOR_1_CUR] = rx_MOTOR_1_CUR,
+  [CANMSG_MOTOR_2_CUR] = rx_MOTOR_2_CUR,
+  [CANMSG_MOTOR_3_CUR] = rx_MOTOR_3_CUR,
+  [CANMSG_IMU_FZ] = rx_IMU_FZ,
+  [CANMSG_BOOM_ROLL] = rx_BOOM_ROLL,
+  [CANMSG_BOOM_PITCH] = rx_BOOM_PITCH,
+  [CANMSG_BOOM_YAW] = rx_BOOM_YAW
+};
+
+// written by the receiving thread only:
+static struct {
+  uint32_t frames[CANMSG_COUNT]; // per canmsg_table entry
+  uint32_t unknown;              // frames of messages we have no handler for
+  uint32_t shortFrames;          // frames shorter than their DLC in canmsg_table
+  uint32_t wakeups;              // readCAN() calls that got frames
+  uint32_t maxBatch;             // most frames drained by one readCAN()
+} canRxStats;
+
+static uint8_t canFD;             // set by initSocketCAN()
+static can_joint_ctrl jointCtrl;  // sent with every MOTOR_CMD_FD
+
+// The transmit slot of a command message (see can_io.h). The sending thread
+// puts each command in it under a sequence lock, numbered by gen; whichever
+// thread finds the frame ahead gone (the sender when it hands a command
+// over, the receiving thread on the echo) claims the newest command by
+// moving sentGen to its gen, and writes it. The claim is a compare-and-swap,
+// so each command is written at most once, by one of them.
+typedef struct {
+  // written by the sending thread only:
+  uint32_t seq;               // odd while the command below is being replaced
+  struct canfd_frame frame;
+  size_t size;                // CAN_MTU or CANFD_MTU
+  int64_t queued;             // CLOCK_MONOTONIC time it was handed over, ns
+  uint32_t gen;               // commands handed over so far
+  // either thread:
+  uint32_t sentGen;           // gen of the command last written
+  uint32_t doneGen;           // gen of the command last echoed (== sentGen: none in flight)
+  int64_t sentAt;             // when sentGen was written, ns
+  int64_t sentQueued;         // when sentGen was handed over, ns
+} can_tx_slot;
+
+static can_tx_slot canTxSlots[CANMSG_COUNT]; // only command messages are used
+
+static struct {
+  uint32_t handed;       // commands handed over (sending thread)
+  uint32_t superseded;   // replaced by a newer one before they were written (sending thread)
+  uint32_t lost;         // not echoed within CAN_TX_TIMEOUT_US (sending thread)
+  uint32_t sent;         // written to the socket (atomic, both threads)
+  uint32_t writeErrors;  // failed writes (atomic, both threads)
+  rt_hist wait;          // handed over to echoed (receiving thread)
+} canTxStats;
+
+static uint8_t canTxEcho; // the interface sets IFF_ECHO
+
+int initSocketCAN(const char *ifname, int fd) { // set up CAN raw socket
+  struct can_filter filters[CANMSG_COUNT];
+  struct ifreq mtu;
+  int i, n = 0, on = 1, sndbuf = CAN_TX_SNDBUF;
+  socklen_t len = sizeof(sndbuf);
+  char path[64];
+  unsigned flags = 0;
+  FILE *f;
+
   printf("Beginning CAN socket setup:\n");
 
   /* open socket */
@@ -13,7 +140,7 @@ int initSocketCAN(void) { // set up CAN raw socket
 
   addr.can_family = AF_CAN;
 
-  strcpy(ifr.ifr_name, "can0");
+  snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
   if (ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
   	perror("\tSIOCGIFINDEX");
     return 1;
@@ -21,10 +148,67 @@ int initSocketCAN(void) { // set up CAN raw socket
   printf("\tioctl complete\n");
   addr.can_ifindex = ifr.ifr_ifindex;
 
-  // // set up timeout for blocking read
-  // tv.tv_sec = 0;
-  // tv.tv_usec = 10;
-  // setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  // CAN FD needs an FD capable interface (MTU CANFD_MTU) and a socket that
+  // takes struct canfd_frame; else we stay with classic CAN:
+  canFD = 0;
+  if (fd) {
+    mtu = ifr;
+    if (ioctl(s, SIOCGIFMTU, &mtu) < 0 || mtu.ifr_mtu != CANFD_MTU) {
+      printf("\t%s does not do CAN FD, using classic CAN\n",ifname);
+    } else if (setsockopt(s, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &on, sizeof(on)) < 0) {
+      perror("\tCAN_RAW_FD_FRAMES");
+      printf("\tusing classic CAN\n");
+    } else {
+      canFD = 1;
+      printf("\tCAN FD enabled\n");
+    }
+  }
+
+  // our own commands come back to us once sent, which completes them (see
+  // can_io.h); a small send buffer keeps the kernel from holding many of
+  // our frames anyway:
+  if (setsockopt(s, SOL_CAN_RAW, CAN_RAW_RECV_OWN_MSGS, &on, sizeof(on)) < 0) {
+    perror("\tCAN_RAW_RECV_OWN_MSGS");
+    return 1;
+  }
+  // receive time stamps, for CAN_read's latency (readCAN()):
+  if (setsockopt(s, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0) {
+    perror("\tSO_TIMESTAMPNS");
+  }
+  if (setsockopt(s, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) < 0 ||
+      getsockopt(s, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) < 0) {
+    perror("\tSO_SNDBUF");
+    return 1;
+  }
+  // IFF_ECHO does not fit SIOCGIFFLAGS' 16 bits:
+  snprintf(path, sizeof(path), "/sys/class/net/%s/flags", ifname);
+  if ((f = fopen(path, "r"))) {
+    if (fscanf(f, "%x", &flags) != 1) {
+      flags = 0;
+    }
+    fclose(f);
+  }
+  canTxEcho = (flags & IFF_ECHO) != 0;
+  printf("\tsend buffer %d bytes, commands complete %s\n",sndbuf,
+    canTxEcho ? "once on the bus (IFF_ECHO)" : "once the driver has them (no IFF_ECHO)");
+  can_tx_reset();
+  rt_hist_init(&canTxStats.wait);
+
+  // receive only the messages in canRxHandlers, each with its exact ID and
+  // frame format, and the echoes of the commands we send:
+  for (i = 0; i < CANMSG_COUNT; ++i) {
+    if (canRxHandlers[i] || i == CANMSG_MOTOR_CMD || i == CANMSG_MOTOR_CMD_FD) {
+      filters[n].can_id = canmsg_table[i].key;
+      filters[n].can_mask = CAN_EFF_FLAG |
+        ((canmsg_table[i].key & CAN_EFF_FLAG) ? CAN_EFF_MASK : CAN_SFF_MASK);
+      ++n;
+    }
+  }
+  if (setsockopt(s, SOL_CAN_RAW, CAN_RAW_FILTER, filters, n*sizeof(filters[0])) < 0) {
+    perror("\tCAN_RAW_FILTER");
+    return 1;
+  }
+  printf("\t%d receive filters set\n",n);
 
   if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
   	perror("\tbind");
@@ -34,105 +218,374 @@ int initSocketCAN(void) { // set up CAN raw socket
   printf("\tbind complete\n");
 
   printf("\tsocket: %d\n",s);
-  printf("\tsizeof(writeFrame): %d\n",sizeof(writeFrame));
-
   printf("CAN socket set up complete!\n");
 
-  /* parse bogus CAN frame */
-  if (parse_canframe("00000001#0000000000000000", &writeFrame)){
-  	fprintf(stderr, "\nWrong CAN-frame format!\n\n");
-  	fprintf(stderr, "Try: <can_id>#{R|data}\n");
-  	fprintf(stderr, "can_id can have 3 (SFF) or 8 (EFF) hex chars\n");
-  	fprintf(stderr, "data has 0 to 8 hex-values that can (optionally)");
-  	fprintf(stderr, " be seperated by '.'\n\n");
-  	fprintf(stderr, "e.g. 5A1#11.2233.44556677.88 / 123#DEADBEEF / ");
-  	fprintf(stderr, "5AA# /\n     1F334455#1122334455667788 / 123#R ");
-  	fprintf(stderr, "for remote transmission request.\n\n");
-  	return 1;
-  }
-  printf("CAN writeFrame ID: %X\n",writeFrame.can_id);
+  return 0;
+}
+
+int canFDEnabled(void) {
+  return canFD;
+}
+
+static int64_t now_ns(void) {
+  struct timespec t;
 
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (int64_t)t.tv_sec*1000000000 + t.tv_nsec;
+}
+
+// write command gen of slot sl, once claimed; a failed write completes it
+// at once, as it will never be echoed:
+static int tx_write(can_tx_slot *sl, uint32_t gen, const struct canfd_frame *f, size_t size,
+  int64_t queued) {
+  __atomic_store_n(&sl->sentQueued, queued, __ATOMIC_RELAXED);
+  __atomic_store_n(&sl->sentAt, now_ns(), __ATOMIC_RELAXED);
+  // never blocks: the slot keeps at most one frame in the kernel
+  if (send(s, f, size, MSG_DONTWAIT) != (ssize_t)size) {
+    __atomic_fetch_add(&canTxStats.writeErrors, 1, __ATOMIC_RELAXED);
+    rt_log("write to CAN failed: errno %d\n",errno); // not perror(): called from the RT threads
+    __atomic_store_n(&sl->doneGen, gen, __ATOMIC_SEQ_CST);
+    return 1;
+  }
+  __atomic_fetch_add(&canTxStats.sent, 1, __ATOMIC_RELAXED);
   return 0;
 }
 
-// get data from CAN, parse it, and put it into a struct of type can_input_struct:
-int readCAN(can_input_struct *ptr) {
-  int ID;
+// hand command f over to the slot of message msg (sending thread); it is
+// written now if no frame of msg is in flight, else when that one has left,
+// unless a newer command replaces it first:
+static int tx_submit(int msg, const struct canfd_frame *f, size_t size) {
+  can_tx_slot *sl = &canTxSlots[msg];
+  uint32_t gen = sl->gen + 1, sent, done;
+  int64_t t = now_ns();
 
-  nbytesR = read(s, &readFrame, sizeof(readFrame));
+  if (__atomic_load_n(&sl->sentGen, __ATOMIC_RELAXED) != sl->gen) {
+    ++canTxStats.superseded; // the last command was never written
+  }
+  ++canTxStats.handed;
 
-  pthread_mutex_lock(&mutex1);
-  switch (readFrame.can_id & 0x0FFFFFFF) {
-    // if the received CAN frame ID indicates a joint position:
-    case MOTOR_1_POS_CAN_ID:
-    {
-      ID = 1;
-      ptr->qa_act[0] = ((readFrame.data[1] << 8) | readFrame.data[0]);
-      // printf("qa_act[0] = %X\n",ptr->qa_act[0]); // TODO: delete this line after testing
-      break;
-    }
-    case MOTOR_2_POS_CAN_ID:
-    {
-      ID = 2;
-      ptr->qa_act[1] = ((readFrame.data[1] << 8) | readFrame.data[0]);
-      // printf("qa_act[1] = %X\n",ptr->qa_act[1]); // TODO: delete this line after testing
-      break;
+  __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  sl->frame = *f;
+  sl->size = size;
+  sl->queued = t;
+  __atomic_store_n(&sl->gen, gen, __ATOMIC_RELAXED);
+  __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELEASE);
+
+  // the gen store above, then the doneGen load; tx_complete() does the
+  // opposite, so either it sees this command or we see the slot free:
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  sent = __atomic_load_n(&sl->sentGen, __ATOMIC_RELAXED);
+  done = __atomic_load_n(&sl->doneGen, __ATOMIC_RELAXED);
+  if (sent != done) {
+    if (t - __atomic_load_n(&sl->sentAt, __ATOMIC_RELAXED) < (int64_t)CAN_TX_TIMEOUT_US*1000) {
+      return 0; // waits for the echo of the frame ahead
     }
-    case MOTOR_3_POS_CAN_ID:
-    {
-      ptr->qa_act[2] = ((readFrame.data[1] << 8) | readFrame.data[0]);
-      break;
+    // never echoed (dropped, or the bus is off): go on without it
+    ++canTxStats.lost;
+  }
+  if (!__atomic_compare_exchange_n(&sl->sentGen, &sent, gen, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    return 0; // the receiving thread took it
+  }
+  return tx_write(sl, gen, f, size, t);
+}
+
+// the echo of a frame of message msg came back at t (receiving thread): the
+// frame in flight has left, so write the newest command waiting behind it:
+static void tx_complete(int msg, int64_t t) {
+  can_tx_slot *sl = &canTxSlots[msg];
+  uint32_t sent = __atomic_load_n(&sl->sentGen, __ATOMIC_SEQ_CST), seq, gen;
+  struct canfd_frame f;
+  size_t size;
+  int64_t queued;
+
+  if (__atomic_load_n(&sl->doneGen, __ATOMIC_RELAXED) == sent) {
+    return; // a late echo of a frame given up as lost
+  }
+  rt_hist_add(&canTxStats.wait, t - __atomic_load_n(&sl->sentQueued, __ATOMIC_RELAXED));
+  __atomic_store_n(&sl->doneGen, sent, __ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&sl->gen, __ATOMIC_SEQ_CST) == sent) {
+    return; // nothing waiting
+  }
+  do {
+    seq = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE);
+    f = sl->frame;
+    size = sl->size;
+    queued = sl->queued;
+    gen = sl->gen;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) || seq != __atomic_load_n(&sl->seq, __ATOMIC_RELAXED));
+
+  if (__atomic_compare_exchange_n(&sl->sentGen, &sent, gen, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+    tx_write(sl, gen, &f, size, queued);
+  }
+}
+
+void can_tx_reset(void) {
+  int i;
+
+  for (i = 0; i < CANMSG_COUNT; ++i) {
+    __atomic_store_n(&canTxSlots[i].doneGen, __atomic_load_n(&canTxSlots[i].sentGen,
+      __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+  }
+}
+
+const rt_hist *can_tx_wait_hist(void) {
+  return &canTxStats.wait;
+}
+
+void can_tx_report(void) {
+  printf("CAN transmit: %u commands, %u sent, %u superseded, %u lost (no echo within %d us), "
+    "%u write errors; waits until %s\n",canTxStats.handed,canTxStats.sent,canTxStats.superseded,
+    canTxStats.lost,CAN_TX_TIMEOUT_US,canTxStats.writeErrors,
+    canTxEcho ? "on the bus" : "taken by the driver");
+}
+
+// parse one received frame, classic or FD, into *ptr, through canRxHandlers:
+static void parse_frame(canid_t can_id, uint8_t len, const uint8_t *data, can_input_struct *ptr) {
+  int i = canmsg_find(can_id & (CAN_EFF_FLAG | CAN_EFF_MASK));
+
+  if (i < 0 || !canRxHandlers[i]) {
+    ++canRxStats.unknown;
+  } else if (len < canmsg_table[i].dlc) {
+    ++canRxStats.shortFrames; // the sender does not match canmsg.h
+  } else {
+    canRxHandlers[i](data, ptr);
+    ++canRxStats.frames[i];
+  }
+}
+
+void parseCAN(const struct can_frame *f, can_input_struct *ptr) {
+  parse_frame(f->can_id, f->can_dlc, f->data, ptr);
+}
+
+// wait up to CAN_RX_TIMEOUT_MS for frames, then drain all pending frames into *ptr:
+int readCAN(can_input_struct *ptr, struct timespec *rx, struct timespec *woke) {
+  struct canfd_frame frames[CAN_RX_BATCH]; // a classic frame fills the first CAN_MTU bytes
+  struct mmsghdr msgs[CAN_RX_BATCH];
+  struct iovec iov[CAN_RX_BATCH];
+  union {
+    char buf[CMSG_SPACE(sizeof(struct timespec))];
+    struct cmsghdr align;
+  } ctrl[CAN_RX_BATCH];
+  struct pollfd pfd = {s, POLLIN, 0};
+  struct cmsghdr *cm;
+  struct timespec wall, stamp, mono;
+  int i, k, n, total = 0;
+  int64_t now = 0, age;
+
+  if ((n = poll(&pfd, 1, CAN_RX_TIMEOUT_MS)) <= 0) {
+    return (n < 0 && errno != EINTR) ? -1 : 0;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  clock_gettime(CLOCK_REALTIME, &wall);
+  if (woke) {
+    *woke = mono;
+  }
+  if (rx) {
+    *rx = mono; // unless the first frame has a time stamp
+  }
+
+  memset(msgs, 0, sizeof(msgs));
+  for (i = 0; i < CAN_RX_BATCH; ++i) {
+    iov[i].iov_base = &frames[i];
+    iov[i].iov_len = sizeof(frames[i]);
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_control = ctrl[i].buf;
+  }
+
+  // one system call per CAN_RX_BATCH frames, until the socket is empty:
+  do {
+    for (i = 0; i < CAN_RX_BATCH; ++i) {
+      msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i].buf); // the kernel shrinks it
     }
-    // if the received CAN frame ID indicates a motor current:
-    case MOTOR_1_CUR_CAN_ID:
-    {
-      ptr->ia[0] = ((readFrame.data[1] << 8) | readFrame.data[0]);
+    if ((n = recvmmsg(s, msgs, CAN_RX_BATCH, MSG_DONTWAIT, NULL)) < 0) {
+      if (errno != EAGAIN && errno != EINTR) {
+        rt_log("readCAN: recvmmsg failed: errno %d\n",errno);
+        return total ? total : -1;
+      }
       break;
     }
-    case MOTOR_2_CUR_CAN_ID:
-    {
-      ptr->ia[1] = ((readFrame.data[1] << 8) | readFrame.data[0]);
-      break;
+    // the kernel stamps frames on the wall clock, which may be stepped: take
+    // the first frame's age on it, from the time the wait ended
+    if (rx && !total && n > 0) {
+      for (cm = CMSG_FIRSTHDR(&msgs[0].msg_hdr); cm; cm = CMSG_NXTHDR(&msgs[0].msg_hdr, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+          memcpy(&stamp, CMSG_DATA(cm), sizeof(stamp));
+          age = (int64_t)(wall.tv_sec - stamp.tv_sec)*1000000000 + (wall.tv_nsec - stamp.tv_nsec);
+          if (age > 0 && age < 1000000000) {
+            rx->tv_sec = mono.tv_sec - age/1000000000;
+            rx->tv_nsec = mono.tv_nsec - age%1000000000;
+            if (rx->tv_nsec < 0) {
+              rx->tv_nsec += 1000000000;
+              --rx->tv_sec;
+            }
+          }
+        }
+      }
     }
-    case MOTOR_3_CUR_CAN_ID:
-    {
-      ptr->ia[2] = ((readFrame.data[1] << 8) | readFrame.data[0]);
-      break;
+    for (i = 0; i < n; ++i) {
+      if (msgs[i].msg_hdr.msg_flags & MSG_CONFIRM) { // the echo of a frame we sent
+        if (!now) {
+          now = now_ns();
+        }
+        if ((k = canmsg_find(frames[i].can_id & (CAN_EFF_FLAG | CAN_EFF_MASK))) >= 0) {
+          tx_complete(k, now);
+        }
+      } else {
+        parse_frame(frames[i].can_id, frames[i].len, frames[i].data, ptr);
+      }
     }
-    // if the received CAN frame ID indicates a boom angle:
-    case BOOM_ROLL_CAN_ID:
-    {
-      ptr->boom[0] = ((readFrame.data[1] << 8) | readFrame.data[0]);
-      break;
+    total += n;
+  } while (n == CAN_RX_BATCH);
+
+  ++canRxStats.wakeups;
+  if (total > canRxStats.maxBatch) {
+    canRxStats.maxBatch = total;
+  }
+  return total;
+}
+
+void can_rx_report(void) {
+  int i;
+
+  printf("CAN receive: %u wakeups, at most %u frames per wakeup\n",
+    canRxStats.wakeups,canRxStats.maxBatch);
+  for (i = 0; i < CANMSG_COUNT; ++i) {
+    if (canRxHandlers[i]) {
+      printf("%16s %8X %10u\n",canmsg_table[i].name,
+        canmsg_table[i].key & CAN_EFF_MASK,canRxStats.frames[i]);
     }
-    case BOOM_PITCH_CAN_ID:
-    {
-      ptr->boom[1] = ((readFrame.data[1] << 8) | readFrame.data[0]);
+  }
+  if (canRxStats.unknown || canRxStats.shortFrames) {
+    printf("%u frames with unknown IDs, %u too short\n",canRxStats.unknown,canRxStats.shortFrames);
+  }
+}
+
+void can_input_publish(can_input_state *st, const can_input_struct *data) {
+  uint32_t seq = st->seq;
+
+  // seq odd, then the data, then seq even again; the fences keep the data
+  // stores between the two seq stores:
+  __atomic_store_n(&st->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  st->data = *data;
+  clock_gettime(CLOCK_MONOTONIC, &st->stamp);
+  st->frames++;
+  __atomic_store_n(&st->seq, seq + 2, __ATOMIC_RELEASE);
+
+  // the seq store above, then the waiters load; can_input_wait() does the
+  // opposite, so either it sees the new seq or we see it waiting:
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&st->waiters, __ATOMIC_RELAXED)) {
+    syscall(SYS_futex, &st->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+  }
+}
+
+uint32_t can_input_snapshot(can_input_state *st, can_input_struct *data, struct timespec *stamp) {
+  uint32_t seq0, seq1, frames;
+  struct timespec t;
+
+  do {
+    seq0 = __atomic_load_n(&st->seq, __ATOMIC_ACQUIRE);
+    *data = st->data;
+    t = st->stamp;
+    frames = st->frames;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    seq1 = __atomic_load_n(&st->seq, __ATOMIC_RELAXED);
+  } while ((seq0 & 1) || seq0 != seq1); // a publish overlapped the copy
+
+  if (stamp) {
+    *stamp = t;
+  }
+  return frames;
+}
+
+static int64_t ts_diff_ns(const struct timespec *a, const struct timespec *b) {
+  return (int64_t)(a->tv_sec - b->tv_sec)*1000000000 + (a->tv_nsec - b->tv_nsec);
+}
+
+uint32_t can_input_wait(can_input_state *st, uint8_t cmdSeq, const struct timespec *sent,
+  uint32_t timeout_us, can_input_struct *data, struct timespec *stamp) {
+  struct timespec now, t, left;
+  uint32_t seq, frames;
+  int64_t ns;
+
+  __atomic_fetch_add(&st->waiters, 1, __ATOMIC_SEQ_CST);
+  for (;;) {
+    seq = __atomic_load_n(&st->seq, __ATOMIC_SEQ_CST);
+    frames = can_input_snapshot(st, data, &t);
+    // published after the command, so an old answer with the same seq (256
+    // cycles ago) does not count:
+    if (frames && ts_diff_ns(&t, sent) >= 0 && data->cmdSeq[0] == cmdSeq &&
+        data->cmdSeq[1] == cmdSeq && data->cmdSeq[2] == cmdSeq) {
       break;
     }
-    case BOOM_YAW_CAN_ID:
-    {
-      ptr->boom[2] = ((readFrame.data[1] << 8) | readFrame.data[0]);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (int64_t)timeout_us*1000 - ts_diff_ns(&now, sent);
+    if (ns <= 0) {
+      frames = 0;
       break;
     }
-    // if the received CAN frame ID indicates IMU/FZ information:
-    case IMU_FZ_CAN_ID:
-    {
-      ptr->accel = ((readFrame.data[1] << 8) | readFrame.data[0]);
-      // optionally expand for accelerations in 3 axes
-      ptr->fz = ((readFrame.data[3] << 8) | readFrame.data[2]);
-      break;
+    left.tv_sec = ns/1000000000;
+    left.tv_nsec = ns%1000000000;
+    // returns at once if a publish has changed seq since we read it:
+    syscall(SYS_futex, &st->seq, FUTEX_WAIT_PRIVATE, seq, &left, NULL, 0);
+  }
+  __atomic_fetch_sub(&st->waiters, 1, __ATOMIC_RELAXED);
+
+  if (stamp) {
+    *stamp = t;
+  }
+  return frames;
+}
+
+void setJointCtrlCAN(const can_joint_ctrl *ctrl) {
+  jointCtrl = *ctrl;
+}
+
+// a physical value as a raw field value, rounded and clamped to [lo, hi]:
+static long to_raw(double v, double scale, long lo, long hi) {
+  long raw = lround(v/scale);
+
+  return raw < lo ? lo : raw > hi ? hi : raw;
+}
+
+// send a MOTOR_CMD frame, or a MOTOR_CMD_FD frame over CAN FD, that enables
+// all three motors; latest-value-wins, through its transmit slot:
+static int writeCmdToCAN(uint8_t mode, const int16_t *ref, uint8_t seq) {
+  struct canfd_frame writeFrame = {0};
+  canmsg_motor_cmd cmd = {mode, {1, 1, 1}, {ref[0], ref[1], ref[2]}, seq};
+  canmsg_motor_cmd_fd cmdFD = {mode, {1, 1, 1}, seq};
+  size_t size = CAN_MTU;
+  int i;
+
+  if (canFD) {
+    for (i = 0; i < 3; ++i) {
+      cmdFD.ref[i] = ref[i];
+      cmdFD.ff[i] = to_raw(jointCtrl.ff_Nm[i], CANMSG_MOTOR_CMD_FD_FF_SCALE, INT16_MIN, INT16_MAX);
+      cmdFD.kp[i] = to_raw(jointCtrl.kp[i], CANMSG_MOTOR_CMD_FD_KP_SCALE, 0, UINT16_MAX);
+      cmdFD.kd[i] = to_raw(jointCtrl.kd[i], CANMSG_MOTOR_CMD_FD_KD_SCALE, 0, UINT16_MAX);
     }
-    default: // CAN frame does not match any known IDs
-      fprintf(stderr,"The received CAN frame does not match any known IDs.\n");
-      // return 1;
+    writeFrame.can_id = CANMSG_MOTOR_CMD_FD_ID | (CANMSG_MOTOR_CMD_FD_EXT ? CAN_EFF_FLAG : 0);
+    writeFrame.len = CANMSG_MOTOR_CMD_FD_DLC;
+    writeFrame.flags = CANFD_BRS; // the data phase at the data bit rate
+    canmsg_motor_cmd_fd_pack(writeFrame.data, &cmdFD);
+    size = CANFD_MTU;
+  } else {
+    writeFrame.can_id = CANMSG_MOTOR_CMD_ID | (CANMSG_MOTOR_CMD_EXT ? CAN_EFF_FLAG : 0);
+    writeFrame.len = CANMSG_MOTOR_CMD_DLC;
+    canmsg_motor_cmd_pack(writeFrame.data, &cmd);
   }
-  pthread_mutex_unlock(&mutex1);
-  return ID;
+
+  return tx_submit(canFD ? CANMSG_MOTOR_CMD_FD : CANMSG_MOTOR_CMD, &writeFrame, size);
 }
 
 // write 3 reference joint positions to CAN:
-int writePosToCAN(double *pos_deg_arr) {
+int writePosToCAN(double *pos_deg_arr, uint8_t seq) {
   int16_t qa_deg10[3];
 
   // *pos_deg_arr is a pointer to an array of 3 joint positions, represented as doubles.
@@ -143,30 +596,11 @@ int writePosToCAN(double *pos_deg_arr) {
   qa_deg10[1] = ((int) 2700 + (10*pos_deg_arr[1]));
   qa_deg10[2] = ((int) 2700 + (10*pos_deg_arr[2]));
 
-  writeFrame.can_id = MOTOR_CMD_ID;
-  // set mode to position control and enable motors:
-  writeFrame.data[0] = (MODE_POS_CTRL | MOTOR_3_EN | MOTOR_2_EN | MOTOR_1_EN);
-  // set data bytes to reference positions:
-  writeFrame.data[1] = (qa_deg10[0] & 0x00FF);
-  writeFrame.data[2] = (qa_deg10[0] & 0xFF00) >> 8;
-  writeFrame.data[3] = (qa_deg10[1] & 0x00FF);
-  writeFrame.data[4] = (qa_deg10[1] & 0xFF00) >> 8;
-  writeFrame.data[5] = (qa_deg10[2] & 0x00FF);
-  writeFrame.data[6] = (qa_deg10[2] & 0xFF00) >> 8;
-
-  pthread_mutex_lock(&mutex1);
-  if ((nbytesW = write(s, &writeFrame, sizeof(writeFrame))) != sizeof(writeFrame)) {
-    perror("write");
-    pthread_mutex_unlock(&mutex1); // still have to unlock the mutex!
-    return 1;
-  }
-  pthread_mutex_unlock(&mutex1);
-
-  return 0;
+  return writeCmdToCAN(MODE_POS_CTRL, qa_deg10, seq);
 }
 
 // write 3 reference joint torques to CAN:
-int writeTrqToCAN(double *trq_Nm_arr) {
+int writeTrqToCAN(double *trq_Nm_arr, uint8_t seq) {
   int16_t qa_trq_mNm[3];
 
   // *trq_Nm_arr is a pointer to an array of 3 joint positions, represented as doubles.
@@ -177,24 +611,5 @@ int writeTrqToCAN(double *trq_Nm_arr) {
   qa_trq_mNm[1] = ((int) (1000*trq_Nm_arr[1]));
   qa_trq_mNm[2] = ((int) (1000*trq_Nm_arr[2]));
 
-  writeFrame.can_id = MOTOR_CMD_ID;
-  // set mode to torque control and enable motors:
-  writeFrame.data[0] = (MODE_TRQ_CTRL | MOTOR_3_EN | MOTOR_2_EN | MOTOR_1_EN);
-  // set data bytes to reference torques:
-  writeFrame.data[1] = (qa_trq_mNm[0] & 0x00FF);
-  writeFrame.data[2] = (qa_trq_mNm[0] & 0xFF00) >> 8;
-  writeFrame.data[3] = (qa_trq_mNm[1] & 0x00FF);
-  writeFrame.data[4] = (qa_trq_mNm[1] & 0xFF00) >> 8;
-  writeFrame.data[5] = (qa_trq_mNm[2] & 0x00FF);
-  writeFrame.data[6] = (qa_trq_mNm[2] & 0xFF00) >> 8;
-
-  pthread_mutex_lock(&mutex1);
-  if ((nbytesW = write(s, &writeFrame, sizeof(writeFrame))) != sizeof(writeFrame)) {
-    perror("write");
-    pthread_mutex_unlock(&mutex1); // still have to unlock the mutex!
-    return 1;
-  }
-  pthread_mutex_unlock(&mutex1);
-
-  return 0;
+  return writeCmdToCAN(MODE_TRQ_CTRL, qa_trq_mNm, seq);
 }
@@ -2,6 +2,26 @@
 #define __CAN_IO__H__
 // Header file for can_io.c
 // implements a CAN bus interface built on SocketCAN.
+//
+// The bus runs classic CAN or, if the interface supports it and it is asked
+// for, CAN FD (see initSocketCAN()). Over CAN FD one MOTOR_CMD_FD frame
+// carries all three joints' references with feedforward torques and gains
+// (setJointCtrlCAN()), and each motor answers with one MOTOR_n_STATE frame
+// holding its position, velocity, current and the time it was sampled;
+// over classic CAN the same calls send MOTOR_CMD and the motors answer with
+// MOTOR_n_POS (CAN/hopper.canmsg).
+//
+// Commands are sent latest-value-wins: each command message has one
+// transmit slot, and at most one of its frames is in the kernel or the
+// controller at a time. A command handed over while the last one is still
+// waiting for the bus takes its place in the slot (the older one is
+// superseded, never sent), and goes out as soon as the frame ahead has left.
+// So when the bus is busy the motors get the newest reference, at most one
+// tick late, instead of a backlog of stale ones queued in the qdisc. A frame
+// has left when the kernel hands it back to our socket (CAN_RAW_RECV_OWN_MSGS,
+// the echo flagged MSG_CONFIRM), which readCAN() handles; with drivers that
+// set IFF_ECHO (the PiCAN2's mcp251x) that is once the controller has sent
+// it, else (e.g. vcan) once the driver has taken it.
 
 #include <errno.h>          /* Error number definitions */
 #include <stdio.h>
@@ -15,42 +35,30 @@
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 
-#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
 
 #include <linux/can.h>
 #include <linux/can/raw.h>
 
+#include "canmsg.h"
 #include "linux-can-utils/lib.h"
 #include "per_threads.h"
+#include "rt_log.h"
 
-#define MOTOR_1_EN 0b00000010
-#define MOTOR_2_EN 0b00001000
-#define MOTOR_3_EN 0b00100000
-
+// MOTOR_CMD mode bit (all CAN IDs and payload layouts are in canmsg.h,
+// generated from CAN/hopper.canmsg):
 #define MODE_TRQ_CTRL 0
 #define MODE_POS_CTRL 1
 
-// CAN IDs:
-// TODO: make sure ID makes sense with message frequency
-#define MOTOR_CMD_ID 0x00000001 // TODO: finalize ID: 0
-#define MOTOR_1_POS_CAN_ID 0x00002001 // TODO: finalize ID: 2
-#define MOTOR_2_POS_CAN_ID 0x00003001 // TODO: finalize ID: 3
-#define MOTOR_3_POS_CAN_ID 0x00004001 // TODO: finalize ID: 4
-#define MOTOR_1_CUR_CAN_ID 5 // TODO: finalize ID: 5
-#define MOTOR_2_CUR_CAN_ID 6 // TODO: finalize ID: 6
-#define MOTOR_3_CUR_CAN_ID 7 // TODO: finalize ID: 7
-#define IMU_FZ_CAN_ID 8 // TODO: finalize ID: 8
-#define BOOM_ROLL_CAN_ID 9 // TODO: finalize ID: 9
-#define BOOM_PITCH_CAN_ID 10 // TODO: finalize ID: 10
-#define BOOM_YAW_CAN_ID 11 // TODO: finalize ID: 11
+#define CAN_RX_BATCH 16 // frames per recvmmsg() call
+#define CAN_RX_TIMEOUT_MS 100 // longest readCAN() waits for frames
+#define CAN_TX_SNDBUF 0 // socket send buffer, bytes (the kernel raises it to its minimum)
+#define CAN_TX_TIMEOUT_US 10000 // a frame not echoed by then is taken as lost
 
 int s; // can raw socket
-int nbytesR,nbytesW;
 struct sockaddr_can addr;
-struct can_frame writeFrame;
-struct can_frame readFrame;
 struct ifreq ifr;
-struct timeval tv; // used for read timeout
 
 typedef struct {
   int16_t qa_act[3];  // (actual) actuated joint angles
@@ -58,18 +66,108 @@ typedef struct {
   int16_t boom[3];    // boom angles
   int16_t accel;      // acceleration from IMU
   int16_t fz;         // force from force sensor
+  uint8_t cmdSeq[3];  // seq of the MOTOR_CMD each qa_act answers
+  int32_t qd_act[3];  // actuated joint speeds (CAN FD only)
+  uint32_t nodeTime[3]; // each motor node's clock when it sampled qa_act, us (CAN FD only)
 } can_input_struct;
 
-// set up CAN raw socket:
-int initSocketCAN(void);
+// Latest sensor data, shared by CAN_read_thread (the only writer) and its
+// readers through a sequence lock: a publish never waits, and a reader that
+// overlaps a publish simply copies again, so readers never block and always
+// get one consistent, timestamped snapshot. A reader may also sleep until
+// the motors have answered a given MOTOR_CMD (can_input_wait()): it waits on
+// seq as a futex, which a publish wakes only if someone is waiting.
+typedef struct {
+  uint32_t seq;           // odd while a publish is in progress
+  can_input_struct data;
+  struct timespec stamp;  // CLOCK_MONOTONIC time of the last publish
+  uint32_t frames;        // number of publishes so far
+  uint32_t waiters;       // threads in can_input_wait()
+} can_input_state;
+
+#define CAN_IFNAME "can0" // the bus; main.c takes $HOPPER_CAN instead if set (e.g.
+                          // vcan0, to run against hopper_sim)
+
+// set up CAN raw socket on interface ifname, with kernel filters for the IDs
+// readCAN() parses; with fd set, over CAN FD if ifname supports it (its MTU
+// is CANFD_MTU), else over classic CAN, with a warning. Returns 0 on success,
+// 1 on failure:
+int initSocketCAN(const char *ifname, int fd);
+
+// 1 if initSocketCAN() set up CAN FD, 0 for classic CAN:
+int canFDEnabled(void);
+
+// wait (at most CAN_RX_TIMEOUT_MS) for CAN frames, then read all pending
+// frames, parse them, and put their data into *ptr (fields of IDs not
+// received are left as they were); the echoes of our own commands complete
+// them, and send the commands waiting behind them. With frames read, *rx
+// (if rx is not NULL) is when the first of them reached the socket (the
+// kernel's time stamp), and *woke when the wait ended, both on
+// CLOCK_MONOTONIC. Returns the number of frames read, 0 on timeout, -1 on
+// error:
+int readCAN(can_input_struct *ptr, struct timespec *rx, struct timespec *woke);
+
+// parse one frame into *ptr, as readCAN() does with every frame it reads
+// (counted in can_rx_report()); lets can_replay feed logs to the parser
+// without a socket:
+void parseCAN(const struct can_frame *f, can_input_struct *ptr);
+
+// print the frames received per ID, and the number of readCAN() wake-ups
+// (call once the receiving thread has stopped):
+void can_rx_report(void);
+
+// publish data as the latest snapshot (one writer only):
+void can_input_publish(can_input_state *st, const can_input_struct *data);
+
+// copy the latest snapshot and its time stamp (stamp may be NULL);
+// returns the number of publishes so far, 0 if there has been none:
+uint32_t can_input_snapshot(can_input_state *st, can_input_struct *data, struct timespec *stamp);
+
+// like can_input_snapshot(), but first sleeps until all three motors have
+// answered the MOTOR_CMD with seq cmdSeq, sent at *sent (CLOCK_MONOTONIC),
+// or until timeout_us after *sent; returns 0 on timeout, with the latest
+// snapshot in *data all the same:
+uint32_t can_input_wait(can_input_state *st, uint8_t cmdSeq, const struct timespec *sent,
+  uint32_t timeout_us, can_input_struct *data, struct timespec *stamp);
+
+// Each MOTOR_CMD is also the SYNC of a control cycle: the motor nodes sample
+// their encoders as soon as it arrives and answer at once, echoing its seq
+// (see CAN/hopper.canmsg).
+
+// feedforward torques and PD gains of the motor nodes' controllers, sent
+// with every command over CAN FD; classic frames have no room for them, so
+// the nodes then use their own gains and no feedforward. All zero at first;
+// Control_thread sets the gains (JOINT_KP, JOINT_KD in main.c) before its
+// first command, and the feedforward (the trajectory's velocity) every cycle.
+typedef struct {
+  double ff_Nm[3];    // added to the controllers' output
+  double kp[3];       // Nm/rad; kp and kd both 0: the node's own gains
+  double kd[3];       // Nm*s/rad
+} can_joint_ctrl;
 
-// get data from CAN, parse it, and put it into a struct of type can_input_struct:
-int readCAN(can_input_struct *ptr);
+// sets the feedforward torques and gains sent from the next command on
+// (from the thread that sends the commands):
+void setJointCtrlCAN(const can_joint_ctrl *ctrl);
 
-int writePosToCAN(double *pos_deg_arr); // write 3 reference joint positions to CAN
+// write 3 reference joint positions to CAN, as cycle seq:
+int writePosToCAN(double *pos_deg_arr, uint8_t seq);
 
-int writeTrqToCAN(double *trq_Nm_arr); // write 3 reference joint torques to CAN
+// write 3 reference joint torques to CAN, as cycle seq:
+int writeTrqToCAN(double *trq_Nm_arr, uint8_t seq);
 
 int killMotors(void);
 
+// forget the command frames in flight, so the next command goes out at once
+// even if their echoes are never read (e.g. once the receiving thread has
+// stopped):
+void can_tx_reset(void);
+
+// time from handing each sent command over to its echo (written by the
+// receiving thread):
+const rt_hist *can_tx_wait_hist(void);
+
+// print the commands sent, superseded and lost (call once the sending and
+// receiving threads have stopped):
+void can_tx_report(void);
+
 #endif
@@ -0,0 +1,470 @@
+#define _GNU_SOURCE // recvmmsg
+#include "can_mon.h"
+
+#include <errno.h>
+#include <math.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can/error.h>
+#include <linux/can/raw.h>
+
+#include "rt_log.h"
+
+#ifndef CAN_ERR_CNT
+#define CAN_ERR_CNT 0x00000200U // TX/RX error counters in data[6]/data[7] (newer kernels)
+#endif
+
+#define NSEC_PER_SEC 1000000000LL
+
+// bits of a frame after the CRC, never stuffed: CRC delimiter, ACK slot,
+// ACK delimiter, 7 end of frame, 3 intermission:
+#define CAN_FRAME_TAIL_BITS 13
+#define CAN_FRAME_MAX_BITS 560 // dynamically stuffed part of a frame: 553 bits at most (extended FD, 64 bytes)
+
+// statistics of one message over the window:
+typedef struct {
+  uint32_t frames;
+  uint32_t gaps;      // inter-arrival times, in mean and m2
+  double mean, m2;    // of the inter-arrival times, ns (Welford)
+  int64_t maxGap;     // ns
+  int64_t last;       // time of the last frame (kept across windows), 0: none yet
+} can_mon_msg_stats;
+
+// run totals, for can_mon_report():
+typedef struct {
+  uint64_t frames, errFrames;
+  uint32_t busOff, busErrors, noAck, lostArb, overflows, drops;
+  float maxLoad, maxPeakLoad;
+  uint8_t worstState;
+  uint32_t msgFrames[CANMSG_COUNT];
+  float maxJitter_us[CANMSG_COUNT];
+  uint32_t maxGap_us[CANMSG_COUNT];
+} can_mon_totals;
+
+// touched by the polling thread only:
+static struct {
+  int fd;                 // -1 if not open
+  uint32_t bitrate, dataBitrate;
+  uint32_t window;        // windows closed so far
+  int64_t windowStart;    // CLOCK_REALTIME, ns (as the kernel's time stamps)
+  double bits;            // on the wire, in the window (at the nominal bit rate)
+  uint32_t frames, other;
+  int64_t slice;          // the CAN_MON_SLICE_US slice being summed, by number
+  double sliceBits, peakBits;
+  uint32_t lastDrops;     // the kernel's drop count (SO_RXQ_OVFL), at the last frame
+  can_mon_summary sum;    // the error state and counts of the window so far
+  can_mon_msg_stats msg[CANMSG_COUNT];
+  can_mon_totals total;
+} mon = {.fd = -1};
+
+/******************************************************************************
+* Bits on the wire
+******************************************************************************/
+
+// CRC-15 of CAN over bits[0..n):
+static uint16_t can_crc15(const uint8_t *bits, int n) {
+  uint16_t crc = 0;
+  int i;
+
+  for (i = 0; i < n; ++i) {
+    if (bits[i] ^ ((crc >> 14) & 1)) {
+      crc = ((crc << 1) ^ 0x4599) & 0x7FFF;
+    } else {
+      crc = (crc << 1) & 0x7FFF;
+    }
+  }
+  return crc;
+}
+
+// appends the nbits low bits of v to bits[*n], most significant first:
+static void put_bits(uint8_t *bits, int *n, uint32_t v, int nbits) {
+  while (nbits--) {
+    bits[(*n)++] = (v >> nbits) & 1;
+  }
+}
+
+// the length a CAN FD DLC codes for, for a frame of len bytes (the kernel
+// pads the others up to it):
+static int canfd_padded_len(int len) {
+  static const uint8_t lens[] = {12, 16, 20, 24, 32, 48, 64};
+  int i;
+
+  for (i = 0; len > 8 && i < (int)sizeof(lens) - 1 && lens[i] < len; ++i);
+  return len > 8 ? lens[i] : len;
+}
+
+// the DLC that codes a CAN FD frame of len bytes (a padded length):
+static int canfd_dlc(int len) {
+  return len <= 8 ? len : len <= 24 ? 8 + (len - 8)/4 : len == 32 ? 13 : len == 48 ? 14 : 15;
+}
+
+double can_frame_bits(const struct canfd_frame *f, int fd, double dataSpeedup) {
+  uint8_t bits[CAN_FRAME_MAX_BITS];
+  uint8_t last = 0;
+  int n = 0, i, run = 0, stuff = 0, dataStuff = 0, dataFrom, fixed;
+  int rtr = !fd && (f->can_id & CAN_RTR_FLAG);
+  int len = fd ? canfd_padded_len(f->len) : f->len > 8 ? 8 : f->len;
+  double nominal, data;
+
+  put_bits(bits, &n, 0, 1); // start of frame
+  if (f->can_id & CAN_EFF_FLAG) {
+    put_bits(bits, &n, (f->can_id & CAN_EFF_MASK) >> 18, 11); // base ID
+    put_bits(bits, &n, 3, 2);                                 // SRR, IDE
+    put_bits(bits, &n, f->can_id & 0x3FFFF, 18);              // ID extension
+    put_bits(bits, &n, rtr, 1);                               // RTR (FD: RRS)
+    put_bits(bits, &n, fd ? 2 : 0, 2);                        // r1, r0 (FD: FDF, res)
+  } else {
+    put_bits(bits, &n, f->can_id & CAN_SFF_MASK, 11);
+    put_bits(bits, &n, rtr, 1);                               // RTR (FD: RRS)
+    put_bits(bits, &n, fd ? 1 : 0, 2);                        // IDE, r0 (FD: IDE, FDF)
+    if (fd) {
+      put_bits(bits, &n, 0, 1);                               // res
+    }
+  }
+  if (fd) {
+    put_bits(bits, &n, (f->flags & CANFD_BRS) != 0, 1);
+  }
+  dataFrom = n; // from here on, the data phase of an FD frame with BRS
+  if (fd) {
+    put_bits(bits, &n, (f->flags & CANFD_ESI) != 0, 1);
+  }
+  put_bits(bits, &n, fd ? canfd_dlc(len) : len, 4);
+  for (i = 0; !rtr && i < len; ++i) {
+    put_bits(bits, &n, f->data[i], 8);
+  }
+  if (!fd) {
+    put_bits(bits, &n, can_crc15(bits, n), 15);
+  }
+
+  // after five equal bits the sender adds one of the other value, which
+  // starts the next run:
+  for (i = 0; i < n; ++i) {
+    run = (i && bits[i] == last) ? run + 1 : 1;
+    last = bits[i];
+    if (run == 5) {
+      ++stuff;
+      dataStuff += i >= dataFrom;
+      last = !last;
+      run = 1;
+    }
+  }
+
+  if (!fd) {
+    return n + stuff + CAN_FRAME_TAIL_BITS;
+  }
+  // CAN FD: then the stuff count (4 bits) and the CRC (17 bits up to 16
+  // data bytes, else 21), stuffed with a fixed bit before every 4 bits:
+  fixed = 4 + (len <= 16 ? 17 : 21);
+  fixed += (fixed + 3)/4;
+  nominal = dataFrom + stuff - dataStuff + CAN_FRAME_TAIL_BITS;
+  data = n - dataFrom + dataStuff + fixed;
+  return (f->flags & CANFD_BRS) ? nominal + data/dataSpeedup : nominal + data;
+}
+
+const char *can_mon_state_name(uint8_t state) {
+  switch (state) {
+    case CAN_MON_ERROR_ACTIVE: return "active";
+    case CAN_MON_ERROR_WARNING: return "warning";
+    case CAN_MON_ERROR_PASSIVE: return "passive";
+    case CAN_MON_BUS_OFF: return "bus-off";
+  }
+  return "?";
+}
+
+/******************************************************************************
+* Monitor
+******************************************************************************/
+static int64_t realtime_ns(void) {
+  struct timespec t;
+
+  clock_gettime(CLOCK_REALTIME, &t);
+  return (int64_t)t.tv_sec*NSEC_PER_SEC + t.tv_nsec;
+}
+
+int can_mon_init(const char *ifname, uint32_t bitrate, uint32_t dataBitrate) {
+  struct sockaddr_can addr = {0};
+  struct ifreq ifr;
+  can_err_mask_t errMask = CAN_ERR_MASK;
+  int on = 1, rcvbuf = CAN_MON_RCVBUF;
+
+  memset(&mon, 0, sizeof(mon));
+  mon.fd = -1;
+  mon.bitrate = bitrate;
+  mon.dataBitrate = dataBitrate;
+
+  if ((mon.fd = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
+    perror("can_mon: socket");
+    return 1;
+  }
+  snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+  if (ioctl(mon.fd, SIOCGIFINDEX, &ifr) < 0) {
+    perror("can_mon: SIOCGIFINDEX");
+    can_mon_close();
+    return 1;
+  }
+  addr.can_family = AF_CAN;
+  addr.can_ifindex = ifr.ifr_ifindex;
+
+  // no CAN_RAW_FILTER: the default lets every data frame through; CAN FD
+  // frames too, if the interface does CAN FD:
+  setsockopt(mon.fd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &on, sizeof(on));
+  setsockopt(mon.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  if (setsockopt(mon.fd, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &errMask, sizeof(errMask)) < 0 ||
+      setsockopt(mon.fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0 ||
+      setsockopt(mon.fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) < 0) {
+    perror("can_mon: setsockopt");
+    can_mon_close();
+    return 1;
+  }
+  if (bind(mon.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("can_mon: bind");
+    can_mon_close();
+    return 1;
+  }
+
+  mon.windowStart = realtime_ns();
+  return 0;
+}
+
+static void can_mon_set_state(uint8_t state) {
+  mon.sum.state = state;
+  if (state > mon.sum.worstState) {
+    mon.sum.worstState = state;
+  }
+}
+
+// an error frame (see linux/can/error.h):
+static void can_mon_error(const struct can_frame *f) {
+  uint8_t ctrl = f->data[1];
+
+  ++mon.sum.errFrames;
+  if (f->can_id & CAN_ERR_LOSTARB) {
+    ++mon.sum.lostArb;
+  }
+  if (f->can_id & CAN_ERR_ACK) {
+    ++mon.sum.noAck;
+  }
+  if (f->can_id & (CAN_ERR_PROT | CAN_ERR_BUSERROR)) {
+    ++mon.sum.busErrors;
+  }
+  if (f->can_id & CAN_ERR_CRTL) {
+    if (ctrl & (CAN_ERR_CRTL_RX_OVERFLOW | CAN_ERR_CRTL_TX_OVERFLOW)) {
+      ++mon.sum.overflows;
+    }
+    if (ctrl & (CAN_ERR_CRTL_RX_PASSIVE | CAN_ERR_CRTL_TX_PASSIVE)) {
+      can_mon_set_state(CAN_MON_ERROR_PASSIVE);
+    } else if (ctrl & (CAN_ERR_CRTL_RX_WARNING | CAN_ERR_CRTL_TX_WARNING)) {
+      can_mon_set_state(CAN_MON_ERROR_WARNING);
+    } else if (ctrl & CAN_ERR_CRTL_ACTIVE) {
+      can_mon_set_state(CAN_MON_ERROR_ACTIVE);
+    }
+  }
+  if (f->can_id & CAN_ERR_CNT) {
+    mon.sum.txErr = f->data[6];
+    mon.sum.rxErr = f->data[7];
+  }
+  if (f->can_id & CAN_ERR_BUSOFF) {
+    ++mon.sum.busOff;
+    can_mon_set_state(CAN_MON_BUS_OFF);
+  }
+  if (f->can_id & CAN_ERR_RESTARTED) {
+    ++mon.sum.restarts;
+    can_mon_set_state(CAN_MON_ERROR_ACTIVE);
+  }
+}
+
+// a data frame (fd: a CAN FD frame), received at t (CLOCK_REALTIME, ns):
+static void can_mon_frame(const struct canfd_frame *f, int fd, int64_t t) {
+  double bits = can_frame_bits(f, fd, (double)mon.dataBitrate/mon.bitrate);
+  int64_t slice = t/(CAN_MON_SLICE_US*1000LL), gap;
+  can_mon_msg_stats *m;
+  double d;
+  int i;
+
+  mon.bits += bits;
+  ++mon.frames;
+  if (slice != mon.slice) {
+    mon.slice = slice;
+    mon.sliceBits = 0;
+  }
+  mon.sliceBits += bits;
+  if (mon.sliceBits > mon.peakBits) {
+    mon.peakBits = mon.sliceBits;
+  }
+
+  if ((i = canmsg_find(f->can_id & (CAN_EFF_FLAG | CAN_EFF_MASK))) < 0) {
+    ++mon.other;
+    return;
+  }
+  m = &mon.msg[i];
+  ++m->frames;
+  if (m->last && (gap = t - m->last) >= 0) {
+    d = gap - m->mean;
+    m->mean += d/++m->gaps;
+    m->m2 += d*(gap - m->mean);
+    if (gap > m->maxGap) {
+      m->maxGap = gap;
+    }
+  }
+  m->last = t;
+}
+
+// closes the window at now into *sum, and starts the next:
+static void can_mon_close_window(int64_t now, can_mon_summary *sum) {
+  double seconds = (now - mon.windowStart)*1e-9;
+  can_mon_msg_stats *m;
+  can_mon_totals *tot = &mon.total;
+  int64_t last;
+  int i;
+
+  *sum = mon.sum;
+  sum->window = ++mon.window;
+  sum->seconds = seconds;
+  sum->load = mon.bits/(seconds*mon.bitrate);
+  sum->peakLoad = mon.peakBits/(CAN_MON_SLICE_US*1e-6*mon.bitrate);
+  sum->frames = mon.frames;
+  sum->otherHz = mon.other/seconds;
+  for (i = 0; i < CANMSG_COUNT; ++i) {
+    m = &mon.msg[i];
+    sum->msg[i].hz = m->frames/seconds;
+    sum->msg[i].jitter_us = m->gaps ? sqrt(m->m2/m->gaps)*1e-3 : 0;
+    sum->msg[i].maxGap_us = m->maxGap/1000;
+
+    tot->msgFrames[i] += m->frames;
+    if (sum->msg[i].jitter_us > tot->maxJitter_us[i]) tot->maxJitter_us[i] = sum->msg[i].jitter_us;
+    if (sum->msg[i].maxGap_us > tot->maxGap_us[i]) tot->maxGap_us[i] = sum->msg[i].maxGap_us;
+    last = m->last;
+    memset(m, 0, sizeof(*m));
+    m->last = last;
+  }
+
+  tot->frames += sum->frames;
+  tot->errFrames += sum->errFrames;
+  tot->busOff += sum->busOff;
+  tot->busErrors += sum->busErrors;
+  tot->noAck += sum->noAck;
+  tot->lostArb += sum->lostArb;
+  tot->overflows += sum->overflows;
+  tot->drops += sum->drops;
+  if (sum->load > tot->maxLoad) tot->maxLoad = sum->load;
+  if (sum->peakLoad > tot->maxPeakLoad) tot->maxPeakLoad = sum->peakLoad;
+  if (sum->worstState > tot->worstState) tot->worstState = sum->worstState;
+
+  // the error state and counters carry over; the counts start again:
+  memset(&mon.sum, 0, sizeof(mon.sum));
+  mon.sum.state = mon.sum.worstState = sum->state;
+  mon.sum.txErr = sum->txErr;
+  mon.sum.rxErr = sum->rxErr;
+  mon.bits = 0;
+  mon.frames = mon.other = 0;
+  mon.peakBits = mon.sliceBits; // the current slice goes on into the next window
+  mon.windowStart = now;
+}
+
+int can_mon_poll(can_mon_summary *sum) {
+  struct canfd_frame frames[CAN_MON_BATCH];
+  struct mmsghdr msgs[CAN_MON_BATCH];
+  struct iovec iov[CAN_MON_BATCH];
+  union {
+    char buf[CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t))];
+    struct cmsghdr align;
+  } ctrl[CAN_MON_BATCH];
+  struct cmsghdr *cm;
+  struct timespec ts;
+  uint32_t drops;
+  int64_t t, now;
+  int i, n;
+
+  if (mon.fd < 0) {
+    return 0;
+  }
+
+  do {
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < CAN_MON_BATCH; ++i) {
+      iov[i].iov_base = &frames[i];
+      iov[i].iov_len = sizeof(frames[i]);
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_control = ctrl[i].buf;
+      msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i].buf);
+    }
+    if ((n = recvmmsg(mon.fd, msgs, CAN_MON_BATCH, MSG_DONTWAIT, NULL)) < 0) {
+      if (errno != EAGAIN && errno != EINTR) {
+        rt_log("can_mon: recvmmsg failed: errno %d\n",errno);
+      }
+      break;
+    }
+
+    for (i = 0; i < n; ++i) {
+      t = 0;
+      for (cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cm; cm = CMSG_NXTHDR(&msgs[i].msg_hdr, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET) {
+          continue;
+        }
+        if (cm->cmsg_type == SCM_TIMESTAMPNS) {
+          memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+          t = (int64_t)ts.tv_sec*NSEC_PER_SEC + ts.tv_nsec;
+        } else if (cm->cmsg_type == SO_RXQ_OVFL) {
+          memcpy(&drops, CMSG_DATA(cm), sizeof(drops));
+          mon.sum.drops += drops - mon.lastDrops;
+          mon.lastDrops = drops;
+        }
+      }
+      if (!t) { // no kernel time stamp: take ours
+        t = realtime_ns();
+      }
+
+      if (frames[i].can_id & CAN_ERR_FLAG) {
+        can_mon_error((const struct can_frame *)&frames[i]);
+      } else {
+        can_mon_frame(&frames[i], msgs[i].msg_len == CANFD_MTU, t);
+      }
+    }
+  } while (n == CAN_MON_BATCH);
+
+  now = realtime_ns();
+  if (now - mon.windowStart < CAN_MON_WINDOW_MS*1000000LL) {
+    return 0;
+  }
+  can_mon_close_window(now, sum);
+  return 1;
+}
+
+void can_mon_report(void) {
+  const can_mon_totals *tot = &mon.total;
+  int i;
+
+  if (!mon.window) {
+    printf("CAN monitor: no full window\n");
+    return;
+  }
+  printf("CAN monitor: %u windows of %d ms at %u bit/s (FD data %u bit/s), load at most %.1f%% "
+    "(%.1f%% over %d us), worst state %s\n",
+    mon.window,CAN_MON_WINDOW_MS,mon.bitrate,mon.dataBitrate,100*tot->maxLoad,100*tot->maxPeakLoad,
+    CAN_MON_SLICE_US,can_mon_state_name(tot->worstState));
+  printf("%16s %10s %14s %14s\n","message","frames","jitter (us)","max gap (us)");
+  for (i = 0; i < CANMSG_COUNT; ++i) {
+    if (tot->msgFrames[i]) {
+      printf("%16s %10u %14.1f %14u\n",canmsg_table[i].name,tot->msgFrames[i],
+        tot->maxJitter_us[i],tot->maxGap_us[i]);
+    }
+  }
+  printf("%llu frames, %llu error frames: %u bus-off, %u bus errors, %u unacknowledged, "
+    "%u arbitration lost, %u controller overflows; %u dropped by the kernel\n",
+    (unsigned long long)tot->frames,(unsigned long long)tot->errFrames,tot->busOff,
+    tot->busErrors,tot->noAck,tot->lostArb,tot->overflows,tot->drops);
+}
+
+void can_mon_close(void) {
+  if (mon.fd >= 0) {
+    close(mon.fd);
+    mon.fd = -1;
+  }
+}
@@ -0,0 +1,102 @@
+#ifndef __CAN_MON__H__
+#define __CAN_MON__H__
+// Header file for can_mon.c
+// Implements a CAN bus load and health monitor.
+//
+// The monitor has a CAN socket of its own, without filters, so it sees every
+// frame on the bus: the Tivas', the frames the Pi sends (the kernel loops
+// them back to the other sockets) and the controller's error frames
+// (CAN_ERR_FLAG). It is polled from a low-priority thread, which drains the
+// socket with recvmmsg(); the kernel time stamps each frame (SO_TIMESTAMPNS)
+// as it arrives, so the statistics do not depend on when it is polled.
+//
+// For every window of CAN_MON_WINDOW_MS it computes:
+// - the bus load: the time each frame took on the wire, stuff bits
+//   included (can_frame_bits()), over the window; CAN FD frames count their
+//   data phase at the data bit rate. And the peak load over any
+//   CAN_MON_SLICE_US slice, as bursts fill the bus before the average does;
+// - per message of canmsg_table, i.e. per sending node: its rate, and the
+//   jitter (standard deviation) and longest gap of its inter-arrival times;
+// - the controller's error state (active, warning, passive, bus-off), its
+//   error counters when the driver reports them, and counts of the error
+//   frames by kind.
+//
+// The load counts data frames only; the bits of error frames and of
+// retransmissions after them are not seen, so under errors the real load is
+// higher.
+
+#include <stdint.h>
+
+#include <linux/can.h>
+
+#include "canmsg.h"
+
+#define CAN_MON_BITRATE 1000000   // can0's bit rate (set by "ip link ... bitrate")
+#define CAN_MON_DATA_BITRATE 5000000 // its CAN FD data bit rate ("ip link ... dbitrate")
+#define CAN_MON_WINDOW_MS 1000    // statistics window
+#define CAN_MON_SLICE_US 10000    // slice of the peak load
+#define CAN_MON_LOAD_WARN 0.7     // load above which the bus is close to full
+#define CAN_MON_BATCH 32          // frames per recvmmsg() call (of CANFD_MTU bytes)
+#define CAN_MON_RCVBUF (256*1024) // socket receive buffer, bytes
+
+// controller error states, as the error frames report them:
+enum {
+  CAN_MON_ERROR_ACTIVE,
+  CAN_MON_ERROR_WARNING,  // an error counter reached 96
+  CAN_MON_ERROR_PASSIVE,  // an error counter reached 128
+  CAN_MON_BUS_OFF         // transmit errors reached 256: the node is off the bus
+};
+
+typedef struct {
+  float hz;           // frames per second
+  float jitter_us;    // standard deviation of the time between frames
+  uint32_t maxGap_us; // longest time between frames (0: fewer than two frames)
+} can_mon_msg;
+
+typedef struct {
+  uint32_t window;       // windows so far, this one included
+  float seconds;         // length of the window
+  float load;            // fraction of the bus's bit time taken by frames
+  float peakLoad;        // highest load over a CAN_MON_SLICE_US slice
+  uint32_t frames;       // data frames
+  uint32_t drops;        // frames the kernel dropped from the monitor's socket
+  uint8_t state;         // error state at the end of the window (CAN_MON_ERROR_...)
+  uint8_t worstState;    // worst error state during the window
+  uint8_t txErr, rxErr;  // controller error counters (0 if the driver does not report them)
+  uint32_t errFrames;    // error frames, of any kind
+  uint32_t busOff;       // bus-off events
+  uint32_t restarts;     // restarts after bus-off
+  uint32_t busErrors;    // protocol violations (bit, stuff, form, CRC errors)
+  uint32_t noAck;        // frames nobody acknowledged
+  uint32_t lostArb;      // arbitration lost
+  uint32_t overflows;    // controller receive/transmit buffer overflows
+  can_mon_msg msg[CANMSG_COUNT]; // by index in canmsg_table
+  float otherHz;         // frames with IDs not in canmsg_table
+} can_mon_summary;
+
+// opens the monitor's socket on interface ifname, with the bus running at
+// bitrate bit/s, and the data phase of CAN FD frames at dataBitrate bit/s;
+// returns 0 on success, 1 on failure:
+int can_mon_init(const char *ifname, uint32_t bitrate, uint32_t dataBitrate);
+
+// reads all pending frames; once a window has passed, returns 1 with its
+// statistics in *sum and starts the next, else returns 0 (also if
+// can_mon_init() failed):
+int can_mon_poll(can_mon_summary *sum);
+
+// prints the totals over all windows (call once the polling thread has
+// stopped):
+void can_mon_report(void);
+
+void can_mon_close(void);
+
+// the time frame f takes on the bus, in bits at the nominal bit rate, from
+// its start of frame to the end of the intermission after it, with the
+// stuff bits it needs. With fd, f is a CAN FD frame; if it has CANFD_BRS,
+// its data phase runs dataSpeedup times faster (the data bit rate over the
+// nominal one):
+double can_frame_bits(const struct canfd_frame *f, int fd, double dataSpeedup);
+
+const char *can_mon_state_name(uint8_t state);
+
+#endif
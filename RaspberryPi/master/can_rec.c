@@ -0,0 +1,237 @@
+// can_rec.c
+// CAN flight recorder: writes every frame on the bus to a CAN log (canlog.h).
+//
+// usage: ./can_rec [-i interface] [-t seconds] [-c cpu] log file
+//
+// Records all frames (no filters, error frames included, and the frames the
+// Pi program sends, which the kernel loops back to other sockets) with
+// their kernel receive times (SO_TIMESTAMP), draining the socket
+// CAN_REC_BATCH frames per recvmmsg() call. Frames the kernel had to drop
+// because we fell behind (SO_RXQ_OVFL) are counted, and the next record is
+// flagged CANLOG_OVERFLOW. Stops after -t seconds or on Ctrl+C. CAN FD
+// frames are not recorded: a log record holds 8 data bytes.
+//
+// The kernel stamps frames on the wall clock, which NTP may step at any
+// time (the Pi has no RTC, and often syncs minutes into a run); the log
+// keeps times on CLOCK_MONOTONIC instead, each frame's stamp taken as its
+// age (on the wall clock) when we read it, clamped so that times never go
+// backwards or ahead of the read.
+//
+// Run it next to main.a on the Pi, ideally pinned (-c) to a core the
+// real-time threads do not use; replay the log with can_replay.
+//
+// compile with
+// make can_rec
+
+#define _GNU_SOURCE // recvmmsg
+#include <errno.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/error.h>
+#include <linux/can/raw.h>
+
+#include "canlog.h"
+
+#define CAN_REC_BATCH 32
+#define CAN_REC_RCVBUF (1 << 20) // socket receive buffer, bytes
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+static int64_t clock_us(clockid_t clock) {
+  struct timespec ts;
+
+  clock_gettime(clock, &ts);
+  return (int64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static int open_can(const char *ifname) {
+  struct sockaddr_can addr = {0};
+  struct ifreq ifr;
+  can_err_mask_t errMask = CAN_ERR_MASK;
+  int s, on = 1, rcvbuf = CAN_REC_RCVBUF;
+
+  if ((s = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
+    perror("socket");
+    return -1;
+  }
+  snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+  if (ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
+    perror(ifname);
+    close(s);
+    return -1;
+  }
+  addr.can_family = AF_CAN;
+  addr.can_ifindex = ifr.ifr_ifindex;
+
+  setsockopt(s, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &errMask, sizeof(errMask));
+  setsockopt(s, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  if (setsockopt(s, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on)) < 0 ||
+      setsockopt(s, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) < 0) {
+    perror("setsockopt");
+    close(s);
+    return -1;
+  }
+  if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("bind");
+    close(s);
+    return -1;
+  }
+  return s;
+}
+
+int main(int argc, char **argv) {
+  const char *ifname = "can0";
+  double duration = 0;
+  int opt, cpu = -1, s, i, n, rc = 0;
+  struct can_frame frames[CAN_REC_BATCH];
+  struct mmsghdr msgs[CAN_REC_BATCH];
+  struct iovec iov[CAN_REC_BATCH];
+  union {
+    char buf[CMSG_SPACE(sizeof(struct timeval)) + CMSG_SPACE(sizeof(uint32_t))];
+    struct cmsghdr align;
+  } ctrl[CAN_REC_BATCH];
+  struct pollfd pfd;
+  struct cmsghdr *cm;
+  struct timeval tv;
+  canlog_writer w;
+  int64_t start, mono0, rtNow, now, t, lastT = 0, endAt = 0;
+  uint32_t kernelDrops = 0, drops, lastDrops = 0;
+  uint64_t errFrames = 0;
+  uint8_t flags;
+  cpu_set_t cpus;
+
+  while ((opt = getopt(argc, argv, "i:t:c:h")) != -1) {
+    switch (opt) {
+      case 'i': ifname = optarg; break;
+      case 't': duration = atof(optarg); break;
+      case 'c': cpu = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-i interface] [-t seconds] [-c cpu] log file\n", argv[0]);
+        return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "usage: %s [-i interface] [-t seconds] [-c cpu] log file\n", argv[0]);
+    return 1;
+  }
+  if (cpu >= 0) {
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+      perror("sched_setaffinity");
+    }
+  }
+
+  if ((s = open_can(ifname)) < 0) {
+    return 1;
+  }
+  start = clock_us(CLOCK_REALTIME);
+  mono0 = clock_us(CLOCK_MONOTONIC);
+  if (duration > 0) {
+    endAt = (int64_t)(duration*1e6);
+  }
+  if (canlog_create(&w, argv[optind], start, ifname)) {
+    close(s);
+    return 1;
+  }
+  signal(SIGINT, &on_signal);
+  signal(SIGTERM, &on_signal);
+  printf("recording %s to %s\n", ifname, argv[optind]);
+
+  pfd.fd = s;
+  pfd.events = POLLIN;
+  while (!stop) {
+    if (poll(&pfd, 1, 100) <= 0) {
+      if (endAt && clock_us(CLOCK_MONOTONIC) - mono0 >= endAt) {
+        break;
+      }
+      continue;
+    }
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < CAN_REC_BATCH; ++i) {
+      iov[i].iov_base = &frames[i];
+      iov[i].iov_len = sizeof(frames[i]);
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_control = ctrl[i].buf;
+      msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i].buf);
+    }
+    if ((n = recvmmsg(s, msgs, CAN_REC_BATCH, MSG_DONTWAIT, NULL)) < 0) {
+      if (errno == EAGAIN || errno == EINTR) {
+        continue;
+      }
+      perror("recvmmsg");
+      rc = 1;
+      break;
+    }
+    rtNow = clock_us(CLOCK_REALTIME);
+    now = clock_us(CLOCK_MONOTONIC) - mono0;
+
+    for (i = 0; i < n; ++i) {
+      t = now; // without a kernel time stamp
+      flags = 0;
+      for (cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cm; cm = CMSG_NXTHDR(&msgs[i].msg_hdr, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET) {
+          continue;
+        }
+        if (cm->cmsg_type == SCM_TIMESTAMP) {
+          memcpy(&tv, CMSG_DATA(cm), sizeof(tv));
+          t = now - (rtNow - ((int64_t)tv.tv_sec*1000000 + tv.tv_usec));
+        } else if (cm->cmsg_type == SO_RXQ_OVFL) {
+          memcpy(&drops, CMSG_DATA(cm), sizeof(drops));
+          if (drops != lastDrops) {
+            kernelDrops += drops - lastDrops;
+            lastDrops = drops;
+            flags |= CANLOG_OVERFLOW;
+          }
+        }
+      }
+      if (t > now) {
+        t = now;
+      } else if (t < lastT) {
+        t = lastT;
+      }
+      lastT = t;
+      if (frames[i].can_id & CAN_ERR_FLAG) {
+        ++errFrames;
+      }
+      if (canlog_append(&w, t, &frames[i], flags)) {
+        perror("can_rec: writing the log");
+        stop = 1;
+        rc = 1;
+        break;
+      }
+      if (endAt && t >= endAt) {
+        stop = 1;
+      }
+    }
+  }
+
+  if (canlog_close(&w)) {
+    perror("can_rec: closing the log");
+    rc = 1;
+  }
+  close(s);
+  printf("%llu frames recorded (%llu error frames), %u dropped by the kernel\n",
+    (unsigned long long)w.records, (unsigned long long)errFrames, kernelDrops);
+  return rc;
+}
@@ -0,0 +1,270 @@
+// can_replay.c
+// Replays a CAN log written by can_rec (canlog.h).
+//
+// usage: ./can_replay [-i interface] [-x speed] [-s from s] [-e to s] [-a]
+//                     [-p [-o csv file] [-c period ms]] log file
+//
+// Sends the logged frames on a (virtual) CAN interface, default vcan0, with
+// their logged timing scaled by -x: 1 (default) for real time, N for N times
+// faster, 0 for as fast as the interface takes them. Error frames are never
+// replayed, nor, unless -a is given, the Pi's own MOTOR_CMD and MOTOR_CMD_FD
+// frames (so main.a can run against vcan0 and send its own). -s and -e
+// select a part of the log, in seconds since its start, through its
+// per-second index.
+//
+// -p feeds the frames straight to parseCAN() (can_io.c), the parser behind
+// readCAN(), without a socket, by default as fast as it goes (-x to pace
+// it), and prints the frames parsed per message and the parse time per
+// frame. With -o, it writes the parsed sensor state (can_input_struct)
+// every -c ms of log time (default 2, the control period) as CSV, for
+// running the estimation and control code offline on real hops.
+//
+// compile with
+// make can_replay
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <net/if.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include "can_io.h"
+#include "canlog.h"
+
+#define NSEC_PER_SEC 1000000000LL
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+static int64_t now_ns(void) {
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (int64_t)t.tv_sec*NSEC_PER_SEC + t.tv_nsec;
+}
+
+// sleeps until CLOCK_MONOTONIC time at (ns):
+static void sleep_until(int64_t at) {
+  struct timespec t = {at/NSEC_PER_SEC, at%NSEC_PER_SEC};
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR && !stop);
+}
+
+static int open_can(const char *ifname) {
+  struct sockaddr_can sa = {0};
+  struct ifreq ir;
+  int fd;
+
+  if ((fd = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
+    perror("socket");
+    return -1;
+  }
+  snprintf(ir.ifr_name, sizeof(ir.ifr_name), "%s", ifname);
+  if (ioctl(fd, SIOCGIFINDEX, &ir) < 0) {
+    perror(ifname);
+    close(fd);
+    return -1;
+  }
+  sa.can_family = AF_CAN;
+  sa.can_ifindex = ir.ifr_ifindex;
+  setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0); // send only
+  if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+    perror("bind");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// sends f, waiting while the interface's queue is full; returns 0 on success:
+static int send_frame(int fd, const struct can_frame *f, uint64_t *waits) {
+  struct pollfd pfd = {fd, POLLOUT, 0};
+
+  while (write(fd, f, sizeof(*f)) != sizeof(*f)) {
+    if (errno != ENOBUFS && errno != EAGAIN && errno != EINTR) {
+      return 1;
+    }
+    ++*waits;
+    poll(&pfd, 1, 10);
+    if (stop) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// the cost of a now_ns() call (the least of many), taken off the parse times:
+static int64_t clock_cost(void) {
+  int64_t a, b, best = NSEC_PER_SEC;
+  int k;
+
+  for (k = 0; k < 1000; ++k) {
+    a = now_ns();
+    b = now_ns();
+    if (b - a < best) best = b - a;
+  }
+  return best;
+}
+
+static void write_csv(FILE *csv, double t, const can_input_struct *in) {
+  fprintf(csv, "%.6f,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\n", t,
+    in->qa_act[0], in->qa_act[1], in->qa_act[2], in->ia[0], in->ia[1], in->ia[2],
+    in->boom[0], in->boom[1], in->boom[2], in->accel, in->fz);
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-i interface] [-x speed] [-s from s] [-e to s] [-a]\n"
+    "       %*s [-p [-o csv file] [-c period ms]] log file\n", prog, (int)strlen(prog), "");
+}
+
+int main(int argc, char **argv) {
+  const char *ifname = "vcan0", *csvPath = NULL;
+  double speed = 1, period = 2;
+  int opt, parse = 0, all = 0, paced = 0, fd = -1, rc = 0;
+  uint32_t from = 0, to = UINT32_MAX, key;
+  uint64_t i, first, last, sent = 0, skipped = 0, overflows = 0, waits = 0;
+  int64_t wall0, t0, at, parseNs = 0, nextSample = 0, run, clockNs = 0;
+  const canlog_rec *rec;
+  struct can_frame f;
+  can_input_struct in;
+  canlog_reader r;
+  FILE *csv = NULL;
+
+  while ((opt = getopt(argc, argv, "i:x:s:e:apo:c:h")) != -1) {
+    switch (opt) {
+      case 'i': ifname = optarg; break;
+      case 'x': speed = atof(optarg); paced = 1; break;
+      case 's': from = strtoul(optarg, NULL, 0); break;
+      case 'e': to = strtoul(optarg, NULL, 0); break;
+      case 'a': all = 1; break;
+      case 'p': parse = 1; break;
+      case 'o': csvPath = optarg; break;
+      case 'c': period = atof(optarg); break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+  if (optind != argc - 1 || (csvPath && !parse) || period <= 0 || speed < 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (parse && !paced) {
+    speed = 0;
+  }
+
+  if (canlog_open(&r, argv[optind])) {
+    return 1;
+  }
+  printf("%s: %s, %llu frames over %u s%s\n", argv[optind], r.hdr->ifname,
+    (unsigned long long)r.records, r.indexCount,
+    r.rebuilt ? " (not closed cleanly, index rebuilt)" : "");
+  first = canlog_seek(&r, from);
+  last = to == UINT32_MAX ? r.records : canlog_seek(&r, to);
+  if (first >= last) {
+    fprintf(stderr, "nothing to replay between %u s and %u s\n", from, to);
+    canlog_release(&r);
+    return 1;
+  }
+
+  if (parse) {
+    if (csvPath) {
+      if (!(csv = fopen(csvPath, "w"))) {
+        perror(csvPath);
+        canlog_release(&r);
+        return 1;
+      }
+      fprintf(csv, "t,qa_act0,qa_act1,qa_act2,ia0,ia1,ia2,boom0,boom1,boom2,accel,fz\n");
+    }
+  } else if ((fd = open_can(ifname)) < 0) {
+    canlog_release(&r);
+    return 1;
+  }
+  signal(SIGINT, &on_signal);
+  signal(SIGTERM, &on_signal);
+
+  if (parse) {
+    clockNs = clock_cost();
+  }
+  memset(&in, 0, sizeof(in));
+  t0 = r.rec[first].t;
+  nextSample = t0 + (int64_t)(period*1000);
+  wall0 = now_ns();
+  for (i = first; i < last && !stop; ++i) {
+    rec = &r.rec[i];
+    if (rec->flags & CANLOG_OVERFLOW) {
+      ++overflows;
+    }
+    key = rec->can_id & (CAN_EFF_FLAG | CAN_EFF_MASK);
+    if ((rec->can_id & CAN_ERR_FLAG) || (!all &&
+        (key == canmsg_table[CANMSG_MOTOR_CMD].key || key == canmsg_table[CANMSG_MOTOR_CMD_FD].key))) {
+      ++skipped;
+      continue;
+    }
+    if (speed > 0) {
+      at = wall0 + (int64_t)((rec->t - t0)*1000/speed);
+      if (at > now_ns()) {
+        sleep_until(at);
+      }
+    }
+    canlog_frame(rec, &f);
+
+    if (!parse) {
+      if (send_frame(fd, &f, &waits)) {
+        if (!stop) {
+          perror("can_replay: write");
+          rc = 1;
+        }
+        break;
+      }
+    } else {
+      for (; csv && nextSample <= rec->t; nextSample += (int64_t)(period*1000)) {
+        write_csv(csv, nextSample*1e-6, &in);
+      }
+      run = now_ns();
+      parseCAN(&f, &in);
+      parseNs += now_ns() - run - clockNs;
+    }
+    ++sent;
+  }
+  wall0 = now_ns() - wall0;
+  at = i > first ? r.rec[i - 1].t - t0 : 0; // log time replayed, us
+
+  printf("%llu frames %s in %.3f s (%.3f s of log, %.1fx), %llu skipped",
+    (unsigned long long)sent, parse ? "parsed" : "sent", wall0*1e-9,
+    at*1e-6, wall0 ? at*1e3/wall0 : 0.0,
+    (unsigned long long)skipped);
+  if (overflows) {
+    printf(", %llu after kernel drops while recording", (unsigned long long)overflows);
+  }
+  printf("\n");
+  if (parse) {
+    printf("parseCAN: %.1f ns/frame\n", sent ? (double)parseNs/sent : 0.0);
+    can_rx_report();
+  } else if (waits) {
+    printf("waited %llu times for the interface's queue\n", (unsigned long long)waits);
+  }
+
+  if (csv && fclose(csv)) {
+    perror(csvPath);
+    rc = 1;
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  canlog_release(&r);
+  return rc;
+}
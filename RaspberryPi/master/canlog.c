@@ -0,0 +1,245 @@
+#include "canlog.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CANLOG_RECORDS_AT sizeof(canlog_header) // file offset of the first record
+
+/******************************************************************************
+* Writer
+******************************************************************************/
+static int canlog_write_header(canlog_writer *w, const canlog_header *hdr) {
+  return pwrite(w->fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr);
+}
+
+// maps the window holding the file offset w->offset, growing the file to cover it:
+static int canlog_map(canlog_writer *w) {
+  long page = sysconf(_SC_PAGESIZE);
+
+  if (w->map) {
+    munmap(w->map, CANLOG_WINDOW);
+    w->map = NULL;
+  }
+  w->mapOffset = w->offset & ~(uint64_t)(page - 1);
+  if (ftruncate(w->fd, w->mapOffset + CANLOG_WINDOW) < 0) {
+    return 1;
+  }
+  w->map = mmap(NULL, CANLOG_WINDOW, PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, w->mapOffset);
+  if (w->map == MAP_FAILED) {
+    w->map = NULL;
+    return 1;
+  }
+  return 0;
+}
+
+int canlog_create(canlog_writer *w, const char *path, int64_t start, const char *ifname) {
+  canlog_header hdr;
+
+  memset(w, 0, sizeof(*w));
+  if ((w->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+    perror(path);
+    return 1;
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, CANLOG_MAGIC, sizeof(hdr.magic));
+  hdr.version = CANLOG_VERSION;
+  hdr.recSize = sizeof(canlog_rec);
+  hdr.start = start;
+  snprintf(hdr.ifname, sizeof(hdr.ifname), "%s", ifname);
+
+  w->offset = CANLOG_RECORDS_AT;
+  if (canlog_write_header(w, &hdr) || canlog_map(w)) {
+    perror(path);
+    close(w->fd);
+    return 1;
+  }
+  return 0;
+}
+
+// adds index entries up to second sec, all pointing at the next record:
+static int canlog_index_to(canlog_writer *w, uint32_t sec) {
+  canlog_index *grown;
+
+  while (w->indexCount <= sec) {
+    if (w->indexCount == w->indexCap) {
+      w->indexCap = w->indexCap ? 2*w->indexCap : 1024;
+      if (!(grown = realloc(w->index, w->indexCap*sizeof(*grown)))) {
+        return 1;
+      }
+      w->index = grown;
+    }
+    w->index[w->indexCount].second = w->indexCount;
+    w->index[w->indexCount].pad = 0;
+    w->index[w->indexCount++].first = w->records;
+  }
+  return 0;
+}
+
+int canlog_append(canlog_writer *w, int64_t t, const struct can_frame *f, uint8_t flags) {
+  canlog_rec *rec;
+
+  if (w->offset + sizeof(*rec) > w->mapOffset + CANLOG_WINDOW) {
+    canlog_header hdr;
+
+    if (canlog_map(w)) {
+      return 1;
+    }
+    // keep the record count in the header roughly current, for logs cut short:
+    if (pread(w->fd, &hdr, sizeof(hdr), 0) == sizeof(hdr)) {
+      hdr.records = w->records;
+      canlog_write_header(w, &hdr);
+    }
+  }
+  if (t >= 0 && canlog_index_to(w, (uint32_t)(t/1000000))) {
+    return 1;
+  }
+
+  rec = (canlog_rec *)(w->map + (w->offset - w->mapOffset));
+  rec->t = t;
+  rec->can_id = f->can_id;
+  rec->dlc = f->can_dlc;
+  rec->pad[0] = rec->pad[1] = 0;
+  memcpy(rec->data, f->data, sizeof(rec->data));
+  rec->flags = flags | CANLOG_VALID; // last, so a half-written record reads as the end
+
+  w->offset += sizeof(*rec);
+  ++w->records;
+  return 0;
+}
+
+int canlog_close(canlog_writer *w) {
+  canlog_header hdr;
+  size_t indexBytes = w->indexCount*sizeof(canlog_index);
+  int rc = 0;
+
+  if (w->map) {
+    munmap(w->map, CANLOG_WINDOW);
+    w->map = NULL;
+  }
+
+  if (pread(w->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+      (indexBytes && pwrite(w->fd, w->index, indexBytes, w->offset) != (ssize_t)indexBytes) ||
+      ftruncate(w->fd, w->offset + indexBytes) < 0) {
+    rc = 1;
+  } else {
+    hdr.records = w->records;
+    hdr.indexOffset = w->offset;
+    hdr.indexCount = w->indexCount;
+    rc = canlog_write_header(w, &hdr);
+  }
+
+  free(w->index);
+  w->index = NULL;
+  if (close(w->fd) < 0) {
+    rc = 1;
+  }
+  return rc;
+}
+
+/******************************************************************************
+* Reader
+******************************************************************************/
+
+// finds the records of a log that was not closed cleanly, and indexes them:
+static int canlog_rebuild(canlog_reader *r) {
+  uint64_t n = (r->size - CANLOG_RECORDS_AT)/sizeof(canlog_rec), i;
+  canlog_index *index = NULL, *grown;
+  uint32_t count = 0, cap = 0, sec;
+
+  for (i = 0; i < n && (r->rec[i].flags & CANLOG_VALID); ++i) {
+    if (r->rec[i].t < 0) {
+      continue;
+    }
+    for (sec = (uint32_t)(r->rec[i].t/1000000); count <= sec; ++count) {
+      if (count == cap) {
+        cap = cap ? 2*cap : 1024;
+        if (!(grown = realloc(index, cap*sizeof(*grown)))) {
+          free(index);
+          return 1;
+        }
+        index = grown;
+      }
+      index[count].second = count;
+      index[count].pad = 0;
+      index[count].first = i;
+    }
+  }
+
+  r->records = i;
+  r->index = r->ownIndex = index;
+  r->indexCount = count;
+  r->rebuilt = 1;
+  return 0;
+}
+
+int canlog_open(canlog_reader *r, const char *path) {
+  struct stat st;
+  int fd;
+
+  memset(r, 0, sizeof(*r));
+  if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    if (fd >= 0) close(fd);
+    return 1;
+  }
+  r->size = st.st_size;
+  if (r->size < CANLOG_RECORDS_AT) {
+    fprintf(stderr, "%s: not a CAN log (too short)\n", path);
+    close(fd);
+    return 1;
+  }
+  r->map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (r->map == MAP_FAILED) {
+    perror(path);
+    r->map = NULL;
+    return 1;
+  }
+
+  r->hdr = r->map;
+  r->rec = (const canlog_rec *)((const uint8_t *)r->map + CANLOG_RECORDS_AT);
+  if (memcmp(r->hdr->magic, CANLOG_MAGIC, sizeof(r->hdr->magic)) ||
+      r->hdr->version != CANLOG_VERSION || r->hdr->recSize != sizeof(canlog_rec)) {
+    fprintf(stderr, "%s: not a CAN log of version %d\n", path, CANLOG_VERSION);
+    canlog_release(r);
+    return 1;
+  }
+
+  if (r->hdr->indexOffset &&
+      r->hdr->indexOffset == CANLOG_RECORDS_AT + r->hdr->records*sizeof(canlog_rec) &&
+      r->hdr->indexOffset + (uint64_t)r->hdr->indexCount*sizeof(canlog_index) <= r->size) {
+    r->records = r->hdr->records;
+    r->index = (const canlog_index *)((const uint8_t *)r->map + r->hdr->indexOffset);
+    r->indexCount = r->hdr->indexCount;
+  } else if (canlog_rebuild(r)) {
+    fprintf(stderr, "%s: out of memory\n", path);
+    canlog_release(r);
+    return 1;
+  }
+  return 0;
+}
+
+uint64_t canlog_seek(const canlog_reader *r, uint32_t sec) {
+  return sec < r->indexCount ? r->index[sec].first : r->records;
+}
+
+void canlog_release(canlog_reader *r) {
+  if (r->map) {
+    munmap(r->map, r->size);
+  }
+  free(r->ownIndex);
+  memset(r, 0, sizeof(*r));
+}
+
+void canlog_frame(const canlog_rec *rec, struct can_frame *f) {
+  memset(f, 0, sizeof(*f));
+  f->can_id = rec->can_id;
+  f->can_dlc = rec->dlc;
+  memcpy(f->data, rec->data, sizeof(f->data));
+}
@@ -0,0 +1,112 @@
+#ifndef __CANLOG__H__
+#define __CANLOG__H__
+// Header file for canlog.c
+// Implements the CAN log file written by can_rec and read by can_replay.
+//
+// A log is a header, then one fixed-size record per CAN frame, in the
+// order received, then (once the writer has closed it cleanly) an index
+// with the first record of every second. The writer never seeks back into
+// the records: it appends through a mmap'd window of CANLOG_WINDOW bytes,
+// growing the file a window at a time, so a frame costs a memcpy and no
+// system call. A log cut short (crash, power off) keeps every record that
+// reached the page cache; the reader finds its end by the CANLOG_VALID
+// flag and rebuilds the index.
+//
+// All fields are little-endian, as on the Pi and on x86.
+
+#include <stdint.h>
+
+#include <linux/can.h>
+
+#define CANLOG_MAGIC "HOPCANLG"
+#define CANLOG_VERSION 1
+#define CANLOG_WINDOW (1 << 20) // bytes mapped by the writer at a time (a multiple of the page size)
+
+typedef struct {
+  char magic[8];        // CANLOG_MAGIC, without its '\0'
+  uint32_t version;     // CANLOG_VERSION
+  uint32_t recSize;     // sizeof(canlog_rec)
+  int64_t start;        // CLOCK_REALTIME at the start, us since the epoch
+  char ifname[16];      // the interface recorded
+  uint64_t records;     // records written; may lag if not closed cleanly
+  uint64_t indexOffset; // file offset of the index, 0 if not closed cleanly
+  uint32_t indexCount;  // index entries
+  uint32_t reserved[3];
+} canlog_header;
+
+#define CANLOG_VALID 0x80   // set in every record, so zeroed space reads as the end
+#define CANLOG_OVERFLOW 0x01 // the kernel dropped frames just before this one
+
+typedef struct {
+  int64_t t;       // receive time, us since the start on CLOCK_MONOTONIC; never decreasing
+  uint32_t can_id; // as in struct can_frame (EFF/RTR/ERR flags included)
+  uint8_t dlc;
+  uint8_t flags;   // CANLOG_VALID | CANLOG_OVERFLOW
+  uint8_t pad[2];
+  uint8_t data[8];
+} canlog_rec;
+
+typedef struct {
+  uint32_t second;  // since the start
+  uint32_t pad;
+  uint64_t first;   // index of the first record at or after that second
+} canlog_index;
+
+_Static_assert(sizeof(canlog_header) == 72, "canlog_header layout");
+_Static_assert(sizeof(canlog_rec) == 24, "canlog_rec layout");
+_Static_assert(sizeof(canlog_index) == 16, "canlog_index layout");
+
+/******************************************************************************
+* Writer
+******************************************************************************/
+typedef struct {
+  int fd;
+  uint8_t *map;          // the mapped window
+  uint64_t mapOffset;    // file offset of the window
+  uint64_t offset;       // file offset of the next record
+  uint64_t records;
+  canlog_index *index;   // grows as seconds go by
+  uint32_t indexCount, indexCap;
+} canlog_writer;
+
+// creates (or truncates) the log at path, stamped with start (us since the
+// epoch) and ifname; returns 0 on success, 1 on failure:
+int canlog_create(canlog_writer *w, const char *path, int64_t start, const char *ifname);
+
+// appends frame f, received at t (us since the start, monotonic, so the
+// index grows with the time recorded, whatever the wall clock does); returns
+// 0 on success, 1 if the file could not grow:
+int canlog_append(canlog_writer *w, int64_t t, const struct can_frame *f, uint8_t flags);
+
+// writes the index and the final header, and closes the file; returns 0 on
+// success, 1 on failure:
+int canlog_close(canlog_writer *w);
+
+/******************************************************************************
+* Reader
+******************************************************************************/
+typedef struct {
+  const canlog_header *hdr;
+  const canlog_rec *rec;      // all records, in order
+  uint64_t records;
+  const canlog_index *index;  // index[i] covers second index[i].second
+  uint32_t indexCount;
+  int rebuilt;                // the log was not closed cleanly; index rebuilt
+  void *map, *ownIndex;
+  uint64_t size;
+} canlog_reader;
+
+// maps the log at path (read-only); returns 0 on success, 1 on failure (the
+// reason is printed to stderr):
+int canlog_open(canlog_reader *r, const char *path);
+
+// the first record at or after second sec since the start (r->records if
+// there is none):
+uint64_t canlog_seek(const canlog_reader *r, uint32_t sec);
+
+void canlog_release(canlog_reader *r);
+
+// the record as a struct can_frame:
+void canlog_frame(const canlog_rec *rec, struct can_frame *f);
+
+#endif
@@ -0,0 +1,318 @@
+#define _GNU_SOURCE // sync_file_range
+#include "fdr.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "spsc_ring.h"
+
+SPSC_RING_DEFINE(fdr_ring, tlm_sample, FDR_RING)
+
+#define FDR_SEGMENT_SIZE (FDR_HEADER_SIZE + (size_t)FDR_SEGMENT_RECORDS*sizeof(tlm_sample))
+
+// the ring is shared with the real-time side; the rest is touched by the
+// thread calling fdr_poll() only:
+static struct {
+  fdr_ring ring;
+  uint8_t open;           // fdr_open() succeeded
+  char dir[192];
+  char run[16];           // YYYYmmdd-HHMMSS, the start of the run
+  fdr_header proto;       // the header of every segment, but for segment and records
+  int fd;                 // of the current segment, -1 if none
+  uint8_t *map;           // the current segment, header included
+  uint32_t segment;       // the current one
+  size_t flushed;         // bytes of it handed to the kernel to write back
+  int64_t headerSynced;   // when its header was last (CLOCK_MONOTONIC, ms)
+  uint64_t records;       // written, all segments
+  uint32_t writeErrors;   // segments that could not be opened or written back
+} fdr = {.fd = -1};
+
+static int64_t now_ms(void) {
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (int64_t)t.tv_sec*1000 + t.tv_nsec/1000000;
+}
+
+static void segment_path(char *path, size_t n, uint32_t segment) {
+  snprintf(path, n, "%s/%s_%04u.fdr", fdr.dir, fdr.run, segment);
+}
+
+static void add_field(fdr_header *hdr, const char *name, const char *unit, uint8_t type, uint8_t count, size_t offset) {
+  fdr_field *f = &hdr->field[hdr->nfields++];
+
+  snprintf(f->name, sizeof(f->name), "%s", name);
+  snprintf(f->unit, sizeof(f->unit), "%s", unit);
+  f->type = type;
+  f->count = count;
+  f->offset = offset;
+}
+
+_Static_assert(TLM_MAX_CHANNELS + 2 <= FDR_MAX_FIELDS, "raise FDR_MAX_FIELDS");
+
+/******************************************************************************
+* Recorder
+******************************************************************************/
+
+// creates segment fdr.segment, preallocated and mapped, deleting the one
+// FDR_SEGMENTS before it:
+static int segment_open(void) {
+  char path[256];
+  fdr_header *hdr;
+  int err;
+
+  if (fdr.segment >= FDR_SEGMENTS) {
+    segment_path(path, sizeof(path), fdr.segment - FDR_SEGMENTS);
+    unlink(path);
+  }
+  segment_path(path, sizeof(path), fdr.segment);
+  if ((fdr.fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+    perror(path);
+    return 1;
+  }
+  if ((err = posix_fallocate(fdr.fd, 0, FDR_SEGMENT_SIZE))) {
+    fprintf(stderr, "%s: posix_fallocate: %s\n", path, strerror(err));
+    close(fdr.fd);
+    fdr.fd = -1;
+    return 1;
+  }
+  // MAP_POPULATE: the pages are faulted in now, not record by record
+  fdr.map = mmap(NULL, FDR_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fdr.fd, 0);
+  if (fdr.map == MAP_FAILED) {
+    perror(path);
+    fdr.map = NULL;
+    close(fdr.fd);
+    fdr.fd = -1;
+    return 1;
+  }
+
+  hdr = (fdr_header *)fdr.map;
+  *hdr = fdr.proto;
+  hdr->segment = fdr.segment;
+  fdr.flushed = 0;
+  fdr.headerSynced = 0;
+  return 0;
+}
+
+// starts writing back what the segment holds (header included); with
+// wait, returns once it is on the storage:
+static int segment_flush(int wait) {
+  fdr_header *hdr = (fdr_header *)fdr.map;
+  size_t end = FDR_HEADER_SIZE + (size_t)hdr->records*sizeof(tlm_sample);
+  long page = sysconf(_SC_PAGESIZE);
+  int64_t now = now_ms();
+
+  if (wait) {
+    return msync(fdr.map, end, MS_SYNC) < 0;
+  }
+  // the full pages only: the last one is still being filled
+  end &= ~(size_t)(page - 1);
+  if (end > fdr.flushed && end > FDR_HEADER_SIZE) {
+    if (fdr.flushed < FDR_HEADER_SIZE) {
+      fdr.flushed = FDR_HEADER_SIZE;
+    }
+    if (sync_file_range(fdr.fd, fdr.flushed, end - fdr.flushed, SYNC_FILE_RANGE_WRITE) < 0) {
+      return 1;
+    }
+    fdr.flushed = end;
+  }
+  if (now - fdr.headerSynced >= FDR_HEADER_SYNC_MS) {
+    fdr.headerSynced = now;
+    return sync_file_range(fdr.fd, 0, FDR_HEADER_SIZE, SYNC_FILE_RANGE_WRITE) < 0;
+  }
+  return 0;
+}
+
+static int segment_close(int wait) {
+  int rc = segment_flush(wait);
+
+  if (!wait && sync_file_range(fdr.fd, 0, 0, SYNC_FILE_RANGE_WRITE) < 0) {
+    rc = 1; // the rest, the last page and the header
+  }
+  munmap(fdr.map, FDR_SEGMENT_SIZE);
+  fdr.map = NULL;
+  if (close(fdr.fd) < 0) {
+    rc = 1;
+  }
+  fdr.fd = -1;
+  return rc;
+}
+
+int fdr_open(const char *dir, float tickHz) {
+  struct timespec t;
+  struct tm tm;
+  int i;
+
+  fdr_ring_init(&fdr.ring);
+  if (strlen(dir) >= sizeof(fdr.dir)) {
+    fprintf(stderr, "fdr_open: directory name too long: %s\n", dir);
+    return 1;
+  }
+  strcpy(fdr.dir, dir);
+  if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+    perror(dir);
+    return 1;
+  }
+
+  clock_gettime(CLOCK_REALTIME, &t);
+  localtime_r(&t.tv_sec, &tm);
+  strftime(fdr.run, sizeof(fdr.run), "%Y%m%d-%H%M%S", &tm);
+
+  memset(&fdr.proto, 0, sizeof(fdr.proto));
+  memcpy(fdr.proto.magic, FDR_MAGIC, sizeof(fdr.proto.magic));
+  fdr.proto.version = FDR_VERSION;
+  fdr.proto.headerSize = FDR_HEADER_SIZE;
+  fdr.proto.recSize = sizeof(tlm_sample);
+  fdr.proto.capacity = FDR_SEGMENT_RECORDS;
+  fdr.proto.start = (int64_t)t.tv_sec*1000000 + t.tv_nsec/1000;
+  fdr.proto.tickHz = tickHz;
+  add_field(&fdr.proto, "tick", "", FDR_U32, 1, offsetof(tlm_sample, tick));
+  add_field(&fdr.proto, "t_us", "us", FDR_U32, 1, offsetof(tlm_sample, t_us));
+  for (i = 0; i < tlm_nchannels; ++i) {
+    add_field(&fdr.proto, tlm_channels[i].name, tlm_channels[i].unit, FDR_F32,
+      tlm_channels[i].count, tlm_channels[i].field);
+  }
+
+  fdr.segment = 0;
+  if (segment_open()) {
+    return 1;
+  }
+  __atomic_store_n(&fdr.open, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+void fdr_record(const tlm_sample *s) {
+  if (__atomic_load_n(&fdr.open, __ATOMIC_ACQUIRE)) {
+    fdr_ring_push(&fdr.ring, s);
+  }
+}
+
+uint32_t fdr_poll(void) {
+  fdr_header *hdr;
+  uint32_t n, total = 0;
+
+  while (fdr.map) {
+    hdr = (fdr_header *)fdr.map;
+    if (hdr->records == hdr->capacity) {
+      if (!spsc_ring_count(&fdr.ring.ring)) {
+        break; // no empty segment left behind at the end
+      }
+      // on to the next segment; the samples wait in the ring meanwhile
+      if (segment_close(0)) {
+        ++fdr.writeErrors;
+      }
+      ++fdr.segment;
+      if (segment_open()) {
+        ++fdr.writeErrors; // no more segments: the ring fills and drops
+        break;
+      }
+      continue;
+    }
+    // popped straight into the segment:
+    n = fdr_ring_pop_n(&fdr.ring,
+      (tlm_sample *)(fdr.map + FDR_HEADER_SIZE + (size_t)hdr->records*sizeof(tlm_sample)),
+      hdr->capacity - hdr->records);
+    if (!n) {
+      break;
+    }
+    hdr->records += n;
+    fdr.records += n;
+    total += n;
+  }
+  if (fdr.map && total && segment_flush(0)) {
+    ++fdr.writeErrors;
+  }
+  return total;
+}
+
+int fdr_close(void) {
+  int rc = 0;
+
+  if (!__atomic_load_n(&fdr.open, __ATOMIC_ACQUIRE)) {
+    return 0;
+  }
+  __atomic_store_n(&fdr.open, 0, __ATOMIC_RELEASE);
+  fdr_poll();
+  if (fdr.map) {
+    rc = segment_close(1);
+  }
+  return rc;
+}
+
+void fdr_report(void) {
+  if (!fdr.dir[0]) {
+    return;
+  }
+  printf("Flight recorder: %llu records in %u segments (%s/%s_*.fdr, last %d kept), "
+    "%u dropped, ring high water %u of %u, %u write errors\n",
+    (unsigned long long)fdr.records,fdr.segment + 1,fdr.dir,fdr.run,FDR_SEGMENTS,
+    spsc_ring_overflows(&fdr.ring.ring),spsc_ring_high_water(&fdr.ring.ring),
+    spsc_ring_capacity(&fdr.ring.ring),fdr.writeErrors);
+}
+
+/******************************************************************************
+* Reader
+******************************************************************************/
+int fdr_read_open(fdr_reader *r, const char *path) {
+  const fdr_header *hdr;
+  struct stat st;
+  uint32_t i;
+  int fd;
+
+  memset(r, 0, sizeof(*r));
+  if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    if (fd >= 0) close(fd);
+    return 1;
+  }
+  r->size = st.st_size;
+  if (r->size < sizeof(fdr_header)) {
+    fprintf(stderr, "%s: not a flight recorder segment (too short)\n", path);
+    close(fd);
+    return 1;
+  }
+  r->map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (r->map == MAP_FAILED) {
+    perror(path);
+    r->map = NULL;
+    return 1;
+  }
+
+  r->hdr = hdr = r->map;
+  if (memcmp(hdr->magic, FDR_MAGIC, sizeof(hdr->magic)) || hdr->version != FDR_VERSION ||
+      hdr->headerSize < sizeof(fdr_header) || hdr->headerSize > r->size || !hdr->recSize ||
+      hdr->nfields > FDR_MAX_FIELDS || hdr->records > hdr->capacity) {
+    fprintf(stderr, "%s: not a flight recorder segment of version %d\n", path, FDR_VERSION);
+    fdr_read_release(r);
+    return 1;
+  }
+  for (i = 0; i < hdr->nfields; ++i) {
+    if (hdr->field[i].offset + 4u*hdr->field[i].count > hdr->recSize) {
+      fprintf(stderr, "%s: field %u outside the record\n", path, i);
+      fdr_read_release(r);
+      return 1;
+    }
+  }
+
+  r->rec = (const uint8_t *)r->map + hdr->headerSize;
+  r->records = hdr->records;
+  if (hdr->headerSize + (uint64_t)r->records*hdr->recSize > r->size) {
+    r->records = (r->size - hdr->headerSize)/hdr->recSize; // cut short
+  }
+  return 0;
+}
+
+void fdr_read_release(fdr_reader *r) {
+  if (r->map) {
+    munmap(r->map, r->size);
+  }
+  memset(r, 0, sizeof(*r));
+}
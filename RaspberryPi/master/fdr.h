@@ -0,0 +1,123 @@
+#ifndef __FDR__H__
+#define __FDR__H__
+// Header file for fdr.c
+// Implements the flight data recorder: every control tick's full state
+// (tlm_sample, telemetry.h), on the Pi, for the whole run.
+//
+// The serial link carries a few channels at a time (see tlm_subscribe());
+// the recorder keeps all of them, at every tick, on the Pi's own storage:
+// the SD card, or a tmpfs (e.g. HOPPER_FDR=/dev/shm/hopper) for runs
+// where the SD card's write stalls matter, copied off after the run.
+//
+// Control_thread hands each tick's sample to fdr_record(), which only
+// pushes it into an SPSC ring (spsc_ring.h): it never blocks, never
+// allocates and never enters the kernel. A thread under SCHED_OTHER calls
+// fdr_poll(), which pops the samples straight into a segment file mapped
+// into memory, and starts the kernel writing back the pages it has filled
+// (sync_file_range(), which does not wait for the writes). A sample in the
+// mapping is in the page cache, so it survives the program crashing; only
+// a power cut loses the last ones not yet written back.
+//
+// Segments are files of FDR_SEGMENT_RECORDS samples, preallocated when
+// opened (posix_fallocate()), so the card never runs out of room in the
+// middle of one, named after the run's start time:
+//   <dir>/<YYYYmmdd-HHMMSS>_<segment>.fdr
+// A full segment is closed and the next one opened; the run keeps its last
+// FDR_SEGMENTS segments, deleting the oldest as a new one opens.
+//
+// Each segment starts with a header describing its records field by field
+// (fdr_header), so a reader needs no copy of tlm_sample; fdr_export turns
+// segments into CSV, MATLAB (.mat) or NumPy (.npy) files (see
+// fdr_export.c). The header's record count is updated on every
+// fdr_poll() and written back every FDR_HEADER_SYNC_MS: after a power cut,
+// a segment reads as up to that much shorter than it was.
+//
+// All fields are little-endian, as on the Pi and on x86.
+
+#include <stdint.h>
+
+#include "telemetry.h"
+
+#define FDR_DIR "/var/tmp/hopper"    // default directory, on the SD card
+#define FDR_MAGIC "HOPFDREC"
+#define FDR_VERSION 1
+#define FDR_HEADER_SIZE 4096         // the records start here, on a page of their own
+#define FDR_SEGMENT_RECORDS 60000    // 2 minutes at 500 Hz (CONTROL_PERIOD_US in main.c): 7.4 MB
+#define FDR_SEGMENTS 10              // kept per run
+#define FDR_RING 4096                // samples between the control loop and the storage (8 s at 500 Hz)
+#define FDR_HEADER_SYNC_MS 1000      // how often the header's record count is written back
+#define FDR_MAX_FIELDS 32
+
+// field types:
+enum {
+  FDR_U32,
+  FDR_F32
+};
+
+typedef struct {
+  char name[16];   // a tlm_channels name, "tick" or "t_us"; '\0'-padded
+  char unit[16];
+  uint8_t type;    // FDR_U32, FDR_F32
+  uint8_t count;   // values
+  uint16_t offset; // in the record, bytes
+} fdr_field;
+
+typedef struct {
+  char magic[8];        // FDR_MAGIC, without its '\0'
+  uint32_t version;     // FDR_VERSION
+  uint32_t headerSize;  // FDR_HEADER_SIZE
+  uint32_t recSize;     // bytes per record
+  uint32_t capacity;    // records the segment has room for
+  uint32_t records;     // written so far
+  uint32_t segment;     // of the run, from 0
+  int64_t start;        // CLOCK_REALTIME at the run's start, us since the epoch
+  float tickHz;         // control ticks per second
+  uint32_t nfields;
+  fdr_field field[FDR_MAX_FIELDS];
+} fdr_header;
+
+_Static_assert(sizeof(fdr_field) == 36, "fdr_field layout");
+_Static_assert(sizeof(fdr_header) == 48 + FDR_MAX_FIELDS*36, "fdr_header layout");
+_Static_assert(sizeof(fdr_header) <= FDR_HEADER_SIZE, "raise FDR_HEADER_SIZE");
+
+/******************************************************************************
+* Recorder
+******************************************************************************/
+
+// creates dir if need be and opens the run's first segment, for samples
+// coming at tickHz; returns 0 on success, 1 on failure (printed to stderr;
+// fdr_record() then drops everything):
+int fdr_open(const char *dir, float tickHz);
+
+// queues s for the recorder; real-time safe. Dropped and counted if the
+// ring is full:
+void fdr_record(const tlm_sample *s);
+
+// writes the queued samples to the segments (one thread only); returns
+// how many:
+uint32_t fdr_poll(void);
+
+// writes what is still queued, waits for it to reach the storage, and
+// closes the segment; returns 0 on success, 1 on failure:
+int fdr_close(void);
+
+void fdr_report(void);
+
+/******************************************************************************
+* Reader
+******************************************************************************/
+typedef struct {
+  const fdr_header *hdr;
+  const uint8_t *rec;   // the records, hdr->recSize bytes each
+  uint32_t records;
+  void *map;
+  uint64_t size;
+} fdr_reader;
+
+// maps the segment at path (read-only); returns 0 on success, 1 on failure
+// (the reason is printed to stderr):
+int fdr_read_open(fdr_reader *r, const char *path);
+
+void fdr_read_release(fdr_reader *r);
+
+#endif
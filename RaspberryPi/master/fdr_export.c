@@ -0,0 +1,285 @@
+// fdr_export.c
+// Exports flight data recorder segments (fdr.h) for analysis off the robot.
+//
+// usage: ./fdr_export [-f csv|mat|npy] -o output file segment files...
+//
+// Reads the segments of one run (e.g. /var/tmp/hopper/20260501-142000_*.fdr,
+// copied off the Pi), in segment order whatever the order given, and
+// writes their records as one table:
+// - csv: a line of column names (qa_0, qa_1, ... for a field of several
+//   values), a line of units, then a line per record;
+// - mat: a MATLAB level 4 MAT-file (load() in MATLAB, scipy.io.loadmat() in
+//   Python), a records x values matrix of doubles per field (tick, t_us,
+//   qa, qu, ...);
+// - npy: a NumPy array with a structured dtype, a field per field of the
+//   records (numpy.load(f)['qa'] is records x 3), the records as they are
+//   in the segments.
+// The format defaults to the output file's extension. Every field is
+// described in the segments' headers, so segments written by a later
+// main.a export without rebuilding this. Segments of different layouts
+// cannot be mixed; a gap in the segments (deleted by the recorder's
+// rotation, or not copied) is reported.
+//
+// compile with
+// make fdr_export
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fdr.h"
+
+enum {FMT_CSV, FMT_MAT, FMT_NPY};
+
+static fdr_reader *segs;
+static int nsegs;
+static uint64_t records;
+
+static int by_segment(const void *a, const void *b) {
+  const fdr_header *x = ((const fdr_reader *)a)->hdr, *y = ((const fdr_reader *)b)->hdr;
+
+  if (x->start != y->start) {
+    return x->start < y->start ? -1 : 1;
+  }
+  return x->segment < y->segment ? -1 : x->segment > y->segment;
+}
+
+// the record's values of field f, as doubles:
+static double value(const uint8_t *rec, const fdr_field *f, int i) {
+  uint32_t u;
+  float v;
+
+  if (f->type == FDR_U32) {
+    memcpy(&u, rec + f->offset + 4*i, 4);
+    return u;
+  }
+  memcpy(&v, rec + f->offset + 4*i, 4);
+  return v;
+}
+
+// the unit of value i of field f: a unit per value, as in "m,m,rad", or
+// one for them all:
+static void unit(const fdr_field *f, int i, char *u, size_t n) {
+  char all[17];
+  char *p, *save = NULL;
+  int k = 0;
+
+  snprintf(all, sizeof(all), "%.16s", f->unit);
+  snprintf(u, n, "%s", all);
+  if (strchr(all, ',')) {
+    for (p = strtok_r(all, ",", &save); p; p = strtok_r(NULL, ",", &save), ++k) {
+      if (k == i) {
+        snprintf(u, n, "%s", p);
+      }
+    }
+  }
+}
+
+// record r of segment s:
+static const uint8_t *record(int s, uint32_t r) {
+  return segs[s].rec + (size_t)r*segs[s].hdr->recSize;
+}
+
+static int write_csv(FILE *out, const fdr_header *hdr) {
+  char u[17];
+  uint32_t f, r;
+  int i, s;
+
+  for (f = 0; f < hdr->nfields; ++f) {
+    for (i = 0; i < hdr->field[f].count; ++i) {
+      fputs(f || i ? "," : "", out);
+      if (hdr->field[f].count > 1) {
+        fprintf(out, "%.16s_%d", hdr->field[f].name, i);
+      } else {
+        fprintf(out, "%.16s", hdr->field[f].name);
+      }
+    }
+  }
+  fprintf(out, "\n");
+  for (f = 0; f < hdr->nfields; ++f) {
+    for (i = 0; i < hdr->field[f].count; ++i) {
+      unit(&hdr->field[f], i, u, sizeof(u));
+      fprintf(out, "%s%s", f || i ? "," : "", u);
+    }
+  }
+  fprintf(out, "\n");
+
+  for (s = 0; s < nsegs; ++s) {
+    for (r = 0; r < segs[s].records; ++r) {
+      for (f = 0; f < hdr->nfields; ++f) {
+        for (i = 0; i < hdr->field[f].count; ++i) {
+          fprintf(out, hdr->field[f].type == FDR_U32 ? "%s%.0f" : "%s%.9g", f || i ? "," : "",
+            value(record(s, r), &hdr->field[f], i));
+        }
+      }
+      fprintf(out, "\n");
+    }
+  }
+  return ferror(out);
+}
+
+// a level 4 MAT-file is a sequence of matrices, each a header, its name and
+// its values, column by column:
+static int write_mat(FILE *out, const fdr_header *hdr) {
+  char name[17];
+  int32_t mh[5];
+  double v;
+  uint32_t f, r;
+  int i, s;
+
+  for (f = 0; f < hdr->nfields; ++f) {
+    snprintf(name, sizeof(name), "%.16s", hdr->field[f].name);
+    mh[0] = 0;                          // little-endian, doubles, a full matrix
+    mh[1] = records;                    // rows
+    mh[2] = hdr->field[f].count;        // columns
+    mh[3] = 0;                          // real
+    mh[4] = strlen(name) + 1;
+    fwrite(mh, sizeof(mh), 1, out);
+    fwrite(name, mh[4], 1, out);
+    for (i = 0; i < hdr->field[f].count; ++i) {
+      for (s = 0; s < nsegs; ++s) {
+        for (r = 0; r < segs[s].records; ++r) {
+          v = value(record(s, r), &hdr->field[f], i);
+          fwrite(&v, sizeof(v), 1, out);
+        }
+      }
+    }
+  }
+  return ferror(out);
+}
+
+// the dtype, in the header's own order, with padding where the fields
+// leave gaps:
+static int write_npy(FILE *out, const fdr_header *hdr) {
+  char head[4096];
+  size_t n = 0, at = 0;
+  uint16_t len;
+  uint32_t f, r;
+  int s;
+
+  n += snprintf(head + n, sizeof(head) - n, "{'descr': [");
+  for (f = 0; f < hdr->nfields && n < sizeof(head); ++f) {
+    if (hdr->field[f].offset < at) {
+      fprintf(stderr, "npy: field %.16s overlaps the one before\n", hdr->field[f].name);
+      return 1;
+    } else if (hdr->field[f].offset > at) {
+      n += snprintf(head + n, sizeof(head) - n, "('', '|V%zu'), ", hdr->field[f].offset - at);
+    }
+    n += snprintf(head + n, sizeof(head) - n, "('%.16s', '%s'", hdr->field[f].name,
+      hdr->field[f].type == FDR_U32 ? "<u4" : "<f4");
+    if (hdr->field[f].count > 1) {
+      n += snprintf(head + n, sizeof(head) - n, ", (%d,)", hdr->field[f].count);
+    }
+    n += snprintf(head + n, sizeof(head) - n, "), ");
+    at = hdr->field[f].offset + 4*hdr->field[f].count;
+  }
+  if (n < sizeof(head) && hdr->recSize > at) {
+    n += snprintf(head + n, sizeof(head) - n, "('', '|V%zu'), ", hdr->recSize - at);
+  }
+  if (n < sizeof(head)) {
+    n += snprintf(head + n, sizeof(head) - n, "], 'fortran_order': False, 'shape': (%llu,), }",
+      (unsigned long long)records);
+  }
+  // magic, version 1.0, header length, header padded with spaces and ended
+  // by a newline so the data starts 64-byte aligned:
+  while (n < sizeof(head) - 1 && (10 + n + 1) % 64) {
+    head[n++] = ' ';
+  }
+  if (n >= sizeof(head) - 1) {
+    fprintf(stderr, "npy: too many fields\n");
+    return 1;
+  }
+  head[n++] = '\n';
+  len = n;
+  fwrite("\x93NUMPY\x01\x00", 8, 1, out);
+  fwrite(&len, sizeof(len), 1, out);
+  fwrite(head, n, 1, out);
+
+  for (s = 0; s < nsegs; ++s) {
+    for (r = 0; r < segs[s].records; ++r) {
+      fwrite(record(s, r), hdr->recSize, 1, out);
+    }
+  }
+  return ferror(out);
+}
+
+int main(int argc, char **argv) {
+  const char *outPath = NULL, *ext;
+  const fdr_header *hdr;
+  FILE *out;
+  int format = -1, c, i, rc;
+
+  while ((c = getopt(argc, argv, "f:o:")) != -1) {
+    switch (c) {
+      case 'f':
+        format = !strcmp(optarg, "csv") ? FMT_CSV : !strcmp(optarg, "mat") ? FMT_MAT :
+          !strcmp(optarg, "npy") ? FMT_NPY : -2;
+        break;
+      case 'o': outPath = optarg; break;
+      default: format = -2;
+    }
+  }
+  if (format == -1 && outPath && (ext = strrchr(outPath, '.'))) {
+    format = !strcmp(ext, ".csv") ? FMT_CSV : !strcmp(ext, ".mat") ? FMT_MAT :
+      !strcmp(ext, ".npy") ? FMT_NPY : -1;
+  }
+  if (format < 0 || !outPath || optind == argc) {
+    fprintf(stderr, "usage: %s [-f csv|mat|npy] -o output file segment files...\n", argv[0]);
+    return 1;
+  }
+
+  nsegs = argc - optind;
+  if (!(segs = calloc(nsegs, sizeof(*segs)))) {
+    return 1;
+  }
+  for (i = 0; i < nsegs; ++i) {
+    if (fdr_read_open(&segs[i], argv[optind + i])) {
+      return 1;
+    }
+  }
+  qsort(segs, nsegs, sizeof(*segs), by_segment);
+
+  hdr = segs[0].hdr;
+  for (i = 0; i < nsegs; ++i) {
+    if (segs[i].hdr->recSize != hdr->recSize || segs[i].hdr->nfields != hdr->nfields ||
+        memcmp(segs[i].hdr->field, hdr->field, hdr->nfields*sizeof(fdr_field))) {
+      fprintf(stderr, "%s: segment %u has another layout than segment %u\n", argv[0],
+        segs[i].hdr->segment, hdr->segment);
+      return 1;
+    }
+    if (segs[i].hdr->start != hdr->start) {
+      fprintf(stderr, "%s: segments of more than one run\n", argv[0]);
+      return 1;
+    }
+    if (i && segs[i].hdr->segment != segs[i - 1].hdr->segment + 1) {
+      fprintf(stderr, "%s: segments %u to %u missing\n", argv[0],
+        segs[i - 1].hdr->segment + 1, segs[i].hdr->segment - 1);
+    }
+    records += segs[i].records;
+  }
+
+  if (!(out = fopen(outPath, "wb"))) {
+    perror(outPath);
+    return 1;
+  }
+  switch (format) {
+    case FMT_CSV: rc = write_csv(out, hdr); break;
+    case FMT_MAT: rc = write_mat(out, hdr); break;
+    default: rc = write_npy(out, hdr);
+  }
+  if (fclose(out) || rc) {
+    perror(outPath);
+    return 1;
+  }
+  printf("%llu records of %u fields at %.0f Hz, segments %u to %u, to %s\n",
+    (unsigned long long)records, hdr->nfields, hdr->tickHz, hdr->segment,
+    segs[nsegs - 1].hdr->segment, outPath);
+
+  for (i = 0; i < nsegs; ++i) {
+    fdr_read_release(&segs[i]);
+  }
+  free(segs);
+  return 0;
+}
@@ -0,0 +1,557 @@
+// hopper_sim.c
+// Virtual hopper: emulates the Tiva nodes on a (virtual) CAN bus, so the Pi
+// program can run, and be load tested, without the robot.
+//
+// usage: ./hopper_sim [-i interface] [-t seconds] [-d drop %] [-j jitter us]
+//                     [-l load frames/s] [-s seed] [-f] [-v]
+//
+// Sends what the three MotorControlTivas, the IMUAndForceTiva and the three
+// BoomTivas send, with the IDs, rates and payloads of canmsg.h, and answers
+// MOTOR_CMD frames with a simple motor model: each motor runs the Tiva's
+// position controller (P on the encoder error, with its deadband) or takes
+// the commanded current, and its speed follows the current as a first-order
+// lag (SIM_MOTOR_TAU). As the motor Tivas, it answers each MOTOR_CMD (the
+// cycle's SYNC) at once with the three MOTOR_n_POS frames, echoing its seq,
+// and sends them free-running at SIM_FREE_RUN_HZ only while no MOTOR_CMD
+// came for SIM_SYNC_LOST_NS.
+//
+// With -f the motor nodes talk CAN FD, as the Pi does with HOPPER_CAN_FD set
+// (the interface must be FD capable: "ip link set vcan0 mtu 72"): they take
+// MOTOR_CMD_FD, with its feedforward torques and gains, and send
+// MOTOR_n_STATE (position, speed, current, time) instead of MOTOR_n_POS.
+//
+// Faults, on the emulated nodes' frames:
+//   -d  drop each frame with this probability (%)
+//   -j  delay each frame by up to this long (uniform; frames of one ID stay
+//       in order, as on a real bus)
+//   -l  add this many filler frames/s on an ID no node uses (SIM_LOAD_ID),
+//       which the Pi's kernel filters should drop
+//
+// At exit (after -t seconds, or on Ctrl+C) it prints the frames sent per
+// message and, for the MOTOR_CMD frames received, their rate, period jitter
+// and "position age": the time from the last MOTOR_n_POS frames sent to the
+// command, i.e. how stale the sensor data behind each command is at most
+// (about one period when the Pi runs SYNC cycles).
+//
+// To run against the Pi program on a dev box or in CI:
+//   sudo modprobe vcan
+//   sudo ip link add dev vcan0 type vcan && sudo ip link set up vcan0
+//   ./hopper_sim -i vcan0 -t 10 &
+//   HOPPER_CAN=vcan0 ./main.a
+//
+// compile with
+// make hopper_sim
+
+#define _GNU_SOURCE // ppoll
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <net/if.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/can.h>
+#include <linux/can/raw.h>
+
+#include "canmsg.h"
+
+#define NSEC_PER_SEC 1000000000LL
+
+#define SIM_TICK_NS 1000000LL // motor model step, as the Tivas' control loop
+#define SIM_MOTOR_KP 20.0     // mA per 0.1 deg of error (Tiva: Kp/1000)
+#define SIM_MOTOR_DEADBAND 15 // 0.1 deg (Tiva: DEADBAND)
+#define SIM_MOTOR_IMAX 10000  // mA
+#define SIM_MOTOR_GAIN 1.0    // steady speed per current, 0.1 deg/s per mA
+#define SIM_MOTOR_TAU 0.02    // s
+#define SIM_MOTOR_START 2700  // 0.1 deg, encoder reading at start (0 deg)
+#define SIM_MOTOR_KT 0.0001   // Nm per mA, for MOTOR_CMD_FD's torques and gains
+#define SIM_DEG10_PER_RAD (1800/M_PI)
+
+#define SIM_FREE_RUN_HZ 1000  // MOTOR_n_POS without SYNCs (Tiva: POS_CTRL_FREQ)
+#define SIM_SYNC_LOST_NS 10000000LL // (Tiva: SYNC_LOST_TICKS)
+
+#define SIM_LOAD_ID 0x7FF     // std ID of the filler frames
+#define SIM_DELAYQ 1024       // frames waiting out their delay
+#define SIM_MAX_CMDS (1 << 20) // MOTOR_CMD frames timed
+
+typedef struct {
+  double pos;   // 0.1 deg
+  double speed; // 0.1 deg/s
+  double cur;   // mA
+} sim_motor;
+
+typedef struct {
+  int msg;              // index in canmsg_table
+  int64_t period, next; // ns
+  int64_t last;         // release time of the last frame (keeps the order)
+  uint32_t sent, dropped;
+} sim_source;
+
+typedef struct {
+  int64_t at;
+  int msg;
+  struct canfd_frame frame;
+} sim_delayed;
+
+static volatile sig_atomic_t stop;
+
+static int s; // CAN raw socket
+static sim_motor motors[3];
+static canmsg_motor_cmd cmd; // last MOTOR_CMD received, all disabled until then
+static double ff[3], kp[3], kd[3]; // and MOTOR_CMD_FD's torques (mA) and gains (mA per 0.1 deg, 0.1 deg/s)
+static int fdNodes;          // -f: the motor nodes talk CAN FD
+
+static sim_source sources[CANMSG_COUNT + 1]; // the nodes' messages, then the load
+static int nsources;
+static sim_source *posSources[3];             // MOTOR_n_POS (MOTOR_n_STATE with -f), sent on SYNC
+
+static double dropPct;
+static int64_t jitter; // ns
+
+static sim_delayed delayq[SIM_DELAYQ];
+static int ndelayed;
+static uint32_t delayqFull, txFailed;
+
+static int64_t posSent;        // time of the last MOTOR_n_POS frames
+static int64_t start;          // the nodes' clocks start at 0 then
+static int64_t *cmdAge, *cmdPeriod;
+static uint32_t ncmds;
+static int64_t lastCmd;
+
+static int64_t now_ns(void) {
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (int64_t)t.tv_sec*NSEC_PER_SEC + t.tv_nsec;
+}
+
+static void on_signal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+static double uniform(void) {
+  return rand()/(RAND_MAX + 1.0);
+}
+
+/******************************************************************************
+* Emulated nodes
+******************************************************************************/
+static void motor_step(sim_motor *m, int i, double dt) {
+  double err;
+
+  if (!cmd.enable[i]) { // IDLE
+    m->cur = 0;
+  } else if (cmd.mode) { // POS_CTRL
+    err = cmd.ref[i] - m->pos;
+    if (fabs(err) < SIM_MOTOR_DEADBAND) {
+      err = 0;
+    }
+    if (kp[i] || kd[i]) { // MOTOR_CMD_FD's gains
+      m->cur = kp[i]*err - kd[i]*m->speed + ff[i];
+    } else {
+      m->cur = SIM_MOTOR_KP*err + ff[i];
+    }
+  } else { // CUR_CTRL
+    m->cur = cmd.ref[i] + ff[i];
+  }
+  if (m->cur > SIM_MOTOR_IMAX) m->cur = SIM_MOTOR_IMAX;
+  if (m->cur < -SIM_MOTOR_IMAX) m->cur = -SIM_MOTOR_IMAX;
+
+  m->speed += (SIM_MOTOR_GAIN*m->cur - m->speed)*dt/SIM_MOTOR_TAU;
+  m->pos += m->speed*dt;
+}
+
+// the frame message msg carries now (msg < 0: a load frame):
+static void fill_frame(struct canfd_frame *f, int msg, int64_t t) {
+  double sec = t*1e-9;
+
+  memset(f, 0, sizeof(*f));
+  if (msg < 0) {
+    f->can_id = SIM_LOAD_ID;
+    f->len = 8;
+    return;
+  }
+  f->can_id = canmsg_table[msg].key; // SocketCAN's can_id, EFF flag included
+  f->len = canmsg_table[msg].dlc;
+  if (canmsg_table[msg].fd) {
+    f->flags = CANFD_BRS;
+  }
+
+  switch (msg) {
+    case CANMSG_MOTOR_1_POS:
+    case CANMSG_MOTOR_2_POS:
+    case CANMSG_MOTOR_3_POS:
+    {
+      int i = msg == CANMSG_MOTOR_1_POS ? 0 : msg == CANMSG_MOTOR_2_POS ? 1 : 2;
+      canmsg_motor_pos_set_pos(f->data, (uint32_t)lround(motors[i].pos));
+      canmsg_motor_pos_set_seq(f->data, cmd.seq); // the last SYNC's
+      break;
+    }
+    case CANMSG_MOTOR_1_STATE:
+    case CANMSG_MOTOR_2_STATE:
+    case CANMSG_MOTOR_3_STATE:
+    {
+      int i = msg == CANMSG_MOTOR_1_STATE ? 0 : msg == CANMSG_MOTOR_2_STATE ? 1 : 2;
+      canmsg_motor_state_set_pos(f->data, (uint32_t)lround(motors[i].pos));
+      canmsg_motor_state_set_vel(f->data, lround(motors[i].speed));
+      canmsg_motor_state_set_cur(f->data, lround(motors[i].cur));
+      canmsg_motor_state_set_seq(f->data, cmd.seq);
+      canmsg_motor_state_set_time(f->data, (uint32_t)((t - start)/1000));
+      break;
+    }
+    case CANMSG_IMU_FZ: // 1 g at rest (LSM6DS33, +-2 g), a mid-scale force
+      canmsg_imu_fz_set_az(f->data, 16393 + (rand() % 65) - 32);
+      canmsg_imu_fz_set_fz(f->data, 2048 + (rand() % 17) - 8);
+      break;
+    case CANMSG_BOOM_ROLL: // the boom circling slowly
+      canmsg_boom_angle_set_angle(f->data, lround(20*sin(0.5*sec)));
+      break;
+    case CANMSG_BOOM_PITCH:
+      canmsg_boom_angle_set_angle(f->data, lround(50*sin(2*sec)));
+      break;
+    case CANMSG_BOOM_YAW:
+      canmsg_boom_angle_set_angle(f->data, lround(fmod(100*sec, 3600)));
+      break;
+  }
+}
+
+/******************************************************************************
+* Bus
+******************************************************************************/
+static void send_frame(const struct canfd_frame *f, int msg) {
+  size_t size = msg >= 0 && canmsg_table[msg].fd ? CANFD_MTU : CAN_MTU;
+
+  if (write(s, f, size) != (ssize_t)size) {
+    ++txFailed; // e.g. ENOBUFS: the interface's queue is full
+  }
+}
+
+static void send_due(int64_t t) {
+  int i = 0;
+
+  while (i < ndelayed) {
+    if (delayq[i].at <= t) {
+      send_frame(&delayq[i].frame, delayq[i].msg);
+      delayq[i] = delayq[--ndelayed];
+    } else {
+      ++i;
+    }
+  }
+}
+
+static void release(sim_source *src, int64_t t) {
+  struct canfd_frame f;
+  int64_t at;
+
+  fill_frame(&f, src->msg, t);
+  if (src == posSources[2]) {
+    posSent = t; // the motors all send on the same tick, 3 last
+  }
+  if (src->msg >= 0 && dropPct > 0 && 100*uniform() < dropPct) {
+    ++src->dropped;
+    return;
+  }
+  ++src->sent;
+
+  at = t + (jitter ? (int64_t)(jitter*uniform()) : 0);
+  if (at < src->last) {
+    at = src->last;
+  }
+  src->last = at;
+  if (at <= t) {
+    send_frame(&f, src->msg);
+  } else if (ndelayed < SIM_DELAYQ) {
+    delayq[ndelayed].at = at;
+    delayq[ndelayed].msg = src->msg;
+    delayq[ndelayed++].frame = f;
+  } else {
+    ++delayqFull;
+    send_frame(&f, src->msg);
+  }
+}
+
+// MOTOR_CMD_FD's references as a MOTOR_CMD, and its torques and gains in
+// the motor model's units:
+static void take_cmd_fd(const uint8_t *data) {
+  canmsg_motor_cmd_fd c;
+  int i;
+
+  canmsg_motor_cmd_fd_unpack(data, &c);
+  cmd.mode = c.mode;
+  cmd.seq = c.seq;
+  for (i = 0; i < 3; ++i) {
+    cmd.enable[i] = c.enable[i];
+    cmd.ref[i] = c.ref[i];
+    ff[i] = CANMSG_MOTOR_CMD_FD_FF_SCALE*c.ff[i]/SIM_MOTOR_KT;
+    kp[i] = CANMSG_MOTOR_CMD_FD_KP_SCALE*c.kp[i]/SIM_DEG10_PER_RAD/SIM_MOTOR_KT;
+    kd[i] = CANMSG_MOTOR_CMD_FD_KD_SCALE*c.kd[i]/SIM_DEG10_PER_RAD/SIM_MOTOR_KT;
+  }
+}
+
+static void receive(void) {
+  struct canfd_frame f;
+  ssize_t n;
+  int64_t t;
+  int i, msg;
+
+  while ((n = read(s, &f, sizeof(f))) == CAN_MTU || n == CANFD_MTU) {
+    t = now_ns();
+    msg = canmsg_find(f.can_id & (CAN_EFF_FLAG | CAN_EFF_MASK));
+    if (msg == CANMSG_MOTOR_CMD && f.len >= CANMSG_MOTOR_CMD_DLC) {
+      canmsg_motor_cmd_unpack(f.data, &cmd);
+      memset(ff, 0, sizeof(ff));
+      memset(kp, 0, sizeof(kp));
+      memset(kd, 0, sizeof(kd));
+    } else if (msg == CANMSG_MOTOR_CMD_FD && fdNodes && f.len >= CANMSG_MOTOR_CMD_FD_DLC) {
+      take_cmd_fd(f.data);
+    } else {
+      continue;
+    }
+
+    if (ncmds < SIM_MAX_CMDS) {
+      cmdAge[ncmds] = posSent ? t - posSent : -1;
+      cmdPeriod[ncmds] = lastCmd ? t - lastCmd : -1;
+      ++ncmds;
+    }
+    lastCmd = t;
+
+    // SYNC: sample and answer at once
+    for (i = 0; i < 3; ++i) {
+      if (posSources[i]) {
+        release(posSources[i], t);
+      }
+    }
+  }
+}
+
+static int open_can(const char *ifname) {
+  struct sockaddr_can addr = {0};
+  struct ifreq ifr;
+  struct can_filter filters[2];
+  int on = 1;
+
+  if ((s = socket(PF_CAN, SOCK_RAW, CAN_RAW)) < 0) {
+    perror("socket");
+    return 1;
+  }
+  snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+  if (ioctl(s, SIOCGIFINDEX, &ifr) < 0) {
+    perror(ifname);
+    return 1;
+  }
+  addr.can_family = AF_CAN;
+  addr.can_ifindex = ifr.ifr_ifindex;
+
+  // the nodes only listen to MOTOR_CMD and MOTOR_CMD_FD:
+  filters[0].can_id = canmsg_table[CANMSG_MOTOR_CMD].key;
+  filters[0].can_mask = CAN_EFF_FLAG | (CANMSG_MOTOR_CMD_EXT ? CAN_EFF_MASK : CAN_SFF_MASK);
+  filters[1].can_id = canmsg_table[CANMSG_MOTOR_CMD_FD].key;
+  filters[1].can_mask = CAN_EFF_FLAG | (CANMSG_MOTOR_CMD_FD_EXT ? CAN_EFF_MASK : CAN_SFF_MASK);
+  setsockopt(s, SOL_CAN_RAW, CAN_RAW_FILTER, filters, sizeof(filters));
+  if (fdNodes && setsockopt(s, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &on, sizeof(on)) < 0) {
+    perror("CAN_RAW_FD_FRAMES");
+    return 1;
+  }
+
+  if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("bind");
+    return 1;
+  }
+  fcntl(s, F_SETFL, O_NONBLOCK);
+  return 0;
+}
+
+/******************************************************************************
+* Report
+******************************************************************************/
+static int cmp_i64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+// min/median/p99/max of the non-negative values in v, in us:
+static void print_dist(const char *what, int64_t *v, uint32_t n) {
+  uint32_t i, m = 0;
+
+  for (i = 0; i < n; ++i) {
+    if (v[i] >= 0) {
+      v[m++] = v[i];
+    }
+  }
+  if (!m) {
+    printf("%-24s (none)\n", what);
+    return;
+  }
+  qsort(v, m, sizeof(v[0]), cmp_i64);
+  printf("%-24s min %8.1f  median %8.1f  p99 %8.1f  max %8.1f us\n", what,
+    v[0]*1e-3, v[m/2]*1e-3, v[(uint32_t)(0.99*(m - 1))]*1e-3, v[m - 1]*1e-3);
+}
+
+static void report(double seconds) {
+  int i;
+
+  printf("%-16s %10s %10s %10s\n", "message", "sent", "dropped", "frames/s");
+  for (i = 0; i < nsources; ++i) {
+    printf("%-16s %10u %10u %10.1f\n",
+      sources[i].msg < 0 ? "(load)" : canmsg_table[sources[i].msg].name,
+      sources[i].sent, sources[i].dropped, sources[i].sent/seconds);
+  }
+  if (delayqFull || txFailed) {
+    printf("%u frames sent early (delay queue full), %u sends failed\n", delayqFull, txFailed);
+  }
+
+  printf("%s received: %u (%.1f/s)\n", fdNodes ? "MOTOR_CMD(_FD)" : "MOTOR_CMD", ncmds, ncmds/seconds);
+  print_dist("  period", cmdPeriod, ncmds);
+  print_dist("  position age", cmdAge, ncmds);
+  for (i = 0; i < 3; ++i) {
+    printf("motor %d: %.1f deg, ref %.1f deg, %s\n", i + 1,
+      0.1*motors[i].pos - 270, 0.1*cmd.ref[i] - 270,
+      !cmd.enable[i] ? "idle" : cmd.mode ? "position control" : "current control");
+  }
+}
+
+/******************************************************************************
+* Main
+******************************************************************************/
+static void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-i interface] [-t seconds] [-d drop %%] [-j jitter us]\n"
+    "       %*s [-l load frames/s] [-s seed] [-f] [-v]\n", prog, (int)strlen(prog), "");
+}
+
+int main(int argc, char **argv) {
+  const char *ifname = "vcan0";
+  double duration = 0, load = 0;
+  int64_t t, next, tick;
+  int opt, verbose = 0, i;
+  unsigned seed = 1;
+  struct pollfd pfd;
+  struct timespec timeout;
+
+  while ((opt = getopt(argc, argv, "i:t:d:j:l:s:fvh")) != -1) {
+    switch (opt) {
+      case 'i': ifname = optarg; break;
+      case 't': duration = atof(optarg); break;
+      case 'd': dropPct = atof(optarg); break;
+      case 'j': jitter = (int64_t)(1000*atof(optarg)); break;
+      case 'l': load = atof(optarg); break;
+      case 's': seed = strtoul(optarg, NULL, 0); break;
+      case 'f': fdNodes = 1; break;
+      case 'v': verbose = 1; break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+  srand(seed);
+
+  if (open_can(ifname)) {
+    fprintf(stderr, "hopper_sim: cannot use CAN interface %s (see the top of hopper_sim.c)\n", ifname);
+    return 1;
+  }
+  cmdAge = malloc(SIM_MAX_CMDS*sizeof(*cmdAge));
+  cmdPeriod = malloc(SIM_MAX_CMDS*sizeof(*cmdPeriod));
+  if (!cmdAge || !cmdPeriod) {
+    fprintf(stderr, "hopper_sim: out of memory\n");
+    return 1;
+  }
+  signal(SIGINT, &on_signal);
+  signal(SIGTERM, &on_signal);
+
+  for (i = 0; i < 3; ++i) {
+    motors[i].pos = SIM_MOTOR_START;
+  }
+
+  // every message the nodes send periodically (the motors' in classic CAN
+  // or CAN FD), then the load:
+  start = now_ns();
+  for (i = 0; i < CANMSG_COUNT; ++i) {
+    if (i == CANMSG_MOTOR_CMD || i == CANMSG_MOTOR_CMD_FD || !canmsg_table[i].hz ||
+        (canmsg_table[i].fd != fdNodes && (i == CANMSG_MOTOR_1_POS || i == CANMSG_MOTOR_2_POS ||
+        i == CANMSG_MOTOR_3_POS || i == CANMSG_MOTOR_1_STATE || i == CANMSG_MOTOR_2_STATE ||
+        i == CANMSG_MOTOR_3_STATE))) {
+      continue;
+    }
+    sources[nsources].msg = i;
+    sources[nsources].period = NSEC_PER_SEC/canmsg_table[i].hz;
+    sources[nsources].next = start;
+    if (i == CANMSG_MOTOR_1_POS || i == CANMSG_MOTOR_1_STATE) posSources[0] = &sources[nsources];
+    if (i == CANMSG_MOTOR_2_POS || i == CANMSG_MOTOR_2_STATE) posSources[1] = &sources[nsources];
+    if (i == CANMSG_MOTOR_3_POS || i == CANMSG_MOTOR_3_STATE) posSources[2] = &sources[nsources];
+    ++nsources;
+  }
+  for (i = 0; i < 3; ++i) {
+    posSources[i]->period = NSEC_PER_SEC/SIM_FREE_RUN_HZ;
+  }
+  if (load > 0) {
+    sources[nsources].msg = -1;
+    sources[nsources].period = (int64_t)(NSEC_PER_SEC/load);
+    sources[nsources++].next = start;
+  }
+  printf("hopper_sim on %s: %d messages%s, %s motor nodes, drop %.1f%%, jitter %.0f us\n", ifname,
+    nsources - (load > 0), load > 0 ? " + load" : "", fdNodes ? "CAN FD" : "classic CAN",
+    dropPct, jitter*1e-3);
+
+  pfd.fd = s;
+  pfd.events = POLLIN;
+  tick = start;
+  while (!stop) {
+    t = now_ns();
+    if (duration > 0 && t - start >= (int64_t)(duration*NSEC_PER_SEC)) {
+      break;
+    }
+
+    for (; tick <= t; tick += SIM_TICK_NS) {
+      for (i = 0; i < 3; ++i) {
+        motor_step(&motors[i], i, SIM_TICK_NS*1e-9);
+      }
+      if (verbose && (tick - start) % NSEC_PER_SEC < SIM_TICK_NS) {
+        printf("%6.1f s: motors %7.1f %7.1f %7.1f deg, %u commands\n", (tick - start)*1e-9,
+          0.1*motors[0].pos - 270, 0.1*motors[1].pos - 270, 0.1*motors[2].pos - 270, ncmds);
+      }
+    }
+    for (i = 0; i < nsources; ++i) {
+      // releases missed by more than a period are skipped, not sent in a burst
+      if (t - sources[i].next >= sources[i].period) {
+        sources[i].next += (t - sources[i].next)/sources[i].period*sources[i].period;
+      }
+      if (sources[i].next <= t) {
+        // the motors answer SYNCs instead, while they come:
+        if (!(lastCmd && t - lastCmd < SIM_SYNC_LOST_NS &&
+              (&sources[i] == posSources[0] || &sources[i] == posSources[1] ||
+               &sources[i] == posSources[2]))) {
+          release(&sources[i], t);
+        }
+        sources[i].next += sources[i].period;
+      }
+    }
+    send_due(t);
+
+    // sleep until the next event, or until a command arrives:
+    next = tick;
+    for (i = 0; i < nsources; ++i) {
+      if (sources[i].next < next) next = sources[i].next;
+    }
+    for (i = 0; i < ndelayed; ++i) {
+      if (delayq[i].at < next) next = delayq[i].at;
+    }
+    t = now_ns();
+    if (next > t) {
+      timeout.tv_sec = (next - t)/NSEC_PER_SEC;
+      timeout.tv_nsec = (next - t)%NSEC_PER_SEC;
+      ppoll(&pfd, 1, &timeout, NULL);
+    }
+    receive();
+  }
+
+  report((now_ns() - start)*1e-9);
+  close(s);
+  return 0;
+}
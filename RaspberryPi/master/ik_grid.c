@@ -0,0 +1,168 @@
+// ik_grid.c
+// Run-time side of the precomputed IK grid: maps the file written by
+// ik_grid_gen and interpolates it. See ik_grid.h for the file layout.
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ik_grid.h"
+
+#define PI 3.14159265
+
+void ik_grid_geometry(float *geometry) {
+  const hopper_geometry *g = kin_get_geometry();
+
+  geometry[0] = g->L1;
+  geometry[1] = g->L2;
+  geometry[2] = g->L3;
+  geometry[3] = g->L4;
+  geometry[4] = g->L5;
+  geometry[5] = g->L6;
+  geometry[6] = g->L7;
+  geometry[7] = g->L8;
+  geometry[8] = g->B1X;
+  geometry[9] = g->B2X;
+  geometry[10] = g->B1Y;
+  geometry[11] = g->B2Y;
+}
+
+int ik_grid_open(ik_grid *g, const char *path) {
+  int fd;
+  struct stat st;
+  void *map;
+  const ik_grid_header *hdr;
+  float geometry[12];
+  size_t nnodes;
+
+  g->hdr = NULL;
+  g->nodes = NULL;
+  g->mapLen = 0;
+
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    perror("ik_grid_open: open");
+    return 1;
+  }
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ik_grid_header)) {
+    fprintf(stderr,"ik_grid_open: %s is too short.\n",path);
+    close(fd);
+    return 1;
+  }
+
+  // MAP_POPULATE prefaults the whole grid, so queries from the control loop
+  // never take a page fault:
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror("ik_grid_open: mmap");
+    return 1;
+  }
+
+  hdr = map;
+  ik_grid_geometry(geometry);
+  nnodes = (size_t)hdr->n[0]*hdr->n[1]*hdr->n[2];
+  if (memcmp(hdr->magic, IK_GRID_MAGIC, sizeof(hdr->magic))
+      || hdr->version != IK_GRID_VERSION
+      || hdr->nodeSize != sizeof(ik_grid_node)) {
+    fprintf(stderr,"ik_grid_open: %s is not a version %d IK grid.\n",path,IK_GRID_VERSION);
+  } else if (hdr->n[0] < 2 || hdr->n[1] < 2 || hdr->n[2] < 2
+      || (size_t)st.st_size != sizeof(ik_grid_header) + nnodes*sizeof(ik_grid_node)) {
+    fprintf(stderr,"ik_grid_open: %s has the wrong size.\n",path);
+  } else if (memcmp(hdr->geometry, geometry, sizeof(geometry))) {
+    fprintf(stderr,"ik_grid_open: %s was built for different link lengths.\n",path);
+  } else {
+    g->hdr = hdr;
+    g->nodes = (const ik_grid_node *)(hdr + 1);
+    g->mapLen = st.st_size;
+    return 0;
+  }
+
+  munmap(map, st.st_size);
+  return 1;
+}
+
+void ik_grid_close(ik_grid *g) {
+  if (g->hdr) {
+    munmap((void *)g->hdr, g->mapLen);
+  }
+  g->hdr = NULL;
+  g->nodes = NULL;
+  g->mapLen = 0;
+}
+
+int8_t ik_grid_query(const ik_grid *g, float *footPose, float *qa, float *qu,
+  float *cond, uint8_t refine) {
+  const ik_grid_header *hdr = g->hdr;
+  const ik_grid_node *corner[8];
+  float t[3], w;
+  uint32_t idx[3], flags = 0;
+  uint8_t inside = 1;
+  uint8_t k, c;
+  float u, lim;
+  size_t sx, sy, base;
+  kin_state ks = {};
+  double dpose[3];
+
+  // cell index and fractional position along each axis, clamped to the grid
+  // (a NaN or infinite pose is outside, and goes to the first cell rather
+  // than through the cast to the index)
+  for (k = 0; k < 3; ++k) {
+    u = (footPose[k] - hdr->origin[k])/hdr->step[k];
+    lim = (float)(hdr->n[k] - 1);
+    if (!isfinite(u)) {
+      u = 0.0f;
+      inside = 0;
+    }
+    inside &= (u >= 0.0f) & (u <= lim);
+    u = fminf(fmaxf(u, 0.0f), lim);
+    idx[k] = (uint32_t)u;
+    idx[k] -= (idx[k] == hdr->n[k] - 1); // keep the upper corner in range
+    t[k] = u - (float)idx[k];
+  }
+
+  sx = hdr->n[0];
+  sy = (size_t)hdr->n[0]*hdr->n[1];
+  base = idx[0] + idx[1]*sx + idx[2]*sy;
+  for (c = 0; c < 8; ++c) {
+    corner[c] = &g->nodes[base + (c & 1) + ((c >> 1) & 1)*sx + ((c >> 2) & 1)*sy];
+    flags |= corner[c]->flags;
+  }
+
+  for (k = 0; k < 3; ++k) qa[k] = 0;
+  for (k = 0; k < 6; ++k) qu[k] = 0;
+  if (cond) *cond = 0;
+  for (c = 0; c < 8; ++c) {
+    w = ((c & 1) ? t[0] : 1.0f - t[0])
+      * (((c >> 1) & 1) ? t[1] : 1.0f - t[1])
+      * (((c >> 2) & 1) ? t[2] : 1.0f - t[2]);
+    for (k = 0; k < 3; ++k) qa[k] += w*corner[c]->qa[k];
+    for (k = 0; k < 6; ++k) qu[k] += w*corner[c]->qu[k];
+    if (cond) *cond += w*corner[c]->cond;
+  }
+
+  if (!inside || flags) {
+    return 1; // outside the grid or next to an unreachable node
+  }
+
+  if (refine) {
+    // one Newton step: qa += inv(Ja)*(footPose - FK(qa)), then qu from FK
+    if (kin_state_update(&ks, qa, 1) == 0) {
+      dpose[0] = footPose[0] - ks.footPose[0];
+      dpose[1] = footPose[1] - ks.footPose[1];
+      dpose[2] = remainder(footPose[2] - ks.footPose[2], 2*PI);
+      for (k = 0; k < 3; ++k) {
+        qa[k] += ks.Jainv[3*k]*dpose[0] + ks.Jainv[3*k + 1]*dpose[1] + ks.Jainv[3*k + 2]*dpose[2];
+      }
+      if (kin_state_update(&ks, qa, 1) == 0) {
+        for (k = 0; k < 6; ++k) qu[k] = ks.qu[k];
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,70 @@
+#ifndef __IK_GRID__H__
+#define __IK_GRID__H__
+// Header file for ik_grid.c
+// Precomputed inverse kinematics over a regular grid of foot poses.
+//
+// ik_grid_gen (ik_grid_gen.c) samples foot pose space (x, y, angle) offline
+// and writes the solutions to a binary grid file. At run time ik_grid_open()
+// maps that file into memory and ik_grid_query() answers IK by trilinear
+// interpolation between the 8 surrounding nodes, optionally followed by one
+// Newton step on the closed-loop FK. The query also reports whether the pose
+// is inside the reachable workspace, before it is ever commanded.
+//
+// Foot angles follow geomFK()'s convention: pi + atan2(...), i.e. 3*pi/2 for
+// a foot pointing straight down.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kinematic.h"
+
+#define IK_GRID_MAGIC "HOP3RIKG"
+#define IK_GRID_VERSION 1
+
+// node flags (KIN_BATCH_* flags from kin_batch.h, plus):
+#define IK_GRID_SINGULAR 0x10 // Ja is singular at this node
+
+// file layout: one ik_grid_header, then nx*ny*na ik_grid_node's, x fastest
+typedef struct {
+  char magic[8];        // IK_GRID_MAGIC, not NUL-terminated
+  uint32_t version;     // IK_GRID_VERSION
+  uint32_t nodeSize;    // sizeof(ik_grid_node)
+  uint32_t n[3];        // number of nodes along x, y, angle
+  float origin[3];      // pose of node (0,0,0)
+  float step[3];        // node spacing along x, y, angle
+  float geometry[12];   // L1..L8, B1X, B2X, B1Y, B2Y the grid was built for
+} ik_grid_header;
+
+typedef struct {
+  float qa[3];          // actuated joint angles
+  float qu[6];          // unactuated joint angles
+  float cond;           // condition number of Ja (Frobenius norm), 0 if unreachable
+  uint32_t flags;       // 0 if reachable
+} ik_grid_node;
+
+typedef struct {
+  const ik_grid_header *hdr;
+  const ik_grid_node *nodes;
+  size_t mapLen;        // length of the mapping, for munmap()
+} ik_grid;
+
+/******************************************************************************
+* Function prototypes
+******************************************************************************/
+
+// fill geometry[] with the link lengths of the current kinematic geometry:
+void ik_grid_geometry(float *geometry);
+
+// map a grid file, check that it matches this build; returns 0 on success:
+int ik_grid_open(ik_grid *g, const char *path);
+void ik_grid_close(ik_grid *g);
+
+// IK for footPose; refine != 0 adds one Newton step on the FK.
+// cond (may be NULL) receives the interpolated condition number of Ja.
+// Returns 0 if footPose is inside the grid and all 8 surrounding nodes are
+// reachable, 1 otherwise (qa and qu are still filled in, from the clamped
+// grid position).
+int8_t ik_grid_query(const ik_grid *g, float *footPose, float *qa, float *qu,
+  float *cond, uint8_t refine);
+
+#endif
@@ -0,0 +1,211 @@
+// ik_grid_gen.c
+// Builds the precomputed IK grid file read by ik_grid.c.
+//
+// usage: ./ik_grid_gen <grid file> [nx ny na [xmin xmax ymin ymax amin amax]]
+//
+// Every node is solved with subchainIK_batch(), checked against geomFK_batch()
+// (so the grid agrees with the FK used on the robot), and tagged with the
+// condition number of Ja. Angle slices are shared out over one thread per
+// online core, and each thread writes its nodes straight into the mmap'd
+// output file.
+//
+// compile with
+// make ik_grid_gen
+
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ik_grid.h"
+#include "kin_batch.h"
+
+#define PI 3.14159265
+#define MAX_THREADS 64
+
+// default grid: +/-0.16 m across, 0.16 m of leg travel, +/-0.8 rad of foot tilt
+#define DEFAULT_N 64
+#define DEFAULT_XMIN -0.16
+#define DEFAULT_XMAX 0.16
+#define DEFAULT_YMIN -0.28
+#define DEFAULT_YMAX -0.12
+#define DEFAULT_AMIN (1.5*PI - 0.8)
+#define DEFAULT_AMAX (1.5*PI + 0.8)
+
+typedef struct {
+  ik_grid_header *hdr;
+  ik_grid_node *nodes;
+  uint32_t first;   // first angle slice
+  uint32_t stride;  // number of threads
+  size_t nreach;    // reachable nodes found by this thread
+} gen_job;
+
+static void *gen_thread(void *arg) {
+  gen_job *job = arg;
+  const ik_grid_header *hdr = job->hdr;
+  size_t nx = hdr->n[0];
+  float *pose = malloc(3*nx*sizeof(float));
+  float *fkpose = malloc(3*nx*sizeof(float));
+  float *qa = malloc(3*nx*sizeof(float));
+  float *qu = malloc(6*nx*sizeof(float));
+  float *fkqu = malloc(6*nx*sizeof(float));
+  uint8_t *flags = malloc(nx);
+  uint8_t *fkflags = malloc(nx);
+  uint32_t ia, iy, ix;
+  uint8_t k;
+  ik_grid_node *node;
+  kin_trig t;
+  double Ja[9], Jainv[9], nJa, nJainv;
+  float q[3], u[6];
+
+  if (!pose || !fkpose || !qa || !qu || !fkqu || !flags || !fkflags) {
+    fprintf(stderr,"ik_grid_gen: out of memory.\n");
+    exit(1);
+  }
+
+  for (ia = job->first; ia < hdr->n[2]; ia += job->stride) {
+    for (iy = 0; iy < hdr->n[1]; ++iy) {
+      for (ix = 0; ix < nx; ++ix) {
+        pose[ix] = hdr->origin[0] + ix*hdr->step[0];
+        pose[nx + ix] = hdr->origin[1] + iy*hdr->step[1];
+        pose[2*nx + ix] = hdr->origin[2] + ia*hdr->step[2];
+      }
+
+      // IK for the row, then FK back from the solution:
+      subchainIK_batch(pose, nx, qa, qu, NULL, flags);
+      geomFK_batch(qa, nx, fkqu, fkpose, 1, NULL, fkflags);
+
+      for (ix = 0; ix < nx; ++ix) {
+        node = &job->nodes[ix + nx*(iy + (size_t)hdr->n[1]*ia)];
+        node->flags = flags[ix] | fkflags[ix];
+        if (fabsf(fkpose[ix] - pose[ix]) > KIN_BATCH_TOL
+            || fabsf(fkpose[nx + ix] - pose[nx + ix]) > KIN_BATCH_TOL
+            || fabsf(remainderf(fkpose[2*nx + ix] - pose[2*nx + ix], 2*PI)) > 10*KIN_BATCH_TOL) {
+          node->flags |= KIN_BATCH_INACCURATE; // FK assembles a different branch
+        }
+
+        for (k = 0; k < 3; ++k) q[k] = qa[k*nx + ix];
+        for (k = 0; k < 6; ++k) u[k] = qu[k*nx + ix];
+        node->cond = 0;
+        if (!node->flags) {
+          kin_trig_eval(&t, q, u);
+          if (actuatorJacobian_trig(Ja, Jainv, &t)) {
+            node->flags |= IK_GRID_SINGULAR;
+          } else {
+            nJa = nJainv = 0;
+            for (k = 0; k < 9; ++k) {
+              nJa += Ja[k]*Ja[k];
+              nJainv += Jainv[k]*Jainv[k];
+            }
+            node->cond = sqrt(nJa*nJainv);
+          }
+        }
+
+        if (node->flags) { // keep unreachable nodes finite for interpolation
+          memset(node->qa, 0, sizeof(node->qa));
+          memset(node->qu, 0, sizeof(node->qu));
+        } else {
+          memcpy(node->qa, q, sizeof(node->qa));
+          memcpy(node->qu, u, sizeof(node->qu));
+          job->nreach++;
+        }
+      }
+    }
+  }
+
+  free(pose); free(fkpose); free(qa); free(qu); free(fkqu); free(flags); free(fkflags);
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  uint32_t n[3] = {DEFAULT_N, DEFAULT_N, DEFAULT_N/2};
+  double lo[3] = {DEFAULT_XMIN, DEFAULT_YMIN, DEFAULT_AMIN};
+  double hi[3] = {DEFAULT_XMAX, DEFAULT_YMAX, DEFAULT_AMAX};
+  int fd, i;
+  long ncpu;
+  size_t len, nnodes, nreach = 0;
+  void *map;
+  ik_grid_header *hdr;
+  pthread_t threads[MAX_THREADS];
+  gen_job jobs[MAX_THREADS];
+
+  if (argc != 2 && argc != 5 && argc != 11) {
+    fprintf(stderr,"usage: %s <grid file> [nx ny na [xmin xmax ymin ymax amin amax]]\n",argv[0]);
+    return 1;
+  }
+  if (argc >= 5) {
+    for (i = 0; i < 3; ++i) n[i] = atoi(argv[2 + i]);
+  }
+  if (argc == 11) {
+    for (i = 0; i < 3; ++i) {
+      lo[i] = atof(argv[5 + 2*i]);
+      hi[i] = atof(argv[6 + 2*i]);
+    }
+  }
+  for (i = 0; i < 3; ++i) {
+    if (n[i] < 2 || hi[i] <= lo[i]) {
+      fprintf(stderr,"ik_grid_gen: need at least 2 nodes and max > min on every axis.\n");
+      return 1;
+    }
+  }
+
+  nnodes = (size_t)n[0]*n[1]*n[2];
+  len = sizeof(ik_grid_header) + nnodes*sizeof(ik_grid_node);
+  if ((fd = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+    perror("ik_grid_gen: open");
+    return 1;
+  }
+  if (ftruncate(fd, len) < 0) {
+    perror("ik_grid_gen: ftruncate");
+    return 1;
+  }
+  map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    perror("ik_grid_gen: mmap");
+    return 1;
+  }
+
+  hdr = map;
+  memcpy(hdr->magic, IK_GRID_MAGIC, sizeof(hdr->magic));
+  hdr->version = IK_GRID_VERSION;
+  hdr->nodeSize = sizeof(ik_grid_node);
+  for (i = 0; i < 3; ++i) {
+    hdr->n[i] = n[i];
+    hdr->origin[i] = lo[i];
+    hdr->step[i] = (hi[i] - lo[i])/(n[i] - 1);
+  }
+  ik_grid_geometry(hdr->geometry);
+
+  ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  if (ncpu < 1) ncpu = 1;
+  if (ncpu > MAX_THREADS) ncpu = MAX_THREADS;
+  printf("Solving %u x %u x %u grid (%s kernels, %ld threads)...\n",n[0],n[1],n[2],kin_batch_isa(),ncpu);
+
+  for (i = 0; i < ncpu; ++i) {
+    jobs[i].hdr = hdr;
+    jobs[i].nodes = (ik_grid_node *)(hdr + 1);
+    jobs[i].first = i;
+    jobs[i].stride = ncpu;
+    jobs[i].nreach = 0;
+    if (pthread_create(&threads[i], NULL, &gen_thread, &jobs[i])) {
+      fprintf(stderr,"ik_grid_gen: thread creation failed.\n");
+      return 1;
+    }
+  }
+  for (i = 0; i < ncpu; ++i) {
+    pthread_join(threads[i], NULL);
+    nreach += jobs[i].nreach;
+  }
+
+  msync(map, len, MS_SYNC);
+  munmap(map, len);
+  close(fd);
+
+  printf("Wrote %s: %zu of %zu nodes reachable, %zu bytes.\n",argv[1],nreach,nnodes,len);
+  return 0;
+}
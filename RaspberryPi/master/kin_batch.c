@@ -0,0 +1,343 @@
+// kin_batch.c
+// Batch forward and inverse kinematics over struct-of-arrays buffers.
+//
+// The math is the same as geomFK() and subchainIK() in kinematic.c, written
+// with the vector operations from kin_simd.h so that KIN_SIMD_WIDTH points are
+// solved per pass, without branches. Each point is also checked by running FK
+// along all three open subchains and measuring how far the chains' foot
+// positions land from the solution (the loop-closure error).
+
+#include <math.h>
+#include <stdint.h>
+
+#include "kin_batch.h"
+#include "kin_simd.h"
+
+#define W KIN_SIMD_WIDTH
+
+#define PI_F 3.14159265f
+#define DEGENERATE_EPS 1e-12f  // squared distance (m^2) treated as zero
+
+// flags for each of the W lanes, from lane masks:
+static size_t store_flags(uint8_t *flags, size_t nlanes, vm unreach, vm degen, vm inacc) {
+  unsigned u = vm_bits(unreach);
+  unsigned d = vm_bits(degen);
+  unsigned a = vm_bits(inacc);
+  size_t l, nfail = 0;
+  uint8_t f;
+
+  for (l = 0; l < nlanes; ++l) {
+    f = (((u >> l) & 1) ? KIN_BATCH_UNREACHABLE : 0)
+      | (((d >> l) & 1) ? KIN_BATCH_DEGENERATE : 0)
+      | (((a >> l) & 1) ? KIN_BATCH_INACCURATE : 0);
+    if (flags) {
+      flags[l] = f;
+    }
+    nfail += (f != KIN_BATCH_OK);
+  }
+  return nfail;
+}
+
+// distance between (x1, y1) and (x2, y2):
+static inline vf vf_dist(vf x1, vf y1, vf x2, vf y2) {
+  vf dx = vf_sub(x1, x2);
+  vf dy = vf_sub(y1, y2);
+  return vf_sqrt(vf_madd(dx, dx, vf_mul(dy, dy)));
+}
+
+/******************************************************************************
+* Forward kinematics
+*
+* in:  qa (3 rows), out: qu (6 rows), footPose (3 rows); row k of a buffer
+* starts at buf + k*stride.
+******************************************************************************/
+static size_t geomFK_block(const float *qa, float *qu, float *pose, size_t stride,
+  size_t nlanes, uint8_t solOption, float *err, uint8_t *flags) {
+  const vf zero = vf_set1(0.0f);
+  const vf pi = vf_set1(PI_F);
+  const vf twopi = vf_set1(2*PI_F);
+  // branch signs, see geomFK():
+  const vf sgnA = vf_set1((solOption == 1 || solOption == 2) ? 1.0f : -1.0f);
+  const vf sgnuA = vf_set1((solOption == 1 || solOption == 3) ? 1.0f : -1.0f);
+
+  vf th1, ph1, ps1, s0, c0, s1, c1, s2, c2;
+  vf xkth, ykth, xkps, ykps, xkph, ykph;
+  vf dx, dy, a2, a, b, c, ba, ca, xA, yA;
+  vf ex, ey, d2, d, e, f, ed, fd, xuA, yuA;
+  vf xAp, yAp, bth, bph, bps, fang, cf, sf, xF, yF;
+  vf sm, cm, ethe, ephi, epsi, emax;
+  vm unreach, degen, inacc;
+
+  th1 = vf_load(qa);
+  ph1 = vf_load(qa + stride);
+  ps1 = vf_load(qa + 2*stride);
+  vf_sincos(th1, &s0, &c0);
+  vf_sincos(ph1, &s1, &c1);
+  vf_sincos(ps1, &s2, &c2);
+
+  // lower ankle from the theta- and psi-chain "knees":
+  xkth = vf_madd(vf_set1(KG(L1)), c0, vf_set1(-KG(B1X)));
+  ykth = vf_madd(vf_set1(KG(L1)), s0, vf_set1(KG(B1Y)));
+  xkps = vf_madd(vf_set1(KG(L5)), c2, vf_set1(KG(B2X)));
+  ykps = vf_madd(vf_set1(KG(L5)), s2, vf_set1(KG(B2Y)));
+
+  dx = vf_sub(xkps, xkth);
+  dy = vf_sub(ykps, ykth);
+  a2 = vf_madd(dx, dx, vf_mul(dy, dy));
+  degen = vf_lt(a2, vf_set1(DEGENERATE_EPS));
+  a = vf_sqrt(vf_max(a2, vf_set1(DEGENERATE_EPS)));
+  b = vf_div(vf_add(vf_set1(KG(L26sqDiff)), a2), vf_add(a, a));
+  c = vf_sub(vf_set1(KG(L2sq)), vf_mul(b, b));
+  unreach = vf_lt(c, zero);
+  c = vf_sqrt(vf_max(c, zero));
+  ba = vf_div(b, a);
+  ca = vf_mul(sgnA, vf_div(c, a));
+  xA = vf_add(vf_add(vf_mul(ba, dx), vf_mul(ca, dy)), xkth);
+  yA = vf_add(vf_sub(vf_mul(ba, dy), vf_mul(ca, dx)), ykth);
+
+  // upper ankle from the phi-chain "knee" and the lower ankle:
+  xkph = vf_mul(vf_set1(KG(L3)), c1);
+  ykph = vf_mul(vf_set1(KG(L3)), s1);
+
+  ex = vf_sub(xA, xkph);
+  ey = vf_sub(yA, ykph);
+  d2 = vf_madd(ex, ex, vf_mul(ey, ey));
+  degen = vm_or(degen, vf_lt(d2, vf_set1(DEGENERATE_EPS)));
+  d = vf_sqrt(vf_max(d2, vf_set1(DEGENERATE_EPS)));
+  e = vf_div(vf_add(vf_set1(KG(L47sqDiff)), d2), vf_add(d, d));
+  f = vf_sub(vf_set1(KG(L4sq)), vf_mul(e, e));
+  unreach = vm_or(unreach, vf_lt(f, zero));
+  f = vf_sqrt(vf_max(f, zero));
+  ed = vf_div(e, d);
+  fd = vf_mul(sgnuA, vf_div(f, d));
+  xuA = vf_add(vf_sub(vf_mul(ed, ex), vf_mul(fd, ey)), xkph);
+  yuA = vf_add(vf_add(vf_mul(ed, ey), vf_mul(fd, ex)), ykph);
+
+  // "knee" angles:
+  xAp = vf_add(vf_set1(KG(B1X)), xA);
+  yAp = vf_sub(vf_set1(KG(B1Y)), yA);
+  bth = vf_sub(pi, vf_acos(vf_div(
+    vf_sub(vf_set1(KG(L12sqSum)), vf_madd(xAp, xAp, vf_mul(yAp, yAp))), vf_set1(KG(L12x2)))));
+  bph = vf_sub(pi, vf_acos(vf_div(
+    vf_sub(vf_set1(KG(L34sqSum)), vf_madd(xuA, xuA, vf_mul(yuA, yuA))), vf_set1(KG(L34x2)))));
+  xAp = vf_sub(vf_set1(KG(B2X)), xA);
+  yAp = vf_sub(vf_set1(KG(B2Y)), yA);
+  bps = vf_sub(vf_acos(vf_div(
+    vf_sub(vf_set1(KG(L56sqSum)), vf_madd(xAp, xAp, vf_mul(yAp, yAp))), vf_set1(KG(L56x2)))), pi);
+
+  // foot pose:
+  fang = vf_add(pi, vf_atan2(vf_sub(yuA, yA), vf_sub(xuA, xA)));
+  cf = vf_mul(vf_sub(xA, xuA), vf_set1(KG(invL7)));
+  sf = vf_mul(vf_sub(yA, yuA), vf_set1(KG(invL7)));
+  xF = vf_madd(vf_set1(KG(L8)), cf, xA);
+  yF = vf_madd(vf_set1(KG(L8)), sf, yA);
+
+  vf_store(pose, xF);
+  vf_store(pose + stride, yF);
+  vf_store(pose + 2*stride, fang);
+
+  vf_store(qu, bth);
+  vf_store(qu + stride, vf_sub(vf_sub(vf_sub(fang, th1), bth), twopi));
+  vf_store(qu + 2*stride, bph);
+  vf_store(qu + 3*stride, vf_sub(vf_sub(vf_sub(fang, ph1), bph), twopi));
+  vf_store(qu + 4*stride, bps);
+  vf_store(qu + 5*stride, vf_sub(vf_sub(vf_sub(fang, ps1), bps), twopi));
+
+  // loop closure: foot position along each open subchain, from the angles
+  vf_sincos(vf_add(th1, bth), &sm, &cm);
+  ethe = vf_dist(vf_madd(vf_set1(KG(L8)), cf, vf_madd(vf_set1(KG(L2)), cm, xkth)),
+                 vf_madd(vf_set1(KG(L8)), sf, vf_madd(vf_set1(KG(L2)), sm, ykth)), xF, yF);
+  vf_sincos(vf_add(ph1, bph), &sm, &cm);
+  ephi = vf_dist(vf_madd(vf_set1(KG(L78)), cf, vf_madd(vf_set1(KG(L4)), cm, xkph)),
+                 vf_madd(vf_set1(KG(L78)), sf, vf_madd(vf_set1(KG(L4)), sm, ykph)), xF, yF);
+  vf_sincos(vf_add(ps1, bps), &sm, &cm);
+  epsi = vf_dist(vf_madd(vf_set1(KG(L8)), cf, vf_madd(vf_set1(KG(L6)), cm, xkps)),
+                 vf_madd(vf_set1(KG(L8)), sf, vf_madd(vf_set1(KG(L6)), sm, ykps)), xF, yF);
+  emax = vf_max(ethe, vf_max(ephi, epsi));
+  // NaN never compares greater, so test "not within tolerance":
+  inacc = vf_neq(vf_min(emax, vf_set1(KIN_BATCH_TOL)), emax);
+  if (err) {
+    vf_store(err, emax);
+  }
+
+  return store_flags(flags, nlanes, unreach, degen, inacc);
+}
+
+/******************************************************************************
+* Inverse kinematics
+*
+* in:  footPose (3 rows), out: qa (3 rows), qu (6 rows)
+******************************************************************************/
+
+// one open subchain's planar 2R IK: hip-to-ankle vector (x, y), link lengths
+// l1, l2 given as l1^2 - l2^2, 2*l1, l1^2 + l2^2 and 2*l1*l2; returns the
+// hip-to-ankle distance r and the two cosines the acos()'s are taken of,
+// flagging unreachable lanes.
+static inline void chain2R(vf x, vf y, float sqDiff, float twoL1, float sqSum,
+  float twoL1L2, vf *r, vf *calpha, vf *cbeta, vm *unreach, vm *degen) {
+  vf r2 = vf_madd(x, x, vf_mul(y, y));
+
+  *degen = vm_or(*degen, vf_lt(r2, vf_set1(DEGENERATE_EPS)));
+  *r = vf_sqrt(vf_max(r2, vf_set1(DEGENERATE_EPS)));
+  *calpha = vf_div(vf_add(r2, vf_set1(sqDiff)), vf_mul(vf_set1(twoL1), *r));
+  *cbeta = vf_div(vf_sub(vf_set1(sqSum), r2), vf_set1(twoL1L2));
+  *unreach = vm_or(*unreach, vf_gt(vf_abs(*calpha), vf_set1(1.0f)));
+  *unreach = vm_or(*unreach, vf_gt(vf_abs(*cbeta), vf_set1(1.0f)));
+}
+
+static size_t subchainIK_block(const float *pose, float *qa, float *qu, size_t stride,
+  size_t nlanes, float *err, uint8_t *flags) {
+  const vf pi = vf_set1(PI_F);
+  const vf twopi = vf_set1(2*PI_F);
+
+  vf xF, yF, angF, sa, ca, xA, yA, xAu, yAu, xAp, yAp, r, calpha, cbeta;
+  vf q1, q2, s1, c1, s12, c12, ethe, ephi, epsi, emax;
+  vm unreach, degen, inacc;
+
+  xF = vf_load(pose);
+  yF = vf_load(pose + stride);
+  angF = vf_load(pose + 2*stride);
+  vf_sincos(angF, &sa, &ca);
+
+  xA = vf_madd(vf_set1(-KG(L8)), ca, xF);
+  yA = vf_madd(vf_set1(-KG(L8)), sa, yF);
+  xAu = vf_madd(vf_set1(-KG(L78)), ca, xF);
+  yAu = vf_madd(vf_set1(-KG(L78)), sa, yF);
+
+  unreach = vf_lt(xF, xF); // all false
+  degen = unreach;
+
+  // theta-chain:
+  xAp = vf_add(vf_set1(KG(B1X)), xA);
+  yAp = vf_sub(vf_set1(KG(B1Y)), yA);
+  chain2R(xAp, yAp, KG(L12sqDiff), 2*KG(L1), KG(L12sqSum), KG(L12x2), &r, &calpha, &cbeta, &unreach, &degen);
+  q1 = vf_neg(vf_add(vf_atan2(yAp, xAp), vf_acos(calpha)));
+  q2 = vf_sub(pi, vf_acos(cbeta));
+  vf_store(qa, q1);
+  vf_store(qu, q2);
+  vf_store(qu + stride, vf_sub(vf_sub(vf_sub(angF, q1), q2), twopi));
+  vf_sincos(q1, &s1, &c1);
+  vf_sincos(vf_add(q1, q2), &s12, &c12);
+  ethe = vf_dist(vf_madd(vf_set1(KG(L8)), ca, vf_madd(vf_set1(KG(L2)), c12, vf_madd(vf_set1(KG(L1)), c1, vf_set1(-KG(B1X))))),
+                 vf_madd(vf_set1(KG(L8)), sa, vf_madd(vf_set1(KG(L2)), s12, vf_madd(vf_set1(KG(L1)), s1, vf_set1(KG(B1Y))))), xF, yF);
+
+  // phi-chain (hip at the origin):
+  chain2R(xAu, yAu, KG(L34sqDiff), 2*KG(L3), KG(L34sqSum), KG(L34x2), &r, &calpha, &cbeta, &unreach, &degen);
+  q1 = vf_neg(vf_add(vf_abs(vf_atan2(yAu, xAu)), vf_acos(calpha)));
+  q2 = vf_sub(pi, vf_acos(cbeta));
+  vf_store(qa + stride, q1);
+  vf_store(qu + 2*stride, q2);
+  vf_store(qu + 3*stride, vf_sub(vf_sub(vf_sub(angF, q1), q2), twopi));
+  vf_sincos(q1, &s1, &c1);
+  vf_sincos(vf_add(q1, q2), &s12, &c12);
+  ephi = vf_dist(vf_madd(vf_set1(KG(L78)), ca, vf_madd(vf_set1(KG(L4)), c12, vf_mul(vf_set1(KG(L3)), c1))),
+                 vf_madd(vf_set1(KG(L78)), sa, vf_madd(vf_set1(KG(L4)), s12, vf_mul(vf_set1(KG(L3)), s1))), xF, yF);
+
+  // psi-chain:
+  xAp = vf_sub(vf_set1(KG(B2X)), xA);
+  yAp = vf_sub(vf_set1(KG(B2Y)), yA);
+  chain2R(xAp, yAp, KG(L56sqDiff), 2*KG(L5), KG(L56sqSum), KG(L56x2), &r, &calpha, &cbeta, &unreach, &degen);
+  q1 = vf_sub(vf_add(vf_abs(vf_atan2(yAp, xAp)), vf_acos(calpha)), pi);
+  q2 = vf_sub(vf_acos(cbeta), pi);
+  vf_store(qa + 2*stride, q1);
+  vf_store(qu + 4*stride, q2);
+  vf_store(qu + 5*stride, vf_sub(vf_sub(vf_sub(angF, q1), q2), twopi));
+  vf_sincos(q1, &s1, &c1);
+  vf_sincos(vf_add(q1, q2), &s12, &c12);
+  epsi = vf_dist(vf_madd(vf_set1(KG(L8)), ca, vf_madd(vf_set1(KG(L6)), c12, vf_madd(vf_set1(KG(L5)), c1, vf_set1(KG(B2X))))),
+                 vf_madd(vf_set1(KG(L8)), sa, vf_madd(vf_set1(KG(L6)), s12, vf_madd(vf_set1(KG(L5)), s1, vf_set1(KG(B2Y))))), xF, yF);
+
+  emax = vf_max(ethe, vf_max(ephi, epsi));
+  inacc = vf_neq(vf_min(emax, vf_set1(KIN_BATCH_TOL)), emax);
+  if (err) {
+    vf_store(err, emax);
+  }
+
+  return store_flags(flags, nlanes, unreach, degen, inacc);
+}
+
+/******************************************************************************
+* Drivers: full vectors straight from the caller's buffers, then the last
+* n % W points through zero-padded scratch buffers.
+******************************************************************************/
+size_t geomFK_batch(const float *qa_soa, size_t n, float *qu_soa,
+  float *footPose_soa, uint8_t solOption, float *err, uint8_t *flags) {
+  float in[3*W], qu[6*W], pose[3*W], e[W];
+  size_t i, k, l, rem, nfail = 0;
+
+  for (i = 0; i + W <= n; i += W) {
+    nfail += geomFK_block(qa_soa + i, qu_soa + i, footPose_soa + i, n, W, solOption,
+      err ? err + i : NULL, flags ? flags + i : NULL);
+  }
+
+  rem = n - i;
+  if (rem) {
+    for (k = 0; k < 3; ++k)
+      for (l = 0; l < W; ++l)
+        in[k*W + l] = qa_soa[k*n + i + (l < rem ? l : 0)];
+    nfail += geomFK_block(in, qu, pose, W, rem, solOption, e, flags ? flags + i : NULL);
+    for (l = 0; l < rem; ++l) {
+      for (k = 0; k < 6; ++k)
+        qu_soa[k*n + i + l] = qu[k*W + l];
+      for (k = 0; k < 3; ++k)
+        footPose_soa[k*n + i + l] = pose[k*W + l];
+      if (err)
+        err[i + l] = e[l];
+    }
+  }
+
+  return nfail;
+}
+
+size_t subchainIK_batch(const float *footPose_soa, size_t n, float *qa_soa,
+  float *qu_soa, float *err, uint8_t *flags) {
+  float in[3*W], qa[3*W], qu[6*W], e[W];
+  size_t i, k, l, rem, nfail = 0;
+
+  for (i = 0; i + W <= n; i += W) {
+    nfail += subchainIK_block(footPose_soa + i, qa_soa + i, qu_soa + i, n, W,
+      err ? err + i : NULL, flags ? flags + i : NULL);
+  }
+
+  rem = n - i;
+  if (rem) {
+    for (k = 0; k < 3; ++k)
+      for (l = 0; l < W; ++l)
+        in[k*W + l] = footPose_soa[k*n + i + (l < rem ? l : 0)];
+    nfail += subchainIK_block(in, qa, qu, W, rem, e, flags ? flags + i : NULL);
+    for (l = 0; l < rem; ++l) {
+      for (k = 0; k < 3; ++k)
+        qa_soa[k*n + i + l] = qa[k*W + l];
+      for (k = 0; k < 6; ++k)
+        qu_soa[k*n + i + l] = qu[k*W + l];
+      if (err)
+        err[i + l] = e[l];
+    }
+  }
+
+  return nfail;
+}
+
+void kin_aos2soa(float *soa, float aos[][3], size_t n) {
+  size_t i;
+
+  for (i = 0; i < n; ++i) {
+    soa[i] = aos[i][0];
+    soa[n + i] = aos[i][1];
+    soa[2*n + i] = aos[i][2];
+  }
+}
+
+void kin_soa2aos(float aos[][3], const float *soa, size_t n) {
+  size_t i;
+
+  for (i = 0; i < n; ++i) {
+    aos[i][0] = soa[i];
+    aos[i][1] = soa[n + i];
+    aos[i][2] = soa[2*n + i];
+  }
+}
+
+const char *kin_batch_isa(void) {
+  return KIN_SIMD_NAME;
+}
@@ -0,0 +1,50 @@
+#ifndef __KIN_BATCH__H__
+#define __KIN_BATCH__H__
+// Header file for kin_batch.c
+// Batch (whole-trajectory) forward and inverse kinematics.
+//
+// kin_batch.c evaluates the same closed-form solutions as geomFK() and
+// subchainIK() in kinematic.c, several points at a time, using the SIMD
+// kernels in kin_simd.h (NEON on the Pi, SSE2/AVX on x86, plain C otherwise).
+//
+// All buffers are struct-of-arrays: component k of point i lives at
+// buf[k*n + i]. E.g. qa_soa holds n theta1's, then n phi1's, then n psi1's.
+// kin_aos2soa() and kin_soa2aos() convert to and from float[][3] arrays such
+// as qaTraj.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kinematic.h"
+
+// per-point flags (bitwise OR):
+#define KIN_BATCH_OK          0x00
+#define KIN_BATCH_UNREACHABLE 0x01  // no assembly/solution exists for this point
+#define KIN_BATCH_DEGENERATE  0x02  // coincident joints, solution is undefined
+#define KIN_BATCH_INACCURATE  0x04  // loop-closure error exceeds KIN_BATCH_TOL
+
+#define KIN_BATCH_TOL 1e-5  // loop-closure tolerance, in meters
+
+/******************************************************************************
+* Function prototypes
+*
+* Each returns the number of points whose flags are not KIN_BATCH_OK.
+* err (per-point loop-closure error, meters) and flags may be NULL.
+******************************************************************************/
+
+// forward kinematics: qa_soa (3 x n) -> qu_soa (6 x n), footPose_soa (3 x n)
+size_t geomFK_batch(const float *qa_soa, size_t n, float *qu_soa,
+  float *footPose_soa, uint8_t solOption, float *err, uint8_t *flags);
+
+// inverse kinematics: footPose_soa (3 x n) -> qa_soa (3 x n), qu_soa (6 x n)
+size_t subchainIK_batch(const float *footPose_soa, size_t n, float *qa_soa,
+  float *qu_soa, float *err, uint8_t *flags);
+
+// layout conversion for 3-tuples:
+void kin_aos2soa(float *soa, float aos[][3], size_t n);
+void kin_soa2aos(float aos[][3], const float *soa, size_t n);
+
+// name of the instruction set the kernels were compiled for:
+const char *kin_batch_isa(void);
+
+#endif
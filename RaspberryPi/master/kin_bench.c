@@ -0,0 +1,465 @@
+// kin_bench.c
+// Micro-benchmarks for the kinematics in kinematic.c (replaces kin_test.c).
+//
+// usage: ./kin_bench [-n samples] [-r calls] [-p passes] [-c cpu]
+//                    [-o baseline file] [-b baseline file [-t tolerance %]]
+//
+// Each function is timed over n reachable workspace samples (foot poses
+// drawn around the standing pose and solved with subchainIK()). One timing
+// covers r back-to-back calls on the same sample, read with
+// clock_gettime(CLOCK_MONOTONIC_RAW), minus the cost of reading the clock;
+// the distribution of ns/call over all samples and passes is reported as
+// min/median/p99/max. Cycles/call come from the CPU cycle counter
+// (perf_event_open) over a separate untimed run, or, where that is not
+// allowed, from the median and the current CPU clock ("est").
+//
+// -o writes the results as a baseline file; -b compares against one and
+// exits with 1 if any median got slower by more than the tolerance
+// (default 10%). Pin to an idle core (-c) and use the "performance" cpufreq
+// governor for repeatable numbers.
+//
+// compile with
+// make kin_bench
+
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <math.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kinematic.h"
+
+#define PI 3.14159265
+
+#define BENCH_VERSION 1
+#define DEFAULT_SAMPLES 4096
+#define DEFAULT_CALLS 8
+#define DEFAULT_PASSES 5
+#define DEFAULT_TOL 10.0
+#define MAX_DRAWS 100    // foot pose draws per sample before giving up
+#define NR_TICK 1e-3     // qa step (rad) between the warm start and nrFK's qa
+
+// workspace samples, drawn once:
+static size_t nsamp;
+static float (*sQa)[3], (*sQu)[6], (*sPose)[3];
+static float (*sQuPrev)[6];          // qu one control tick earlier, for nrFK
+static double (*sTwist)[3], (*sWrench)[3];
+static kin_state *sKs;               // kin_state at each sample
+
+// outputs, kept live so no call can be optimized away:
+static float oQa[3], oQu[6], oPose[3];
+static double oJa[9], oVec[3];
+static kin_state oKs;
+static volatile double sink;
+
+/******************************************************************************
+* Benchmarked calls
+******************************************************************************/
+static void b_geomFK(size_t i) {
+  geomFK(sQa[i], oQu, oPose, 1);
+}
+
+static void b_subchainIK(size_t i) {
+  subchainIK(oQa, oQu, sPose[i]);
+}
+
+static void b_actuatorJacobian(size_t i) {
+  actuatorJacobian(oJa, sQa[i], sQu[i], 0);
+}
+
+static void b_twist2vels(size_t i) {
+  twist2vels(sQa[i], sQu[i], oVec, sTwist[i]);
+}
+
+static void b_wrench2torques(size_t i) {
+  wrench2torques(sQa[i], sQu[i], oVec, sWrench[i]);
+}
+
+static void b_nrFK(size_t i) {
+  memcpy(oQu, sQuPrev[i], sizeof(oQu));
+  nrFK(sQa[i], oQu, oPose);
+}
+
+static void b_kin_state_update(size_t i) {
+  kin_state_update(&oKs, sQa[i], 1);
+}
+
+static void b_kin_state_wrench2torques(size_t i) {
+  kin_state_wrench2torques(&sKs[i], oVec, sWrench[i]);
+}
+
+typedef struct {
+  const char *name;
+  void (*call)(size_t i);
+  // results:
+  double min, median, p99, max;  // ns/call
+  double cycles;                 // cycles/call, < 0 if unknown
+  uint8_t cyclesEst;             // cycles estimated from the CPU clock
+} bench;
+
+static bench benches[] = {
+  {.name = "geomFK", .call = b_geomFK},
+  {.name = "subchainIK", .call = b_subchainIK},
+  {.name = "actuatorJacobian", .call = b_actuatorJacobian},
+  {.name = "twist2vels", .call = b_twist2vels},
+  {.name = "wrench2torques", .call = b_wrench2torques},
+  {.name = "nrFK", .call = b_nrFK},
+  {.name = "kin_state_update", .call = b_kin_state_update},
+  {.name = "kin_state_wrench2torques", .call = b_kin_state_wrench2torques},
+};
+#define NBENCH (sizeof(benches)/sizeof(benches[0]))
+
+/******************************************************************************
+* Workspace samples
+******************************************************************************/
+
+// xorshift32, so every run (and every machine) draws the same samples:
+static uint32_t rng = 2463534242u;
+static double uniform(double lo, double hi) {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return lo + (hi - lo)*(rng/4294967296.0);
+}
+
+static int8_t draw_samples(size_t n) {
+  size_t i, k, tries;
+  float pose[3], fk[3], qu[6], qaPrev[3];
+  double Ja[9];
+
+  sQa = malloc(n*sizeof(*sQa));
+  sQu = malloc(n*sizeof(*sQu));
+  sPose = malloc(n*sizeof(*sPose));
+  sQuPrev = malloc(n*sizeof(*sQuPrev));
+  sTwist = malloc(n*sizeof(*sTwist));
+  sWrench = malloc(n*sizeof(*sWrench));
+  sKs = calloc(n, sizeof(*sKs));
+  if (!sQa || !sQu || !sPose || !sQuPrev || !sTwist || !sWrench || !sKs) {
+    fprintf(stderr,"kin_bench: out of memory.\n");
+    return 1;
+  }
+
+  for (i = 0; i < n; ++i) {
+    for (tries = 0; tries < MAX_DRAWS; ++tries) {
+      // around the standing pose (foot 0.22 m below the hips, pointing down):
+      pose[0] = uniform(-0.06, 0.06);
+      pose[1] = uniform(-0.26, -0.17);
+      pose[2] = uniform(1.5*PI - 0.3, 1.5*PI + 0.3);
+      subchainIK(sQa[i], sQu[i], pose);
+      if (isnan(sQa[i][0]) || isnan(sQa[i][1]) || isnan(sQa[i][2])) continue;
+
+      // keep the sample only if FK lands back on it and Ja is regular:
+      geomFK(sQa[i], qu, fk, 1);
+      if (!(fabsf(fk[0] - pose[0]) < 1e-4 && fabsf(fk[1] - pose[1]) < 1e-4)) continue;
+      if (actuatorJacobian(Ja, sQa[i], qu, 0)) continue;
+      memcpy(sQu[i], qu, sizeof(qu));
+      memcpy(sPose[i], fk, sizeof(fk));
+      break;
+    }
+    if (tries == MAX_DRAWS) {
+      fprintf(stderr,"kin_bench: could not find reachable workspace samples.\n");
+      return 1;
+    }
+
+    for (k = 0; k < 3; ++k) {
+      qaPrev[k] = sQa[i][k] - NR_TICK*uniform(-1, 1);
+      sTwist[i][k] = uniform(-1, 1);
+      sWrench[i][k] = uniform(-1, 1);
+    }
+    geomFK(qaPrev, sQuPrev[i], fk, 1);
+    kin_state_update(&sKs[i], sQa[i], 1);
+  }
+
+  nsamp = n;
+  return 0;
+}
+
+/******************************************************************************
+* Timing
+******************************************************************************/
+static inline int64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (int64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// median cost of one now_ns() pair, subtracted from every timing:
+static double clock_overhead(void) {
+  double t[1001];
+  int64_t t0;
+  int i;
+
+  for (i = 0; i < 1001; ++i) {
+    t0 = now_ns();
+    t[i] = now_ns() - t0;
+  }
+  qsort(t, 1001, sizeof(double), cmp_double);
+  return t[500];
+}
+
+// CPU cycle counter of this thread, -1 if the kernel does not allow it:
+static int open_cycle_counter(void) {
+  struct perf_event_attr pe;
+
+  memset(&pe, 0, sizeof(pe));
+  pe.type = PERF_TYPE_HARDWARE;
+  pe.size = sizeof(pe);
+  pe.config = PERF_COUNT_HW_CPU_CYCLES;
+  pe.disabled = 1;
+  pe.exclude_kernel = 1;
+  pe.exclude_hv = 1;
+  return syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+}
+
+// current clock of the CPU we run on, in GHz (0 if unknown); cpufreq on the
+// Pi, /proc/cpuinfo on x86 boxes without cpufreq:
+static double cpu_ghz(void) {
+  char path[96], line[256];
+  FILE *fp;
+  long khz = 0;
+  double mhz = 0;
+  int cpu = sched_getcpu();
+
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", cpu < 0 ? 0 : cpu);
+  if ((fp = fopen(path, "r"))) {
+    if (fscanf(fp, "%ld", &khz) != 1) khz = 0;
+    fclose(fp);
+  }
+  if (khz > 0) {
+    return khz/1e6;
+  }
+  if ((fp = fopen("/proc/cpuinfo", "r"))) {
+    while (fgets(line, sizeof(line), fp)) {
+      if (!strncmp(line, "cpu MHz", 7) && sscanf(strchr(line, ':') + 1, "%lf", &mhz) == 1) break;
+    }
+    fclose(fp);
+  }
+  return mhz/1e3;
+}
+
+static void run_bench(bench *b, uint32_t calls, uint32_t passes, double overhead,
+  double *t, int cycleFd) {
+  size_t i, n = 0;
+  uint32_t p, r;
+  int64_t t0;
+  long long cycles;
+  double ghz;
+
+  // warm-up pass (caches, branch predictors, cpufreq ramp-up):
+  for (i = 0; i < nsamp; ++i)
+    for (r = 0; r < calls; ++r) b->call(i);
+
+  for (p = 0; p < passes; ++p) {
+    for (i = 0; i < nsamp; ++i) {
+      t0 = now_ns();
+      for (r = 0; r < calls; ++r) b->call(i);
+      t[n] = (now_ns() - t0 - overhead)/calls;
+      if (t[n] < 0) t[n] = 0;
+      ++n;
+    }
+  }
+  sink += oPose[0] + oQa[0] + oJa[0] + oVec[0] + oKs.Ja[0];
+
+  qsort(t, n, sizeof(double), cmp_double);
+  b->min = t[0];
+  b->median = t[n/2];
+  b->p99 = t[(size_t)(0.99*(n - 1))];
+  b->max = t[n - 1];
+
+  b->cycles = -1;
+  b->cyclesEst = 0;
+  if (cycleFd >= 0) {
+    ioctl(cycleFd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(cycleFd, PERF_EVENT_IOC_ENABLE, 0);
+    for (i = 0; i < nsamp; ++i)
+      for (r = 0; r < calls; ++r) b->call(i);
+    ioctl(cycleFd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(cycleFd, &cycles, sizeof(cycles)) == sizeof(cycles) && cycles > 0) {
+      b->cycles = (double)cycles/(nsamp*calls);
+    }
+  }
+  if (b->cycles < 0 && (ghz = cpu_ghz()) > 0) {
+    b->cycles = b->median*ghz;
+    b->cyclesEst = 1;
+  }
+}
+
+/******************************************************************************
+* Baseline files
+*
+* '#' lines describe the machine and build; every other line is
+*   <function> <min ns> <median ns> <p99 ns> <max ns> <cycles/call or -1>
+******************************************************************************/
+static void describe_build(char *buf, size_t len) {
+  struct utsname u;
+  char line[256], model[128] = "unknown";
+  FILE *fp;
+
+  // x86 says "model name", the Pi's kernel says "Model" (or only "Hardware"):
+  if ((fp = fopen("/proc/cpuinfo", "r"))) {
+    while (fgets(line, sizeof(line), fp)) {
+      if (!strncmp(line, "model name", 10) || !strncmp(line, "Model", 5) || !strncmp(line, "Hardware", 8)) {
+        char *v = strchr(line, ':');
+        if (v) {
+          snprintf(model, sizeof(model), "%s", v + 2);
+          model[strcspn(model, "\n")] = 0;
+          if (line[0] != 'H') break;
+        }
+      }
+    }
+    fclose(fp);
+  }
+  uname(&u);
+  snprintf(buf, len, "# machine: %s %s, %s\n# build: %s, %s geometry\n",
+    u.machine, u.release, model,
+#ifdef __OPTIMIZE__
+    "optimized",
+#else
+    "not optimized",
+#endif
+#ifdef HOPPER_FIXED_GEOMETRY
+    "fixed"
+#else
+    "runtime"
+#endif
+    );
+}
+
+static int8_t write_baseline(const char *path, const char *build, uint32_t calls, uint32_t passes) {
+  FILE *fp = fopen(path, "w");
+  size_t k;
+
+  if (!fp) {
+    perror("kin_bench: baseline");
+    return 1;
+  }
+  fprintf(fp, "# kin_bench baseline v%d\n%s", BENCH_VERSION, build);
+  fprintf(fp, "# samples %zu, calls/timing %u, passes %u\n", nsamp, calls, passes);
+  for (k = 0; k < NBENCH; ++k) {
+    fprintf(fp, "%s %.2f %.2f %.2f %.2f %.1f\n", benches[k].name, benches[k].min,
+      benches[k].median, benches[k].p99, benches[k].max, benches[k].cycles);
+  }
+  fclose(fp);
+  return 0;
+}
+
+// returns the number of functions whose median regressed by more than tol %:
+static int compare_baseline(const char *path, const char *build, double tol) {
+  FILE *fp = fopen(path, "r");
+  char line[256], name[64], oldBuild[512] = "";
+  double mn, med, p99, mx, cyc, d;
+  int nworse = 0;
+  size_t k;
+
+  if (!fp) {
+    perror("kin_bench: baseline");
+    return -1;
+  }
+  printf("\nagainst %s (median and p99 change, + is slower):\n", path);
+  while (fgets(line, sizeof(line), fp)) {
+    if (line[0] == '#') {
+      if (!strncmp(line, "# machine", 9) || !strncmp(line, "# build", 7)) {
+        strncat(oldBuild, line, sizeof(oldBuild) - strlen(oldBuild) - 1);
+      }
+      continue;
+    }
+    if (sscanf(line, "%63s %lf %lf %lf %lf %lf", name, &mn, &med, &p99, &mx, &cyc) != 6) continue;
+    for (k = 0; k < NBENCH && strcmp(benches[k].name, name); ++k);
+    if (k == NBENCH) continue;
+    d = 100*(benches[k].median - med)/med;
+    printf("%-26s %+7.1f%% %+7.1f%%%s\n", name, d, 100*(benches[k].p99 - p99)/p99,
+      d > tol ? "  REGRESSION" : "");
+    nworse += (d > tol);
+  }
+  fclose(fp);
+  if (strcmp(oldBuild, build)) {
+    printf("note: the baseline was taken on a different machine or build:\n%s", oldBuild);
+  }
+  return nworse;
+}
+
+int main(int argc, char **argv) {
+  size_t n = DEFAULT_SAMPLES;
+  uint32_t calls = DEFAULT_CALLS, passes = DEFAULT_PASSES;
+  double tol = DEFAULT_TOL, overhead;
+  const char *outPath = NULL, *basePath = NULL;
+  char build[512];
+  double *t;
+  int opt, cpu = -1, cycleFd, nworse = 0;
+  size_t k;
+  cpu_set_t set;
+
+  while ((opt = getopt(argc, argv, "n:r:p:c:o:b:t:h")) != -1) {
+    switch (opt) {
+      case 'n': n = strtoul(optarg, NULL, 10); break;
+      case 'r': calls = strtoul(optarg, NULL, 10); break;
+      case 'p': passes = strtoul(optarg, NULL, 10); break;
+      case 'c': cpu = atoi(optarg); break;
+      case 'o': outPath = optarg; break;
+      case 'b': basePath = optarg; break;
+      case 't': tol = atof(optarg); break;
+      default:
+        fprintf(stderr,"usage: %s [-n samples] [-r calls] [-p passes] [-c cpu] [-o baseline] [-b baseline [-t tol%%]]\n",argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (n < 1 || calls < 1 || passes < 1) {
+    fprintf(stderr,"kin_bench: samples, calls and passes must be positive.\n");
+    return 1;
+  }
+
+  if (cpu >= 0) {
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set)) {
+      perror("kin_bench: sched_setaffinity");
+      return 1;
+    }
+  }
+
+  if (draw_samples(n)) return 1;
+  t = malloc(n*passes*sizeof(double));
+  if (!t) {
+    fprintf(stderr,"kin_bench: out of memory.\n");
+    return 1;
+  }
+  overhead = clock_overhead();
+  cycleFd = open_cycle_counter();
+  describe_build(build, sizeof(build));
+
+  printf("%s", build);
+  printf("# %zu workspace samples x %u passes, %u calls/timing, clock overhead %.0f ns, cycles from %s\n",
+    n, passes, calls, overhead, cycleFd >= 0 ? "the cycle counter"
+    : cpu_ghz() > 0 ? "median x CPU clock (est)" : "nowhere (no counter or CPU clock)");
+  printf("%-26s %9s %9s %9s %9s %12s\n", "function (ns/call)", "min", "median", "p99", "max", "cycles/call");
+  for (k = 0; k < NBENCH; ++k) {
+    run_bench(&benches[k], calls, passes, overhead, t, cycleFd);
+    printf("%-26s %9.1f %9.1f %9.1f %9.1f ", benches[k].name, benches[k].min,
+      benches[k].median, benches[k].p99, benches[k].max);
+    if (benches[k].cycles < 0) printf("%12s\n", "-");
+    else printf("%8.0f%s\n", benches[k].cycles, benches[k].cyclesEst ? " est" : "    ");
+  }
+
+  if (outPath && write_baseline(outPath, build, calls, passes)) return 1;
+  if (basePath) {
+    nworse = compare_baseline(basePath, build, tol);
+    if (nworse < 0) return 1;
+  }
+
+  if (cycleFd >= 0) close(cycleFd);
+  free(t);
+  return nworse > 0;
+}
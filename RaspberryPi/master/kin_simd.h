@@ -0,0 +1,282 @@
+#ifndef __KIN_SIMD__H__
+#define __KIN_SIMD__H__
+// Header file for the SIMD kernels used by kin_batch.c
+//
+// Wraps the handful of float vector operations the batch kinematics need, so
+// the kernels are written once and compiled for whichever instruction set the
+// build targets:
+//   ARM NEON (the Pi, build with -mfpu=neon)  4 lanes
+//   x86 AVX (build with -mavx)                8 lanes
+//   x86 SSE2 (any x86-64 build)               4 lanes
+//   plain C (anything else)                   1 lane
+//
+// Define KIN_SIMD_SCALAR to force the plain C path (e.g. to compare results).
+//
+// vf is a vector of floats, vm a lane mask (all bits set where true).
+// Do not build with -ffast-math: vf_round() relies on IEEE rounding.
+
+#include <stdint.h>
+#include <math.h>
+
+#if defined(KIN_SIMD_SCALAR)
+/* plain C, selected below */
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+/******************************************************************************
+* ARM NEON
+******************************************************************************/
+#include <arm_neon.h>
+
+#define KIN_SIMD_WIDTH 4
+#define KIN_SIMD_NAME "NEON"
+
+typedef float32x4_t vf;
+typedef uint32x4_t vm;
+
+static inline vf vf_set1(float x) { return vdupq_n_f32(x); }
+static inline vf vf_load(const float *p) { return vld1q_f32(p); }
+static inline void vf_store(float *p, vf a) { vst1q_f32(p, a); }
+static inline vf vf_add(vf a, vf b) { return vaddq_f32(a, b); }
+static inline vf vf_sub(vf a, vf b) { return vsubq_f32(a, b); }
+static inline vf vf_mul(vf a, vf b) { return vmulq_f32(a, b); }
+static inline vf vf_min(vf a, vf b) { return vminq_f32(a, b); }
+static inline vf vf_max(vf a, vf b) { return vmaxq_f32(a, b); }
+static inline vf vf_abs(vf a) { return vabsq_f32(a); }
+static inline vf vf_neg(vf a) { return vnegq_f32(a); }
+#if defined(__aarch64__)
+static inline vf vf_div(vf a, vf b) { return vdivq_f32(a, b); }
+static inline vf vf_sqrt(vf a) { return vsqrtq_f32(a); }
+#else
+// ARMv7 NEON has no divide or square root: refine the hardware estimates
+// with Newton-Raphson steps (two steps give ~full float precision).
+static inline vf vf_div(vf a, vf b) {
+  vf r = vrecpeq_f32(b);
+  r = vmulq_f32(vrecpsq_f32(b, r), r);
+  r = vmulq_f32(vrecpsq_f32(b, r), r);
+  return vmulq_f32(a, r);
+}
+static inline vf vf_sqrt(vf a) {
+  vf r = vrsqrteq_f32(a);
+  r = vmulq_f32(vrsqrtsq_f32(vmulq_f32(a, r), r), r);
+  r = vmulq_f32(vrsqrtsq_f32(vmulq_f32(a, r), r), r);
+  // rsqrt(0) is +inf, so patch sqrt(0) = 0 explicitly:
+  return vbslq_f32(vceqq_f32(a, vdupq_n_f32(0.0f)), a, vmulq_f32(a, r));
+}
+#endif
+static inline vm vf_lt(vf a, vf b) { return vcltq_f32(a, b); }
+static inline vm vf_gt(vf a, vf b) { return vcgtq_f32(a, b); }
+static inline vm vf_neq(vf a, vf b) { return vmvnq_u32(vceqq_f32(a, b)); }
+static inline vm vm_or(vm a, vm b) { return vorrq_u32(a, b); }
+static inline vm vm_and(vm a, vm b) { return vandq_u32(a, b); }
+static inline vf vf_select(vm m, vf a, vf b) { return vbslq_f32(m, a, b); }
+static inline unsigned vm_bits(vm m) { // one bit per lane, like movemask
+  static const uint32_t lane_bit[4] = {1, 2, 4, 8};
+  uint32x4_t b = vandq_u32(m, vld1q_u32(lane_bit));
+  uint32x2_t s = vpadd_u32(vget_low_u32(b), vget_high_u32(b));
+  s = vpadd_u32(s, s);
+  return vget_lane_u32(s, 0);
+}
+
+#elif defined(__AVX__)
+/******************************************************************************
+* x86 AVX
+******************************************************************************/
+#include <immintrin.h>
+
+#define KIN_SIMD_WIDTH 8
+#define KIN_SIMD_NAME "AVX"
+
+typedef __m256 vf;
+typedef __m256 vm;
+
+static inline vf vf_set1(float x) { return _mm256_set1_ps(x); }
+static inline vf vf_load(const float *p) { return _mm256_loadu_ps(p); }
+static inline void vf_store(float *p, vf a) { _mm256_storeu_ps(p, a); }
+static inline vf vf_add(vf a, vf b) { return _mm256_add_ps(a, b); }
+static inline vf vf_sub(vf a, vf b) { return _mm256_sub_ps(a, b); }
+static inline vf vf_mul(vf a, vf b) { return _mm256_mul_ps(a, b); }
+static inline vf vf_div(vf a, vf b) { return _mm256_div_ps(a, b); }
+static inline vf vf_sqrt(vf a) { return _mm256_sqrt_ps(a); }
+static inline vf vf_min(vf a, vf b) { return _mm256_min_ps(a, b); }
+static inline vf vf_max(vf a, vf b) { return _mm256_max_ps(a, b); }
+static inline vf vf_abs(vf a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+static inline vf vf_neg(vf a) { return _mm256_xor_ps(_mm256_set1_ps(-0.0f), a); }
+static inline vm vf_lt(vf a, vf b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline vm vf_gt(vf a, vf b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+static inline vm vf_neq(vf a, vf b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_UQ); }
+static inline vm vm_or(vm a, vm b) { return _mm256_or_ps(a, b); }
+static inline vm vm_and(vm a, vm b) { return _mm256_and_ps(a, b); }
+static inline vf vf_select(vm m, vf a, vf b) { return _mm256_blendv_ps(b, a, m); }
+static inline unsigned vm_bits(vm m) { return (unsigned)_mm256_movemask_ps(m); }
+
+#elif defined(__SSE2__)
+/******************************************************************************
+* x86 SSE2
+******************************************************************************/
+#include <emmintrin.h>
+
+#define KIN_SIMD_WIDTH 4
+#define KIN_SIMD_NAME "SSE2"
+
+typedef __m128 vf;
+typedef __m128 vm;
+
+static inline vf vf_set1(float x) { return _mm_set1_ps(x); }
+static inline vf vf_load(const float *p) { return _mm_loadu_ps(p); }
+static inline void vf_store(float *p, vf a) { _mm_storeu_ps(p, a); }
+static inline vf vf_add(vf a, vf b) { return _mm_add_ps(a, b); }
+static inline vf vf_sub(vf a, vf b) { return _mm_sub_ps(a, b); }
+static inline vf vf_mul(vf a, vf b) { return _mm_mul_ps(a, b); }
+static inline vf vf_div(vf a, vf b) { return _mm_div_ps(a, b); }
+static inline vf vf_sqrt(vf a) { return _mm_sqrt_ps(a); }
+static inline vf vf_min(vf a, vf b) { return _mm_min_ps(a, b); }
+static inline vf vf_max(vf a, vf b) { return _mm_max_ps(a, b); }
+static inline vf vf_abs(vf a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+static inline vf vf_neg(vf a) { return _mm_xor_ps(_mm_set1_ps(-0.0f), a); }
+static inline vm vf_lt(vf a, vf b) { return _mm_cmplt_ps(a, b); }
+static inline vm vf_gt(vf a, vf b) { return _mm_cmpgt_ps(a, b); }
+static inline vm vf_neq(vf a, vf b) { return _mm_cmpneq_ps(a, b); }
+static inline vm vm_or(vm a, vm b) { return _mm_or_ps(a, b); }
+static inline vm vm_and(vm a, vm b) { return _mm_and_ps(a, b); }
+static inline vf vf_select(vm m, vf a, vf b) {
+  return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+}
+static inline unsigned vm_bits(vm m) { return (unsigned)_mm_movemask_ps(m); }
+
+#endif
+
+#if !defined(KIN_SIMD_WIDTH)
+/******************************************************************************
+* Scalar fallback
+******************************************************************************/
+#define KIN_SIMD_WIDTH 1
+#define KIN_SIMD_NAME "scalar"
+
+typedef float vf;
+typedef uint32_t vm;
+
+static inline vf vf_set1(float x) { return x; }
+static inline vf vf_load(const float *p) { return *p; }
+static inline void vf_store(float *p, vf a) { *p = a; }
+static inline vf vf_add(vf a, vf b) { return a + b; }
+static inline vf vf_sub(vf a, vf b) { return a - b; }
+static inline vf vf_mul(vf a, vf b) { return a * b; }
+static inline vf vf_div(vf a, vf b) { return a / b; }
+static inline vf vf_sqrt(vf a) { return sqrtf(a); }
+static inline vf vf_min(vf a, vf b) { return a < b ? a : b; }
+static inline vf vf_max(vf a, vf b) { return a > b ? a : b; }
+static inline vf vf_abs(vf a) { return fabsf(a); }
+static inline vf vf_neg(vf a) { return -a; }
+static inline vm vf_lt(vf a, vf b) { return a < b ? 0xFFFFFFFFu : 0; }
+static inline vm vf_gt(vf a, vf b) { return a > b ? 0xFFFFFFFFu : 0; }
+static inline vm vf_neq(vf a, vf b) { return a != b ? 0xFFFFFFFFu : 0; }
+static inline vm vm_or(vm a, vm b) { return a | b; }
+static inline vm vm_and(vm a, vm b) { return a & b; }
+static inline vf vf_select(vm m, vf a, vf b) { return m ? a : b; }
+static inline unsigned vm_bits(vm m) { return m & 1; }
+
+#endif
+
+/******************************************************************************
+* Math kernels built on the operations above
+*
+* Polynomials are the single-precision minimax fits from Cephes; maximum
+* error is a few ulp over the ranges used by the kinematics.
+******************************************************************************/
+
+static inline vf vf_madd(vf a, vf b, vf c) { return vf_add(vf_mul(a, b), c); } // a*b + c
+
+// round to nearest integer (valid for |x| < 2^22):
+static inline vf vf_round(vf x) {
+  const vf magic = vf_set1(12582912.0f); // 1.5*2^23
+  return vf_sub(vf_add(x, magic), magic);
+}
+
+// lanes where the integer-valued x is odd:
+static inline vm vf_odd(vf x) {
+  vf h = vf_mul(x, vf_set1(0.5f));
+  return vf_neq(h, vf_round(h));
+}
+
+// sin and cos of x, |x| < ~1e5:
+static inline void vf_sincos(vf x, vf *s, vf *c) {
+  vf j, r, r2, ps, pc, one, sn, cs;
+  vm odd, swap_sign_s, swap_sign_c;
+
+  // x = j*pi/2 + r, |r| <= pi/4 (Cody-Waite reduction)
+  j = vf_round(vf_mul(x, vf_set1(0.636619772f)));
+  r = vf_madd(j, vf_set1(-1.5703125f), x);
+  r = vf_madd(j, vf_set1(-4.837512969970703125e-4f), r);
+  r = vf_madd(j, vf_set1(-7.54978995489188216e-8f), r);
+  r2 = vf_mul(r, r);
+
+  ps = vf_madd(r2, vf_set1(-1.9515295891e-4f), vf_set1(8.3321608736e-3f));
+  ps = vf_madd(ps, r2, vf_set1(-1.6666654611e-1f));
+  ps = vf_madd(vf_mul(ps, r2), r, r);
+
+  pc = vf_madd(r2, vf_set1(2.443315711809948e-5f), vf_set1(-1.388731625493765e-3f));
+  pc = vf_madd(pc, r2, vf_set1(4.166664568298827e-2f));
+  pc = vf_madd(vf_mul(pc, r2), r2, vf_madd(r2, vf_set1(-0.5f), vf_set1(1.0f)));
+
+  // quadrant j mod 4 = 0: ( s,  c), 1: ( c, -s), 2: (-s, -c), 3: (-c,  s)
+  odd = vf_odd(j);
+  one = vf_select(odd, vf_set1(1.0f), vf_set1(0.0f));
+  sn = vf_select(odd, pc, ps);
+  cs = vf_select(odd, ps, pc);
+  swap_sign_s = vf_odd(vf_mul(vf_sub(j, one), vf_set1(0.5f))); // floor(j/2) odd
+  swap_sign_c = vf_odd(vf_mul(vf_add(j, one), vf_set1(0.5f))); // floor((j+1)/2) odd
+  *s = vf_select(swap_sign_s, vf_neg(sn), sn);
+  *c = vf_select(swap_sign_c, vf_neg(cs), cs);
+}
+
+// atan2(y, x), full quadrant range; atan2(0, 0) = 0:
+static inline vf vf_atan2(vf y, vf x) {
+  vf ax = vf_abs(x);
+  vf ay = vf_abs(y);
+  vf t, z, p, a;
+  vm big;
+
+  // reduce to t = min/max in [0, 1], then to |t| <= tan(pi/8)
+  t = vf_div(vf_min(ax, ay), vf_max(vf_max(ax, ay), vf_set1(1e-30f)));
+  big = vf_gt(t, vf_set1(0.414213562f));
+  t = vf_select(big, vf_div(vf_sub(t, vf_set1(1.0f)), vf_add(t, vf_set1(1.0f))), t);
+  z = vf_mul(t, t);
+
+  p = vf_madd(z, vf_set1(8.05374449538e-2f), vf_set1(-1.38776856032e-1f));
+  p = vf_madd(p, z, vf_set1(1.99777106478e-1f));
+  p = vf_madd(p, z, vf_set1(-3.33329491539e-1f));
+  a = vf_madd(vf_mul(p, z), t, t);
+  a = vf_add(a, vf_select(big, vf_set1(0.785398163f), vf_set1(0.0f)));
+
+  // undo the reductions: octant, then quadrant
+  a = vf_select(vf_gt(ay, ax), vf_sub(vf_set1(1.570796327f), a), a);
+  a = vf_select(vf_lt(x, vf_set1(0.0f)), vf_sub(vf_set1(3.141592654f), a), a);
+  return vf_select(vf_lt(y, vf_set1(0.0f)), vf_neg(a), a);
+}
+
+// acos(x); x is clamped to [-1, 1], callers flag out-of-range arguments:
+static inline vf vf_acos(vf x) {
+  vf ax = vf_min(vf_abs(x), vf_set1(1.0f));
+  vm neg = vf_lt(x, vf_set1(0.0f));
+  vm big = vf_gt(ax, vf_set1(0.5f));
+  vf zb, z, s, p, as, two;
+
+  // asin(s) with s = |x| (|x| <= 0.5) or s = sqrt((1 - |x|)/2) (|x| > 0.5)
+  zb = vf_mul(vf_set1(0.5f), vf_sub(vf_set1(1.0f), ax));
+  s = vf_select(big, vf_sqrt(zb), ax);
+  z = vf_select(big, zb, vf_mul(ax, ax));
+
+  p = vf_madd(z, vf_set1(4.2163199048e-2f), vf_set1(2.4181311049e-2f));
+  p = vf_madd(p, z, vf_set1(4.5470025998e-2f));
+  p = vf_madd(p, z, vf_set1(7.4953002686e-2f));
+  p = vf_madd(p, z, vf_set1(1.6666752422e-1f));
+  as = vf_madd(vf_mul(p, z), s, s);
+
+  // |x| <= 0.5: acos = pi/2 -+ asin(|x|)
+  // |x| > 0.5:  acos = 2*asin(s), or pi - 2*asin(s) for negative x
+  two = vf_add(as, as);
+  return vf_select(big,
+    vf_select(neg, vf_sub(vf_set1(3.141592654f), two), two),
+    vf_select(neg, vf_add(vf_set1(1.570796327f), as), vf_sub(vf_set1(1.570796327f), as)));
+}
+
+#endif
@@ -2,11 +2,11 @@
 // and can be found at
 // https://github.com/dlynch7/Hop3r/tree/master/MATLAB/Kinematic
 
-#include <gsl/gsl_blas.h>
-#include <gsl/gsl_linalg.h>
 #include <math.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 #include "kinematic.h"
 
@@ -31,8 +31,69 @@ float wrench[3] = {};
 //   // printf("%f\t%f\t%f\t%f\t%f\t%f\n",qu[0],qu[1],qu[2],qu[3],qu[4],qu[5]);
 // }
 
+// geometry:
+
+// a whole hopper_geometry, from link lengths read through G():
+#define HOPPER_GEOMETRY_INIT(G) { \
+  HOPPER_L1(G), HOPPER_L2(G), HOPPER_L3(G), HOPPER_L4(G), \
+  HOPPER_L5(G), HOPPER_L6(G), HOPPER_L7(G), HOPPER_L8(G), \
+  HOPPER_B1X(G), HOPPER_B2X(G), HOPPER_B1Y(G), HOPPER_B2Y(G), \
+  HOPPER_L78(G), HOPPER_L2sq(G), HOPPER_L4sq(G), \
+  HOPPER_L12sqSum(G), HOPPER_L12sqDiff(G), HOPPER_L12x2(G), \
+  HOPPER_L34sqSum(G), HOPPER_L34sqDiff(G), HOPPER_L34x2(G), \
+  HOPPER_L56sqSum(G), HOPPER_L56sqDiff(G), HOPPER_L56x2(G), \
+  HOPPER_L26sqDiff(G), HOPPER_L47sqDiff(G), \
+  HOPPER_invL2(G), HOPPER_invL4(G), HOPPER_invL6(G), HOPPER_invL7(G), \
+  {{HOPPER_L1(G), HOPPER_L2(G), HOPPER_L8(G)},    /* theta-chain */ \
+   {HOPPER_L3(G), HOPPER_L4(G), HOPPER_L78(G)},   /* phi-chain */ \
+   {HOPPER_L5(G), HOPPER_L6(G), HOPPER_L8(G)}},   /* psi-chain */ \
+  {{-HOPPER_B1X(G), HOPPER_B1Y(G)}, {0, 0}, {HOPPER_B2X(G), HOPPER_B2Y(G)}} \
+}
+
+static const hopper_geometry hopper_flight = HOPPER_GEOMETRY_INIT(HOPPER_FLIGHT);
+
+// per-subchain tables (chainLinks[chain][link], chainBase[chain][x or y]):
+#ifdef HOPPER_FIXED_GEOMETRY
+#define chainLinks (hopper_flight.links)
+#define chainBase (hopper_flight.base)
+#else
+__thread const hopper_geometry *kin_geometry = &hopper_flight;
+#define chainLinks (kin_geometry->links)
+#define chainBase (kin_geometry->base)
+#endif
+
+void hopper_geometry_init(hopper_geometry *g) {
+#define RAW(x) (g->x)
+  hopper_geometry derived = HOPPER_GEOMETRY_INIT(RAW);
+#undef RAW
+  *g = derived;
+}
+
+int8_t kin_set_geometry(const hopper_geometry *g) {
+#ifdef HOPPER_FIXED_GEOMETRY
+  // the link lengths are the leading fields, the rest follows from them:
+  return g && memcmp(g, &hopper_flight, offsetof(hopper_geometry, L78));
+#else
+  kin_geometry = g ? g : &hopper_flight;
+  return 0;
+#endif
+}
+
+const hopper_geometry *kin_get_geometry(void) {
+#ifdef HOPPER_FIXED_GEOMETRY
+  return &hopper_flight;
+#else
+  return kin_geometry;
+#endif
+}
+
 // forward kinematics:
-int8_t geomFK(float *qa, float *qu, float *footPose, uint8_t solOption) {
+//
+// geomFK_core() is the geometric FK solution shared by geomFK() and
+// kin_state_update(). When t is not NULL it also fills in the sin/cos of the
+// absolute link angles, read off the joint locations it has already solved
+// for, so the Jacobians need no further trig calls.
+static int8_t geomFK_core(float *qa, float *qu, float *footPose, uint8_t solOption, kin_trig *t) {
   float xhth, yhth;                   // location of theta-chain "hip"
   float xhps, yhps;                   // location of psi-chain "hip"
   float xAptheta, yAptheta;           // relative coordinates (intermediate vars)
@@ -47,18 +108,27 @@ int8_t geomFK(float *qa, float *qu, float *footPose, uint8_t solOption) {
   float xA,yA,xA1,xA2,yA1,yA2;        // location of "lower ankle"
   float xuA,yuA,xuA1,xuA2,yuA1,yuA2;  // location of "upper ankle"
   float footX, footY, footAngle;      // intermidiate vars for footPose vector
+  float cqa[3], sqa[3];               // cos and sin of the actuated joint angles
+  float cfoot, sfoot;                 // cos and sin of the foot angle
+
+  cqa[0] = cos(qa[0]);
+  sqa[0] = sin(qa[0]);
+  cqa[1] = cos(qa[1]);
+  sqa[1] = sin(qa[1]);
+  cqa[2] = cos(qa[2]);
+  sqa[2] = sin(qa[2]);
 
   /****************************************************************************
   * Calculate (xA, yA) using theta1 and psi1:
   ****************************************************************************/
-  xkth = -B1X + L1*cos(qa[0]);  // x-coordinate of theta-chain "knee"
-  ykth = B1Y + L1*sin(qa[0]);   // y-coordinate of theta-chain "knee"
-  xkps = B2X + L5*cos(qa[2]);   // x-coordinate of psi-chain "knee"
-  ykps = B2Y + L5*sin(qa[2]);   // y-coordinate of psi-chain "knee"
+  xkth = -KG(B1X) + KG(L1)*cqa[0];  // x-coordinate of theta-chain "knee"
+  ykth = KG(B1Y) + KG(L1)*sqa[0];   // y-coordinate of theta-chain "knee"
+  xkps = KG(B2X) + KG(L5)*cqa[2];   // x-coordinate of psi-chain "knee"
+  ykps = KG(B2Y) + KG(L5)*sqa[2];   // y-coordinate of psi-chain "knee"
 
   a = sqrt((xkth - xkps)*(xkth - xkps) + (ykth - ykps)*(ykth - ykps));  // intermediate variable
-  b = (L2*L2 - L6*L6 + a*a)/(2*a);                                      // intermediate variable
-  c = sqrt(L2*L2 - b*b);                                                // intermediate variable
+  b = (KG(L26sqDiff) + a*a)/(2*a);                                      // intermediate variable
+  c = sqrt(KG(L2sq) - b*b);                                             // intermediate variable
 
   xA1 = (b/a)*(xkps - xkth) + (c/a)*(ykps - ykth) + xkth;
   xA2 = (b/a)*(xkps - xkth) - (c/a)*(ykps - ykth) + xkth;
@@ -76,12 +146,12 @@ int8_t geomFK(float *qa, float *qu, float *footPose, uint8_t solOption) {
   /****************************************************************************
   * Calculate (xuA, yuA) using phi1 and (xA, yA):
   ****************************************************************************/
-  xkph = L3*cos(qa[1]); // x-coordinate of phi-chain "knee"
-  ykph = L3*sin(qa[1]); // y-coordinate of phi-chain "knee"
+  xkph = KG(L3)*cqa[1]; // x-coordinate of phi-chain "knee"
+  ykph = KG(L3)*sqa[1]; // y-coordinate of phi-chain "knee"
 
   d = sqrt((xkph - xA)*(xkph - xA) + (ykph - yA)*(ykph - yA));  // intermediate variable
-  e = (L4*L4 - L7*L7 + d*d)/(2*d);                              // intermediate variable
-  f = sqrt(L4*L4 - e*e);                                        // intermediate variable
+  e = (KG(L47sqDiff) + d*d)/(2*d);                              // intermediate variable
+  f = sqrt(KG(L4sq) - e*e);                                     // intermediate variable
 
   xuA1 = (e/d)*(xA - xkph) - (f/d)*(yA - ykph) + xkph;
   xuA2 = (e/d)*(xA - xkph) + (f/d)*(yA - ykph) + xkph;
@@ -99,31 +169,33 @@ int8_t geomFK(float *qa, float *qu, float *footPose, uint8_t solOption) {
   /****************************************************************************
   * Solve for "knee" angles (theta2, phi2, psi2):
   ****************************************************************************/
-  xhth = -B1X;  // x-coordinate of theta-chain "hip" joint
-  yhth = B1Y;   // y-coordinate of theta-chain "hip" joint
+  xhth = -KG(B1X);  // x-coordinate of theta-chain "hip" joint
+  yhth = KG(B1Y);   // y-coordinate of theta-chain "hip" joint
 
   xAptheta = -xhth + xA;  // x-coordinate of "lower ankle" w.r.t. theta-chain "hip"
   yAptheta = yhth - yA;  // y-coordinate of "lower ankle" w.r.t. theta-chain "hip"
 
-  betatheta = PI - acos((L1*L1 + L2*L2 - xAptheta*xAptheta - yAptheta*yAptheta)/(2*L1*L2));
+  betatheta = PI - acos((KG(L12sqSum) - xAptheta*xAptheta - yAptheta*yAptheta)/KG(L12x2));
 
 
-  betaphi = PI - acos((L3*L3 + L4*L4 - xuA*xuA - yuA*yuA)/(2*L3*L4));
+  betaphi = PI - acos((KG(L34sqSum) - xuA*xuA - yuA*yuA)/KG(L34x2));
 
   //psi-chain
-  xhps = B2X;
-  yhps = B2Y;
+  xhps = KG(B2X);
+  yhps = KG(B2Y);
   xAppsi = xhps - xA;
   yAppsi = yhps - yA;
 
-  betapsi = -PI + acos((L5*L5 + L6*L6 - xAppsi*xAppsi - yAppsi*yAppsi)/(2*L5*L6));
+  betapsi = -PI + acos((KG(L56sqSum) - xAppsi*xAppsi - yAppsi*yAppsi)/KG(L56x2));
 
   /****************************************************************************
   * Calculate the foot pose:
   ****************************************************************************/
   footAngle = PI + atan2(yuA - yA, xuA - xA);
-  footX = xA + L8*cos(footAngle);
-  footY = yA + L8*sin(footAngle);
+  cfoot = (xA - xuA)*KG(invL7); // the foot link points from upper to lower ankle
+  sfoot = (yA - yuA)*KG(invL7);
+  footX = xA + KG(L8)*cfoot;
+  footY = yA + KG(L8)*sfoot;
 
   footPose[0] = footX;
   footPose[1] = footY;
@@ -145,29 +217,56 @@ int8_t geomFK(float *qa, float *qu, float *footPose, uint8_t solOption) {
 
   // printf("%f\t%f\t%f\t%f\t%f\t%f\n",qu[0],qu[1],qu[2],qu[3],qu[4],qu[5]);
 
+  /****************************************************************************
+  * Link directions for the Jacobians (see kin_trig in kinematic.h):
+  ****************************************************************************/
+  if (t) {
+    // proximal links: the actuated joint angles
+    t->c[0] = cqa[0];
+    t->s[0] = sqa[0];
+    t->c[3] = cqa[1];
+    t->s[3] = sqa[1];
+    t->c[6] = cqa[2];
+    t->s[6] = sqa[2];
+    // middle links: from each "knee" to its ankle
+    t->c[1] = (xA - xkth)*KG(invL2);
+    t->s[1] = (yA - ykth)*KG(invL2);
+    t->c[4] = (xuA - xkph)*KG(invL4);
+    t->s[4] = (yuA - ykph)*KG(invL4);
+    t->c[7] = (xA - xkps)*KG(invL6);
+    t->s[7] = (yA - ykps)*KG(invL6);
+    // distal links: all three chains end on the rigid foot link
+    t->c[2] = t->c[5] = t->c[8] = cfoot;
+    t->s[2] = t->s[5] = t->s[8] = sfoot;
+  }
+
   return 1;
 }
 
+int8_t geomFK(float *qa, float *qu, float *footPose, uint8_t solOption) {
+  return geomFK_core(qa, qu, footPose, solOption, NULL);
+}
+
 int8_t subchainFK(float *qa, float *qu, float *footPose, uint8_t chainOption) {
   switch (chainOption) {
     case 0: // evaluate along theta-chain:
       {
-      footPose[0] = -B1X + L1*cos(qa[0]) + L2*cos(qa[0] + qu[0]) + L8*cos(qa[0] + qu[0] + qu[1]);
-      footPose[1] = B1Y + L1*sin(qa[0]) + L2*sin(qa[0] + qu[0]) + L8*sin(qa[0] + qu[0] + qu[1]);
+      footPose[0] = -KG(B1X) + KG(L1)*cos(qa[0]) + KG(L2)*cos(qa[0] + qu[0]) + KG(L8)*cos(qa[0] + qu[0] + qu[1]);
+      footPose[1] = KG(B1Y) + KG(L1)*sin(qa[0]) + KG(L2)*sin(qa[0] + qu[0]) + KG(L8)*sin(qa[0] + qu[0] + qu[1]);
       footPose[2] = qa[0] + qu[0] + qu[1];
       return 0;
       }
     case 1: // evaluate along phi-chain:
       {
-      footPose[0] = L3*cos(qa[1]) + L4*cos(qa[1] + qu[2]) + (L7+L8)*cos(qa[1] + qu[2] + qu[3]);
-      footPose[1] = L3*sin(qa[1]) + L4*sin(qa[1] + qu[2]) + (L7+L8)*sin(qa[1] + qu[2] + qu[3]);
+      footPose[0] = KG(L3)*cos(qa[1]) + KG(L4)*cos(qa[1] + qu[2]) + KG(L78)*cos(qa[1] + qu[2] + qu[3]);
+      footPose[1] = KG(L3)*sin(qa[1]) + KG(L4)*sin(qa[1] + qu[2]) + KG(L78)*sin(qa[1] + qu[2] + qu[3]);
       footPose[2] = qa[1] + qu[2] + qu[3];
       return 0;
       }
     case 2: // evaluate along psi-chain:
       {
-      footPose[0] = B2X + L5*cos(qa[2]) + L6*cos(qa[2] + qu[4]) + L8*cos(qa[2] + qu[4] + qu[5]);
-      footPose[1] = B2Y + L5*sin(qa[2]) + L6*sin(qa[2] + qu[4]) + L8*sin(qa[2] + qu[4] + qu[5]);
+      footPose[0] = KG(B2X) + KG(L5)*cos(qa[2]) + KG(L6)*cos(qa[2] + qu[4]) + KG(L8)*cos(qa[2] + qu[4] + qu[5]);
+      footPose[1] = KG(B2Y) + KG(L5)*sin(qa[2]) + KG(L6)*sin(qa[2] + qu[4]) + KG(L8)*sin(qa[2] + qu[4] + qu[5]);
       footPose[2] = qa[2] + qu[4] + qu[5];
       return 0;
       }
@@ -184,24 +283,24 @@ int8_t subchainIK(float *qa, float *qu, float *footPose) {
   float angF = footPose[2];
 
   // (x,y) location of lower ankle joint
-  float xA = xF - L8*cos(angF);
-  float yA = yF - L8*sin(angF);
+  float xA = xF - KG(L8)*cos(angF);
+  float yA = yF - KG(L8)*sin(angF);
 
   // (x,y) location of upper ankle joint
-  float xAu = xF - (L7+L8)*cos(angF);
-  float yAu = yF - (L7+L8)*sin(angF);
+  float xAu = xF - KG(L78)*cos(angF);
+  float yAu = yF - KG(L78)*sin(angF);
 
   /****************************************************************************
   * IK for theta-chain:
   ****************************************************************************/
-  float xHtheta = -B1X;
-  float yHtheta = B1Y;
+  float xHtheta = -KG(B1X);
+  float yHtheta = KG(B1Y);
 
   //calculate hip angle
   float xAptheta = -xHtheta + xA;
   float yAptheta = yHtheta - yA;
   float gammatheta = atan2(yAptheta,xAptheta);
-  float alphatheta = acos((xAptheta*xAptheta + yAptheta*yAptheta + L1*L1 - L2*L2)/(2*L1*sqrt(xAptheta*xAptheta + yAptheta*yAptheta)));
+  float alphatheta = acos((xAptheta*xAptheta + yAptheta*yAptheta + KG(L12sqDiff))/(2*KG(L1)*sqrt(xAptheta*xAptheta + yAptheta*yAptheta)));
   float theta1 = -gammatheta - alphatheta;
 
   // (x,y) location of "knee" joint
@@ -209,7 +308,7 @@ int8_t subchainIK(float *qa, float *qu, float *footPose) {
   // float yKtheta = yHtheta + L1*sin(theta1);
 
   // calculate knee angle
-  float betatheta = acos((L1*L1 + L2*L2 - xAptheta*xAptheta - yAptheta*yAptheta)/(2*L1*L2));
+  float betatheta = acos((KG(L12sqSum) - xAptheta*xAptheta - yAptheta*yAptheta)/KG(L12x2));
   float theta2 = PI - betatheta;
 
   // (x,y,angle) of "lower ankle" joint using FK
@@ -227,7 +326,7 @@ int8_t subchainIK(float *qa, float *qu, float *footPose) {
 
   // Calculate hip angle:
   float gammaphi = fabs(atan2(yAu,xAu)); //fabs() is absolute value of a float
-  float alphaphi = acos((xAu*xAu + yAu*yAu + L3*L3 - L4*L4)/(2*L3*sqrt(xAu*xAu + yAu*yAu)));
+  float alphaphi = acos((xAu*xAu + yAu*yAu + KG(L34sqDiff))/(2*KG(L3)*sqrt(xAu*xAu + yAu*yAu)));
   float phi1 = -gammaphi - alphaphi;
 
   // Calculate (x,y) location of "knee" joint:
@@ -235,7 +334,7 @@ int8_t subchainIK(float *qa, float *qu, float *footPose) {
   // float yKphi = yHphi + L3*sin(phi1);
 
   // Calculate knee angle:
-  float betaphi = acos((L3*L3 + L4*L4 - xAu*xAu - yAu*yAu)/(2*L3*L4));
+  float betaphi = acos((KG(L34sqSum) - xAu*xAu - yAu*yAu)/KG(L34x2));
   float phi2 = PI - betaphi;
 
   // Calculate (x,y,angle) of "upper ankle" joint, using FK:
@@ -250,14 +349,14 @@ int8_t subchainIK(float *qa, float *qu, float *footPose) {
   * IK for psi-chain:
   ****************************************************************************/
   // Calculate (x,y) location of "hip" joint:
-  float xHpsi = B2X;
-  float yHpsi = B2Y;
+  float xHpsi = KG(B2X);
+  float yHpsi = KG(B2Y);
 
   // Calculate hip angle:
   float xAppsi = xHpsi - xA;
   float yAppsi = yHpsi - yA;
   float gammapsi = fabs(atan2(yAppsi,xAppsi));
-  float alphapsi = acos((xAppsi*xAppsi + yAppsi*yAppsi + L5*L5 - L6*L6)/(2*L5*sqrt(xAppsi*xAppsi + yAppsi*yAppsi)));
+  float alphapsi = acos((xAppsi*xAppsi + yAppsi*yAppsi + KG(L56sqDiff))/(2*KG(L5)*sqrt(xAppsi*xAppsi + yAppsi*yAppsi)));
   float psi1 = -PI + gammapsi + alphapsi;
 
   // Calculate (x,y) location of "knee" joint:
@@ -265,7 +364,7 @@ int8_t subchainIK(float *qa, float *qu, float *footPose) {
   // float yKpsi = yHpsi + L5*sin(psi1);
 
   // Calculate knee angle:
-  float betapsi = acos((L5*L5 + L6*L6 - xAppsi*xAppsi - yAppsi*yAppsi)/(2*L5*L6));
+  float betapsi = acos((KG(L56sqSum) - xAppsi*xAppsi - yAppsi*yAppsi)/KG(L56x2));
   float psi2 = -PI + betapsi;
 
   // Calculate (x,y,angle) of "lower ankle" joint, using FK:
@@ -291,267 +390,371 @@ int8_t subchainIK(float *qa, float *qu, float *footPose) {
 }
 
 // Jacobians:
-int8_t actuatorJacobian(double *Ja, float *qa, float *qu, uint8_t chainOption) {
-  // first argument is the actuator Jacobian, Ja: 3x3 matrix
-  double Jc[36]; // constraint Jacobian, 6x6
-  double Jcinv[36]; // inverse of Jc, 6x6
-  int s; // used with gsl_linalg_LU_decomp
-  uint8_t i,j; // indices used to get Jcinv
-  double Jtheta[9]; // subchain Jacobian (theta chain), 3x3
-  double Jphi[9]; // subchain Jacobian (phi chain), 3x3
-  double Jpsi[9]; // subchain Jacobian (psi chain), 3x3
-  double Ha[18]; // another Jacobian, 6x3
-  double B[18]; // an intermediate matrix, 6x3
-  double C[9]; // another intermediate matrix, 3x3
-
-  // compute the constraint Jacobian:
-  if (constraintJacobian(Jc,qa,qu)) {
-    printf("actuatorJacobian: failed to compute constraintJacobian.\n");
-    return 1; // failure
+//
+// All of the Jacobians below are built from the sines and cosines of the
+// absolute link angles along each open subchain. kin_trig_eval() computes
+// those 9 sin/cos pairs once, and the *_trig() variants build their matrices
+// from the shared kin_trig struct, so no angle sum is evaluated twice.
+
+void kin_trig_eval(kin_trig *t, float *qa, float *qu) {
+  uint8_t i;
+  double ang;
+
+  for (i = 0; i < 3; ++i) {
+    ang = qa[i];
+    t->c[3*i] = cos(ang);
+    t->s[3*i] = sin(ang);
+    ang += qu[2*i];
+    t->c[3*i + 1] = cos(ang);
+    t->s[3*i + 1] = sin(ang);
+    ang += qu[2*i + 1];
+    t->c[3*i + 2] = cos(ang);
+    t->s[3*i + 2] = sin(ang);
   }
-  // invert the constraint Jacobian:
-  gsl_matrix_view m = gsl_matrix_view_array(Jc, 6, 6);
-  gsl_matrix_view inv = gsl_matrix_view_array(Jcinv,6,6);
-  gsl_permutation * p = gsl_permutation_alloc(6);
-  gsl_linalg_LU_decomp(&m.matrix,p,&s);
-  gsl_linalg_LU_invert(&m.matrix,p,&inv.matrix);
-  for (i = 0; i < 6; ++i)
-      for (j = 0; j < 6; ++j)
-          Jcinv[(6*i)+j] = gsl_matrix_get(&inv.matrix,i,j);
-  gsl_permutation_free(p);
-
-  // compute all 3 open subchain Jacobians:
-  if (subchainJacobian(Jtheta,qa,qu,0)) {
-    printf("actuatorJacobian: failed to compute Jtheta.\n");
-    return 1; // failure
+}
+
+// Closed-form actuator Jacobian.
+//
+// Every open subchain i maps its own joint rates to the (shared) foot twist V:
+//   V = Ji(:,1)*dqa_i + Ji(:,2:3)*[dqu_2i; dqu_2i+1].
+// The vector ni = [cos(th1); sin(th1); c*sin(th2 - th1)] (th1, th2 the
+// absolute angles of the middle and distal links, c the distal length) is
+// orthogonal to both unactuated columns Ji(:,2:3), so premultiplying by ni'
+// eliminates the unactuated rates:
+//   ni'*V = di*dqa_i, with di = a*sin(th1 - th0).
+// Stacking the three chains gives A*V = D*dqa, hence
+//   Ja = inv(A)*D and inv(Ja) = inv(D)*A,
+// which is the same matrix the 6x6 constraint Jacobian route produces,
+// without any LU decomposition or heap allocation.
+//
+// Either output may be NULL. Returns 1 near a singularity (a chain's proximal
+// links aligned, di ~ 0, or the three constraint lines concurrent, det(A) ~ 0).
+#define KIN_SINGULAR_EPS 1e-9
+
+int8_t actuatorJacobian_trig(double *Ja, double *Jainv, const kin_trig *t) {
+  double A[9]; // stacked constraint-line vectors, 3x3
+  double D[3]; // diagonal of D
+  double adj[9]; // adjugate of A
+  double det;
+  uint8_t i,j;
+
+  for (i = 0; i < 3; ++i) {
+    const double *c = &t->c[3*i];
+    const double *s = &t->s[3*i];
+
+    A[3*i] = c[1];
+    A[3*i + 1] = s[1];
+    A[3*i + 2] = chainLinks[i][2]*(s[2]*c[1] - c[2]*s[1]);
+    D[i] = chainLinks[i][0]*(s[1]*c[0] - c[1]*s[0]);
+
+    if (fabs(D[i]) < KIN_SINGULAR_EPS) {
+      return 1; // chain i is at a serial singularity
+    }
   }
 
-  if (subchainJacobian(Jphi,qa,qu,1)) {
-    printf("actuatorJacobian: failed to compute Jphi.\n");
-    return 1; // failure
+  if (Jainv) {
+    for (i = 0; i < 3; ++i)
+      for (j = 0; j < 3; ++j)
+        Jainv[3*i + j] = A[3*i + j]/D[i];
   }
 
-  if (subchainJacobian(Jpsi,qa,qu,2)) {
-    printf("actuatorJacobian: failed to compute Jpsi.\n");
+  if (Ja) {
+    adj[0] = A[4]*A[8] - A[5]*A[7];
+    adj[1] = A[2]*A[7] - A[1]*A[8];
+    adj[2] = A[1]*A[5] - A[2]*A[4];
+    adj[3] = A[5]*A[6] - A[3]*A[8];
+    adj[4] = A[0]*A[8] - A[2]*A[6];
+    adj[5] = A[2]*A[3] - A[0]*A[5];
+    adj[6] = A[3]*A[7] - A[4]*A[6];
+    adj[7] = A[1]*A[6] - A[0]*A[7];
+    adj[8] = A[0]*A[4] - A[1]*A[3];
+    det = A[0]*adj[0] + A[1]*adj[3] + A[2]*adj[6];
+
+    if (fabs(det) < KIN_SINGULAR_EPS) {
+      return 1; // parallel (constraint) singularity
+    }
+
+    for (i = 0; i < 3; ++i)
+      for (j = 0; j < 3; ++j)
+        Ja[3*i + j] = adj[3*i + j]*D[j]/det;
+  }
+
+  return 0;
+}
+
+int8_t actuatorJacobian(double *Ja, float *qa, float *qu, uint8_t chainOption) {
+  // first argument is the actuator Jacobian, Ja: 3x3 matrix
+  // The closed form does not depend on the subchain used to express the foot
+  // twist, so chainOption is only validated.
+  kin_trig t;
+
+  if (chainOption > 2) {
+    printf("actuatorJacobian: invalid chainOption.\n");
     return 1; // failure
   }
 
-  // form Ha from open subchain Jacobians:
-  Ha[0] = Jtheta[0]; // 0x0 = 0
-  Ha[1] = -Jphi[0]; // 0x0 = 0
-  Ha[2] = 0;
-  Ha[3] = Jtheta[3]; // 1x0 = 3
-  Ha[4] = -Jphi[3]; // 1x0 = 3
-  Ha[5] = 0;
-  Ha[6] = Jtheta[6]; // 2x0 = 6
-  Ha[7] = -Jphi[6]; // 2x0 = 6
-  Ha[8] = 0;
-  Ha[9] = 0;
-  Ha[10] = -Jphi[0]; // 0x0 = 0
-  Ha[11] = Jpsi[0]; // 0x0 = 0
-  Ha[12] = 0;
-  Ha[13] = -Jphi[3]; // 1x0 = 3
-  Ha[14] = Jpsi[3]; // 1x0 = 3
-  Ha[15] = 0;
-  Ha[16] = -Jphi[6]; // 2x0 = 6
-  Ha[17] = Jpsi[6]; // 2x0 = 6
-
-  cblas_dgemm(CblasRowMajor,
-              CblasNoTrans,CblasNoTrans, 6, 3, 6,
-              -1.0, Jcinv, 6, Ha, 3, 0.0, B, 3); // lda, ldb, ldc is weird!
-
-  // Compute the actuator Jacobian using the specified subchain:
-  switch (chainOption) {
-    case 0:
-      { // Ja = Jtheta*(a bunch of stuff)
-        C[0] = 1;
-        C[1] = 0;
-        C[2] = 0;
-
-        C[3] = B[0];
-        C[4] = B[1];
-        C[5] = B[2];
-
-        C[6] = B[3];
-        C[7] = B[4];
-        C[8] = B[5];
-        cblas_dgemm(CblasRowMajor,
-                    CblasNoTrans,CblasNoTrans, 3, 3, 3,
-                    1.0, Jtheta, 3, C, 3, 0.0, Ja, 3);
-        break;
-      }
-    case 1:
-      { // Ja = Jphi*(a bunch of stuff)
-        C[0] = 0;
-        C[1] = 1;
-        C[2] = 0;
-
-        C[3] = B[6];
-        C[4] = B[7];
-        C[5] = B[8];
-
-        C[6] = B[9];
-        C[7] = B[10];
-        C[8] = B[11];
-        cblas_dgemm(CblasRowMajor,
-                    CblasNoTrans,CblasNoTrans, 3, 3, 3,
-                    1.0, Jphi, 3, C, 3, 0.0, Ja, 3);
-        break;
-      }
-    case 2:
-      { // Ja = Jpsi*(a bunch of stuff)
-        C[0] = 0;
-        C[1] = 0;
-        C[2] = 1;
-
-        C[3] = B[12];
-        C[4] = B[13];
-        C[5] = B[14];
-
-        C[6] = B[15];
-        C[7] = B[16];
-        C[8] = B[17];
-        cblas_dgemm(CblasRowMajor,
-                    CblasNoTrans,CblasNoTrans, 3, 3, 3,
-                    1.0, Jpsi, 3, C, 3, 0.0, Ja, 3);
-        break;
-      }
-    default:
-      printf("actuatorJacobian: invalid chainOption.\n");
-      return 1; // failure
+  kin_trig_eval(&t, qa, qu);
+  if (actuatorJacobian_trig(Ja, NULL, &t)) {
+    printf("actuatorJacobian: singular configuration.\n");
+    return 1; // failure
   }
 
   return 0;
 }
 
+void constraintJacobian_trig(double *J, const kin_trig *t) { // 6x6 matrix
+  double Jtheta[9], Jphi[9], Jpsi[9];
+  uint8_t r;
+
+  subchainJacobian_trig(Jtheta, t, 0);
+  subchainJacobian_trig(Jphi, t, 1);
+  subchainJacobian_trig(Jpsi, t, 2);
+
+  for (r = 0; r < 3; ++r) {
+    // rows 1-3: theta-chain minus phi-chain
+    J[6*r] = Jtheta[3*r + 1];
+    J[6*r + 1] = Jtheta[3*r + 2];
+    J[6*r + 2] = -Jphi[3*r + 1];
+    J[6*r + 3] = -Jphi[3*r + 2];
+    J[6*r + 4] = 0;
+    J[6*r + 5] = 0;
+    // rows 4-6: psi-chain minus phi-chain
+    J[6*(r + 3)] = 0;
+    J[6*(r + 3) + 1] = 0;
+    J[6*(r + 3) + 2] = -Jphi[3*r + 1];
+    J[6*(r + 3) + 3] = -Jphi[3*r + 2];
+    J[6*(r + 3) + 4] = Jpsi[3*r + 1];
+    J[6*(r + 3) + 5] = Jpsi[3*r + 2];
+  }
+}
+
 int8_t constraintJacobian(double *J, float *qa, float *qu) { // 6x6 matrix
+  kin_trig t;
+
+  kin_trig_eval(&t, qa, qu);
+  constraintJacobian_trig(J, &t);
+
+  return 0;
+}
+
+int8_t subchainJacobian_trig(double *Js, const kin_trig *t, uint8_t chainOption) { // 3x3 matrix
+  const double *c, *s, *l;
+
+  if (chainOption > 2) { // unknown option
+    return -1;
+  }
+  c = &t->c[3*chainOption];
+  s = &t->s[3*chainOption];
+  l = chainLinks[chainOption];
+
   // row 1:
-  J[0] = -L2*sin(qa[0]+qu[0]) - L8*sin(qa[0]+qu[0]+qu[1]);
-  J[1] = -L8*sin(qa[0]+qu[0]+qu[1]);
-  J[2] = L4*sin(qa[1]+qu[2]) + (L7+L8)*sin(qa[1]+qu[2]+qu[3]);
-  J[3] = (L7+L8)*sin(qa[1]+qu[2]+qu[3]);
-  J[4] = 0;
-  J[5] = 0;
+  Js[2] = -l[2]*s[2];
+  Js[1] = -l[1]*s[1] + Js[2];
+  Js[0] = -l[0]*s[0] + Js[1];
   // row 2:
-  J[6] = L2*cos(qa[0]+qu[0]) + L8*cos(qa[0]+qu[0]+qu[1]);
-  J[7] = L8*cos(qa[0]+qu[0]+qu[1]);
-  J[8] = -L4*cos(qa[1]+qu[2]) - (L7+L8)*cos(qa[1]+qu[2]+qu[3]);
-  J[9] = -(L7+L8)*cos(qa[1]+qu[2]+qu[3]);
-  J[10] = 0;
-  J[11] = 0;
+  Js[5] = l[2]*c[2];
+  Js[4] = l[1]*c[1] + Js[5];
+  Js[3] = l[0]*c[0] + Js[4];
   // row 3:
-  J[12] = 1;
-  J[13] = 1;
-  J[14] = -1;
-  J[15] = -1;
-  J[16] = 0;
-  J[17] = 0;
-  // row 4:
-  J[18] = 0;
-  J[19] = 0;
-  J[20] = L4*sin(qa[1]+qu[2]) + (L7+L8)*sin(qa[1]+qu[2]+qu[3]);
-  J[21] = (L7+L8)*sin(qa[1]+qu[2]+qu[3]);
-  J[22] = -L6*sin(qa[2]+qu[4]) - L8*sin(qa[2]+qu[4]+qu[5]);
-  J[23] = -L8*sin(qa[2]+qu[4]+qu[5]);
-  // row 5:
-  J[24] = 0;
-  J[25] = 0;
-  J[26] = -L4*cos(qa[1]+qu[2]) - (L7+L8)*cos(qa[1]+qu[2]+qu[3]);
-  J[27] = -(L7+L8)*cos(qa[1]+qu[2]+qu[3]);
-  J[28] = L6*cos(qa[2]+qu[4]) + L8*cos(qa[2]+qu[4]+qu[5]);
-  J[29] = L8*cos(qa[2]+qu[4]+qu[5]);
-  // row 6:
-  J[30] = 0;
-  J[31] = 0;
-  J[32] = -1;
-  J[33] = -1;
-  J[34] = 1;
-  J[35] = 1;
+  Js[6] = 1;
+  Js[7] = 1;
+  Js[8] = 1;
 
   return 0;
 }
 
 int8_t subchainJacobian(double *Js, float *qa, float *qu, uint8_t chainOption) { // 3x3 matrix
-  switch (chainOption) {
-    case 0: // theta chain
-      {
-      // row 1:
-      Js[0] = -L1*sin(qa[0]) - L2*sin(qa[0]+qu[0]) - L8*sin(qa[0]+qu[0]+qu[1]);
-      Js[1] = -L2*sin(qa[0]+qu[0]) - L8*sin(qa[0]+qu[0]+qu[1]);
-      Js[2] = -L8*sin(qa[0]+qu[0]+qu[1]);
-      // row 2:
-      Js[3] = L1*cos(qa[0]) + L2*cos(qa[0]+qu[0]) + L8*cos(qa[0]+qu[0]+qu[1]);
-      Js[4] = L2*cos(qa[0]+qu[0]) + L8*cos(qa[0]+qu[0]+qu[1]);
-      Js[5] = L8*cos(qa[0]+qu[0]+qu[1]);
-      // row 3:
-      Js[6] = 1;
-      Js[7] = 1;
-      Js[8] = 1;
-      return 0;
-      }
-    case 1: // phi chain
-      {
-      // row 1:
-      Js[0] = -L3*sin(qa[1]) - L4*sin(qa[1]+qu[2]) - (L7+L8)*sin(qa[1]+qu[2]+qu[3]);
-      Js[1] = -L4*sin(qa[1]+qu[2]) - (L7+L8)*sin(qa[1]+qu[2]+qu[3]);
-      Js[2] = -(L7+L8)*sin(qa[1]+qu[2]+qu[3]);
-      // row 2:
-      Js[3] = L3*cos(qa[1]) + L4*cos(qa[1]+qu[2]) + (L7+L8)*cos(qa[1]+qu[2]+qu[3]);
-      Js[4] = L4*cos(qa[1]+qu[2]) + (L7+L8)*cos(qa[1]+qu[2]+qu[3]);
-      Js[5] = (L7+L8)*cos(qa[1]+qu[2]+qu[3]);
-      // row 3:
-      Js[6] = 1;
-      Js[7] = 1;
-      Js[8] = 1;
-      return 0;
+  kin_trig t;
+
+  if (chainOption > 2) { // unknown option
+    return -1;
+  }
+  kin_trig_eval(&t, qa, qu);
+
+  return subchainJacobian_trig(Js, &t, chainOption);
+}
+
+// Newton-Raphson forward kinematics (port of NRFK.m):
+//
+// Solves the six loop-closure equations G(qa,qu) = 0 for qu, starting from the
+// qu passed in, which is normally the previous tick's solution. Near a warm
+// start Newton converges quadratically, and it has no branch choice and no
+// sqrt() of a possibly negative argument, so it keeps working right at the
+// edge of the workspace where geomFK() returns NaN.
+
+#define NRFK_THRESH 1e-5     // loop-closure residual accepted as converged
+#define NRFK_MAX_ITER 10     // Newton iterations before giving up
+#define NRFK_MAX_HALVINGS 4  // step halvings per iteration before giving up
+
+// foot pose along one open subchain, from the shared trig (cf. subchainFK):
+static void subchainFK_trig(double *pose, const kin_trig *t, uint8_t chain) {
+  const double *c = &t->c[3*chain];
+  const double *s = &t->s[3*chain];
+  const double *l = chainLinks[chain];
+
+  pose[0] = chainBase[chain][0] + l[0]*c[0] + l[1]*c[1] + l[2]*c[2];
+  pose[1] = chainBase[chain][1] + l[0]*s[0] + l[1]*s[1] + l[2]*s[2];
+}
+
+void constraintVector_trig(double *G, const kin_trig *t, float *qa, float *qu) { // 6x1 vector
+  double Ptheta[2], Pphi[2], Ppsi[2];
+  double angphi = qa[1] + qu[2] + qu[3];
+
+  subchainFK_trig(Ptheta, t, 0);
+  subchainFK_trig(Pphi, t, 1);
+  subchainFK_trig(Ppsi, t, 2);
+
+  // theta-chain minus phi-chain:
+  G[0] = Ptheta[0] - Pphi[0];
+  G[1] = Ptheta[1] - Pphi[1];
+  G[2] = (qa[0] + qu[0] + qu[1]) - angphi;
+  // psi-chain minus phi-chain:
+  G[3] = Ppsi[0] - Pphi[0];
+  G[4] = Ppsi[1] - Pphi[1];
+  G[5] = (qa[2] + qu[4] + qu[5]) - angphi;
+}
+
+int8_t constraintVector(double *G, float *qa, float *qu) { // 6x1 vector
+  kin_trig t;
+
+  kin_trig_eval(&t, qa, qu);
+  constraintVector_trig(G, &t, qa, qu);
+
+  return 0;
+}
+
+// solves A*x = b in place (x returned in b) for a 6x6 A, by Gaussian
+// elimination with partial pivoting. Returns 1 if A is singular.
+static int8_t solve6(double *A, double *b) {
+  uint8_t i, j, k, p;
+  double f, tmp;
+
+  for (k = 0; k < 6; ++k) {
+    p = k;
+    for (i = k + 1; i < 6; ++i) {
+      if (fabs(A[6*i + k]) > fabs(A[6*p + k])) p = i;
+    }
+    if (fabs(A[6*p + k]) < KIN_SINGULAR_EPS) {
+      return 1;
+    }
+    if (p != k) {
+      for (j = k; j < 6; ++j) {
+        tmp = A[6*k + j]; A[6*k + j] = A[6*p + j]; A[6*p + j] = tmp;
       }
-    case 2: // psi chain
-      {
-      // row 1:
-      Js[0] = -L5*sin(qa[2]) - L6*sin(qa[2]+qu[4]) - L8*sin(qa[2]+qu[4]+qu[5]);
-      Js[1] = -L6*sin(qa[2]+qu[4]) - L8*sin(qa[2]+qu[4]+qu[5]);
-      Js[2] = -L8*sin(qa[2]+qu[4]+qu[5]);
-      // row 2:
-      Js[3] = L5*cos(qa[2]) + L6*cos(qa[2]+qu[4]) + L8*cos(qa[2]+qu[4]+qu[5]);
-      Js[4] = L6*cos(qa[2]+qu[4]) + L8*cos(qa[2]+qu[4]+qu[5]);
-      Js[5] = L8*cos(qa[2]+qu[4]+qu[5]);
-      // row 3:
-      Js[6] = 1;
-      Js[7] = 1;
-      Js[8] = 1;
-      return 0;
+      tmp = b[k]; b[k] = b[p]; b[p] = tmp;
+    }
+    for (i = k + 1; i < 6; ++i) {
+      f = A[6*i + k]/A[6*k + k];
+      for (j = k + 1; j < 6; ++j) {
+        A[6*i + j] -= f*A[6*k + j];
       }
-    default:// unknown option
-      return -1;
+      b[i] -= f*b[k];
+    }
+  }
+  for (k = 6; k-- > 0;) {
+    for (j = k + 1; j < 6; ++j) {
+      b[k] -= A[6*k + j]*b[j];
+    }
+    b[k] /= A[6*k + k];
+  }
+
+  return 0;
+}
+
+static double norm6(const double *v) {
+  return sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2] + v[3]*v[3] + v[4]*v[4] + v[5]*v[5]);
+}
+
+// the Newton-Raphson loop itself; on success qu, t and footPose all belong to
+// the returned solution. Returns the number of iterations, or -1.
+static int8_t nrFK_core(float *qa, float *qu, float *footPose, kin_trig *t) {
+  double G[6], Gtry[6], Jc[36], dq[6], pose[2];
+  double res, resTry, ang;
+  float qutry[6];
+  kin_trig ttry;
+  uint8_t iter, halvings, i;
+
+  kin_trig_eval(t, qa, qu);
+  constraintVector_trig(G, t, qa, qu);
+  res = norm6(G);
+
+  for (iter = 0; res > NRFK_THRESH; ++iter) {
+    if (iter == NRFK_MAX_ITER || isnan(res)) {
+      return -1; // diverged
+    }
+
+    constraintJacobian_trig(Jc, t);
+    for (i = 0; i < 6; ++i) dq[i] = G[i];
+    if (solve6(Jc, dq)) {
+      return -1; // singular constraint Jacobian
+    }
+
+    // full Newton step, halved while it does not reduce the residual
+    // (the binary search in NRFK.m):
+    for (halvings = 0; ; ++halvings) {
+      for (i = 0; i < 6; ++i) qutry[i] = qu[i] - dq[i];
+      kin_trig_eval(&ttry, qa, qutry);
+      constraintVector_trig(Gtry, &ttry, qa, qutry);
+      resTry = norm6(Gtry);
+      if (resTry < res) break;
+      if (halvings == NRFK_MAX_HALVINGS) return -1;
+      for (i = 0; i < 6; ++i) dq[i] *= 0.5;
+    }
+
+    for (i = 0; i < 6; ++i) {
+      qu[i] = qutry[i];
+      G[i] = Gtry[i];
+    }
+    *t = ttry;
+    res = resTry;
   }
+
+  // foot pose along the theta-chain, angle in geomFK()'s (0, 2*pi] range:
+  subchainFK_trig(pose, t, 0);
+  ang = qa[0] + qu[0] + qu[1];
+  footPose[0] = pose[0];
+  footPose[1] = pose[1];
+  footPose[2] = remainder(ang - PI, 2*PI) + PI;
+
+  return iter;
+}
+
+int8_t nrFK(float *qa, float *qu, float *footPose) {
+  kin_trig t;
+  float quwarm[6];
+  uint8_t i;
+
+  for (i = 0; i < 6; ++i) quwarm[i] = qu[i];
+  if (nrFK_core(qa, quwarm, footPose, &t) >= 0) {
+    for (i = 0; i < 6; ++i) qu[i] = quwarm[i];
+    return 0;
+  }
+
+  // Newton failed: fall back to the closed-form solution
+  geomFK(qa, qu, footPose, 1);
+  if (isnan(footPose[0]) || isnan(footPose[1]) || isnan(footPose[2])) {
+    return -1;
+  }
+  return 1;
 }
 
 // task space to joint space conversions
 int8_t twist2vels(float *qa, float *qu, double *dqa_dt, double *twist) {
   // computes motor velocities from foot twist:
   // vels = inv(Ja)*twist, where Ja is the actuator Jacobian
-  double Ja[9], Jainv[9];
-  int i,j,s;
+  double Jainv[9];
+  kin_trig t;
+  uint8_t i;
 
-  if (actuatorJacobian(Ja, qa, qu, 0)) {
+  kin_trig_eval(&t, qa, qu);
+  if (actuatorJacobian_trig(NULL, Jainv, &t)) {
     printf("twist2vels: failed to compute actuator Jacobian.\n");
     return 1; // failure
   }
 
-  // invert the actuator Jacobian:
-  gsl_matrix_view m = gsl_matrix_view_array(Ja,3,3);
-  gsl_matrix_view inv = gsl_matrix_view_array(Jainv,3,3);
-  gsl_permutation * p = gsl_permutation_alloc(3);
-  gsl_linalg_LU_decomp(&m.matrix,p,&s);
-  gsl_linalg_LU_invert(&m.matrix,p,&inv.matrix);
-
-  for (i = 0; i < 3; ++i)
-      for (j = 0; j < 3; ++j)
-          Jainv[(3*i)+j] = gsl_matrix_get(&inv.matrix,i,j);
-  gsl_permutation_free(p);
-
-  cblas_dgemv(CblasRowMajor, CblasNoTrans, 3, 3, 1.0, Jainv, 3,
-    twist, 1, 0.0, dqa_dt, 1);
+  for (i = 0; i < 3; ++i) {
+    dqa_dt[i] = Jainv[3*i]*twist[0] + Jainv[3*i + 1]*twist[1] + Jainv[3*i + 2]*twist[2];
+  }
 
   return 0;
 }
@@ -560,50 +763,128 @@ int8_t wrench2torques(float *qa, float *qu, double *torques, double *wrench) {
   // computes motor torques from foot wrench:
   // torques = Ja'*wrench, where Ja is the actuator Jacobian
   double Ja[9];
+  uint8_t i;
 
   if (actuatorJacobian(Ja, qa, qu, 0)) {
     printf("wrench2torques: failed to compute actuator Jacobian.\n");
     return 1; // failure
   }
 
-  cblas_dgemv(CblasRowMajor, CblasTrans, 3, 3, 1.0, Ja, 3,
-    wrench, 1, 0.0, torques, 1);
+  for (i = 0; i < 3; ++i) {
+    torques[i] = Ja[i]*wrench[0] + Ja[3 + i]*wrench[1] + Ja[6 + i]*wrench[2];
+  }
 
   return 0;
 }
 
-// interpolation:
-//    generates an interpolated array of specified length from an initial tuple
-//    to a final tuple. Interpolation types are linear, cubic, and trapezoidal
-// things that I might want to interpolate: foot pose (3-tuple), qa (3-tuple)
-// inputs: initial tuple, final tuple, number of points, interpolation type,
-//    pointer to output array
-// interpolation types: linear, cubic spline, trapezoidal profile
-uint8_t gen_tuple_list(uint8_t tuple_len, float *init_tuple, float *final_tuple, \
-  uint16_t npoints, uint8_t interp_type, float out_arr[][3]) {
-
-
-  switch (interp_type) {
-    case 0: // linear interpolation
-    {
-      printf("interp_type = %d.\n",interp_type);
-      break;
-    }
-    case 1: // cubic spline
-    {
-      printf("interp_type = %d.\n",interp_type);
-      break;
-    }
-    case 2: // trapezoidal profile
-    {
-      printf("interp_type = %d.\n",interp_type);
-      break;
-    }
-    default:
-      {
-        printf("interp_type = %d is wrong. Enter 0 (linear), 1 (cspline), or 2 (trap)\n",interp_type);
-        return 0;
-      }
+// cached kinematic state:
+//
+// kin_state_update() runs the whole FK -> Jacobian pipeline once per control
+// tick and caches the results, so the kin_state_* queries below are a few
+// multiply-adds each instead of re-running FK and rebuilding Ja.
+// NaN check and Jacobians for a freshly solved state:
+static int8_t kin_state_finish(kin_state *ks) {
+  if (isnan(ks->footPose[0]) || isnan(ks->footPose[1]) || isnan(ks->footPose[2])) {
+    return 1; // qa is outside the reachable workspace
   }
-  return 1;
+  if (actuatorJacobian_trig(ks->Ja, ks->Jainv, &ks->trig)) {
+    return 1; // singular configuration
+  }
+
+  ks->valid = 1;
+  return 0;
+}
+
+// If geomFK fails (NaN right at the workspace boundary) and the previous
+// state was valid, Newton-Raphson FK warm-started from the previous qu gets a
+// second try.
+int8_t kin_state_update(kin_state *ks, float *qa, uint8_t solOption) {
+  uint8_t warm = ks->valid;
+  float quprev[6];
+  uint8_t i;
+
+  for (i = 0; i < 6; ++i) quprev[i] = ks->qu[i];
+  ks->valid = 0;
+  ks->qa[0] = qa[0];
+  ks->qa[1] = qa[1];
+  ks->qa[2] = qa[2];
+
+  geomFK_core(ks->qa, ks->qu, ks->footPose, solOption, &ks->trig);
+  if (warm && (isnan(ks->footPose[0]) || isnan(ks->footPose[1]) || isnan(ks->footPose[2]))) {
+    for (i = 0; i < 6; ++i) ks->qu[i] = quprev[i];
+    nrFK_core(ks->qa, ks->qu, ks->footPose, &ks->trig);
+  }
+
+  return kin_state_finish(ks);
+}
+
+// as kin_state_update(), but with Newton-Raphson FK warm-started from the
+// previous state's qu. Falls back to geomFK (solOption 1) on the first call,
+// after an invalid state, or when Newton does not converge.
+int8_t kin_state_update_nr(kin_state *ks, float *qa) {
+  uint8_t warm = ks->valid;
+
+  ks->valid = 0;
+  ks->qa[0] = qa[0];
+  ks->qa[1] = qa[1];
+  ks->qa[2] = qa[2];
+
+  if (!warm || nrFK_core(ks->qa, ks->qu, ks->footPose, &ks->trig) < 0) {
+    geomFK_core(ks->qa, ks->qu, ks->footPose, 1, &ks->trig);
+  }
+
+  return kin_state_finish(ks);
+}
+
+int8_t kin_state_twist2vels(const kin_state *ks, double *dqa_dt, double *twist) {
+  // vels = inv(Ja)*twist
+  uint8_t i;
+
+  if (!ks->valid) {
+    return 1;
+  }
+  for (i = 0; i < 3; ++i) {
+    dqa_dt[i] = ks->Jainv[3*i]*twist[0] + ks->Jainv[3*i + 1]*twist[1] + ks->Jainv[3*i + 2]*twist[2];
+  }
+
+  return 0;
+}
+
+int8_t kin_state_vels2twist(const kin_state *ks, double *twist, double *dqa_dt) {
+  // twist = Ja*vels
+  uint8_t i;
+
+  if (!ks->valid) {
+    return 1;
+  }
+  for (i = 0; i < 3; ++i) {
+    twist[i] = ks->Ja[3*i]*dqa_dt[0] + ks->Ja[3*i + 1]*dqa_dt[1] + ks->Ja[3*i + 2]*dqa_dt[2];
+  }
+
+  return 0;
+}
+
+int8_t kin_state_wrench2torques(const kin_state *ks, double *torques, double *wrench) {
+  // torques = Ja'*wrench
+  uint8_t i;
+
+  if (!ks->valid) {
+    return 1;
+  }
+  for (i = 0; i < 3; ++i) {
+    torques[i] = ks->Ja[i]*wrench[0] + ks->Ja[3 + i]*wrench[1] + ks->Ja[6 + i]*wrench[2];
+  }
+
+  return 0;
+}
+
+int8_t kin_state_footPose(const kin_state *ks, float *footPose) {
+  if (!ks->valid) {
+    return 1;
+  }
+  footPose[0] = ks->footPose[0];
+  footPose[1] = ks->footPose[1];
+  footPose[2] = ks->footPose[2];
+
+  return 0;
 }
@@ -10,19 +10,110 @@
 #include <stdio.h>
 #include <stdint.h>
 
-// Define link lengths
-#define L1  0.0530
-#define L2  0.1390
-#define L3  0.0970
-#define L4  0.0983
-#define L5  0.0530
-#define L6  0.1390
-#define L7  0.0692
-#define L8  0.1018
-#define B1X 0.0573
-#define B2X 0.0573
-#define B1Y 0.0082
-#define B2Y 0.0082
+/******************************************************************************
+* Geometry
+*
+* kinematic.c and kin_batch.c read every link length, and every constant
+* derived from the link lengths, through KG(name), e.g. KG(L1), KG(L12x2).
+* KG() resolves one of two ways:
+*  - HOPPER_FIXED_GEOMETRY defined (the default in the Makefile, i.e. the
+*    flight build): KG(name) expands to a constant expression in the flight
+*    link lengths below, so the compiler folds all of them into the code.
+*  - HOPPER_FIXED_GEOMETRY not defined: KG(name) reads the calling thread's
+*    hopper_geometry, set with kin_set_geometry() (the flight geometry until
+*    then), so design sweeps can run the same code over many geometries, one
+*    per thread if need be.
+******************************************************************************/
+
+// flight link lengths (m):
+#define HOPPER_FLIGHT_L1  0.0530
+#define HOPPER_FLIGHT_L2  0.1390
+#define HOPPER_FLIGHT_L3  0.0970
+#define HOPPER_FLIGHT_L4  0.0983
+#define HOPPER_FLIGHT_L5  0.0530
+#define HOPPER_FLIGHT_L6  0.1390
+#define HOPPER_FLIGHT_L7  0.0692
+#define HOPPER_FLIGHT_L8  0.1018
+#define HOPPER_FLIGHT_B1X 0.0573
+#define HOPPER_FLIGHT_B2X 0.0573
+#define HOPPER_FLIGHT_B1Y 0.0082
+#define HOPPER_FLIGHT_B2Y 0.0082
+
+// every geometry constant, as an expression of the link lengths read through G():
+#define HOPPER_L1(G)        G(L1)
+#define HOPPER_L2(G)        G(L2)
+#define HOPPER_L3(G)        G(L3)
+#define HOPPER_L4(G)        G(L4)
+#define HOPPER_L5(G)        G(L5)
+#define HOPPER_L6(G)        G(L6)
+#define HOPPER_L7(G)        G(L7)
+#define HOPPER_L8(G)        G(L8)
+#define HOPPER_B1X(G)       G(B1X)
+#define HOPPER_B2X(G)       G(B2X)
+#define HOPPER_B1Y(G)       G(B1Y)
+#define HOPPER_B2Y(G)       G(B2Y)
+#define HOPPER_L78(G)       (G(L7) + G(L8))                 // distal length of the phi-chain
+#define HOPPER_L2sq(G)      (G(L2)*G(L2))
+#define HOPPER_L4sq(G)      (G(L4)*G(L4))
+#define HOPPER_L12sqSum(G)  (G(L1)*G(L1) + G(L2)*G(L2))     // law of cosines, theta-chain
+#define HOPPER_L12sqDiff(G) (G(L1)*G(L1) - G(L2)*G(L2))
+#define HOPPER_L12x2(G)     (2*G(L1)*G(L2))
+#define HOPPER_L34sqSum(G)  (G(L3)*G(L3) + G(L4)*G(L4))     // law of cosines, phi-chain
+#define HOPPER_L34sqDiff(G) (G(L3)*G(L3) - G(L4)*G(L4))
+#define HOPPER_L34x2(G)     (2*G(L3)*G(L4))
+#define HOPPER_L56sqSum(G)  (G(L5)*G(L5) + G(L6)*G(L6))     // law of cosines, psi-chain
+#define HOPPER_L56sqDiff(G) (G(L5)*G(L5) - G(L6)*G(L6))
+#define HOPPER_L56x2(G)     (2*G(L5)*G(L6))
+#define HOPPER_L26sqDiff(G) (G(L2)*G(L2) - G(L6)*G(L6))     // circle intersections in geomFK()
+#define HOPPER_L47sqDiff(G) (G(L4)*G(L4) - G(L7)*G(L7))
+#define HOPPER_invL2(G)     (1.0/G(L2))
+#define HOPPER_invL4(G)     (1.0/G(L4))
+#define HOPPER_invL6(G)     (1.0/G(L6))
+#define HOPPER_invL7(G)     (1.0/G(L7))
+
+typedef struct {
+  // link lengths, set by the caller:
+  double L1, L2, L3, L4, L5, L6, L7, L8;
+  double B1X, B2X, B1Y, B2Y;
+  // derived constants, filled in by hopper_geometry_init():
+  double L78, L2sq, L4sq;
+  double L12sqSum, L12sqDiff, L12x2;
+  double L34sqSum, L34sqDiff, L34x2;
+  double L56sqSum, L56sqDiff, L56x2;
+  double L26sqDiff, L47sqDiff;
+  double invL2, invL4, invL6, invL7;
+  double links[3][3]; // per open subchain {proximal, middle, distal} length
+  double base[3][2];  // per open subchain "hip" location
+} hopper_geometry;
+
+#define HOPPER_FLIGHT(x) HOPPER_FLIGHT_##x
+
+#ifdef HOPPER_FIXED_GEOMETRY
+#define KG(name) (HOPPER_##name(HOPPER_FLIGHT))
+#else
+extern __thread const hopper_geometry *kin_geometry;
+#define KG(name) (kin_geometry->name)
+#endif
+
+// sines and cosines of the absolute link angles along each open subchain,
+// index 3*chain + link, e.g. c[4] = cos(qa[1] + qu[2]) for the phi-chain.
+// Shared by the Jacobian routines so each angle sum is evaluated only once.
+typedef struct {
+  double c[9];
+  double s[9];
+} kin_trig;
+
+// kinematic state of the robot, cached once per control tick by
+// kin_state_update() and read by the kin_state_* queries:
+typedef struct {
+  float qa[3];        // actuated joint angles
+  float qu[6];        // unactuated joint angles
+  float footPose[3];  // foot x, y, angle
+  kin_trig trig;      // sin/cos of the absolute link angles
+  double Ja[9];       // actuator Jacobian, 3x3 row-major
+  double Jainv[9];    // inverse of Ja
+  uint8_t valid;      // 0 if qa was unreachable or singular
+} kin_state;
 
 /******************************************************************************
 * Function prototypes
@@ -30,24 +121,48 @@
 * For each of these functions, the returned value indicates the error type.
 ******************************************************************************/
 
+// geometry:
+// fill in the derived constants of g from its link lengths
+void hopper_geometry_init(hopper_geometry *g);
+// g (NULL for the flight geometry) becomes the calling thread's geometry;
+// g must stay valid while in use. Returns 1, and changes nothing, in a
+// HOPPER_FIXED_GEOMETRY build unless g has the flight link lengths.
+int8_t kin_set_geometry(const hopper_geometry *g);
+const hopper_geometry *kin_get_geometry(void);
+
 // forward kinematics:
 int8_t geomFK(float *qa, float *qu, float *footPose, uint8_t solOption);
 int8_t subchainFK(float *qa, float *qu, float *footPose, uint8_t chainOption);
+// Newton-Raphson FK, warm-started from qu (returns 1 if it fell back to geomFK):
+int8_t nrFK(float *qa, float *qu, float *footPose);
 
 // inverse kinematics:
 int8_t subchainIK(float *qa, float *qu, float *footPose);
 
 // Jacobians
+void kin_trig_eval(kin_trig *t, float *qa, float *qu);
 int8_t actuatorJacobian(double *Ja, float *qa, float *qu, uint8_t chainOption);
+int8_t actuatorJacobian_trig(double *Ja, double *Jainv, const kin_trig *t);
+int8_t constraintVector(double *G, float *qa, float *qu);
+void constraintVector_trig(double *G, const kin_trig *t, float *qa, float *qu);
 int8_t constraintJacobian(double *Jc, float *qa, float *qu);
+void constraintJacobian_trig(double *Jc, const kin_trig *t);
 int8_t subchainJacobian(double *Js, float *qa, float *qu, uint8_t chainOption);
+int8_t subchainJacobian_trig(double *Js, const kin_trig *t, uint8_t chainOption);
 
 // task space to joint space conversions:
 int8_t twist2vels(float *qa, float *qu, double *dqa_dt, double *twist);
 int8_t wrench2torques(float *qa, float *qu, double *torques, double *wrench);
 
-// interpolation:
-uint8_t gen_tuple_list(uint8_t tuple_len,float *init_tuple,float *final_tuple,\
-  uint16_t npoints, uint8_t interp_type, float out_arr[][3]);
+// cached kinematic state (one update per tick, cheap queries afterwards):
+// a kin_state must start zeroed (valid = 0)
+int8_t kin_state_update(kin_state *ks, float *qa, uint8_t solOption);
+int8_t kin_state_update_nr(kin_state *ks, float *qa);
+int8_t kin_state_twist2vels(const kin_state *ks, double *dqa_dt, double *twist);
+int8_t kin_state_vels2twist(const kin_state *ks, double *twist, double *dqa_dt);
+int8_t kin_state_wrench2torques(const kin_state *ks, double *torques, double *wrench);
+int8_t kin_state_footPose(const kin_state *ks, float *footPose);
+
+// interpolation: see trajgen.h
 
 #endif
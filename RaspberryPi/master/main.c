@@ -10,7 +10,7 @@
 * 3-27-2018
 *
 * Periodic threading code from http://2net.co.uk/tutorial/periodic_threads
-* Added 3-28-2018
+* Added 3-28-2018, since replaced by the executive in per_threads.c
 ******************************************************************************/
 
 /*
@@ -61,6 +61,7 @@
 #include <linux/can/raw.h>
 #include <math.h>
 #include <net/if.h>
+#include <poll.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdint.h>
@@ -75,64 +76,127 @@
 #include <wiringPi.h>
 
 #include "can_io.h"
-#include "circ_buffer.h"
+#include "can_mon.h"
+#include "fdr.h"
 #include "kinematic.h"
 #include "linux-can-utils/lib.h"
 #include "per_threads.h"
+#include "rt_log.h"
 #include "serial_interface.h"
 #include "safety.h"
+#include "spsc_ring.h"
+#include "telemetry.h"
+#include "traj.h"
 
 #define CONTROL_PERIOD_US 2000
-#define CAN_READ_PERIOD_US 1
-#define UART_PERIOD_US 2000
+#define SYNC_TIMEOUT_US 1000 // longest Control_thread waits for the motors to answer a SYNC
 
-#define INBUFLENGTH (sizeof(inbuf)/sizeof(inbuf[0]))
+// gains of the motor nodes' position controllers, sent with every command
+// over CAN FD (can_io.h; classic frames leave the nodes on their own):
+#define JOINT_KP 1.15 // Nm/rad, the Tivas' own (20 mA per 0.1 deg at 0.1 mNm/mA)
+#define JOINT_KD 0.02 // Nm*s/rad, damping the Tivas' P controller lacks
+#define CAN_READ_PERIOD_US 0 // sporadic: readCAN() waits for frames
+#define UART_PERIOD_US 2000
+#define UART_PHASE_US 100000 // UART starts later, so the telemetry ring fills first
+#define CAN_MON_PERIOD_US 10000 // CAN_mon drains the monitor's socket
+#define RECORDER_PERIOD_US 20000 // Recorder moves the samples to the flight recorder's segments
+
+// SCHED_FIFO priorities and CPUs of the threads (CPU 0 is left to Linux):
+#define CAN_READ_PRIORITY 85
+#define CONTROL_PRIORITY 80
+#define UART_PRIORITY 50
+#define CAN_READ_CPU 2
+#define CONTROL_CPU 3
+#define UART_CPU 1
+#define CAN_MON_CPU 0 // CAN_mon runs under SCHED_OTHER, next to Linux
+#define RECORDER_CPU 0 // so does Recorder
+#define LOG_CPU 0 // rt_log background thread (SCHED_OTHER)
+
+#define CMD_DUMP_HIST 'h' // from the client: send the latency histograms
+#define CMD_CAN_HEALTH 'c' // from the client: send the CAN monitor's last window per message
+#define CMD_SUBSCRIBE 's'  // from the client: "s <channel> <decimation>\n" (see UART_thread)
+#define CMD_FRAME '\0'     // from the client: a trajectory frame, up to the next zero byte (traj.h)
+#define CMD_LINE_MAX 32    // longest command line
+#define CMD_READ_MAX 256   // most bytes read from the client per tick (more than 115200 baud brings)
+
+#define BUFLEN 1000 // control ticks per run, each sends one telemetry record; the run
+                    // goes on while trajectories are running or coming (traj.h)
+#define TELEMETRY_BATCH 4 // most records UART_thread sends per tick, to catch up
 
 #define PI 3.14159
 
-void *Control_thread();
-void *CAN_read_thread();
-void *UART_thread();
-
-uint8_t Control_thread_begin; // thread must wait for begin = 1
-uint8_t CAN_read_thread_begin; // thread must wait for begin = 1
-uint8_t UART_thread_begin; // thread must wait for begin = 1
+void Control_thread(rt_task *task);
+void CAN_read_thread(rt_task *task);
+void UART_thread(rt_task *task);
+void CAN_mon_thread(rt_task *task);
+void Recorder_thread(rt_task *task);
 
 uint8_t control_complete;
 
 int serial_port;
-char inbuf[100] = "";
 char writemsg[10] = {};
 
-can_input_struct dataFromCAN;
+can_input_state dataFromCAN; // latest sensor data, see can_input_publish()
 
-int refTraj[BUFLEN] = {};
-float qaTraj[BUFLEN][3] = {};
+// Control_thread's SYNC cycles: time from sending MOTOR_CMD to all three
+// answers parsed, and the cycles with an answer missing:
+rt_hist syncHist;
+uint32_t syncMissed;
 
-int main(void) {
-  pthread_t thread1, thread2, thread3;
-  int rc1, rc2, rc3;
-  int readTrajCount = 0;
-  int writePermission = 0;
-  int runPermission = 0;
-  int startwait;
+// Control_thread -> UART_thread, every signal of every tick (UART_thread
+// sends the channels the client subscribed to):
+SPSC_RING_DEFINE(telemetry_ring, tlm_sample, 1024)
+
+telemetry_ring telemetry;
 
-  CAN_read_thread_begin = 0; // reads from CAN bus cannot commence
-  UART_thread_begin = 0; // reading and writing over UART cannot commence
-  Control_thread_begin = 0; // control computations and writes to CAN cannot commence
+tlm_writer tlm; // UART_thread's frames to the client (telemetry.h)
+
+// CAN_mon_thread -> UART_thread, one summary per CAN_MON_WINDOW_MS:
+SPSC_RING_DEFINE(can_health_ring, can_mon_summary, 4)
+
+can_health_ring canHealth;
+
+int main(void) {
+  // name, body, arg, period, deadline (0: period), phase, priority, CPU:
+  rt_task tasks[] = {
+    {"CAN_read", &CAN_read_thread, NULL, CAN_READ_PERIOD_US, 0, 0, CAN_READ_PRIORITY, CAN_READ_CPU},
+    {"Control", &Control_thread, NULL, CONTROL_PERIOD_US, 0, 0, CONTROL_PRIORITY, CONTROL_CPU},
+    {"UART", &UART_thread, NULL, UART_PERIOD_US, 0, UART_PHASE_US, UART_PRIORITY, UART_CPU},
+    {"CAN_mon", &CAN_mon_thread, NULL, CAN_MON_PERIOD_US, 0, 0, 0, CAN_MON_CPU},
+    {"Recorder", &Recorder_thread, NULL, RECORDER_PERIOD_US, 0, 0, 0, RECORDER_CPU}
+  };
+  int ntasks = sizeof(tasks)/sizeof(tasks[0]);
 
   control_complete = 0;
 
-  if(initSocketCAN()) {
-    fprintf(stderr,"Failed to initialize SocketCAN interface.\n");
+  // $HOPPER_CAN_FD set: CAN FD, if the interface can (see can_io.h)
+  const char *canIf = getenv("HOPPER_CAN") ? getenv("HOPPER_CAN") : CAN_IFNAME;
+  if(initSocketCAN(canIf, getenv("HOPPER_CAN_FD") != NULL)) {
+    fprintf(stderr,"Failed to initialize SocketCAN interface %s.\n",canIf);
     return 1;
   }
   printf("Initialized SocketCAN interface.\n");
+  if (can_mon_init(canIf, CAN_MON_BITRATE, CAN_MON_DATA_BITRATE)) {
+    fprintf(stderr,"Failed to open the CAN monitor, running without it.\n");
+  }
 
   safety_init();
 
-  printf("Buffer read index: %d\n",get_read_index());
-  printf("Buffer write index: %d\n",get_write_index());
+  // every tick's state, on the SD card ($HOPPER_FDR: elsewhere, see fdr.h):
+  const char *fdrDir = getenv("HOPPER_FDR") ? getenv("HOPPER_FDR") : FDR_DIR;
+  if (fdr_open(fdrDir, 1e6/CONTROL_PERIOD_US)) {
+    fprintf(stderr,"Failed to open the flight recorder in %s, running without it.\n",fdrDir);
+  }
+
+  // the trajectory slots, allocated here so that mlockall() in rt_exec_init()
+  // locks them:
+  if (traj_init(1e6/CONTROL_PERIOD_US)) {
+    fprintf(stderr,"Failed to allocate the trajectory slots.\n");
+    return 1;
+  }
+  telemetry_ring_init(&telemetry);
+  can_health_ring_init(&canHealth);
+  rt_hist_init(&syncHist);
 
   printf("This is the main function.\n");
 
@@ -145,59 +209,29 @@ int main(void) {
 
   config_port(serial_port);
   dprintf(serial_port,"%d\n",BUFLEN);
+  // binary frames from here on:
+  if (tlm_init(&tlm, serial_port, 1e6/CONTROL_PERIOD_US, SERIAL_BAUD)) {
+    fprintf(stderr,"Failed to set up the telemetry's text pipe, histogram dumps are lost.\n");
+  }
+  tlm_send_desc(&tlm);
 
-  // read(serial_port, inbuf,INBUFLENGTH);
-  // sscanf(inbuf,"%d\n",&runPermission);
-  // printf("runPermission = %d\n",runPermission);
-  // if (runPermission != 1) {
-  //   printf("Client denied permission to run.\n");
-  //   return 1;
-  // }
-
-  // // receive current profile from client PC:
-  // for (readTrajCount = 0; readTrajCount < BUFLEN; readTrajCount++) {
-  //   read(serial_port, inbuf,INBUFLENGTH);
-  //   sscanf(inbuf,"%f %f %f\n",&qaTraj[readTrajCount][0],&qaTraj[readTrajCount][1],&qaTraj[readTrajCount][2]);
-  //   printf("%d: %5.3f\t%5.3f\t%5.3f\n",readTrajCount,qaTraj[readTrajCount][0],qaTraj[readTrajCount][1],qaTraj[readTrajCount][2]);
-  //   // sscanf(inbuf,"%d\n",&refTraj[readTrajCount]);
-  //   // printf("%d %d\n",readTrajCount,refTraj[readTrajCount]);
-  // }
-  //
-  // printf("Done receiving\n");
-  // // ask client PC for permission to write
-  // read(serial_port, inbuf,INBUFLENGTH);
-  // sscanf(inbuf,"%d\n",&writePermission);
-  // printf("writePermission = %d\n",writePermission);
-  // if (writePermission != 1) {
-  //   printf("Client denied permission to write.\n");
-  //   return 1;
-  // } // COMMENT IN ABOVE HERE
+  // the trajectories come from the client while the threads run, in
+  // binary frames (traj.h), read by UART_thread and played by Control_thread
   //////////////////////////////////////////////////////////////////////////////
 
-  printf("Status of data_buf: read = %d, write = %d, empty = %d, full = %d\n",\
-  get_read_index(),get_write_index(),buffer_empty(),buffer_full());
-
   /****************************************************************************
-	*	Create three independent threads:
+	*	Start five periodic threads (see tasks[] above):
   *   Control_thread
   *   CAN_read_thread
   *   UART_thread
+  *   CAN_mon_thread
+  *   Recorder_thread
 	****************************************************************************/
-  if (setup_periodic()) {
+  if (rt_exec_init()) {
     fprintf(stderr, "Failed to setup periodic threads.\n");
     return 1;
   }
 
-  if ( (rc1=pthread_create(&thread1,NULL,&CAN_read_thread,NULL)) ) {
-		fprintf(stderr,"Thread creation failed: %d\n", rc1);
-	}
-	if ( (rc2=pthread_create(&thread2,NULL,&UART_thread,NULL)) ) {
-		fprintf(stderr,"Thread creation failed: %d\n", rc2);
-	}
-  if ( (rc3=pthread_create(&thread3,NULL,&Control_thread,NULL)) ) {
-    fprintf(stderr,"Thread creation failed: %d\n", rc3);
-  }
-
   printf("From main process ID: %d\n", ((int)getpid()));
 
   /****************************************************************************
@@ -206,20 +240,38 @@ int main(void) {
   printf("Running...\n");
   run_program = 1;
 
-  CAN_read_thread_begin = 1;
-  Control_thread_begin = 1; // controls and writes to CAN bus can commence
-  startwait = millis();
-  while ((millis() - startwait) < 100); // delay to avoid emptying buffer early
-  UART_thread_begin = 1; // reading and writing can commence
+  // the threads log through rt_log(), written out by a background thread:
+  if (rt_log_start(stdout, LOG_CPU)) {
+    fprintf(stderr, "Failed to start the log thread, thread messages are lost.\n");
+  }
+
+  if (rt_exec_start(tasks, ntasks)) {
+    fprintf(stderr, "Failed to start periodic threads.\n");
+    run_program = 0;
+  }
 
   /****************************************************************************
   *	Wait until threads are complete before main continues. Unless we
   *	wait, we run the risk of executing an exit which will terminate
   *	the process and all threads before the threads have completed.
   ****************************************************************************/
-  pthread_join(thread1,NULL); // wait for Control_thread to complete
-  pthread_join(thread2,NULL); // wait for UART_thread to complete
-  pthread_join(thread3,NULL); // wait for CAN_read_thread to complete
+  rt_exec_join(tasks, ntasks);
+  rt_log_stop();
+  rt_exec_report(tasks, ntasks);
+  can_rx_report();
+  can_tx_report();
+  can_mon_report();
+  traj_report();
+  traj_close();
+  if (fdr_close()) {
+    fprintf(stderr,"Flight recorder: the last segment may be incomplete.\n");
+  }
+  fdr_report();
+  printf("SYNC cycles: %u of %u without all three answers within %d us\n",
+    syncMissed,syncHist.n + syncMissed,SYNC_TIMEOUT_US);
+  rt_exec_dump(STDOUT_FILENO);
+  rt_hist_dump(STDOUT_FILENO,"Control","sync",&syncHist);
+  rt_hist_dump(STDOUT_FILENO,"CAN_tx","wait",can_tx_wait_hist());
 
   if (kill_motors()) {
     fprintf(stderr,"Unable to kill motors!\n");
@@ -227,11 +279,16 @@ int main(void) {
     printf("Killed motors.\n");
   }
 
+  printf("Telemetry: %u frames, %u failed writes, subscriptions took %.0f%% of the link\n",
+    tlm.frames,tlm.writeErrors,100*tlm_load(&tlm));
+  tlm_close(&tlm);
+
   close(s); // close the CAN socket
+  can_mon_close();
 
-  printf("Done writing to and reading from data_buf.\n");
-  printf("Status of data_buf: read = %d, write = %d, empty = %d, full = %d\n",\
-  get_read_index(),get_write_index(),buffer_empty(),buffer_full());
+  printf("Telemetry ring: %u of %u records left, high water %u, %u dropped\n",
+    spsc_ring_count(&telemetry.ring),spsc_ring_capacity(&telemetry.ring),
+    spsc_ring_high_water(&telemetry.ring),spsc_ring_overflows(&telemetry.ring));
 
   printf("From main process ID: %d\n", ((int)getpid()));
 
@@ -243,131 +300,347 @@ int main(void) {
 //
 // CAN_read_thread:
 //
-// Reads from the CAN bus (blocking read), parses received CAN frames, and puts
-// parsed data into a global struct (dataFromCAN), shared with Control_thread.
-//
+// Waits for CAN frames (only the IDs we parse get through the kernel's
+// filters), reads all pending frames at once, and publishes the parsed data
+// (dataFromCAN) for Control_thread after each such batch.
 //
-// This is a periodic thread with period defined by CAN_READ_PERIOD_US.
+// This is a sporadic thread (CAN_READ_PERIOD_US is 0): each job is released
+// by frames arriving; readCAN() also returns every CAN_RX_TIMEOUT_MS without
+// any, so the thread notices when to stop. Its "# hist CAN_read latency" is
+// from the first frame reaching the socket to readCAN() waking up, and its
+// "exec" from there through draining, parsing and publishing the frames.
 //
 //*****************************************************************************
-void *CAN_read_thread() {
+void CAN_read_thread(rt_task *task) {
   uint16_t read_count = 0;
-  struct periodic_info info;
+  can_input_struct canIn = {0}; // this thread's working copy
+  struct timespec rx, woke;
 
-  while(!CAN_read_thread_begin) {;} // wait
-  make_periodic(CAN_READ_PERIOD_US, &info); // period (first argument) in microseconds
   while ((run_program) && (!control_complete)) {
   // while ((!control_complete)) {
-    readCAN(&dataFromCAN);
+    if (readCAN(&canIn, &rx, &woke) > 0) { // all frames pending, one publish
+      rt_task_release(task, &rx, &woke); // released by the first frame's arrival
+      can_input_publish(&dataFromCAN, &canIn);
+    }
 
-    wait_period(&info);
+    rt_task_wait(task);
   }
 
-  printf("CAN read thread has completed.\n");
-  return NULL;
+  rt_log("CAN read thread has completed.\n");
 }
 
 //*****************************************************************************
 //
 // Control_thread:
 //
-// Reads from a global struct (dataFromCAN), shared with CAN_read_thread.
-// Calculates control inputs (commanded motor torques or motor positions) and
-// writes them to the CAN bus. Also stores info from dataFromCAN and control
-// data to a circular buffer shared with UART_thread.
+// Runs one control cycle per period (CONTROL_PERIOD_US). It starts the
+// cycle by sending the MOTOR_CMD computed in the last one, which is also the
+// SYNC: the motor nodes sample their encoders as it arrives and answer at
+// once with its seq. The thread then sleeps until CAN_read_thread has
+// published all three answers (can_input_wait(), at most SYNC_TIMEOUT_US),
+// so it works on samples taken at a known time, microseconds old, rather
+// than on whatever a free-running node sent last. The SYNC-to-answers time
+// goes into syncHist ("# hist Control sync"). On a busy bus a command that
+// has not left when the next one is computed is replaced by it (see
+// can_io.h); the time each command waited for the bus goes into
+// "# hist CAN_tx wait". Over CAN FD the command also sets the nodes' gains
+// (JOINT_KP, JOINT_KD) and feedforward torques (ctrl).
 //
-// This is a periodic thread with period defined by CONTROL_PERIOD_US.
+// It then calculates control inputs (commanded motor torques or motor
+// positions) for the next cycle, and stores info from dataFromCAN and
+// control data to the telemetry ring read by UART_thread, and to the
+// flight data recorder (fdr.h). The motor positions for the next cycle are
+// the next point of the trajectory running, if any (traj_step(), traj.h);
+// over CAN FD its joint velocities (ref.dqa) go along as feedforward
+// torques, JOINT_KD*dqa, so the nodes' damping tracks the trajectory's
+// velocity instead of braking against it. Between trajectories the motors
+// hold the last point, without feedforward. The run lasts
+// BUFLEN cycles, or longer while trajectories are running, queued or
+// being uploaded.
 //
 //*****************************************************************************
 
-void *Control_thread() {
-  uint16_t k = 0;
+void Control_thread(rt_task *task) {
+  uint32_t k = 0;
   double trqArr[3] = {0.0, 1.0, -2.0};
   double posArr[3] = {-150.0,-45.0,-135.0};
 
-  struct periodic_info info;
-
   float qa[3] = {-1.6845,-2.6214,-1.4571}; // in degrees: -96.5, -150.2, -83.5
   // // -152.2, -170.2, -27.7 (deg) or -2.6564, -2.9706, -0.4835 (rad)
-  float qu[6];
-  float footPose[3] = {};
+  kin_state ks = {}; // qu, foot pose, Ja and inv(Ja), updated once per tick
+  can_input_struct canIn; // this tick's snapshot of dataFromCAN
+  struct timespec sent, answered;
+  uint8_t seq = 0;
+  tlm_sample rec = {0};
+  tg_sample ref = {{0}}; // the trajectory's point for the next cycle
+  can_joint_ctrl ctrl = {{0}, {JOINT_KP, JOINT_KP, JOINT_KP}, {JOINT_KD, JOINT_KD, JOINT_KD}};
   double wrench[3] = {0,-70,0};
-  double torques[3];
+  double torques[3] = {0};
+  struct timespec done;
+  int i;
 
   /****************************************************************************
-  * Wait for permission to begin,
-  * then send/receive via CAN and put relevant data into circular buffer.
+  * Send/receive via CAN and queue relevant data for UART_thread.
   ****************************************************************************/
   control_complete = 0;
-  while(!Control_thread_begin) {;}
-  make_periodic(CONTROL_PERIOD_US, &info); // period (first argument) in microseconds
-
-  while ((run_program) && (k < BUFLEN)) {
-  // while ((k < BUFLEN)) {
-    // get shared data:
-    pthread_mutex_lock(&mutex1);
-    qa[0] = (double) 0.000555556*PI*(dataFromCAN.qa_act[0] - 2700);
-    qa[1] = (double) 0.000555556*PI*(dataFromCAN.qa_act[1] - 2700);
-    qa[2] = (double) 0.000555556*PI*(dataFromCAN.qa_act[2] - 2700);
-    pthread_mutex_unlock(&mutex1);
-    printf("%d\t%d\t%d\n",dataFromCAN.qa_act[0],dataFromCAN.qa_act[1],dataFromCAN.qa_act[2]);
-    printf("qa = %f,\t%f,\t%f\n",qa[0],qa[1],qa[2]);
-
-    clock_t tic2 = clock();
-    geomFK(qa,qu,footPose,1);
-    subchainIK(qaTraj[k],qu,footPose);
-    if (wrench2torques(qa, qu, torques, wrench)) {
-      fprintf(stderr,"wrench2torques failed.\n");
+  setJointCtrlCAN(&ctrl);
+
+  while ((run_program) && (k < BUFLEN || traj_pending())) {
+    // SYNC, with the command of the last cycle:
+    ++seq;
+    clock_gettime(CLOCK_MONOTONIC, &sent);
+    writePosToCAN(posArr, seq);
+
+    // get shared data, once the motors have answered:
+    if (can_input_wait(&dataFromCAN, seq, &sent, SYNC_TIMEOUT_US, &canIn, &answered)) {
+      rt_hist_add(&syncHist, (int64_t)(answered.tv_sec - sent.tv_sec)*1000000000 +
+        (answered.tv_nsec - sent.tv_nsec));
+      rec.timing[1] = (answered.tv_sec - sent.tv_sec)*1e6 + (answered.tv_nsec - sent.tv_nsec)/1e3;
+    } else {
+      ++syncMissed; // go on with the latest samples
+      rec.timing[1] = 0;
+    }
+    qa[0] = (CANMSG_MOTOR_POS_POS_SCALE*canIn.qa_act[0] + CANMSG_MOTOR_POS_POS_OFFSET)*PI/180;
+    qa[1] = (CANMSG_MOTOR_POS_POS_SCALE*canIn.qa_act[1] + CANMSG_MOTOR_POS_POS_OFFSET)*PI/180;
+    qa[2] = (CANMSG_MOTOR_POS_POS_SCALE*canIn.qa_act[2] + CANMSG_MOTOR_POS_POS_OFFSET)*PI/180;
+
+    if (kin_state_update(&ks, qa, 1)) {
+      rt_log("kin_state_update failed.\n");
+    } else if (kin_state_wrench2torques(&ks, torques, wrench)) {
+      rt_log("wrench2torques failed.\n");
     }
-    clock_t toc2 = clock();
-    printf("Calculating took %f seconds\n", (double)(toc2 - tic2) / CLOCKS_PER_SEC);
-
-    // write to the CAN bus:
-    writePosToCAN(posArr); // this function handles the mutex
 
-    // put stuff in the circular buffer:
-    pthread_mutex_lock(&mutex1);
-    buffer_write(qa[0],qa[1],qa[2]);
-    pthread_mutex_unlock(&mutex1);
+    // queue telemetry for UART_thread (dropped and counted if the ring is full):
+    rec.tick = k;
+    rec.t_us = (uint32_t)((int64_t)sent.tv_sec*1000000 + sent.tv_nsec/1000);
+    for (i = 0; i < 3; ++i) {
+      rec.qa[i] = qa[i];
+      rec.foot[i] = ks.footPose[i];
+      rec.trq[i] = torques[i];
+      rec.ia[i] = canIn.ia[i];
+      rec.boom[i] = CANMSG_BOOM_ANGLE_ANGLE_SCALE*canIn.boom[i];
+      rec.cmd[i] = posArr[i];
+    }
+    memcpy(rec.qu, ks.qu, sizeof(rec.qu));
+    rec.accel = canIn.accel;
+    rec.fz = (uint16_t)canIn.fz;
+    rec.timing[0] = (task->wake.tv_sec - task->release.tv_sec)*1e6 +
+      (task->wake.tv_nsec - task->release.tv_nsec)/1e3;
+    clock_gettime(CLOCK_MONOTONIC, &done);
+    rec.timing[2] = (done.tv_sec - task->wake.tv_sec)*1e6 + (done.tv_nsec - task->wake.tv_nsec)/1e3;
+    telemetry_ring_push(&telemetry, &rec);
+    fdr_record(&rec);
+
+    // the next cycle's command:
+    if (traj_step(&ref)) {
+      for (i = 0; i < 3; ++i) {
+        posArr[i] = ref.qa[i]*180/PI;
+        ctrl.ff_Nm[i] = JOINT_KD*ref.dqa[i];
+      }
+    } else {
+      memset(ctrl.ff_Nm, 0, sizeof(ctrl.ff_Nm)); // holding
+    }
+    setJointCtrlCAN(&ctrl);
     ++k;
-    wait_period(&info);
+    rt_task_wait(task);
   }
-  printf("Control thread has completed.\n");
-  control_complete = 1;
-  return NULL;
+  rt_log("Control thread has completed.\n");
+  __atomic_store_n(&control_complete, 1, __ATOMIC_RELEASE);
 }
 
 //*****************************************************************************
 //
 // UART_thread
 //
-// Description
+// Sends the telemetry queued by Control_thread to the client over UART, up to
+// TELEMETRY_BATCH records per tick, each as a binary TLM_DATA frame (see
+// telemetry.h; client/hopper_telemetry.py decodes them). Everything else
+// goes out as TLM_TEXT frames. Sending CMD_DUMP_HIST to the Pi returns the
+// per-thread latency and execution time histograms ("# hist" lines, see
+// rt_exec_dump() in per_threads.h).
+//
+// Only qa is sent at first. The client picks the channels (the names in
+// the channel table, tlm_channels) with lines
+//   s <channel> <decimation>
+// (decimation 1: every tick, n: every n-th, 0: off), answered by
+//   # tlm <channel> every <decimation> ticks, link <load>%
+// or, if the link cannot carry it on top of the other channels (see
+// tlm_subscribe()), by "# tlm ... does not fit", and nothing changes.
+//
+// Trajectories come as binary frames, each between two zero bytes
+// (CMD_FRAME), which traj_frame() loads into the trajectory slots for
+// Control_thread (see traj.h); each gets an answer in a TLM_TRAJ frame, as
+// does the start and the end of every trajectory (traj_poll()). The thread
+// runs until Control_thread has stopped and its telemetry is all sent.
+//
+// It also sends the CAN monitor's summary of every window, as one line
+//   # can window=.. load=.. peak=.. (%) frames=.. state=.. worst=.. tec=.. rec=..
+//         err=.. busoff=.. buserr=.. noack=.. drops=..
+// and, on CMD_CAN_HEALTH, the last window per message:
+//   # can <message> hz=.. jitter=.. maxgap=.. (us)
 //
 //*****************************************************************************
-void *UART_thread() {
-  uint16_t j = 0;
-  float bufferval[3];
-  struct periodic_info info;
+// a CMD_SUBSCRIBE line, without its 's':
+static void subscribe_cmd(const char *args) {
+  char name[16];
+  unsigned decim;
+  float load;
+
+  if (sscanf(args, "%15s %u", name, &decim) != 2 || decim > UINT16_MAX) {
+    tlm_printf(&tlm,"# tlm usage: s <channel> <decimation>\n");
+    return;
+  }
+  switch (tlm_subscribe(&tlm, name, decim, &load)) {
+  case 0:
+    tlm_printf(&tlm,"# tlm %s every %u ticks, link %.0f%%\n",name,decim,100*load);
+    break;
+  case 1:
+    tlm_printf(&tlm,"# tlm unknown channel %s\n",name);
+    break;
+  default:
+    tlm_printf(&tlm,"# tlm %s every %u ticks does not fit, link %.0f%%\n",name,decim,100*load);
+  }
+}
+
+// a CMD_FRAME frame, still COBS encoded:
+static void traj_cmd(const uint8_t *frame, size_t n) {
+  traj_ack ack;
+
+  if (traj_frame(frame, n, &ack)) {
+    tlm_send_traj(&tlm, ack.id, ack.status, ack.slot, ack.points);
+  }
+}
+
+void UART_thread(rt_task *task) {
+  uint32_t i, n;
+  uint8_t done;
+  tlm_sample recs[TELEMETRY_BATCH];
+  can_mon_summary health = {0};
+  traj_ack ack;
+  struct pollfd pfd = {serial_port, POLLIN, 0};
+  char line[CMD_LINE_MAX + 1];
+  uint8_t in[CMD_READ_MAX], frame[TRAJ_MAX_FRAME + TRAJ_MAX_FRAME/254 + 1];
+  int lineLen = -1; // in a CMD_SUBSCRIBE line if >= 0
+  size_t frameLen = 0;
+  int inFrame = 0;  // after a CMD_FRAME
+  ssize_t got;
 
   /****************************************************************************
-  * Wait for permission to begin,
-  * then get relevant data from circular buffer and send via UART
+  * Get telemetry from the ring and send via UART
+  * (first release is UART_PHASE_US after the other threads')
   ****************************************************************************/
 
-  while(!UART_thread_begin) {;}
-  make_periodic(UART_PERIOD_US, &info); // period (1st argument) in microseconds
-  while ((run_program) && (j < BUFLEN)) {
-  // while ((j < BUFLEN)) {
-    pthread_mutex_lock(&mutex1);
-    buffer_read(bufferval);
-    pthread_mutex_unlock(&mutex1);
+  while (run_program) {
+    // the flag is read first: if it was set, the ring already holds the last
+    // record, and the trajectories their final state
+    done = __atomic_load_n(&control_complete, __ATOMIC_ACQUIRE);
+    while (traj_poll(&ack)) {
+      tlm_send_traj(&tlm, ack.id, ack.status, ack.slot, ack.points);
+    }
+    n = telemetry_ring_pop_n(&telemetry, recs, TELEMETRY_BATCH);
+    if (!n && done) {
+      break;
+    }
+    for (i = 0; i < n; ++i) {
+      tlm_send_sample(&tlm, &recs[i]);
+    }
+
+    if (can_health_ring_pop(&canHealth, &health)) {
+      tlm_printf(&tlm,"# can window=%u load=%.1f peak=%.1f frames=%u state=%s worst=%s "
+        "tec=%u rec=%u err=%u busoff=%u buserr=%u noack=%u drops=%u\n",
+        health.window,100*health.load,100*health.peakLoad,health.frames,
+        can_mon_state_name(health.state),can_mon_state_name(health.worstState),
+        health.txErr,health.rxErr,health.errFrames,health.busOff,health.busErrors,
+        health.noAck,health.drops);
+    }
+
+    // commands from the client, without blocking:
+    got = poll(&pfd, 1, 0) > 0 ? read(serial_port, in, sizeof(in)) : 0;
+    for (i = 0; (ssize_t)i < got; ++i) {
+      if (inFrame) {
+        if (in[i] != CMD_FRAME) {
+          if (frameLen < sizeof(frame)) {
+            frame[frameLen] = in[i];
+          }
+          ++frameLen; // too long: counted as corrupt when it ends
+        } else if (frameLen) {
+          traj_cmd(frame, frameLen < sizeof(frame) ? frameLen : 0);
+          frameLen = 0;
+          inFrame = 0;
+        } // else the zero byte before the next frame
+      } else if (lineLen >= 0) {
+        if (in[i] == '\n' || in[i] == '\r') {
+          line[lineLen] = 0;
+          subscribe_cmd(line);
+          lineLen = -1;
+        } else if (lineLen < CMD_LINE_MAX) {
+          line[lineLen++] = in[i];
+        }
+      } else if (in[i] == CMD_FRAME) {
+        inFrame = 1;
+      } else if (in[i] == CMD_SUBSCRIBE) {
+        lineLen = 0;
+      } else if (in[i] == CMD_DUMP_HIST) {
+        rt_exec_dump(tlm_text_fd(&tlm));
+        rt_hist_dump(tlm_text_fd(&tlm),"Control","sync",&syncHist);
+        rt_hist_dump(tlm_text_fd(&tlm),"CAN_tx","wait",can_tx_wait_hist());
+        tlm_flush_text(&tlm);
+      } else if (in[i] == CMD_CAN_HEALTH) {
+        for (n = 0; n < CANMSG_COUNT; ++n) {
+          tlm_printf(&tlm,"# can %s hz=%.1f jitter=%.1f maxgap=%u\n",canmsg_table[n].name,
+            health.msg[n].hz,health.msg[n].jitter_us,health.msg[n].maxGap_us);
+        }
+      }
+    }
+
+    rt_task_wait(task);
+  }
+  rt_log("UART thread has completed.\n");
+}
+
+//*****************************************************************************
+//
+// CAN_mon_thread
+//
+// Polls the CAN monitor (can_mon.h) every CAN_MON_PERIOD_US, under
+// SCHED_OTHER: the monitor's socket sees every frame on the bus, time
+// stamped by the kernel, so the thread only has to keep the socket from
+// filling up. Each window's summary goes to safety_check_bus(), and to
+// UART_thread for the client.
+//
+//*****************************************************************************
+void CAN_mon_thread(rt_task *task) {
+  can_mon_summary sum;
+
+  while ((run_program) && (!control_complete)) {
+    if (can_mon_poll(&sum)) {
+      safety_check_bus(&sum);
+      can_health_ring_push(&canHealth, &sum);
+    }
+
+    rt_task_wait(task);
+  }
+
+  rt_log("CAN monitor thread has completed.\n");
+}
 
-    dprintf(serial_port,"%5.3f %5.3f %5.3f\n",bufferval[0],bufferval[1],bufferval[2]);
-    printf("UART thread: %d: %5.3f %5.3f %5.3f\n",j,bufferval[0],bufferval[1],bufferval[2]);
-    ++j;
+//*****************************************************************************
+//
+// Recorder_thread
+//
+// Moves the samples Control_thread queued for the flight data recorder
+// (fdr_record()) to its segment files, every RECORDER_PERIOD_US, under
+// SCHED_OTHER: fdr_poll() copies them into the mapped segment and opens the
+// next one when it is full, which may wait for the storage. main()
+// writes out the rest with fdr_close(), once Control_thread has stopped.
+//
+//*****************************************************************************
+void Recorder_thread(rt_task *task) {
+  while ((run_program) && (!control_complete)) {
+    fdr_poll();
 
-    wait_period(&info);
+    rt_task_wait(task);
   }
-  printf("UART thread has completed.\n");
-  return NULL;
+
+  rt_log("Recorder thread has completed.\n");
 }
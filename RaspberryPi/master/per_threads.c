@@ -1,73 +1,313 @@
+#define _GNU_SOURCE // pthread_attr_setaffinity_np
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+
 #include "per_threads.h"
 
-int make_periodic(int unsigned period, struct periodic_info *info)
-{
-	static int next_sig;
-	int ret;
-	unsigned int ns;
-	unsigned int sec;
-	struct sigevent sigev;
-	timer_t timer_id;
-	struct itimerspec itval;
-
-	/* Initialise next_sig first time through. We can't use static
-	   initialisation because SIGRTMIN is a function call, not a constant */
-	if (next_sig == 0)
-		next_sig = SIGRTMIN;
-	/* Check that we have not run out of signals */
-	if (next_sig > SIGRTMAX)
-		return -1;
-	info->sig = next_sig;
-	next_sig++;
-	/* Create the signal mask that will be used in wait_period */
-	sigemptyset(&(info->alarm_sig));
-	sigaddset(&(info->alarm_sig), info->sig);
-
-	/* Create a timer that will generate the signal we have chosen */
-	sigev.sigev_notify = SIGEV_SIGNAL;
-	sigev.sigev_signo = info->sig;
-	sigev.sigev_value.sival_ptr = (void *)&timer_id;
-	ret = timer_create(CLOCK_MONOTONIC, &sigev, &timer_id);
-	if (ret == -1)
-		return ret;
-
-	/* Make the timer periodic */
-	sec = period / 1000000;
-	ns = (period - (sec * 1000000)) * 1000;
-	itval.it_interval.tv_sec = sec;
-	itval.it_interval.tv_nsec = ns;
-	itval.it_value.tv_sec = sec;
-	itval.it_value.tv_nsec = ns;
-	ret = timer_settime(timer_id, 0, &itval, NULL);
-	return ret;
-}
-
-void wait_period(struct periodic_info *info)
-{
-	int sig;
-	sigwait(&(info->alarm_sig), &sig);
+#define NSEC_PER_SEC 1000000000L
+
+// common start time of all tasks, and the tasks, set by rt_exec_start():
+static struct timespec rt_epoch;
+static rt_task *rt_tasks;
+static int rt_ntasks;
+
+static void ts_add_ns(struct timespec *t, int64_t ns) {
+  ns += t->tv_nsec;
+  t->tv_sec += ns/NSEC_PER_SEC;
+  t->tv_nsec = ns%NSEC_PER_SEC;
+}
+
+static int64_t ts_diff_ns(const struct timespec *a, const struct timespec *b) {
+  return (int64_t)(a->tv_sec - b->tv_sec)*NSEC_PER_SEC + (a->tv_nsec - b->tv_nsec);
+}
+
+static void sleep_until(const struct timespec *t) {
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, t, NULL) == EINTR);
+}
+
+/******************************************************************************
+* Histograms
+******************************************************************************/
+static uint32_t rt_hist_bucket(uint32_t us) {
+  uint32_t oct;
+
+  if (us < RT_HIST_LINEAR) {
+    return us;
+  }
+  oct = 31 - __builtin_clz(us); // floor(log2(us)), 3 or more
+  if (oct >= 3 + RT_HIST_OCTAVES) {
+    return RT_HIST_BUCKETS - 1;
+  }
+  return RT_HIST_LINEAR + 4*(oct - 3) + ((us >> (oct - 2)) & 3);
 }
 
-int setup_periodic(void) {
-  sigset_t alarm_sig;
-	int i;
+static uint32_t rt_hist_lower(uint32_t b) {
+  uint32_t oct;
 
-	pthread_mutex_init(&mutex1, NULL);
+  if (b < RT_HIST_LINEAR) {
+    return b;
+  }
+  oct = 3 + (b - RT_HIST_LINEAR)/4;
+  return (1u << oct) + ((b - RT_HIST_LINEAR)%4)*(1u << (oct - 2));
+}
+
+#define STORE(var, val) __atomic_store_n(&(var), (val), __ATOMIC_RELAXED)
+#define LOAD(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+void rt_hist_init(rt_hist *h) {
+  memset(h, 0, sizeof(*h));
+  h->min_us = UINT32_MAX;
+}
 
-	printf("Periodic threads using POSIX timers\n");
+// called by the owning task only:
+void rt_hist_add(rt_hist *h, int64_t ns) {
+  uint32_t us = ns <= 0 ? 0 : ns/1000 > UINT32_MAX ? UINT32_MAX : ns/1000;
+  uint32_t b = rt_hist_bucket(us);
 
-	/* Block all real time signals so they can be used for the timers.
-	   Note: this has to be done in main() before any threads are created
-	   so they all inherit the same mask. Doing it later is subject to
-	   race conditions */
-	sigemptyset(&alarm_sig);
-	for (i = SIGRTMIN; i <= SIGRTMAX; i++)
-		sigaddset(&alarm_sig, i);
-	sigprocmask(SIG_BLOCK, &alarm_sig, NULL);
+  STORE(h->count[b], h->count[b] + 1);
+  STORE(h->sum_us, h->sum_us + us);
+  if (us < h->min_us) STORE(h->min_us, us);
+  if (us > h->max_us) STORE(h->max_us, us);
+  STORE(h->n, h->n + 1);
+}
+
+// smallest bucket upper bound below which a fraction q of the samples lie:
+static uint32_t rt_hist_quantile(const uint32_t *count, uint32_t n, uint32_t max, double q) {
+  uint64_t cum = 0;
+  uint32_t b;
+
+  for (b = 0; b < RT_HIST_BUCKETS - 1; ++b) {
+    cum += count[b];
+    if (cum >= q*n) {
+      return rt_hist_lower(b + 1) < max ? rt_hist_lower(b + 1) : max;
+    }
+  }
+  return max;
+}
+
+void rt_hist_dump(int fd, const char *task, const char *kind, const rt_hist *h) {
+  uint32_t count[RT_HIST_BUCKETS];
+  uint32_t b, n, max;
+
+  // a snapshot: the task may add samples meanwhile, so counts can be one off
+  n = 0;
+  for (b = 0; b < RT_HIST_BUCKETS; ++b) {
+    count[b] = LOAD(h->count[b]);
+    n += count[b];
+  }
+  max = LOAD(h->max_us);
+  if (!n) {
+    dprintf(fd,"# hist %s %s n=0\n",task,kind);
+    return;
+  }
+
+  dprintf(fd,"# hist %s %s n=%u min=%u mean=%.1f p50=%u p99=%u p99.9=%u max=%u\n",
+    task,kind,n,LOAD(h->min_us),(double)LOAD(h->sum_us)/LOAD(h->n),
+    rt_hist_quantile(count,n,max,0.5),rt_hist_quantile(count,n,max,0.99),
+    rt_hist_quantile(count,n,max,0.999),max);
+  for (b = 0; b < RT_HIST_BUCKETS; ++b) {
+    if (count[b]) {
+      dprintf(fd,"# hist %s %s %u %u\n",task,kind,rt_hist_lower(b),count[b]);
+    }
+  }
+}
+
+void rt_exec_dump(int fd) {
+  int i;
+
+  fflush(stdout); // keep the order with anything printf'd before
+  for (i = 0; i < rt_ntasks; ++i) {
+    // sporadic tasks too, n=0 if their bodies never call rt_task_release():
+    rt_hist_dump(fd, rt_tasks[i].name, "latency", &rt_tasks[i].latency);
+    rt_hist_dump(fd, rt_tasks[i].name, "exec", &rt_tasks[i].exec);
+  }
+}
+
+/******************************************************************************
+* Executive
+******************************************************************************/
+
+// touch the first RT_STACK_PREFAULT bytes of the stack so that the task's
+// first jobs do not take page faults:
+static void __attribute__((noinline)) prefault_stack(void) {
+  volatile unsigned char stack[RT_STACK_PREFAULT];
+  size_t i;
+
+  for (i = 0; i < sizeof(stack); i += 1024) {
+    stack[i] = 0;
+  }
+}
+
+static void *rt_task_thread(void *arg) {
+  rt_task *task = arg;
+
+  prefault_stack();
+
+  task->release = rt_epoch;
+  ts_add_ns(&task->release, (int64_t)task->phase_us*1000);
+  sleep_until(&task->release);
+  clock_gettime(CLOCK_MONOTONIC, &task->wake);
+  if (task->period_us) {
+    rt_hist_add(&task->latency, ts_diff_ns(&task->wake, &task->release));
+  }
+
+  task->body(task);
+  return NULL;
+}
+
+int rt_exec_init(void) {
+  printf("Periodic threads using clock_nanosleep\n");
+
+  // lock everything mapped now and later (heap, thread stacks) into RAM:
+  if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+    perror("rt_exec_init: mlockall (not running as root?)");
+  }
+
+  return 0;
+}
+
+// Creates all task threads. The first release of each task is its phase
+// after a common start time, far enough ahead for every thread to get
+// created and prefault its stack.
+int rt_exec_start(rt_task *tasks, int ntasks) {
+  pthread_attr_t attr;
+  struct sched_param param;
+  cpu_set_t cpus, online;
+  rt_task *task;
+  int i, rc;
+
+  // the CPUs we may run on (fewer than the tasks ask for on a smaller board,
+  // or under taskset):
+  if (sched_getaffinity(0, sizeof(online), &online)) {
+    CPU_ZERO(&online);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &rt_epoch);
+  ts_add_ns(&rt_epoch, 10000000L + 1000000L*ntasks);
+  rt_tasks = tasks;
+  rt_ntasks = ntasks;
+
+  for (i = 0; i < ntasks; ++i) {
+    task = &tasks[i];
+    task->jobs = task->overruns = task->skipped = task->maxResponse_us = 0;
+    task->realtime = task->priority > 0;
+    task->released = 0;
+    rt_hist_init(&task->latency);
+    rt_hist_init(&task->exec);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, RT_STACK_SIZE);
+    if (task->cpu >= 0 && (task->cpu >= CPU_SETSIZE || !CPU_ISSET(task->cpu, &online))) {
+      fprintf(stderr,"rt_exec_start: no CPU %d here, %s runs on any CPU.\n",task->cpu,task->name);
+      task->cpu = -1;
+    }
+    if (task->cpu >= 0) {
+      CPU_ZERO(&cpus);
+      CPU_SET(task->cpu, &cpus);
+      pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+    if (task->realtime) {
+      param.sched_priority = task->priority;
+      pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+      pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+      pthread_attr_setschedparam(&attr, &param);
+    }
+
+    rc = pthread_create(&task->thread, &attr, &rt_task_thread, task);
+    if (rc == EPERM && task->realtime) {
+      fprintf(stderr,"rt_exec_start: no permission for SCHED_FIFO, %s runs as a normal thread.\n",task->name);
+      task->realtime = 0;
+      pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+      rc = pthread_create(&task->thread, &attr, &rt_task_thread, task);
+    }
+    pthread_attr_destroy(&attr);
+
+    if (rc) {
+      fprintf(stderr,"rt_exec_start: creating %s failed: %s\n",task->name,strerror(rc));
+      return 1;
+    }
+  }
 
   return 0;
 }
 
+// Ends the current job: checks it against its deadline, then sleeps until
+// the next release. If the job ran past one or more whole periods, those
+// releases are dropped (counted in skipped) and the next job starts at once,
+// so a stall is not followed by a burst of back-to-back jobs.
+void rt_task_wait(rt_task *task) {
+  struct timespec now;
+  int64_t response, period = (int64_t)task->period_us*1000;
+  int64_t deadline = task->deadline_us ? (int64_t)task->deadline_us*1000 : period;
+
+  ++task->jobs;
+  if (!period) { // sporadic: the next job is released by the body's own input
+    if (task->released) {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      response = ts_diff_ns(&now, &task->release);
+      if (task->deadline_us && response > deadline) {
+        ++task->overruns;
+      }
+      if (response/1000 > task->maxResponse_us) {
+        task->maxResponse_us = response/1000;
+      }
+      rt_hist_add(&task->exec, ts_diff_ns(&now, &task->wake));
+      task->released = 0;
+    }
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  response = ts_diff_ns(&now, &task->release);
+  if (response > deadline) {
+    ++task->overruns;
+  }
+  if (response/1000 > task->maxResponse_us) {
+    task->maxResponse_us = response/1000;
+  }
+  rt_hist_add(&task->exec, ts_diff_ns(&now, &task->wake));
+
+  ts_add_ns(&task->release, period);
+  while (ts_diff_ns(&now, &task->release) >= period) {
+    ts_add_ns(&task->release, period);
+    ++task->skipped;
+  }
+  sleep_until(&task->release);
+  clock_gettime(CLOCK_MONOTONIC, &task->wake);
+  rt_hist_add(&task->latency, ts_diff_ns(&task->wake, &task->release));
+}
+
+void rt_task_release(rt_task *task, const struct timespec *release, const struct timespec *wake) {
+  task->release = *release;
+  if (wake) {
+    task->wake = *wake;
+  } else {
+    clock_gettime(CLOCK_MONOTONIC, &task->wake);
+  }
+  rt_hist_add(&task->latency, ts_diff_ns(&task->wake, &task->release));
+  task->released = 1;
+}
+
+void rt_exec_join(rt_task *tasks, int ntasks) {
+  int i;
+
+  for (i = 0; i < ntasks; ++i) {
+    pthread_join(tasks[i].thread, NULL);
+  }
+}
+
+void rt_exec_report(const rt_task *tasks, int ntasks) {
+  int i;
+
+  printf("%-16s %8s %8s %8s %8s %10s\n","task","period","jobs","overruns","skipped","max resp");
+  for (i = 0; i < ntasks; ++i) {
+    printf("%-16s %6uus %8u %8u %8u %8uus%s\n",tasks[i].name,tasks[i].period_us,
+      tasks[i].jobs,tasks[i].overruns,tasks[i].skipped,tasks[i].maxResponse_us,
+      tasks[i].realtime ? "" : " (not SCHED_FIFO)");
+  }
+}
+
 void display_sched_attr(int policy, struct sched_param *param)
 {
    printf("    policy=%s, priority=%d\n",
@@ -2,28 +2,113 @@
 #define __PER_THREADS__H__
 // Header file for per_threads.c
 // Implements periodic thread scheduling
-
-// per_threads.c is a library based on timer.c from http://2net.co.uk/tutorial/periodic_threads
+//
+// per_threads.c is a small real-time executive. Each task is declared with a
+// period, relative deadline, SCHED_FIFO priority, CPU and release phase
+// (rt_task below); rt_exec_start() creates one thread per task, pinned and
+// prioritized, with its stack prefaulted, and releases all of them against
+// a common start time. A task body does one job per period and then calls
+// rt_task_wait(), which sleeps until the next release with an absolute-time
+// clock_nanosleep() (so the period does not drift) and counts overruns.
+//
+// Every task also records its wake-up latency (release to wake-up) and
+// execution time (wake-up to rt_task_wait()) in two log-scale histograms, as
+// cyclictest does. A sporadic task (period 0) has no releases of its own:
+// its body calls rt_task_release() when its input has come, with the time
+// the input arrived. Only the task's own thread writes the histograms, with
+// relaxed atomic stores, so rt_exec_dump() can print them from any thread
+// while the tasks run, without locks.
+//
+// rt_exec_init() locks all memory (mlockall) first, so no task takes a page
+// fault once running. Without root (e.g. on a dev box) SCHED_FIFO and
+// mlockall() are refused; the executive warns and runs the tasks as normal
+// threads.
+//
+// The scheduling was first based on timer.c from
+// http://2net.co.uk/tutorial/periodic_threads
 
 #include <stdio.h>
-#include <signal.h>
 #include <errno.h>
 #include <time.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <unistd.h>
 
-struct periodic_info {
-	int sig;
-	sigset_t alarm_sig;
+#define RT_STACK_SIZE (256*1024)    // stack of every task thread
+#define RT_STACK_PREFAULT (64*1024) // part of it touched before the first job
+
+// histogram of times in microseconds: 1 us wide buckets below 8 us, then 4
+// buckets per octave (at most 25% wide) up to 2^20 us (~1 s); longer times
+// go in the last bucket.
+#define RT_HIST_LINEAR 8
+#define RT_HIST_OCTAVES 17
+#define RT_HIST_BUCKETS (RT_HIST_LINEAR + 4*RT_HIST_OCTAVES)
+
+typedef struct {
+  uint32_t count[RT_HIST_BUCKETS];
+  uint32_t n;
+  uint32_t min_us, max_us;
+  uint64_t sum_us;
+} rt_hist;
+
+typedef struct rt_task rt_task;
+
+struct rt_task {
+  // declared by the caller:
+  const char *name;
+  void (*body)(rt_task *task); // does one job per period, calls rt_task_wait()
+  void *arg;                   // for the body's use
+  uint32_t period_us;          // 0: sporadic, the body blocks on its own input
+  uint32_t deadline_us;        // relative deadline, 0: same as the period
+  uint32_t phase_us;           // first release, after the common start time
+  int priority;                // SCHED_FIFO priority, 1..99; 0: SCHED_OTHER
+  int cpu;                     // CPU to pin the thread to, -1: any
+
+  // kept by the executive:
+  pthread_t thread;
+  struct timespec release;     // release time of the current job
+  uint32_t jobs;               // jobs completed
+  uint32_t overruns;           // jobs that finished after their deadline
+  uint32_t skipped;            // releases dropped after an overrun
+  uint32_t maxResponse_us;     // worst release-to-completion time
+  uint8_t realtime;            // 1 if running under SCHED_FIFO
+  uint8_t released;            // sporadic: rt_task_release() called for this job
+  struct timespec wake;        // wake-up time of the current job
+  rt_hist latency;             // wake-up latency (periodic tasks only)
+  rt_hist exec;                // execution time (periodic tasks only)
 };
 
-pthread_mutex_t mutex1;
+int rt_exec_init(void);
+
+int rt_exec_start(rt_task *tasks, int ntasks);
+
+void rt_task_wait(rt_task *task);
+
+// for a sporadic task: its job was released at *release (the arrival of its
+// input, CLOCK_MONOTONIC) and woke at *wake (NULL: now); records the latency,
+// and has rt_task_wait() record the execution time and check the deadline
+// (deadline_us, if set):
+void rt_task_release(rt_task *task, const struct timespec *release, const struct timespec *wake);
+
+void rt_exec_join(rt_task *tasks, int ntasks);
+
+void rt_exec_report(const rt_task *tasks, int ntasks);
+
+// writes the histograms of all running tasks to fd (stdout, the serial
+// port, ...), one "# hist" line each for the summary and every non-empty
+// bucket:
+//   # hist <task> <latency|exec> n=.. min=.. mean=.. p50=.. p99=.. p99.9=.. max=.. (us)
+//   # hist <task> <latency|exec> <bucket lower bound, us> <count>
+void rt_exec_dump(int fd);
 
-int make_periodic(int unsigned period, struct periodic_info *info);
+// A task may keep histograms of its own (e.g. the time from sending a
+// command to its reply), with the same buckets and "# hist" lines:
+void rt_hist_init(rt_hist *h);
 
-void wait_period(struct periodic_info *info);
+// adds a time of ns; from one thread only (as for the task's own histograms):
+void rt_hist_add(rt_hist *h, int64_t ns);
 
-int setup_periodic(void);
+void rt_hist_dump(int fd, const char *task, const char *kind, const rt_hist *h);
 
 void display_sched_attr(int policy, struct sched_param *param);
 
@@ -0,0 +1,267 @@
+#define _GNU_SOURCE // pthread_attr_setaffinity_np
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#include "rt_log.h"
+#include "spsc_ring.h"
+
+typedef struct {
+  const char *fmt;
+  union {
+    long long i;
+    double d;
+    const void *p;
+  } arg[RT_LOG_MAXARGS];
+} rt_log_rec;
+
+SPSC_RING_DEFINE(rt_log_ring, rt_log_rec, RT_LOG_RECORDS)
+
+static rt_log_ring rt_log_rings[RT_LOG_THREADS];
+static uint8_t rt_log_ready[RT_LOG_THREADS]; // set once the ring is claimed
+static uint32_t rt_log_claimed;              // rings handed out (may pass RT_LOG_THREADS)
+static uint32_t rt_log_unringed;             // records of threads that got no ring
+
+static __thread rt_log_ring *rt_log_mine;
+static __thread uint8_t rt_log_none;         // this thread got no ring
+
+static FILE *rt_log_out;
+static pthread_t rt_log_thread;
+static uint8_t rt_log_running, rt_log_stopping;
+
+/******************************************************************************
+* Format parsing, shared by rt_log() and the background thread
+******************************************************************************/
+enum {RT_LOG_ARG_NONE, RT_LOG_ARG_INT, RT_LOG_ARG_UINT, RT_LOG_ARG_DOUBLE, RT_LOG_ARG_PTR, RT_LOG_ARG_BAD};
+
+// length modifiers:
+enum {RT_LOG_LEN_INT, RT_LOG_LEN_LONG, RT_LOG_LEN_LLONG, RT_LOG_LEN_SIZE, RT_LOG_LEN_PTRDIFF, RT_LOG_LEN_LDOUBLE};
+
+// parses the conversion spec at p (just after its '%'); returns the
+// character after it, and the argument it takes and its length modifier:
+static const char *rt_log_spec(const char *p, int *arg, int *len) {
+  *len = RT_LOG_LEN_INT;
+  p += strspn(p, "-+ #0");
+  p += strspn(p, "0123456789");
+  if (*p == '.') {
+    p += 1 + strspn(p + 1, "0123456789");
+  }
+  for (; *p && strchr("hljztL", *p); ++p) {
+    switch (*p) {
+      case 'h': break; // promoted to int anyway
+      case 'l': *len = *len == RT_LOG_LEN_LONG ? RT_LOG_LEN_LLONG : RT_LOG_LEN_LONG; break;
+      case 'j': *len = RT_LOG_LEN_LLONG; break;
+      case 'z': *len = RT_LOG_LEN_SIZE; break;
+      case 't': *len = RT_LOG_LEN_PTRDIFF; break;
+      case 'L': *len = RT_LOG_LEN_LDOUBLE; break;
+    }
+  }
+
+  switch (*p) {
+    case '%': *arg = RT_LOG_ARG_NONE; break;
+    case 'd': case 'i': case 'c': *arg = RT_LOG_ARG_INT; break;
+    case 'u': case 'o': case 'x': case 'X': *arg = RT_LOG_ARG_UINT; break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+      *arg = *len == RT_LOG_LEN_LDOUBLE ? RT_LOG_ARG_BAD : RT_LOG_ARG_DOUBLE;
+      break;
+    case 's': case 'p': *arg = RT_LOG_ARG_PTR; break;
+    default: *arg = RT_LOG_ARG_BAD; // '*', %n, or not a conversion
+  }
+  return *p ? p + 1 : p;
+}
+
+/******************************************************************************
+* Real-time side
+******************************************************************************/
+static rt_log_ring *rt_log_claim(void) {
+  uint32_t i = __atomic_fetch_add(&rt_log_claimed, 1, __ATOMIC_RELAXED);
+
+  if (i >= RT_LOG_THREADS) {
+    rt_log_none = 1;
+    return NULL;
+  }
+  rt_log_ring_init(&rt_log_rings[i]);
+  __atomic_store_n(&rt_log_ready[i], 1, __ATOMIC_RELEASE);
+  return &rt_log_rings[i];
+}
+
+void rt_log(const char *fmt, ...) {
+  rt_log_rec rec;
+  va_list ap;
+  const char *p = fmt;
+  int n = 0, arg, len;
+
+  if (!rt_log_mine && (rt_log_none || !(rt_log_mine = rt_log_claim()))) {
+    __atomic_fetch_add(&rt_log_unringed, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  rec.fmt = fmt;
+  va_start(ap, fmt);
+  while (n < RT_LOG_MAXARGS && (p = strchr(p, '%'))) {
+    p = rt_log_spec(p + 1, &arg, &len);
+    if (arg == RT_LOG_ARG_BAD) {
+      break; // the rest of fmt is written out as it is
+    } else if (arg == RT_LOG_ARG_DOUBLE) {
+      rec.arg[n++].d = va_arg(ap, double);
+    } else if (arg == RT_LOG_ARG_PTR) {
+      rec.arg[n++].p = va_arg(ap, const void *);
+    } else if (arg != RT_LOG_ARG_NONE) {
+      switch (len) {
+        case RT_LOG_LEN_LONG: rec.arg[n++].i = va_arg(ap, long); break;
+        case RT_LOG_LEN_LLONG: rec.arg[n++].i = va_arg(ap, long long); break;
+        case RT_LOG_LEN_SIZE: rec.arg[n++].i = va_arg(ap, size_t); break;
+        case RT_LOG_LEN_PTRDIFF: rec.arg[n++].i = va_arg(ap, ptrdiff_t); break;
+        default: rec.arg[n++].i = va_arg(ap, int);
+      }
+    }
+  }
+  va_end(ap);
+
+  rt_log_ring_push(rt_log_mine, &rec); // dropped and counted if full
+}
+
+uint32_t rt_log_dropped(void) {
+  uint32_t i, dropped = __atomic_load_n(&rt_log_unringed, __ATOMIC_RELAXED);
+
+  for (i = 0; i < RT_LOG_THREADS; ++i) {
+    if (__atomic_load_n(&rt_log_ready[i], __ATOMIC_ACQUIRE)) {
+      dropped += spsc_ring_overflows(&rt_log_rings[i].ring);
+    }
+  }
+  return dropped;
+}
+
+/******************************************************************************
+* Background thread
+******************************************************************************/
+
+// formats one record, a conversion at a time:
+static void rt_log_write(FILE *out, const rt_log_rec *rec) {
+  char spec[32];
+  const char *p = rec->fmt, *q;
+  int n = 0, arg, len;
+
+  while ((q = strchr(p, '%'))) {
+    fwrite(p, 1, q - p, out);
+    p = rt_log_spec(q + 1, &arg, &len);
+    if (arg == RT_LOG_ARG_BAD || n == RT_LOG_MAXARGS || (size_t)(p - q) >= sizeof(spec)) {
+      p = q; // as rt_log() gave up here
+      break;
+    }
+    memcpy(spec, q, p - q);
+    spec[p - q] = '\0';
+
+    if (arg == RT_LOG_ARG_NONE) {
+      fputc('%', out);
+    } else if (arg == RT_LOG_ARG_DOUBLE) {
+      fprintf(out, spec, rec->arg[n++].d);
+    } else if (arg == RT_LOG_ARG_PTR) {
+      fprintf(out, spec, rec->arg[n++].p);
+    } else {
+      switch (len) {
+        case RT_LOG_LEN_LONG: fprintf(out, spec, (long)rec->arg[n++].i); break;
+        case RT_LOG_LEN_LLONG: fprintf(out, spec, rec->arg[n++].i); break;
+        case RT_LOG_LEN_SIZE: fprintf(out, spec, (size_t)rec->arg[n++].i); break;
+        case RT_LOG_LEN_PTRDIFF: fprintf(out, spec, (ptrdiff_t)rec->arg[n++].i); break;
+        default:
+          if (arg == RT_LOG_ARG_UINT) {
+            fprintf(out, spec, (unsigned)rec->arg[n++].i);
+          } else {
+            fprintf(out, spec, (int)rec->arg[n++].i);
+          }
+      }
+    }
+  }
+  fputs(p, out);
+}
+
+// writes out all queued records; returns how many:
+static uint32_t rt_log_drain(FILE *out) {
+  static uint32_t reported; // dropped records reported so far
+  rt_log_rec recs[32];
+  uint32_t i, j, n, total = 0, dropped;
+
+  for (i = 0; i < RT_LOG_THREADS; ++i) {
+    if (!__atomic_load_n(&rt_log_ready[i], __ATOMIC_ACQUIRE)) {
+      continue;
+    }
+    while ((n = rt_log_ring_pop_n(&rt_log_rings[i], recs, sizeof(recs)/sizeof(recs[0])))) {
+      for (j = 0; j < n; ++j) {
+        rt_log_write(out, &recs[j]);
+      }
+      total += n;
+    }
+  }
+
+  dropped = rt_log_dropped();
+  if (dropped != reported) {
+    fprintf(out, "rt_log: %u records dropped\n", dropped - reported);
+    reported = dropped;
+  }
+  if (total) {
+    fflush(out);
+  }
+  return total;
+}
+
+static void *rt_log_main(void *arg) {
+  struct timespec period = {0, RT_LOG_PERIOD_US*1000L};
+  uint8_t stopping;
+
+  (void)arg;
+  for (;;) {
+    // read the flag first: if it was set, everything logged before it is queued
+    stopping = __atomic_load_n(&rt_log_stopping, __ATOMIC_ACQUIRE);
+    if (!rt_log_drain(rt_log_out) && stopping) {
+      break;
+    }
+    nanosleep(&period, NULL);
+  }
+  fflush(rt_log_out);
+  return NULL;
+}
+
+int rt_log_start(FILE *out, int cpu) {
+  pthread_attr_t attr;
+  cpu_set_t cpus;
+  int rc;
+
+  rt_log_out = out;
+  rt_log_stopping = 0;
+
+  pthread_attr_init(&attr);
+  if (cpu >= 0) {
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+  }
+  rc = pthread_create(&rt_log_thread, &attr, &rt_log_main, NULL);
+  if (rc == EINVAL && cpu >= 0) { // no such CPU here, or not ours
+    fprintf(stderr,"rt_log_start: cannot run on CPU %d, the log thread runs on any CPU.\n",cpu);
+    pthread_attr_destroy(&attr);
+    pthread_attr_init(&attr);
+    rc = pthread_create(&rt_log_thread, &attr, &rt_log_main, NULL);
+  }
+  pthread_attr_destroy(&attr);
+
+  if (rc) {
+    fprintf(stderr,"rt_log_start: creating the log thread failed: %s\n",strerror(rc));
+    return 1;
+  }
+  rt_log_running = 1;
+  return 0;
+}
+
+void rt_log_stop(void) {
+  if (!rt_log_running) {
+    return;
+  }
+  __atomic_store_n(&rt_log_stopping, 1, __ATOMIC_RELEASE);
+  pthread_join(rt_log_thread, NULL);
+  rt_log_running = 0;
+}
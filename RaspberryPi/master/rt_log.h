@@ -0,0 +1,49 @@
+#ifndef __RT_LOG__H__
+#define __RT_LOG__H__
+// Header file for rt_log.c
+// Implements asynchronous logging for the real-time threads
+//
+// rt_log() takes a printf format and arguments, but does not format or write
+// anything: it copies the format pointer and the raw arguments into a
+// fixed-size record and pushes it into the calling thread's own SPSC ring
+// (spsc_ring.h). A background thread started by rt_log_start(), running
+// under SCHED_OTHER, pops the records of all threads, formats them and
+// writes them out. So rt_log() never blocks, never allocates and costs
+// about as much as a short memcpy.
+//
+// A thread gets its ring on its first rt_log() call, from a static pool of
+// RT_LOG_THREADS. When its ring is full (or the pool is used up), records
+// are dropped and counted; the background thread prints the count, instead
+// of the real-time thread ever waiting for the output.
+//
+// Since records are formatted later:
+// - fmt must be a string literal (only the pointer is kept);
+// - %s arguments must be string literals or other strings that outlive the
+//   program's logging (they are read when formatted);
+// - at most RT_LOG_MAXARGS conversions per record, no '*' width or
+//   precision, no %n and no long double (%Lf).
+//
+// Records of one thread come out in order; records of different threads
+// come out in rough time order (the rings are drained in turn).
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define RT_LOG_THREADS 8    // threads that may call rt_log()
+#define RT_LOG_RECORDS 256  // ring size per thread (a power of 2)
+#define RT_LOG_MAXARGS 8    // conversions per record
+#define RT_LOG_PERIOD_US 10000 // how often the background thread drains
+
+void rt_log(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// starts the background thread, writing to out (stdout, a file, ...) and
+// pinned to cpu (-1: any); returns 0 on success, 1 on failure:
+int rt_log_start(FILE *out, int cpu);
+
+// writes out everything still queued, then stops the background thread:
+void rt_log_stop(void);
+
+// records dropped so far (rings full, or no ring left for a thread):
+uint32_t rt_log_dropped(void);
+
+#endif
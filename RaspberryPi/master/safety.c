@@ -17,7 +17,8 @@ void trap(int signal) {
 int kill_motors(void) { //
   double qa_trq_kill[3] = {0.0, 0.0, 0.0};
 
-  if (writeTrqToCAN(qa_trq_kill)) {
+  can_tx_reset(); // goes out now, not behind a command whose echo nobody reads
+  if (writeTrqToCAN(qa_trq_kill, 0)) {
     fprintf(stderr,"Unable to write KILL torques to CAN.\n");
     return 1;
   }
@@ -26,3 +27,20 @@ int kill_motors(void) { //
 
   return 0;
 }
+
+int safety_check_bus(const can_mon_summary *sum) {
+  if (sum->load > CAN_MON_LOAD_WARN) {
+    rt_log("CAN bus load %.1f%% (peak %.1f%%), close to full\n",100*sum->load,100*sum->peakLoad);
+  }
+  if (sum->worstState < CAN_MON_ERROR_PASSIVE && !sum->busOff) {
+    return 0;
+  }
+
+  rt_log("CAN bus fault: %s (now %s), %u bus-off, %u bus errors, tec %u rec %u\n",
+    can_mon_state_name(sum->worstState),can_mon_state_name(sum->state),sum->busOff,
+    sum->busErrors,sum->txErr,sum->rxErr);
+  if (SAFETY_STOP_ON_BUS_FAULT) {
+    run_program = 0;
+  }
+  return 1;
+}
@@ -9,6 +9,7 @@
 #include <wiringPi.h>
 
 #include "can_io.h"
+#include "can_mon.h"
 #include "linux-can-utils/lib.h"
 
 #define BOOM_ROLL_MAX 45
@@ -20,6 +21,10 @@
 
 #define COPLEY_EN 26
 
+// 1: end the run when the CAN bus goes error-passive or bus-off (see
+// safety_check_bus()); 0: only log it
+#define SAFETY_STOP_ON_BUS_FAULT 0
+
 uint8_t run_program;
 
 void safety_init(void);
@@ -28,4 +33,10 @@ void trap(int signal);
 
 int kill_motors(void);
 
+// acts on a window of the CAN monitor: logs a bus close to full, and a
+// controller that went error-passive or bus-off, in which case the motor
+// nodes' frames may no longer get through; ends the run for the latter if
+// SAFETY_STOP_ON_BUS_FAULT is set. Returns 1 if the bus was faulty, else 0:
+int safety_check_bus(const can_mon_summary *sum);
+
 #endif
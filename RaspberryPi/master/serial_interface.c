@@ -47,9 +47,9 @@ void config_port(int fd) {
 
   tcgetattr(fd, &options); // Get the current options for the port
 
-  // Set the baud rates to 19200
-  cfsetispeed(&options, B115200);
-  cfsetospeed(&options, B115200);
+  // Set the baud rates to SERIAL_BAUD
+  cfsetispeed(&options, SERIAL_SPEED);
+  cfsetospeed(&options, SERIAL_SPEED);
 
   options.c_cflag |= (CLOCAL | CREAD); // Enable the receiver and set local mode
 
@@ -13,6 +13,9 @@
 #ifndef __SERIAL_INTERFACE__H__
 #define __SERIAL_INTERFACE__H__
 
+#define SERIAL_BAUD 115200   // bit/s (8N1)
+#define SERIAL_SPEED B115200 // the same, for cfsetispeed() (termios.h)
+
 int open_port(void);
 void config_port(int fd);
 
@@ -0,0 +1,150 @@
+#ifndef __SPSC_RING__H__
+#define __SPSC_RING__H__
+// Header file for single-producer/single-consumer ring buffers
+//
+// Replaces circ_buffer.c. A ring is a queue between exactly one producer
+// thread and one consumer thread, which never lock or wait on each other:
+// only the producer moves head and only the consumer moves tail, and each
+// publishes its index with a release store after touching the records,
+// which the other side loads with acquire. head and tail live on separate
+// cache lines, so pushing and popping do not bounce one line between CPUs.
+//
+// Declare a ring type for a record type and a capacity (a power of 2) with
+//   SPSC_RING_DEFINE(telemetry_ring, telemetry_rec, 1024)
+// which defines the type telemetry_ring and the functions
+//   void     telemetry_ring_init(telemetry_ring *q);
+//   uint8_t  telemetry_ring_push(telemetry_ring *q, const telemetry_rec *rec);
+//   uint32_t telemetry_ring_push_n(telemetry_ring *q, const telemetry_rec *recs, uint32_t n);
+//   uint8_t  telemetry_ring_pop(telemetry_ring *q, telemetry_rec *rec);
+//   uint32_t telemetry_ring_pop_n(telemetry_ring *q, telemetry_rec *recs, uint32_t n);
+// push/pop return the number of records queued/dequeued. A push to a full
+// ring keeps the records already queued and drops the new ones; they are
+// counted in spsc_ring_overflows(). spsc_ring_high_water() is the most
+// records ever queued at once, to size the ring.
+
+#include <stdint.h>
+#include <string.h>
+
+#define SPSC_CACHE_LINE 64 // Cortex-A53 (Pi 3) and x86
+
+typedef struct {
+  // written by the producer only:
+  uint32_t head __attribute__((aligned(SPSC_CACHE_LINE))); // records pushed so far
+  uint32_t overflows;  // records dropped because the ring was full
+  uint32_t highWater;  // most records queued at once
+
+  // written by the consumer only:
+  uint32_t tail __attribute__((aligned(SPSC_CACHE_LINE))); // records popped so far
+
+  // set by spsc_ring_init():
+  uint32_t mask __attribute__((aligned(SPSC_CACHE_LINE))); // capacity - 1
+  uint32_t size;       // bytes per record
+  unsigned char *rec;
+} spsc_ring;
+
+// head and tail run freely and wrap at 2^32; head - tail is the number of
+// records queued, and index & mask their slot.
+
+static inline void spsc_ring_init(spsc_ring *r, void *rec, uint32_t size, uint32_t capacity) {
+  memset(r, 0, sizeof(*r));
+  r->mask = capacity - 1;
+  r->size = size;
+  r->rec = rec;
+}
+
+// copies n records between recs and the slots from index on, wrapping:
+static inline void spsc_ring_copy_in(spsc_ring *r, uint32_t index, const void *recs, uint32_t n, uint32_t size) {
+  uint32_t first = index & r->mask;
+  uint32_t m = r->mask + 1 - first < n ? r->mask + 1 - first : n; // before the wrap
+
+  memcpy(r->rec + (size_t)first*size, recs, (size_t)m*size);
+  memcpy(r->rec, (const unsigned char *)recs + (size_t)m*size, (size_t)(n - m)*size);
+}
+
+static inline void spsc_ring_copy_out(spsc_ring *r, uint32_t index, void *recs, uint32_t n, uint32_t size) {
+  uint32_t first = index & r->mask;
+  uint32_t m = r->mask + 1 - first < n ? r->mask + 1 - first : n;
+
+  memcpy(recs, r->rec + (size_t)first*size, (size_t)m*size);
+  memcpy((unsigned char *)recs + (size_t)m*size, r->rec, (size_t)(n - m)*size);
+}
+
+// The record size is passed again (as a constant, by the typed wrappers) so
+// that the copies compile to a few loads and stores.
+
+// producer only:
+static inline uint32_t spsc_ring_push_n(spsc_ring *r, const void *recs, uint32_t n, uint32_t size) {
+  uint32_t head = r->head;
+  uint32_t used = head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+  uint32_t room = r->mask + 1 - used;
+
+  if (n > room) {
+    __atomic_store_n(&r->overflows, r->overflows + (n - room), __ATOMIC_RELAXED);
+    n = room;
+  }
+  if (used + n > r->highWater) {
+    __atomic_store_n(&r->highWater, used + n, __ATOMIC_RELAXED);
+  }
+  if (n) {
+    spsc_ring_copy_in(r, head, recs, n, size);
+    __atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+  }
+  return n;
+}
+
+// consumer only:
+static inline uint32_t spsc_ring_pop_n(spsc_ring *r, void *recs, uint32_t n, uint32_t size) {
+  uint32_t tail = r->tail;
+  uint32_t used = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - tail;
+
+  if (n > used) {
+    n = used;
+  }
+  if (n) {
+    spsc_ring_copy_out(r, tail, recs, n, size);
+    __atomic_store_n(&r->tail, tail + n, __ATOMIC_RELEASE);
+  }
+  return n;
+}
+
+// either side (a snapshot, the other side may be moving):
+static inline uint32_t spsc_ring_count(const spsc_ring *r) {
+  return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
+
+static inline uint32_t spsc_ring_capacity(const spsc_ring *r) {
+  return r->mask + 1;
+}
+
+static inline uint32_t spsc_ring_overflows(const spsc_ring *r) {
+  return __atomic_load_n(&r->overflows, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t spsc_ring_high_water(const spsc_ring *r) {
+  return __atomic_load_n(&r->highWater, __ATOMIC_RELAXED);
+}
+
+#define SPSC_RING_DEFINE(name, type, capacity) \
+  _Static_assert((capacity) > 0 && ((capacity) & ((capacity) - 1)) == 0, \
+    #name ": capacity must be a power of 2"); \
+  typedef struct { \
+    spsc_ring ring; \
+    type rec[capacity] __attribute__((aligned(SPSC_CACHE_LINE))); \
+  } name; \
+  static inline void name##_init(name *q) { \
+    spsc_ring_init(&q->ring, q->rec, sizeof(type), (capacity)); \
+  } \
+  static inline uint32_t name##_push_n(name *q, const type *recs, uint32_t n) { \
+    return spsc_ring_push_n(&q->ring, recs, n, sizeof(type)); \
+  } \
+  static inline uint8_t name##_push(name *q, const type *rec) { \
+    return spsc_ring_push_n(&q->ring, rec, 1, sizeof(type)); \
+  } \
+  static inline uint32_t name##_pop_n(name *q, type *recs, uint32_t n) { \
+    return spsc_ring_pop_n(&q->ring, recs, n, sizeof(type)); \
+  } \
+  static inline uint8_t name##_pop(name *q, type *rec) { \
+    return spsc_ring_pop_n(&q->ring, rec, 1, sizeof(type)); \
+  }
+
+#endif
@@ -0,0 +1,360 @@
+#define _GNU_SOURCE // pipe2
+#include "telemetry.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TLM_FIELD(f) offsetof(tlm_sample, f)
+
+const tlm_channel tlm_channels[] = {
+  // id, count, format, scale, offset, name, unit, field
+  {TLM_CH_QA, 3, TLM_I16, 1e-4f, 0, "qa", "rad", TLM_FIELD(qa)},           // +-3.27 rad
+  {TLM_CH_QU, 6, TLM_I16, 2e-4f, 0, "qu", "rad", TLM_FIELD(qu)},           // +-6.55 rad
+  {TLM_CH_FOOT, 3, TLM_F32, 1, 0, "foot", "m,m,rad", TLM_FIELD(foot)},
+  {TLM_CH_TRQ, 3, TLM_I16, 1e-3f, 0, "trq", "Nm", TLM_FIELD(trq)},         // +-32.7 Nm
+  {TLM_CH_IA, 3, TLM_I16, 1, 0, "ia", "mA", TLM_FIELD(ia)},                // as on the bus
+  {TLM_CH_BOOM, 3, TLM_I16, 0.1f, 0, "boom", "deg", TLM_FIELD(boom)},      // as on the bus
+  {TLM_CH_ACCEL, 1, TLM_I16, 1, 0, "accel", "raw", TLM_FIELD(accel)},
+  {TLM_CH_FZ, 1, TLM_I16, 1, 32768, "fz", "counts", TLM_FIELD(fz)},       // a u16 on the bus
+  {TLM_CH_TIMING, 3, TLM_I16, 1, 0, "timing", "us", TLM_FIELD(timing)},   // up to 32 ms
+  {TLM_CH_CMD, 3, TLM_I16, 0.1f, 0, "cmd", "deg", TLM_FIELD(cmd)}          // +-3276 deg
+};
+
+const int tlm_nchannels = sizeof(tlm_channels)/sizeof(tlm_channels[0]);
+
+_Static_assert(sizeof(tlm_channels)/sizeof(tlm_channels[0]) <= TLM_MAX_CHANNELS, "raise TLM_MAX_CHANNELS");
+
+static int find_channel(uint8_t id) {
+  int i;
+
+  for (i = 0; i < tlm_nchannels; ++i) {
+    if (tlm_channels[i].id == id) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// bytes of a channel in a sample frame, its id included:
+static size_t channel_size(const tlm_channel *ch) {
+  return 1 + ch->count*(ch->format == TLM_F32 ? 4 : 2);
+}
+
+// the share of the link taken by subscriptions decim, and the largest
+// sample frame (every channel due at once, on tick 0):
+static float link_load(const tlm_writer *w, const uint16_t *decim, size_t *maxFrame) {
+  double bytes = 0, frames = 0;
+  int i;
+
+  *maxFrame = TLM_FRAME_OVERHEAD;
+  for (i = 0; i < tlm_nchannels; ++i) {
+    if (decim[i]) {
+      bytes += w->tickHz/decim[i]*channel_size(&tlm_channels[i]);
+      frames += w->tickHz/decim[i];
+      *maxFrame += channel_size(&tlm_channels[i]);
+    }
+  }
+  if (frames > w->tickHz) {
+    frames = w->tickHz;
+  }
+  bytes += frames*TLM_FRAME_OVERHEAD;
+  return bytes/(w->baud/10.0*(1 - TLM_TEXT_SHARE)); // 10 bits a byte, start and stop bits included
+}
+
+uint16_t tlm_crc16(const uint8_t *p, size_t n) {
+  uint16_t crc = 0xFFFF;
+  int b;
+
+  while (n--) {
+    crc ^= (uint16_t)*p++ << 8;
+    for (b = 0; b < 8; ++b) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+size_t tlm_cobs_encode(const uint8_t *in, size_t n, uint8_t *out) {
+  size_t code = 0, o = 1, i;
+
+  // out[code] is the length of the current run of non-zero bytes, plus one
+  for (i = 0; i < n; ++i) {
+    if (in[i]) {
+      out[o++] = in[i];
+    }
+    if (!in[i] || o - code == 0xFF) {
+      out[code] = (uint8_t)(o - code);
+      code = o++;
+    }
+  }
+  out[code] = (uint8_t)(o - code);
+  return o;
+}
+
+size_t tlm_cobs_decode(const uint8_t *in, size_t n, uint8_t *out, size_t max) {
+  size_t i = 0, o = 0, code;
+
+  while (i < n) {
+    code = in[i];
+    if (!code || i + code > n || o + code - 1 > max) {
+      return 0;
+    }
+    memcpy(&out[o], &in[i + 1], code - 1);
+    o += code - 1;
+    i += code;
+    if (code < 0xFF && i < n) {
+      if (o == max) {
+        return 0;
+      }
+      out[o++] = 0;
+    }
+  }
+  return o;
+}
+
+static void put_u8(tlm_writer *w, uint8_t v) {
+  w->buf[w->len++] = v;
+}
+
+static void put_u16(tlm_writer *w, uint16_t v) {
+  put_u8(w, v & 0xFF);
+  put_u8(w, v >> 8);
+}
+
+static void put_u32(tlm_writer *w, uint32_t v) {
+  put_u16(w, v & 0xFFFF);
+  put_u16(w, v >> 16);
+}
+
+static void put_f32(tlm_writer *w, float v) {
+  uint32_t u;
+
+  memcpy(&u, &v, sizeof(u));
+  put_u32(w, u);
+}
+
+static void frame_start(tlm_writer *w, uint8_t type) {
+  w->len = 0;
+  put_u8(w, type);
+  put_u16(w, w->seq);
+}
+
+// CRC, COBS, the zero byte, and out to the fd:
+static int frame_write(tlm_writer *w) {
+  uint8_t out[TLM_MAX_PAYLOAD + 2 + (TLM_MAX_PAYLOAD + 2)/254 + 2];
+  size_t n;
+
+  put_u16(w, tlm_crc16(w->buf, w->len));
+  n = tlm_cobs_encode(w->buf, w->len, out);
+  out[n++] = 0;
+  ++w->seq; // a frame that cannot be written counts as lost
+  ++w->sinceDesc;
+  ++w->frames;
+  if (write(w->fd, out, n) != (ssize_t)n) {
+    ++w->writeErrors;
+    return 1;
+  }
+  return 0;
+}
+
+int tlm_init(tlm_writer *w, int fd, float tickHz, uint32_t baud) {
+  memset(w, 0, sizeof(*w));
+  w->fd = fd;
+  w->tickHz = tickHz;
+  w->baud = baud;
+  w->decim[find_channel(TLM_CH_QA)] = 1;
+  if (pipe2(w->text, O_NONBLOCK | O_CLOEXEC) < 0) {
+    perror("tlm_init: pipe2");
+    w->text[0] = w->text[1] = -1;
+    return 1;
+  }
+  return 0;
+}
+
+void tlm_close(tlm_writer *w) {
+  if (w->text[0] >= 0) {
+    close(w->text[0]);
+    close(w->text[1]);
+    w->text[0] = w->text[1] = -1;
+  }
+}
+
+static void put_str(tlm_writer *w, const char *s) {
+  size_t n = strlen(s);
+
+  put_u8(w, n);
+  memcpy(&w->buf[w->len], s, n);
+  w->len += n;
+}
+
+int tlm_send_desc(tlm_writer *w) {
+  const tlm_channel *ch;
+  int i;
+
+  frame_start(w, TLM_DESC);
+  for (i = 0; i < tlm_nchannels; ++i) {
+    ch = &tlm_channels[i];
+    // id, count, format, decimation, scale, offset: 13 bytes, and both strings
+    // with their length bytes:
+    if (w->len + 15 + strlen(ch->name) + strlen(ch->unit) > TLM_MAX_PAYLOAD) {
+      return 1; // the table has outgrown a frame
+    }
+    put_u8(w, ch->id);
+    put_u8(w, ch->count);
+    put_u8(w, ch->format);
+    put_u16(w, w->decim[i]);
+    put_f32(w, ch->scale);
+    put_f32(w, ch->offset);
+    put_str(w, ch->name);
+    put_str(w, ch->unit);
+  }
+  w->sinceDesc = 0;
+  return frame_write(w);
+}
+
+void tlm_begin(tlm_writer *w, uint32_t time_us) {
+  frame_start(w, TLM_DATA);
+  put_u32(w, time_us);
+}
+
+int tlm_subscribe(tlm_writer *w, const char *name, uint16_t decim, float *load) {
+  uint16_t next[TLM_MAX_CHANNELS];
+  size_t maxFrame;
+  float l;
+  int i;
+
+  for (i = 0; i < tlm_nchannels && strcmp(tlm_channels[i].name, name); ++i) {
+  }
+  if (i == tlm_nchannels) {
+    return 1;
+  }
+  memcpy(next, w->decim, sizeof(next));
+  next[i] = decim;
+  l = link_load(w, next, &maxFrame);
+  if (load) {
+    *load = l;
+  }
+  if (l > 1 || maxFrame > TLM_MAX_PAYLOAD + 4) { // + COBS code byte, zero byte, CRC
+    return 2;
+  }
+  w->decim[i] = decim;
+  tlm_send_desc(w);
+  return 0;
+}
+
+float tlm_load(const tlm_writer *w) {
+  size_t maxFrame;
+
+  return link_load(w, w->decim, &maxFrame);
+}
+
+int tlm_send_sample(tlm_writer *w, const tlm_sample *s) {
+  int i, any = 0;
+
+  tlm_begin(w, s->t_us);
+  for (i = 0; i < tlm_nchannels; ++i) {
+    if (w->decim[i] && s->tick % w->decim[i] == 0) {
+      tlm_put(w, tlm_channels[i].id, (const float *)((const char *)s + tlm_channels[i].field));
+      any = 1;
+    }
+  }
+  return any ? tlm_send(w) : 0;
+}
+
+int tlm_put(tlm_writer *w, uint8_t id, const float *v) {
+  int c = find_channel(id);
+  const tlm_channel *ch;
+  long raw;
+  int i;
+
+  if (c < 0 || w->len + channel_size(&tlm_channels[c]) > TLM_MAX_PAYLOAD) {
+    return 1;
+  }
+  ch = &tlm_channels[c];
+  put_u8(w, id);
+  for (i = 0; i < ch->count; ++i) {
+    if (ch->format == TLM_F32) {
+      put_f32(w, v[i]);
+    } else {
+      raw = lroundf((v[i] - ch->offset)/ch->scale);
+      put_u16(w, (uint16_t)(int16_t)(raw < INT16_MIN ? INT16_MIN : raw > INT16_MAX ? INT16_MAX : raw));
+    }
+  }
+  return 0;
+}
+
+int tlm_send(tlm_writer *w) {
+  uint8_t sample[TLM_MAX_PAYLOAD];
+  size_t len;
+  int err = 0;
+
+  if (w->sinceDesc >= TLM_DESC_PERIOD) {
+    // the sample is built in buf, which the table needs: set it aside
+    len = w->len;
+    memcpy(sample, w->buf, len);
+    err = tlm_send_desc(w);
+    memcpy(w->buf, sample, len);
+    w->len = len;
+    w->buf[1] = w->seq & 0xFF; // it now follows the table
+    w->buf[2] = w->seq >> 8;
+  }
+  return frame_write(w) | err;
+}
+
+int tlm_send_traj(tlm_writer *w, uint16_t id, uint8_t status, uint8_t slot, uint32_t points) {
+  frame_start(w, TLM_TRAJ);
+  put_u16(w, id);
+  put_u8(w, status);
+  put_u8(w, slot);
+  put_u32(w, points);
+  return frame_write(w);
+}
+
+int tlm_printf(tlm_writer *w, const char *fmt, ...) {
+  va_list ap;
+  int n;
+
+  frame_start(w, TLM_TEXT);
+  va_start(ap, fmt);
+  n = vsnprintf((char *)&w->buf[w->len], TLM_MAX_PAYLOAD - w->len + 1, fmt, ap);
+  va_end(ap);
+  if (n < 0) {
+    return 1;
+  }
+  w->len += (size_t)n < TLM_MAX_PAYLOAD - w->len ? (size_t)n : TLM_MAX_PAYLOAD - w->len;
+  if (w->len > 3 && w->buf[w->len - 1] == '\n') {
+    --w->len;
+  }
+  return frame_write(w);
+}
+
+int tlm_text_fd(const tlm_writer *w) {
+  return w->text[1];
+}
+
+int tlm_flush_text(tlm_writer *w) {
+  char text[TLM_TEXT_BUF + 1];
+  char *line, *end;
+  ssize_t n;
+  int err = 0;
+
+  while ((n = read(w->text[0], text, TLM_TEXT_BUF)) > 0) {
+    text[n] = 0;
+    // a line cut by the end of the buffer goes out in two frames
+    for (line = text; *line; line = end + 1) {
+      if (!(end = strchr(line, '\n'))) {
+        end = line + strlen(line) - 1;
+      } else {
+        *end = 0;
+      }
+      err |= tlm_printf(w, "%s", line);
+    }
+  }
+  return err;
+}
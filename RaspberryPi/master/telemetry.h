@@ -0,0 +1,194 @@
+#ifndef __TELEMETRY__H__
+#define __TELEMETRY__H__
+// Header file for telemetry.c
+// Implements the binary telemetry protocol of the serial link to the client.
+//
+// After the ASCII line with the number of samples, everything the Pi sends
+// is frames:
+//   type u8, seq u16, body, crc u16
+// little-endian, crc being CRC-16/CCITT-FALSE over type..body. Each frame is
+// COBS encoded, so it holds no zero byte, and followed by a zero byte. A
+// receiver syncs on the first zero byte, drops a frame whose CRC fails, and
+// counts the frames lost from the gaps in seq, which numbers all frames.
+//
+// Frame types and their bodies:
+// - TLM_DESC, the channel table, so decoders need no copy of it; for each
+//   channel:
+//     id u8, count u8, format u8, decimation u16, scale f32, offset f32,
+//     name length u8, name, unit length u8, unit
+//   sent before the first sample, every TLM_DESC_PERIOD frames after, and
+//   whenever the subscriptions change.
+// - TLM_DATA, one sample:
+//     time u32 (us, CLOCK_MONOTONIC, wraps every 71 minutes)
+//   then for each channel in it:
+//     id u8, count values in the channel's format
+//   A TLM_I16 value is offset + scale*raw, a TLM_F32 value is the float.
+// - TLM_TEXT, one line of text ("# can ...", "# hist ...", ...), without
+//   its newline.
+// - TLM_TRAJ, the answer to a trajectory upload frame from the client, or
+//   the start or end of a trajectory (traj.h):
+//     id u16, status u8, slot u8, points u32
+//
+// qa as three scaled int16 takes 18 bytes a sample on the wire, framing
+// included, against about 21 for the "%5.3f %5.3f %5.3f\n" it replaces,
+// with 10 times the resolution, a time stamp and a CRC.
+//
+// Which channels go out is up to the client: it subscribes to each with a
+// decimation (1: every control tick, n: every n-th, 0: off; see
+// tlm_subscribe()), and a sample frame holds the channels due on its tick.
+// A subscription that would take more than the serial link can carry is
+// refused, so the link never falls behind the control loop.
+//
+// The client's trajectory frames to the Pi are framed the same way (see
+// traj.h); tlm_cobs_decode() undoes the COBS.
+//
+// Decoders: client/hopper_telemetry.py (Python), client/tlm_decode.m
+// (MATLAB).
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TLM_MAX_PAYLOAD 250   // type..body, so COBS adds a single byte
+#define TLM_DESC_PERIOD 500   // frames between channel tables (1 s of samples)
+#define TLM_TEXT_BUF 4096     // longest text tlm_flush_text() sends at once
+#define TLM_TEXT_SHARE 0.1    // of the link kept for the channel tables and text
+#define TLM_FRAME_OVERHEAD 11 // bytes of a sample frame besides its channels: type,
+                              // seq, time, CRC, the COBS code byte, the zero byte
+
+// frame types:
+enum {
+  TLM_DESC,
+  TLM_DATA,
+  TLM_TEXT,
+  TLM_TRAJ
+};
+
+// value formats:
+enum {
+  TLM_I16,  // offset + scale*raw, raw an int16
+  TLM_F32
+};
+
+// channel IDs:
+enum {
+  TLM_CH_QA = 1,  // actuated joint angles
+  TLM_CH_QU,      // unactuated joint angles
+  TLM_CH_FOOT,    // foot pose: x, y, angle
+  TLM_CH_TRQ,     // commanded joint torques
+  TLM_CH_IA,      // motor currents
+  TLM_CH_BOOM,    // boom roll, pitch, yaw
+  TLM_CH_ACCEL,   // IMU z acceleration
+  TLM_CH_FZ,      // force sensor
+  TLM_CH_TIMING,  // control loop: wake-up latency, SYNC to answers, execution time
+  TLM_CH_CMD      // motor position commands
+};
+
+// everything Control_thread can send in one tick, and what the flight data
+// recorder (fdr.h) keeps of it; a channel is a field of it:
+typedef struct {
+  uint32_t tick;      // control cycle, counts from 0
+  uint32_t t_us;      // the cycle's SYNC time (CLOCK_MONOTONIC, us)
+  float qa[3];        // rad
+  float qu[6];        // rad
+  float foot[3];      // m, m, rad
+  float trq[3];       // Nm
+  float ia[3];        // mA
+  float boom[3];      // deg
+  float accel;        // raw
+  float fz;           // ADC counts
+  float timing[3];    // us; SYNC to answers is 0 if they did not all come
+  float cmd[3];       // deg, sent with the tick's SYNC
+} tlm_sample;
+
+typedef struct {
+  uint8_t id;
+  uint8_t count;      // values
+  uint8_t format;     // TLM_I16, TLM_F32
+  float scale, offset;
+  const char *name;
+  const char *unit;
+  size_t field;       // offsetof() the values in tlm_sample
+} tlm_channel;
+
+extern const tlm_channel tlm_channels[];
+extern const int tlm_nchannels;
+
+#define TLM_MAX_CHANNELS 16
+
+typedef struct {
+  int fd;                  // where the frames go (the serial port)
+  int text[2];             // pipe behind tlm_text_fd()
+  uint16_t seq;            // of the next frame
+  uint32_t sinceDesc;      // frames since the last channel table
+  uint32_t frames;         // sent so far
+  uint32_t writeErrors;
+  float tickHz;            // samples handed to tlm_send_sample() per second
+  uint32_t baud;           // of the serial link (8N1)
+  uint16_t decim[TLM_MAX_CHANNELS]; // by index in tlm_channels; 0: off
+  size_t len;              // of the frame being built
+  uint8_t buf[TLM_MAX_PAYLOAD + 2];
+} tlm_writer;
+
+// sets up w to send frames to fd, a serial link of baud bit/s, with
+// samples coming at tickHz; qa is subscribed at every tick. Returns 0 on
+// success, 1 on failure:
+int tlm_init(tlm_writer *w, int fd, float tickHz, uint32_t baud);
+
+void tlm_close(tlm_writer *w);
+
+// sends the channel table:
+int tlm_send_desc(tlm_writer *w);
+
+// sends channel name every decim ticks (0: stops it), unless the link
+// cannot carry it with the other subscriptions; *load (may be NULL) gets
+// the share of the link the subscriptions would take. Returns 0 on success
+// (and sends the channel table), 1 for an unknown channel, 2 if it does not
+// fit (the subscriptions stay as they were):
+int tlm_subscribe(tlm_writer *w, const char *name, uint16_t decim, float *load);
+
+// the share of the link the current subscriptions take, in the worst case
+// that every channel's ticks fall apart (a frame for each):
+float tlm_load(const tlm_writer *w);
+
+// sends the channels of s due on its tick, if any (with the channel table
+// first, if it is due); 0 on success, 1 if the write failed:
+int tlm_send_sample(tlm_writer *w, const tlm_sample *s);
+
+// lower-level, for one-off samples:
+// starts a sample taken at time_us:
+void tlm_begin(tlm_writer *w, uint32_t time_us);
+
+// adds the count values of channel id to the sample; returns 1 if the
+// channel is unknown or the frame is full:
+int tlm_put(tlm_writer *w, uint8_t id, const float *v);
+
+// sends the sample (after the channel table, if it is due); these return 0
+// on success, 1 if the write failed:
+int tlm_send(tlm_writer *w);
+
+// sends one TLM_TEXT frame:
+int tlm_printf(tlm_writer *w, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// sends one TLM_TRAJ frame:
+int tlm_send_traj(tlm_writer *w, uint16_t id, uint8_t status, uint8_t slot, uint32_t points);
+
+// an fd to give functions that write text lines to an fd (rt_exec_dump(),
+// ...); what they wrote goes out as TLM_TEXT frames, one per line, on
+// tlm_flush_text():
+int tlm_text_fd(const tlm_writer *w);
+
+int tlm_flush_text(tlm_writer *w);
+
+// CRC-16/CCITT-FALSE (polynomial 0x1021, initial 0xFFFF): 0x29B1 for "123456789"
+uint16_t tlm_crc16(const uint8_t *p, size_t n);
+
+// COBS encodes n bytes of in into out (room for n + n/254 + 1 bytes),
+// without the trailing zero; returns the encoded length:
+size_t tlm_cobs_encode(const uint8_t *in, size_t n, uint8_t *out);
+
+// decodes the n bytes of a COBS block (without its zero byte) into out, of
+// max bytes; returns the decoded length, 0 if the block is malformed or
+// does not fit:
+size_t tlm_cobs_decode(const uint8_t *in, size_t n, uint8_t *out, size_t max);
+
+#endif
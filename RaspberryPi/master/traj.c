@@ -0,0 +1,407 @@
+#include "traj.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "telemetry.h"
+
+// A slot goes
+//   TRAJ_FREE -> TRAJ_LOADING -> TRAJ_READY   (loader)
+//   TRAJ_READY -> TRAJ_ACTIVE -> TRAJ_DONE    (player)
+//   TRAJ_DONE -> TRAJ_FREE                    (loader)
+// and READY -> FREE on an abort (loader). Each side publishes a state with
+// a release store after touching the slot, and the other loads it with
+// acquire; READY is left with a compare-and-swap, as both sides may.
+enum {
+  TRAJ_FREE,
+  TRAJ_LOADING,
+  TRAJ_READY,
+  TRAJ_ACTIVE,
+  TRAJ_DONE
+};
+
+typedef struct {
+  uint8_t state;
+  uint8_t abort;      // set by the loader: the player stops the slot
+  uint8_t started;    // loader: TRAJ_ACK_STARTED sent
+  uint8_t generated;  // a TRAJ_MOVE: the points come from tg, not q
+  uint16_t id;
+  uint32_t queued;    // loader: order of becoming READY, so slots run in upload order
+  uint32_t points;
+  uint32_t received;  // loader
+  uint32_t played;    // player
+  float (*q)[3];
+  tg_traj tg;
+} traj_slot;
+
+_Static_assert(3 + 4 + 16*TG_MAX_POINTS + 2 <= TRAJ_MAX_FRAME, "a TRAJ_MOVE does not fit a frame");
+
+static traj_slot slots[TRAJ_SLOTS];
+static int active = -1;          // player: the slot playing
+static uint32_t queuedCount;     // loader
+static float tickHz = 500;
+
+// run totals, for traj_report():
+static struct {
+  uint32_t trajectories, corrupt, rejected, busy, aborted;
+  uint32_t unreachable;  // ticks of generated foot trajectories qa could not follow
+  uint64_t points;  // played
+} stats;
+
+static uint8_t get_state(const traj_slot *t) {
+  return __atomic_load_n(&t->state, __ATOMIC_ACQUIRE);
+}
+
+static void set_state(traj_slot *t, uint8_t state) {
+  __atomic_store_n(&t->state, state, __ATOMIC_RELEASE);
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+  return p[0] | p[1] << 8;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+  return get_u16(p) | (uint32_t)get_u16(p + 2) << 16;
+}
+
+static float get_f32(const uint8_t *p) {
+  uint32_t u = get_u32(p);
+  float f;
+
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+int traj_init(float hz) {
+  int i;
+
+  tickHz = hz;
+  for (i = 0; i < TRAJ_SLOTS; ++i) {
+    if (!(slots[i].q = malloc((size_t)TRAJ_MAX_POINTS*sizeof(*slots[i].q)))) {
+      traj_close();
+      return 1;
+    }
+    memset(slots[i].q, 0, (size_t)TRAJ_MAX_POINTS*sizeof(*slots[i].q)); // fault it in
+  }
+  return 0;
+}
+
+/******************************************************************************
+* Loader
+******************************************************************************/
+static void slot_free(traj_slot *t) {
+  set_state(t, TRAJ_FREE);
+}
+
+// the slot loading id, or -1:
+static int find_loading(uint16_t id) {
+  int i;
+
+  for (i = 0; i < TRAJ_SLOTS; ++i) {
+    if (get_state(&slots[i]) == TRAJ_LOADING && slots[i].id == id) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void answer(traj_ack *ack, int slot, uint8_t status, uint32_t points) {
+  ack->slot = slot < 0 ? 0xFF : slot;
+  ack->status = status;
+  ack->points = points;
+  if (status == TRAJ_ACK_REJECTED) {
+    ++stats.rejected;
+  }
+}
+
+static void begin(uint16_t id, uint32_t points, traj_ack *ack) {
+  traj_slot *t;
+  int i = find_loading(id);
+
+  if (!points || points > TRAJ_MAX_POINTS) {
+    answer(ack, -1, TRAJ_ACK_REJECTED, 0);
+    return;
+  }
+  if (i < 0) {
+    for (i = 0; i < TRAJ_SLOTS && get_state(&slots[i]) != TRAJ_FREE; ++i) {
+    }
+    if (i == TRAJ_SLOTS) {
+      ++stats.busy;
+      answer(ack, -1, TRAJ_ACK_BUSY, 0);
+      return;
+    }
+  }
+  t = &slots[i];
+  t->id = id;
+  t->points = points;
+  t->received = 0;
+  t->played = 0;
+  t->abort = 0;
+  t->started = 0;
+  t->generated = 0;
+  set_state(t, TRAJ_LOADING);
+  answer(ack, i, TRAJ_ACK_OK, 0);
+}
+
+// p: profile, space, then the n via points:
+static void move(uint16_t id, const uint8_t *p, size_t n, traj_ack *ack) {
+  float times[TG_MAX_POINTS], via[TG_MAX_POINTS][3];
+  traj_slot *t;
+  uint8_t state;
+  int i, k, count = (n - 2)/16;
+
+  // the same MOVE again (its answer was lost): queued already
+  for (i = 0; i < TRAJ_SLOTS; ++i) {
+    state = get_state(&slots[i]);
+    if (slots[i].id == id && slots[i].generated &&
+        (state == TRAJ_READY || state == TRAJ_ACTIVE || state == TRAJ_DONE)) {
+      answer(ack, i, TRAJ_ACK_READY, slots[i].points);
+      return;
+    }
+  }
+  if ((n - 2) % 16 || count < 2 || count > TG_MAX_POINTS) {
+    answer(ack, -1, TRAJ_ACK_REJECTED, 0);
+    return;
+  }
+  for (i = 0; i < count; ++i) {
+    times[i] = get_f32(p + 2 + 16*i);
+    for (k = 0; k < 3; ++k) {
+      via[i][k] = get_f32(p + 2 + 16*i + 4 + 4*k);
+    }
+  }
+  for (i = 0; i < TRAJ_SLOTS && get_state(&slots[i]) != TRAJ_FREE; ++i) {
+  }
+  if (i == TRAJ_SLOTS) {
+    ++stats.busy;
+    answer(ack, -1, TRAJ_ACK_BUSY, 0);
+    return;
+  }
+  t = &slots[i];
+  if (tg_init(&t->tg, p[0], p[1], count, times, via) ||
+      !(t->tg.duration*tickHz < TRAJ_MAX_POINTS)) {
+    answer(ack, -1, TRAJ_ACK_REJECTED, 0);
+    return;
+  }
+  t->id = id;
+  // the last on the last via point (a float 0.4 s is 200.000003 ticks):
+  t->points = (uint32_t)ceil(t->tg.duration*tickHz - 1e-3) + 1;
+  t->received = t->points;
+  t->played = 0;
+  t->abort = 0;
+  t->started = 0;
+  t->generated = 1;
+  t->queued = queuedCount++;
+  set_state(t, TRAJ_READY);
+  answer(ack, i, TRAJ_ACK_READY, t->points);
+}
+
+static void data(uint16_t id, uint32_t first, const uint8_t *p, size_t n, traj_ack *ack) {
+  traj_slot *t;
+  uint32_t k, count = n/12;
+  int i = find_loading(id);
+
+  if (i < 0 || n % 12) {
+    answer(ack, i, TRAJ_ACK_REJECTED, 0);
+    return;
+  }
+  t = &slots[i];
+  if (first != t->received || count > t->points - first) {
+    answer(ack, i, TRAJ_ACK_OK, t->received); // out of order: resend from here
+    return;
+  }
+  for (k = 0; k < count; ++k) {
+    memcpy(t->q[first + k], p + 12*k, 12); // little-endian floats, as on the Pi
+  }
+  t->received += count;
+  if (t->received < t->points) {
+    answer(ack, i, TRAJ_ACK_OK, t->received);
+    return;
+  }
+  t->queued = queuedCount++;
+  set_state(t, TRAJ_READY);
+  answer(ack, i, TRAJ_ACK_READY, t->received);
+}
+
+static void abort_traj(uint16_t id, traj_ack *ack) {
+  uint8_t ready = TRAJ_READY;
+  traj_slot *t;
+  int i;
+
+  for (i = 0; i < TRAJ_SLOTS; ++i) {
+    t = &slots[i];
+    if (t->id != id) {
+      continue;
+    }
+    if (get_state(t) == TRAJ_LOADING ||
+        __atomic_compare_exchange_n(&t->state, &ready, TRAJ_LOADING, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+      slot_free(t); // the player had not taken it
+      ++stats.aborted;
+      answer(ack, i, TRAJ_ACK_ABORTED, t->received);
+      return;
+    }
+    if (get_state(t) == TRAJ_ACTIVE) {
+      __atomic_store_n(&t->abort, 1, __ATOMIC_RELAXED); // FINISHED follows
+      answer(ack, i, TRAJ_ACK_OK, t->received);
+      return;
+    }
+    ready = TRAJ_READY;
+  }
+  answer(ack, -1, TRAJ_ACK_REJECTED, 0);
+}
+
+int traj_frame(const uint8_t *cobs, size_t n, traj_ack *ack) {
+  uint8_t f[TRAJ_MAX_FRAME];
+  size_t len;
+
+  if (!(len = tlm_cobs_decode(cobs, n, f, sizeof(f))) ||
+      len < 5 + 2 || tlm_crc16(f, len - 2) != get_u16(f + len - 2)) {
+    ++stats.corrupt;
+    return 0;
+  }
+  len -= 2; // the CRC
+  memset(ack, 0, sizeof(*ack));
+  ack->id = get_u16(f + 3);
+  switch (f[0]) {
+    case TRAJ_BEGIN:
+      if (len == 3 + 6) {
+        begin(ack->id, get_u32(f + 5), ack);
+      } else {
+        answer(ack, -1, TRAJ_ACK_REJECTED, 0);
+      }
+      break;
+    case TRAJ_DATA:
+      if (len >= 3 + 6) {
+        data(ack->id, get_u32(f + 5), f + 9, len - 9, ack);
+      } else {
+        answer(ack, -1, TRAJ_ACK_REJECTED, 0);
+      }
+      break;
+    case TRAJ_ABORT:
+      abort_traj(ack->id, ack);
+      break;
+    case TRAJ_MOVE:
+      if (len >= 3 + 4) {
+        move(ack->id, f + 5, len - 5, ack);
+      } else {
+        answer(ack, -1, TRAJ_ACK_REJECTED, 0);
+      }
+      break;
+    default:
+      answer(ack, -1, TRAJ_ACK_REJECTED, 0);
+  }
+  return 1;
+}
+
+int traj_poll(traj_ack *ack) {
+  traj_slot *t;
+  uint8_t state;
+  int i;
+
+  for (i = 0; i < TRAJ_SLOTS; ++i) {
+    t = &slots[i];
+    state = get_state(t);
+    if ((state == TRAJ_ACTIVE || state == TRAJ_DONE) && !t->started) {
+      t->started = 1;
+      ack->id = t->id;
+      answer(ack, i, TRAJ_ACK_STARTED, 0);
+      return 1;
+    }
+    if (state == TRAJ_DONE) {
+      ack->id = t->id;
+      answer(ack, i, TRAJ_ACK_FINISHED, t->played);
+      slot_free(t);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/******************************************************************************
+* Player
+******************************************************************************/
+
+// point k of an uploaded trajectory, with velocity and acceleration by
+// central differences (one-sided at the ends):
+static void table_point(const traj_slot *t, uint32_t k, tg_sample *s) {
+  uint32_t prev = k ? k - 1 : k, next = k + 1 < t->points ? k + 1 : k;
+  int i;
+
+  for (i = 0; i < 3; ++i) {
+    s->x[i] = s->qa[i] = t->q[k][i];
+    s->v[i] = s->dqa[i] = next > prev ? (t->q[next][i] - t->q[prev][i])*tickHz/(next - prev) : 0;
+    s->a[i] = next - prev == 2 ? (t->q[next][i] - 2*t->q[k][i] + t->q[prev][i])*tickHz*tickHz : 0;
+  }
+}
+
+int traj_step(tg_sample *s) {
+  uint8_t ready = TRAJ_READY;
+  traj_slot *t;
+  int i, next = -1;
+
+  if (active >= 0) {
+    t = &slots[active];
+    if (t->played == t->points || __atomic_load_n(&t->abort, __ATOMIC_RELAXED)) {
+      stats.points += t->played;
+      ++stats.trajectories;
+      set_state(t, TRAJ_DONE);
+      active = -1;
+    }
+  }
+  if (active < 0) {
+    // the one queued first:
+    for (i = 0; i < TRAJ_SLOTS; ++i) {
+      if (get_state(&slots[i]) == TRAJ_READY &&
+          (next < 0 || (int32_t)(slots[i].queued - slots[next].queued) < 0)) {
+        next = i;
+      }
+    }
+    if (next < 0 || !__atomic_compare_exchange_n(&slots[next].state, &ready, TRAJ_ACTIVE, 0,
+        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+      return 0; // none, or aborted just now
+    }
+    active = next;
+  }
+  t = &slots[active];
+  if (!t->generated) {
+    table_point(t, t->played++, s);
+  } else if (tg_eval(&t->tg, (double)t->played++/tickHz, s)) {
+    ++stats.unreachable;
+  }
+  return 1;
+}
+
+int traj_pending(void) {
+  uint8_t state;
+  int i;
+
+  for (i = 0; i < TRAJ_SLOTS; ++i) {
+    state = get_state(&slots[i]);
+    if (state == TRAJ_LOADING || state == TRAJ_READY || state == TRAJ_ACTIVE) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/******************************************************************************
+* After the run
+******************************************************************************/
+void traj_close(void) {
+  int i;
+
+  for (i = 0; i < TRAJ_SLOTS; ++i) {
+    free(slots[i].q);
+    slots[i].q = NULL;
+    slot_free(&slots[i]);
+  }
+  active = -1;
+}
+
+void traj_report(void) {
+  printf("Trajectories: %u played (%llu points), %u aborted, %u corrupt frames, %u rejected, "
+    "%u begins while both slots were busy, %u ticks out of reach\n",
+    stats.trajectories,(unsigned long long)stats.points,stats.aborted,stats.corrupt,
+    stats.rejected,stats.busy,stats.unreachable);
+}
@@ -0,0 +1,132 @@
+#ifndef __TRAJ__H__
+#define __TRAJ__H__
+// Header file for traj.c
+// Implements the trajectory upload: the client streams joint trajectories
+// (qa, rad, one point per control tick) to the Pi as binary frames, while
+// the robot runs, and Control_thread plays them one after the other. The
+// client can also send just a few via points and a profile, and the Pi
+// generates the trajectory tick by tick (trajgen.h).
+//
+// The Pi has TRAJ_SLOTS slots. A trajectory streams into a free slot while
+// the one in the other slot runs; once all its points are in, it is queued,
+// and starts on the tick after the running one ends, so hops can be chained
+// back-to-back. A trajectory can have any length up to TRAJ_MAX_POINTS. The
+// slots' memory (TRAJ_SLOTS*TRAJ_MAX_POINTS points) is allocated and
+// faulted in once, by traj_init(), before mlockall(), so that neither
+// UART_thread nor Control_thread touches the heap or takes a page fault;
+// raise TRAJ_MAX_POINTS for longer uploads at the cost of locked memory.
+//
+// Client frames are framed as the telemetry (telemetry.h): type u8, seq u16
+// (the client's count, not checked), body, crc u16, COBS encoded; on the
+// way to the Pi each frame is between two zero bytes, which sets it apart
+// from the one-letter commands (see UART_thread). Frame types and bodies:
+// - TRAJ_BEGIN: id u16, points u32
+//   opens a trajectory in a free slot (a BEGIN for the id being uploaded
+//   starts it over);
+// - TRAJ_DATA: id u16, first u32, then up to TRAJ_CHUNK_MAX points of
+//   3 f32 (qa, rad)
+//   the points from first on; first must be the number of points the Pi
+//   has, so chunks go in order;
+// - TRAJ_ABORT: id u16
+//   drops the trajectory, or stops it if it is running;
+// - TRAJ_MOVE: id u16, profile u8, space u8, then 2 to TG_MAX_POINTS via
+//   points of t f32 (s, the first 0) and 3 f32
+//   a generated trajectory (trajgen.h: profile TG_LINEAR ..., space
+//   TG_JOINT or TG_FOOT), queued at once, like a complete upload.
+//
+// The Pi answers each frame with a TLM_TRAJ frame (tlm_send_traj()): id
+// u16, status u8, slot u8, points u32, the status being one of TRAJ_ACK_*
+// below, and sends one when a trajectory starts and when it finishes. A
+// frame that fails its CRC gets no answer: the client resends the chunks
+// from the points in the last answer (on an answer with fewer points than
+// it has sent, or after a timeout), so it can keep a few chunks in flight.
+//
+// At 115200 baud, 64-point chunks upload about 900 points (1.8 s of
+// trajectory at 500 Hz) a second, against about 550 for the
+// "%5.3f %5.3f %5.3f\n" lines this replaces, with 32-bit floats instead of
+// 3 decimals, and while the robot runs rather than before.
+//
+// Control_thread gets the velocity and acceleration of each point along with
+// it, for feedforward: analytic for generated trajectories, by differences
+// between the points for uploaded ones. Over CAN FD, the joint velocities
+// (dqa) go to the motor nodes as feedforward torques (see Control_thread).
+//
+// Clients: client/hopper_traj.py (Python), client/traj_upload.m (MATLAB).
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "trajgen.h"
+
+#define TRAJ_SLOTS 2
+#define TRAJ_MAX_POINTS (1 << 18)  // 8.7 minutes at 500 Hz, 3 MB a slot
+#define TRAJ_CHUNK_MAX 64          // points per TRAJ_DATA frame
+#define TRAJ_MAX_FRAME (3 + 6 + 12*TRAJ_CHUNK_MAX + 2) // type..crc of a full TRAJ_DATA
+
+// client frame types:
+enum {
+  TRAJ_BEGIN = 1,
+  TRAJ_DATA,
+  TRAJ_ABORT,
+  TRAJ_MOVE
+};
+
+// answers:
+enum {
+  TRAJ_ACK_OK,        // BEGIN or DATA taken; points: the points the Pi has
+  TRAJ_ACK_READY,     // all points in (or a MOVE generated), queued to run; points: ticks
+  TRAJ_ACK_STARTED,   // Control_thread is playing it
+  TRAJ_ACK_FINISHED,  // played (points: how many), slot free
+  TRAJ_ACK_BUSY,      // BEGIN: no free slot; try again after a FINISHED
+  TRAJ_ACK_REJECTED,  // too long, unknown id, bad via points, or a malformed frame
+  TRAJ_ACK_ABORTED    // dropped before it ran (stopped ones are FINISHED)
+};
+
+typedef struct {
+  uint16_t id;
+  uint8_t status;     // TRAJ_ACK_*
+  uint8_t slot;
+  uint32_t points;
+} traj_ack;
+
+// before the threads start (and before rt_exec_init()): the control rate
+// (Hz), which times the generated trajectories; allocates the slots, and
+// returns 1 if that fails:
+int traj_init(float tickHz);
+
+/******************************************************************************
+* Loader, in the thread reading the client (UART_thread)
+******************************************************************************/
+
+// handles one client frame, still COBS encoded (without the zero bytes):
+// returns 1 with the answer in *ack, 0 if the frame was corrupt:
+int traj_frame(const uint8_t *cobs, size_t n, traj_ack *ack);
+
+// returns 1 with the next start or finish of a trajectory in *ack (freeing
+// the slots of the finished ones), 0 if there is none; call it until 0:
+int traj_poll(traj_ack *ack);
+
+/******************************************************************************
+* Player, in Control_thread
+******************************************************************************/
+
+// puts the running trajectory's next point in s and returns 1; starts the
+// next queued one when it has ended. Returns 0, and leaves s alone, if none
+// is running (the robot holds the last point). A generated foot trajectory
+// that qa cannot follow leaves s->qa and s->dqa as they were, and the
+// report counts the ticks:
+int traj_step(tg_sample *s);
+
+// a trajectory is running, queued or being uploaded:
+int traj_pending(void);
+
+/******************************************************************************
+* After the run
+******************************************************************************/
+
+// frees the slots' memory (once the threads have stopped):
+void traj_close(void);
+
+void traj_report(void);
+
+#endif
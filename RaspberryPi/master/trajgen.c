@@ -0,0 +1,246 @@
+#include "trajgen.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "kinematic.h"
+
+/******************************************************************************
+* Setting up
+******************************************************************************/
+
+// the slopes m of the cubic spline through y at times t, at rest at both
+// ends, from its second derivatives M (tridiagonal system, Thomas
+// algorithm):
+static void spline(int n, const double t[], const double y[], double m[], double M[]) {
+  double a[TG_MAX_POINTS], b[TG_MAX_POINTS], c[TG_MAX_POINTS], d[TG_MAX_POINTS];
+  double h, w;
+  int i;
+
+  for (i = 0; i < n; ++i) {
+    a[i] = i ? t[i] - t[i - 1] : 0;                  // h[i-1]
+    c[i] = i < n - 1 ? t[i + 1] - t[i] : 0;          // h[i]
+    b[i] = 2*(a[i] + c[i]);
+    d[i] = 6*((i < n - 1 ? (y[i + 1] - y[i])/c[i] : 0) - (i ? (y[i] - y[i - 1])/a[i] : 0));
+  }
+  for (i = 1; i < n; ++i) {
+    w = a[i]/b[i - 1];
+    b[i] -= w*c[i - 1];
+    d[i] -= w*d[i - 1];
+  }
+  M[n - 1] = d[n - 1]/b[n - 1];
+  for (i = n - 2; i >= 0; --i) {
+    M[i] = (d[i] - c[i]*M[i + 1])/b[i];
+  }
+  for (i = 0; i < n - 1; ++i) {
+    h = t[i + 1] - t[i];
+    m[i] = (y[i + 1] - y[i])/h - h*(2*M[i] + M[i + 1])/6;
+  }
+  m[n - 1] = 0;
+}
+
+static tg_piece *piece(tg_traj *tg, double t0) {
+  tg_piece *p = &tg->p[tg->npieces++];
+
+  p->t0 = t0;
+  return p;
+}
+
+// the pieces of coordinate k:
+static void pieces(tg_traj *tg, int k, int n, const double t[], const double y[]) {
+  double m[TG_MAX_POINTS], M[TG_MAX_POINTS];
+  double h, d, v0, v1, a0, a1, tb, vmax, acc;
+  double *c;
+  int i, j = 0;
+
+  if (tg->profile == TG_CUBIC || tg->profile == TG_QUINTIC) {
+    spline(n, t, y, m, M);
+  }
+  for (i = 0; i < n - 1; ++i) {
+    h = t[i + 1] - t[i];
+    d = y[i + 1] - y[i];
+    switch (tg->profile) {
+      case TG_LINEAR:
+        c = tg->p[j++].c[k];
+        c[0] = y[i];
+        c[1] = d/h;
+        break;
+      case TG_CUBIC:
+        c = tg->p[j++].c[k];
+        c[0] = y[i];
+        c[1] = m[i];
+        c[2] = M[i]/2;
+        c[3] = (M[i + 1] - M[i])/(6*h);
+        break;
+      case TG_QUINTIC:
+        // at rest at the ends, with the spline's slope and curvature between:
+        v0 = i ? m[i] : 0;
+        a0 = i ? M[i] : 0;
+        v1 = i + 1 < n - 1 ? m[i + 1] : 0;
+        a1 = i + 1 < n - 1 ? M[i + 1] : 0;
+        c = tg->p[j++].c[k];
+        c[0] = y[i];
+        c[1] = v0;
+        c[2] = a0/2;
+        c[3] = (20*d - (8*v1 + 12*v0)*h - (3*a0 - a1)*h*h)/(2*h*h*h);
+        c[4] = (-30*d + (14*v1 + 16*v0)*h + (3*a0 - 2*a1)*h*h)/(2*h*h*h*h);
+        c[5] = (12*d - 6*(v1 + v0)*h + (a1 - a0)*h*h)/(2*h*h*h*h*h);
+        break;
+      default: // TG_TRAPEZOID: accelerate, cruise, decelerate
+        tb = TG_TRAP_BLEND*h;
+        vmax = d/(h - tb);
+        acc = vmax/tb;
+        c = tg->p[j++].c[k];
+        c[0] = y[i];
+        c[2] = acc/2;
+        c = tg->p[j++].c[k];
+        c[0] = y[i] + acc*tb*tb/2;
+        c[1] = vmax;
+        c = tg->p[j++].c[k];
+        c[0] = y[i + 1] - vmax*tb/2;
+        c[1] = vmax;
+        c[2] = -acc/2;
+    }
+  }
+}
+
+int tg_init(tg_traj *tg, uint8_t profile, uint8_t space, int n, const float t[], const float p[][3]) {
+  double tt[TG_MAX_POINTS], y[TG_MAX_POINTS], tb;
+  float qa[3], qu[6], pose[3];
+  int i, k;
+
+  memset(tg, 0, sizeof(*tg));
+  if (profile > TG_QUINTIC || space > TG_FOOT || n < 2 || n > TG_MAX_POINTS || t[0] != 0) {
+    return 1;
+  }
+  for (i = 0; i < n; ++i) {
+    if (!isfinite(t[i]) || (i && !(t[i] > t[i - 1])) ||
+        !isfinite(p[i][0]) || !isfinite(p[i][1]) || !isfinite(p[i][2])) {
+      return 1;
+    }
+    if (space == TG_FOOT) {
+      memcpy(pose, p[i], sizeof(pose));
+      subchainIK(qa, qu, pose);
+      if (!isfinite(qa[0]) || !isfinite(qa[1]) || !isfinite(qa[2])) {
+        return 1; // out of reach
+      }
+    }
+    tt[i] = t[i];
+  }
+  tg->profile = profile;
+  tg->space = space;
+  tg->duration = tt[n - 1];
+
+  for (i = 0; i < n - 1; ++i) {
+    piece(tg, tt[i]);
+    if (profile == TG_TRAPEZOID) {
+      tb = TG_TRAP_BLEND*(tt[i + 1] - tt[i]);
+      piece(tg, tt[i] + tb);
+      piece(tg, tt[i + 1] - tb);
+    }
+  }
+  for (k = 0; k < 3; ++k) {
+    for (i = 0; i < n; ++i) {
+      y[i] = p[i][k];
+    }
+    pieces(tg, k, n, tt, y);
+  }
+  return 0;
+}
+
+/******************************************************************************
+* Evaluating
+******************************************************************************/
+int tg_eval(tg_traj *tg, double t, tg_sample *s) {
+  const tg_piece *p;
+  const double *c;
+  double tau, twist[3], Jainv[9];
+  float qa[3], qu[6];
+  kin_trig trig;
+  int i, k, hold = t > tg->duration;
+
+  if (t < 0) {
+    t = 0;
+  } else if (hold) {
+    t = tg->duration;
+  }
+  // forward from the last piece, from the first when going back:
+  if (t < tg->p[tg->piece].t0) {
+    tg->piece = 0;
+  }
+  while (tg->piece + 1 < tg->npieces && t >= tg->p[tg->piece + 1].t0) {
+    ++tg->piece;
+  }
+  p = &tg->p[tg->piece];
+
+  tau = t - p->t0;
+  for (k = 0; k < 3; ++k) {
+    c = p->c[k];
+    s->x[k] = c[0] + tau*(c[1] + tau*(c[2] + tau*(c[3] + tau*(c[4] + tau*c[5]))));
+    s->v[k] = c[1] + tau*(2*c[2] + tau*(3*c[3] + tau*(4*c[4] + tau*5*c[5])));
+    s->a[k] = 2*c[2] + tau*(6*c[3] + tau*(12*c[4] + tau*20*c[5]));
+    if (hold) {
+      s->v[k] = s->a[k] = 0; // at rest on the last via point
+    }
+  }
+  if (tg->space == TG_JOINT) {
+    memcpy(s->qa, s->x, sizeof(s->qa));
+    memcpy(s->dqa, s->v, sizeof(s->dqa));
+    return 0;
+  }
+
+  // dqa = inv(Ja)*twist, as in twist2vels():
+  subchainIK(qa, qu, s->x);
+  if (!isfinite(qa[0]) || !isfinite(qa[1]) || !isfinite(qa[2])) {
+    return 1;
+  }
+  kin_trig_eval(&trig, qa, qu);
+  if (actuatorJacobian_trig(NULL, Jainv, &trig)) {
+    return 1;
+  }
+  for (k = 0; k < 3; ++k) {
+    twist[k] = s->v[k];
+  }
+  for (i = 0; i < 3; ++i) {
+    s->qa[i] = qa[i];
+    s->dqa[i] = Jainv[3*i]*twist[0] + Jainv[3*i + 1]*twist[1] + Jainv[3*i + 2]*twist[2];
+  }
+  return 0;
+}
+
+/******************************************************************************
+* Tables
+******************************************************************************/
+uint8_t gen_tuple_list(uint8_t tuple_len, float *init_tuple, float *final_tuple, \
+  uint16_t npoints, uint8_t interp_type, float out_arr[][3]) {
+  static tg_traj tg; // 7 kB
+  float t[2] = {0, npoints - 1};
+  float p[2][3] = {{0}};
+  tg_sample s;
+  uint16_t i;
+  uint8_t j;
+
+  if (interp_type > TG_QUINTIC) {
+    printf("interp_type = %d is wrong. Enter 0 (linear), 1 (cspline), 2 (trap) or 3 (quintic)\n",interp_type);
+    return 0;
+  }
+  if (tuple_len > 3 || npoints < 2) {
+    return 0;
+  }
+  for (j = 0; j < tuple_len; ++j) {
+    p[0][j] = init_tuple[j];
+    p[1][j] = final_tuple[j];
+  }
+  // time in points:
+  if (tg_init(&tg, interp_type, TG_JOINT, 2, t, p)) {
+    return 0;
+  }
+  for (i = 0; i < npoints; ++i) {
+    tg_eval(&tg, i, &s);
+    for (j = 0; j < tuple_len; ++j) {
+      out_arr[i][j] = s.x[j];
+    }
+  }
+  return 1;
+}
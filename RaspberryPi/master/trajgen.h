@@ -0,0 +1,90 @@
+#ifndef __TRAJGEN__H__
+#define __TRAJGEN__H__
+// Header file for trajgen.c
+// Trajectory generator: a trajectory through a few via points, kept as the
+// coefficients of a polynomial per piece, worked out once by tg_init();
+// tg_eval() then gives the position, velocity and acceleration at any time
+// from the piece it falls in, so the control loop evaluates it tick by tick
+// in constant time, without tables and without the heap.
+//
+// Through via points p[0] .. p[n-1] at times t[0] = 0 < t[1] < ... < t[n-1],
+// the profiles are:
+// - TG_LINEAR: straight lines from via point to via point (the velocity
+//   jumps at each);
+// - TG_CUBIC: the cubic spline through them, at rest at both ends; velocity
+//   and acceleration are continuous;
+// - TG_TRAPEZOID: from via point to via point at rest at each, accelerating
+//   for TG_TRAP_BLEND of the way (in time), cruising, and decelerating for as
+//   long;
+// - TG_QUINTIC: minimum jerk: a quintic per segment, at rest (velocity and
+//   acceleration 0) at both ends, going through the via points with the
+//   cubic spline's velocity and acceleration; with two via points, the
+//   minimum-jerk move from one to the other.
+// The trajectory holds p[n-1] after t[n-1].
+//
+// The via points are in joint space (TG_JOINT: qa, rad) or in foot space
+// (TG_FOOT: the foot pose, x and y in m and the angle in rad, as footPose in
+// kinematic.h), where the foot moves along the profile and qa comes from
+// subchainIK() every tick.
+
+#include <stdint.h>
+
+#define TG_MAX_POINTS 16                         // via points
+#define TG_MAX_PIECES (3*(TG_MAX_POINTS - 1))    // a trapezoid is 3 pieces per segment
+#define TG_TRAP_BLEND 0.25                       // accelerating share of a trapezoid segment
+
+// profiles, numbered as gen_tuple_list()'s interp_type:
+enum {
+  TG_LINEAR,
+  TG_CUBIC,
+  TG_TRAPEZOID,
+  TG_QUINTIC
+};
+
+// spaces:
+enum {
+  TG_JOINT,
+  TG_FOOT
+};
+
+typedef struct {
+  double t0;        // start, s from the start of the trajectory
+  double c[3][6];   // per coordinate, coefficients of (t - t0)^0 .. (t - t0)^5
+} tg_piece;
+
+typedef struct {
+  uint8_t profile;  // TG_LINEAR ...
+  uint8_t space;    // TG_JOINT or TG_FOOT
+  uint8_t npieces;
+  uint8_t piece;    // the one last evaluated, where tg_eval() looks first
+  double duration;  // t[n-1]
+  tg_piece p[TG_MAX_PIECES];
+} tg_traj;
+
+// a point of a trajectory:
+typedef struct {
+  float qa[3];      // joint angles (rad), to command
+  float dqa[3];     // their velocities (rad/s), for feedforward
+  float x[3];       // position in the trajectory's space (qa, or the foot pose)
+  float v[3];       // its velocity (per s)
+  float a[3];       // its acceleration (per s^2)
+} tg_sample;
+
+// works out the pieces of the trajectory through the n via points p at
+// times t (s, t[0] = 0, increasing); returns 1, leaving tg unusable, if
+// the profile, the space or the via points are wrong, or a foot pose is
+// out of reach:
+int tg_init(tg_traj *tg, uint8_t profile, uint8_t space, int n, const float t[], const float p[][3]);
+
+// the trajectory at time t (s), into s; quickest for times going forward.
+// Returns 1 if qa cannot follow (a foot pose out of reach, or a singular
+// one), leaving s->qa and s->dqa as they were:
+int tg_eval(tg_traj *tg, double t, tg_sample *s);
+
+// fills out_arr with npoints points from init_tuple to final_tuple (tuples
+// of tuple_len <= 3 values) along the interp_type profile (TG_LINEAR ...),
+// for tables made off-line; returns 1, or 0 if an argument is wrong:
+uint8_t gen_tuple_list(uint8_t tuple_len, float *init_tuple, float *final_tuple, \
+  uint16_t npoints, uint8_t interp_type, float out_arr[][3]);
+
+#endif
@@ -69,11 +69,14 @@
 #include "driverlib/uart.h"
 #include "utils/uartstdio.h"
 
+#include "canmsg.h"
+
 // for custom board
 #define LED_RED GPIO_PIN_2
 #define LED_GREEN GPIO_PIN_3
 
-#define CAN_BOOM_ID 0x7001
+#define CAN_BOOM_ID CANMSG_BOOM_YAW_ID
+#define CAN_BOOM_DLC CANMSG_BOOM_YAW_DLC
 #define BOOM_READ_FREQ 10 // TODO: choose the right freq
 
 #define ROLL 1
@@ -190,7 +193,7 @@ BoomReadIntHandler(void)
 
     // UARTprintf("Angle (degrees): %d.%01d\n", angleDeg10/10,angleDeg10%10);
 
-    (*(uint32_t *)pui8MsgData) = angleDeg10;
+    canmsg_boom_angle_set_angle(pui8MsgData, angleDeg10);
 
     // Print a message to the console showing the message count and the
     // contents of the message being sent.
@@ -460,8 +463,8 @@ main(void)
     ui32MsgData = 0;
     sCANMessage.ui32MsgID = CAN_BOOM_ID;
     sCANMessage.ui32MsgIDMask = 0;
-    sCANMessage.ui32Flags = MSG_OBJ_TX_INT_ENABLE;
-    sCANMessage.ui32MsgLen = sizeof(pui8MsgData);
+    sCANMessage.ui32Flags = (MSG_OBJ_TX_INT_ENABLE | MSG_OBJ_EXTENDED_ID);
+    sCANMessage.ui32MsgLen = CAN_BOOM_DLC;
     sCANMessage.pui8MsgData = pui8MsgData;
 
     //
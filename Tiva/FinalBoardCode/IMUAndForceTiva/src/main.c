@@ -64,12 +64,13 @@
 #include "adc.h"
 #include "i2c_master_no_int.h"
 #include "LSM6DS33.h"
+#include "canmsg.h"
 
 #define LED_GREEN GPIO_PIN_2
 #define LED_RED GPIO_PIN_3
 
 #define PUB_FREQ 1000
-#define CAN_XF_ID 0x0010
+#define CAN_XF_ID CANMSG_IMU_FZ_ID
 
 tCANMsgObject sCANMessageXF;
 uint8_t pui8MsgDataXF[8];
@@ -153,10 +154,8 @@ SensorPubIntHandler(void)
   /****************************************************************************
   * write sensor data to CAN
   ****************************************************************************/
-  pui8MsgDataXF[0] = (Az & 0x00FF);
-  pui8MsgDataXF[1] = (Az & 0xFF00)>>8;
-  pui8MsgDataXF[2] = (fz_adc & 0x00FF);
-  pui8MsgDataXF[3] = (fz_adc & 0xFF00)>>8;
+  canmsg_imu_fz_set_az(pui8MsgDataXF, Az);
+  canmsg_imu_fz_set_fz(pui8MsgDataXF, fz_adc);
   // (*(uint32_t *)pui8MsgDataXL) = Az; // get ready to send Az over CAN
   // (*(uint32_t *)pui8MsgDataFZ) = fz_adc; // get ready to send fz_adc over CAN
 
@@ -383,7 +382,7 @@ main(void)
     sCANMessageXF.ui32MsgID = CAN_XF_ID;
     sCANMessageXF.ui32MsgIDMask = 0;
     sCANMessageXF.ui32Flags = MSG_OBJ_TX_INT_ENABLE;
-    sCANMessageXF.ui32MsgLen = sizeof(pui8MsgDataXF);
+    sCANMessageXF.ui32MsgLen = CANMSG_IMU_FZ_DLC;
     sCANMessageXF.pui8MsgData = pui8MsgDataXF;
     //***********end of CAN setup**********************************************
 
@@ -62,6 +62,7 @@
 
 #include "copley_accelus.h"
 #include "RLS_Orbis.h"
+#include "canmsg.h"
 
 #define LED_GREEN GPIO_PIN_2
 #define LED_RED GPIO_PIN_3
@@ -70,8 +71,10 @@
 #define DT 0.001
 #define MOTOR_ID 1
 #define MOTOR_EN_MASK (1 << (2*MOTOR_ID - 1))
-#define CAN_MOTOR_ID 0x2001
+#define CAN_MOTOR_ID CANMSG_MOTOR_1_POS_ID
+#define CAN_MOTOR_DLC CANMSG_MOTOR_1_POS_DLC
 #define DEADBAND 15 // in tenths of degrees
+#define SYNC_LOST_TICKS 10 // control ticks without a MOTOR_CMD (SYNC) before sending free-running again
 
 #define PI 3.14159
 
@@ -99,6 +102,13 @@ volatile float Kp = 20000;   // M1: 2000;    M2: ; M3:
 volatile float Kd = 10000; // M1: 100000;  M2: ; M3:
 volatile float Ki = 40;    // M1: 500;     M2: 100; M3:
 
+// SYNC: each MOTOR_CMD restarts the control timer and runs its tick at once,
+// which samples the encoder and answers with the command's seq:
+volatile uint8_t SYNC_SEQ = 0; // seq of the last MOTOR_CMD
+volatile bool SYNC_PENDING = 0; // a MOTOR_CMD came, answer on this tick
+volatile uint16_t ticks_since_sync = SYNC_LOST_TICKS;
+uint32_t timer_load; // system clocks per control tick
+
 
 tCANMsgObject sCANMessageR;
 tCANMsgObject sCANMessageT;
@@ -174,6 +184,19 @@ MotorControllerIntHandler(void)
 
     pos_deg = readRLS();
 
+    // answer a SYNC at once; send every tick while none come:
+    if (SYNC_PENDING) {
+      SYNC_PENDING = 0;
+      ticks_since_sync = 0;
+    } else if (ticks_since_sync < SYNC_LOST_TICKS) {
+      ticks_since_sync++;
+    }
+    if ((ticks_since_sync == 0) || (ticks_since_sync >= SYNC_LOST_TICKS)) {
+      canmsg_motor_pos_set_pos(pui8MsgDataT, pos_deg);
+      canmsg_motor_pos_set_seq(pui8MsgDataT, SYNC_SEQ);
+      CANMessageSet(CAN0_BASE, 2, &sCANMessageT, MSG_OBJ_TYPE_TX); // write the angle to CAN
+    }
+
     switch (MODE) {
       case IDLE:
       {
@@ -228,9 +251,6 @@ MotorControllerIntHandler(void)
       }
     }
 
-    (*(uint32_t *)pui8MsgDataT) = pos_deg;
-    CANMessageSet(CAN0_BASE, 2, &sCANMessageT, MSG_OBJ_TYPE_TX); // write the angle to CAN
-
     HWREGBITW(&g_ui32Flags, 0) ^= 1; // Toggle the flag for the first timer.
 
     LED_count++;
@@ -256,7 +276,8 @@ void TimerBegin(){
   SysCtlPeripheralEnable(SYSCTL_PERIPH_TIMER0); // Enable the peripherals used by this example.
   IntMasterEnable(); // Enable processor interrupts.
   TimerConfigure(TIMER0_BASE, TIMER_CFG_PERIODIC); // Configure a 32-bit periodic timer.
-  TimerLoadSet(TIMER0_BASE, TIMER_A, SysCtlClockGet() / POS_CTRL_FREQ);
+  timer_load = SysCtlClockGet() / POS_CTRL_FREQ;
+  TimerLoadSet(TIMER0_BASE, TIMER_A, timer_load);
   IntEnable(INT_TIMER0A); // Setup the interrupts for the timer timeouts.
   IntPrioritySet(INT_TIMER0A, 0x20); // set the Timer 0A interrupt priority to be "low"
   TimerIntEnable(TIMER0_BASE, TIMER_TIMA_TIMEOUT);
@@ -316,8 +337,29 @@ CANIntHandler(void)
         //
         CANIntClear(CAN0_BASE, 1);
         g_ui32MsgCount++; // increment a counter to track how many messages have been received
-        g_bRXFlag1 = 1; //Set flag to indicate received message is pending for this message object.
         g_bErrFlag = 0; // Since a message was received, clear any error flags.
+
+        //
+        // MOTOR_CMD, which is also the SYNC of the Pi's control cycle: take
+        // the command here rather than in the main loop, then restart the
+        // control timer and run its tick right after this handler, so the
+        // encoder is sampled and the Pi answered at once.
+        //
+        sCANMessageR.pui8MsgData = pui8MsgDataR;
+        CANMessageGet(CAN0_BASE, 1, &sCANMessageR, 0);
+        STATUS = pui8MsgDataR[0];
+        if (canmsg_motor_cmd_get_enable(pui8MsgDataR, MOTOR_ID - 1)) {
+          MODE = canmsg_motor_cmd_get_mode(pui8MsgDataR);
+        } else {
+          MODE = IDLE;
+        }
+        CAN_REF = canmsg_motor_cmd_get_ref(pui8MsgDataR, MOTOR_ID - 1);
+        SYNC_SEQ = canmsg_motor_cmd_get_seq(pui8MsgDataR);
+        SYNC_PENDING = 1;
+
+        HWREG(TIMER0_BASE + TIMER_O_TAV) = timer_load - 1; // next tick a full period from now
+        TimerIntClear(TIMER0_BASE, TIMER_TIMA_TIMEOUT);
+        IntPendSet(INT_TIMER0A); // lower priority: runs once this handler returns
     }
     else if(ui32Status == 2)
     {
@@ -495,12 +537,12 @@ main(void)
     // The expected ID must be set along with the mask to indicate that all
     // bits in the ID must match.
     //
-    sCANMessageR.ui32MsgID = 0x001; // used for commanded current
+    sCANMessageR.ui32MsgID = CANMSG_MOTOR_CMD_ID; // used for commanded current
     sCANMessageR.ui32MsgIDMask = 0xfffff;
     // sCANMessageR.ui32Flags = (MSG_OBJ_RX_INT_ENABLE | MSG_OBJ_USE_ID_FILTER |
     //                          MSG_OBJ_EXTENDED_ID);
     sCANMessageR.ui32Flags = (MSG_OBJ_RX_INT_ENABLE | MSG_OBJ_USE_ID_FILTER);
-    sCANMessageR.ui32MsgLen = 8;
+    sCANMessageR.ui32MsgLen = CANMSG_MOTOR_CMD_DLC;
 
     //
     // Now load the message object into the CAN peripheral message object 1.
@@ -512,7 +554,7 @@ main(void)
     sCANMessageT.ui32MsgID = CAN_MOTOR_ID;
     sCANMessageT.ui32MsgIDMask = 0;
     sCANMessageT.ui32Flags = (MSG_OBJ_TX_INT_ENABLE | MSG_OBJ_EXTENDED_ID);
-    sCANMessageT.ui32MsgLen = sizeof(pui8MsgDataT);
+    sCANMessageT.ui32MsgLen = CAN_MOTOR_DLC;
     sCANMessageT.pui8MsgData = pui8MsgDataT;
 
     //
@@ -533,63 +575,11 @@ main(void)
     GPIOPinWrite(GPIO_PORTD_BASE, LED_GREEN, LED_GREEN); // Use the flags to Toggle the LED for this timer
 
     //
-    // Enter loop to process received messages.  This loop just checks a flag
-    // that is set by the interrupt handler, and if set it reads out the
-    // message and displays the contents.  This is not a robust method for
-    // processing incoming CAN data and can only handle one messages at a time.
-    // If many messages are being received close together, then some messages
-    // may be dropped.  In a real application, some other method should be used
-    // for queuing received messages in a way to ensure they are not lost.  You
-    // can also make use of CAN FIFO mode which will allow messages to be
-    // buffered before they are processed.
+    // Commands are taken in the CAN interrupt handler (see CANIntHandler()),
+    // so this loop only prints the controller's state.
     //
     for(;;)
     {
-        //
-        // If the flag for message object 1 is set, that means that the RX
-        // interrupt occurred and there is a message ready to be read from
-        // this CAN message object.
-        //
-        if(g_bRXFlag1)
-        {
-            //
-            // Reuse the same message object that was used earlier to configure
-            // the CAN for receiving messages.  A buffer for storing the
-            // received data must also be provided, so set the buffer pointer
-            // within the message object.  This same buffer is used for all
-            // messages in this example, but your application could set a
-            // different buffer each time a message is read in order to store
-            // different messages in different buffers.
-            //
-            sCANMessageR.pui8MsgData = pui8MsgDataR;
-
-            //
-            // Read the message from the CAN.  Message object number 1 is used
-            // (which is not the same thing as CAN ID).  The interrupt clearing
-            // flag is not set because this interrupt was already cleared in
-            // the interrupt handler.
-            //
-            CANMessageGet(CAN0_BASE, 1, &sCANMessageR, 0);
-
-            //
-            // Clear the pending message flag so that the interrupt handler can
-            // set it again when the next message arrives.
-            //
-            g_bRXFlag1 = 0;
-
-            //
-            // Print information about the message just received.
-            //
-            // PrintCANMessageInfo(&sCANMessage, 1);
-            STATUS = pui8MsgDataR[0];
-            if (STATUS & MOTOR_EN_MASK) {
-              MODE = STATUS & 0x01;
-            } else {
-              MODE = IDLE;
-            }
-
-            CAN_REF = (((pui8MsgDataR[2*MOTOR_ID]) << 8) | pui8MsgDataR[2*MOTOR_ID - 1]);
-        }
         // UARTprintf("g_ui32Msg2Count = %d\n",g_ui32Msg2Count);
         UARTprintf("MODE: %02X, POS_REF: %d, POS_DEG: %d, POS_ERR: %d, dE/dt: %d, POS_ERR_INT: %d, cur_cmd: %d mA, PW: %d\n",\
           MODE,POS_REF,pos_deg,pos_err,dpe_dt,pos_err_int,pos_cur,pulse_width);